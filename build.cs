@@ -100,6 +100,7 @@ void BuildCpp(StringBuilder sb)
     // includes
     PrependFiles(outCpp, "disclaimer.txt", "subprocess.h", "velopack.cpp");
     PrependFiles(outHpp, "disclaimer.txt", "velopack.hpp");
+    AppendFiles(outHpp, "velopack_ext.hpp");
 
     // final touches
     FixLineEndingAndTabs(outCpp);
@@ -111,6 +112,20 @@ void BuildCpp(StringBuilder sb)
         string msbuildPath = GetProcessOutput(vswherePath, "-latest -requires Microsoft.Component.MSBuild -find MSBuild\\**\\Bin\\MSBuild.exe", projectDir);
         RunProcess(sb, msbuildPath, "for-cpp/samples/win32/VeloCppWinSample.sln /t:Build /p:Configuration=Release", projectDir);
     }
+
+    // the delta tests need bzip2 and zstd. Where vcpkg is installed (as on the CI runners), it provides both from
+    // for-cpp/test/vcpkg.json, and the tests then refuse to build without them rather than skip those patch formats.
+    var testDir = Path.Combine(projectDir, "for-cpp", "test");
+    var configure = "-S . -B build";
+    var vcpkgRoot = Environment.GetEnvironmentVariable("VCPKG_ROOT") ?? Environment.GetEnvironmentVariable("VCPKG_INSTALLATION_ROOT");
+    if (!String.IsNullOrEmpty(vcpkgRoot))
+    {
+        var toolchain = Path.Combine(vcpkgRoot, "scripts", "buildsystems", "vcpkg.cmake");
+        configure += $" -DCMAKE_TOOLCHAIN_FILE=\"{toolchain}\" -DVELOPACK_TESTS_REQUIRE_PATCHES=ON";
+    }
+    RunProcess(sb, "cmake", configure, testDir);
+    RunProcess(sb, "cmake", "--build build --config Release", testDir);
+    RunProcess(sb, "ctest", "--test-dir build -C Release --output-on-failure", testDir);
 }
 
 void BuildCs(StringBuilder sb)
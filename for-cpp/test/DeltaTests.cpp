@@ -0,0 +1,334 @@
+//  DeltaApplier tests, against a release chain in src/fixtures:
+//
+//  MyApp-1.0.0-full.nupkg       the base package.
+//  MyApp-2.0.0-delta.nupkg      bsdiff patches and unchanged (.diff) files, a new file, and lib/app/removed.txt dropped.
+//  MyApp-3.0.0-delta.nupkg      zstd patches (.zsdiff), including of the file added by 2.0.0 and of an empty file.
+//  MyApp-3.0.0-full.nupkg       the full package of 3.0.0, which applying both deltas must reproduce.
+//  MyApp-3.0.0-bad-delta.nupkg  MyApp-3.0.0-delta.nupkg with the .shasum of lib/app/f1.txt altered.
+//  MyApp-2.0.0-traversal-delta.nupkg
+//                               a bsdiff patch of lib/app/../../../escaped.txt, which is outside the package.
+//
+//  bsdiff patches need VELOPACK_BZIP2 and zstd patches VELOPACK_ZSTD. Tests of a chain which needs a library the build
+//  lacks are skipped.
+
+namespace
+{
+    // The files of a package by name, without its directories.
+    std::map<std::string, std::pair<std::string, uint32_t>> packageFiles(const std::string &path)
+    {
+        std::map<std::string, std::pair<std::string, uint32_t>> files;
+        BundleZip zip = BundleZip::open(path);
+        for (const auto &entry : zip.entries())
+        {
+            if (!entry.isDirectory())
+                files[std::string(entry.name)] = { VeloTest::sha1(zip.read(entry)), entry.unixMode & 0777 };
+        }
+        return files;
+    }
+
+    constexpr bool canApplyBsdiff =
+#if defined(VELOPACK_BZIP2)
+        true;
+#else
+        false;
+#endif
+
+    constexpr bool canApplyZstd =
+#if defined(VELOPACK_ZSTD)
+        true;
+#else
+        false;
+#endif
+
+    // Skips a test which applies 2.0.0 (bsdiff), and also 3.0.0 (zstd) if `zstd` is set.
+    void requirePatches(bool zstd)
+    {
+        if (!canApplyBsdiff)
+            VELO_SKIP("bsdiff patches are not enabled (VELOPACK_BZIP2)");
+        if (zstd && !canApplyZstd)
+            VELO_SKIP("zstd patches are not enabled (VELOPACK_ZSTD)");
+    }
+
+    void checkMatchesFullPackage(const std::string &package)
+    {
+        auto actual = packageFiles(package);
+        auto expected = packageFiles(VeloTest::fixture("MyApp-3.0.0-full.nupkg"));
+        CHECK_EQ(actual.size(), expected.size());
+        for (const auto &[name, file] : expected)
+        {
+            auto it = actual.find(name);
+            if (it == actual.end())
+                VeloTest::fail(__FILE__, __LINE__, "'" + name + "' is missing from the reconstructed package");
+            CHECK_EQ(it->second.first, file.first);
+#if !defined(_WIN32)
+            CHECK_EQ(it->second.second, file.second);
+#endif
+        }
+        CHECK(actual.find("lib/app/removed.txt") == actual.end());
+    }
+}
+
+VELO_TEST(delta, AppliesBsdiffDelta)
+{
+    requirePatches(false);
+    VeloTest::TempDirectory temp;
+    {
+        DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "work");
+        applier.apply(VeloTest::fixture("MyApp-2.0.0-delta.nupkg"));
+        applier.finish(temp / "MyApp-2.0.0-full.nupkg");
+    }
+    auto actual = packageFiles(temp / "MyApp-2.0.0-full.nupkg");
+    auto latest = packageFiles(VeloTest::fixture("MyApp-3.0.0-full.nupkg"));
+    // f5 and f8 are patched by 2.0.0 and left as they are by 3.0.0
+    for (const char *name : { "lib/app/f5.txt", "lib/app/f8.txt" })
+    {
+        CHECK(actual.count(name) == 1);
+        CHECK_EQ(actual[name].first, latest[name].first);
+    }
+    CHECK(actual.count("lib/app/new2/added.txt") == 1);
+    CHECK(actual.find("lib/app/removed.txt") == actual.end());
+    CHECK(actual.find("lib/app/new3/added.txt") == actual.end());
+}
+
+VELO_TEST(delta, AppliesChainThroughFinish)
+{
+    requirePatches(true);
+    VeloTest::TempDirectory temp;
+    std::string work = temp / "work";
+    {
+        DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), work, 2);
+        std::vector<int16_t> progress;
+        applier.apply(VeloTest::fixture("MyApp-2.0.0-delta.nupkg"), [&progress](int16_t p) { progress.push_back(p); });
+        CHECK(!progress.empty() && progress.back() == 100);
+        applier.apply(VeloTest::fixture("MyApp-3.0.0-delta.nupkg"));
+        applier.finish(temp / "MyApp-3.0.0-full.nupkg");
+    }
+    CHECK(!std::filesystem::exists(work));
+    checkMatchesFullPackage(temp / "MyApp-3.0.0-full.nupkg");
+
+    // the rebuilt package reads back as the release it is
+    CHECK_EQ(BundleZip::open(temp / "MyApp-3.0.0-full.nupkg").readManifest().version, std::string("3.0.0"));
+}
+
+VELO_TEST(delta, ApplyDeltaPackagesReportsProgress)
+{
+    requirePatches(true);
+    VeloTest::TempDirectory temp;
+    std::string output = temp / "MyApp-3.0.0-full.nupkg";
+    std::vector<int16_t> progress;
+    applyDeltaPackages(VeloTest::fixture("MyApp-1.0.0-full.nupkg"),
+                       { VeloTest::fixture("MyApp-2.0.0-delta.nupkg"), VeloTest::fixture("MyApp-3.0.0-delta.nupkg") }, output,
+                       [&progress](int16_t p) { progress.push_back(p); });
+    checkMatchesFullPackage(output);
+    CHECK(std::is_sorted(progress.begin(), progress.end()));
+    CHECK_EQ(progress.back(), (int16_t)100);
+    CHECK(!std::filesystem::exists(output + ".work"));
+}
+
+VELO_TEST(delta, RejectsPatchWithWrongChecksum)
+{
+    requirePatches(true);
+    VeloTest::TempDirectory temp;
+    DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "work");
+    applier.apply(VeloTest::fixture("MyApp-2.0.0-delta.nupkg"));
+    CHECK_THROWS(applier.apply(VeloTest::fixture("MyApp-3.0.0-bad-delta.nupkg")), std::runtime_error,
+                 "'lib/app/f1.txt' does not match its checksum");
+}
+
+VELO_TEST(delta, RejectsDeltaForAnotherBase)
+{
+    VeloTest::TempDirectory temp;
+    DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "work");
+    // 3.0.0 patches a file which 2.0.0 added, so it can not be applied to 1.0.0
+    CHECK_THROWS(applier.apply(VeloTest::fixture("MyApp-3.0.0-delta.nupkg")), std::runtime_error, "is not in the base package");
+}
+
+VELO_TEST(delta, RejectsPatchesWhichAreNotEnabled)
+{
+    if (canApplyBsdiff && canApplyZstd)
+        VELO_SKIP("both kinds of patches are enabled");
+    VeloTest::TempDirectory temp;
+    DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "work");
+    auto applyChain = [&applier]
+    {
+        applier.apply(VeloTest::fixture("MyApp-2.0.0-delta.nupkg"));
+        applier.apply(VeloTest::fixture("MyApp-3.0.0-delta.nupkg"));
+    };
+    CHECK_THROWS(applyChain(), std::runtime_error, "patches are not enabled");
+}
+
+VELO_TEST(delta, RejectsPatchOutsideThePackage)
+{
+    // the target of the patch resolves to temp/escaped.txt, next to the working directory
+    VeloTest::TempDirectory temp;
+    VeloTest::writeFile(temp / "escaped.txt", "outside");
+    DeltaApplier applier(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "work");
+    CHECK_THROWS(applier.apply(VeloTest::fixture("MyApp-2.0.0-traversal-delta.nupkg")), std::runtime_error, "would patch a file outside");
+    CHECK_EQ(VeloTest::readFile(temp / "escaped.txt"), std::string("outside"));
+    CHECK(!std::filesystem::exists(temp / "escaped.txt.velopatch"));
+}
+
+namespace
+{
+    // A source whose downloads are done by a function of the test.
+    class ScriptedSource : public UpdateSource
+    {
+    public:
+        using Download = std::function<void(const VelopackAsset &, const std::string &, const ProgressHandler &, const CancellationToken &)>;
+
+        explicit ScriptedSource(Download download) : _download(std::move(download)) {}
+
+        VelopackAssetFeed getReleaseFeed(const std::string &, const VelopackManifest &, const CancellationToken &) override { return {}; }
+
+        void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress,
+                                  const CancellationToken &cancellation) override
+        {
+            _download(asset, localFile, progress, cancellation);
+        }
+
+    private:
+        Download _download;
+    };
+
+    // Waits for the download to be cancelled, as a download from a slow server would.
+    void waitForCancellation(const CancellationToken &cancellation, std::atomic<bool> &cancelled)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (!cancellation.isCancelled() && VeloTest::millisecondsSince(start) < 10000)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        cancelled = cancellation.isCancelled();
+        throw ProcessCancelledException("The download was cancelled.");
+    }
+
+    UpdatePlan chainPlan(std::vector<bool> cached, int64_t deltaSize)
+    {
+        UpdatePlan plan;
+        for (const char *fileName : { "MyApp-1.0.0-full.nupkg", "MyApp-2.0.0-delta.nupkg", "MyApp-3.0.0-delta.nupkg" })
+        {
+            auto asset = std::make_shared<VelopackAsset>();
+            asset->fileName = fileName;
+            asset->size = plan.assets.empty() ? (int64_t)std::filesystem::file_size(VeloTest::fixture(fileName)) : deltaSize;
+            plan.assets.push_back(asset);
+        }
+        plan.cached = std::move(cached);
+        for (size_t i = 0; i < plan.assets.size(); i++)
+        {
+            if (!plan.cached[i])
+                plan.downloadBytes += (uint64_t)plan.assets[i]->size;
+        }
+        return plan;
+    }
+}
+
+VELO_TEST(delta, PlanStopsDownloadingWhenApplyFails)
+{
+    // the first delta is damaged, and the download of the second one lasts until it is cancelled
+    VeloTest::TempDirectory temp;
+    std::filesystem::copy_file(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "MyApp-1.0.0-full.nupkg");
+    std::atomic<bool> entered{ false }, cancelled{ false };
+    ScriptedSource source([&](const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &, const CancellationToken &cancellation)
+                          {
+        if (asset.fileName == "MyApp-2.0.0-delta.nupkg")
+        {
+            VeloTest::writeFile(localFile, "not a zip");
+            return;
+        }
+        entered = true;
+        waitForCancellation(cancellation, cancelled); });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(executeUpdatePlan(chainPlan({ true, false, false }, 100), source, temp.path().string(), temp / "out.nupkg"), std::exception, "");
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+    // the second download usually starts while the base package is extracted, and must then have been cancelled
+    CHECK(!entered || cancelled);
+}
+
+VELO_TEST(delta, PlanCancellationStopsDownloading)
+{
+    VeloTest::TempDirectory temp;
+    std::filesystem::copy_file(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "MyApp-1.0.0-full.nupkg");
+    std::atomic<bool> cancelled{ false };
+    ScriptedSource source([&](const VelopackAsset &, const std::string &, const ProgressHandler &, const CancellationToken &cancellation)
+                          { waitForCancellation(cancellation, cancelled); });
+    CancellationToken cancellation;
+    std::thread canceller([&cancellation]
+                          {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        cancellation.cancel(); });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(executeUpdatePlan(chainPlan({ true, false, false }, 100), source, temp.path().string(), temp / "out.nupkg", {}, cancellation),
+                 ProcessCancelledException, "cancelled");
+    canceller.join();
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+    CHECK(cancelled);
+}
+
+VELO_TEST(delta, PlanWithoutPackageSizesReportsProgress)
+{
+    requirePatches(true);
+    // a feed without sizes gives a plan with no bytes to download, while the deltas still have to be downloaded
+    VeloTest::TempDirectory temp;
+    std::filesystem::copy_file(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "MyApp-1.0.0-full.nupkg");
+    ScriptedSource source([](const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress, const CancellationToken &)
+                          {
+        progress(50);
+        std::filesystem::copy_file(VeloTest::fixture(asset.fileName), localFile);
+        progress(100); });
+    UpdatePlan plan = chainPlan({ true, false, false }, 0);
+    CHECK_EQ(plan.downloadBytes, (uint64_t)0);
+    std::vector<int16_t> progress;
+    std::mutex progress_mutex;
+    executeUpdatePlan(plan, source, temp.path().string(), temp / "out.nupkg", [&](int16_t p)
+                      {
+        std::lock_guard lock(progress_mutex);
+        progress.push_back(p); });
+    checkMatchesFullPackage(temp / "out.nupkg");
+    CHECK(std::is_sorted(progress.begin(), progress.end()));
+    CHECK_EQ(progress.back(), (int16_t)100);
+}
+
+VELO_TEST(delta, PlanWaitsForAppliedDeltasToFreeSpace)
+{
+    requirePatches(true);
+    // a disk with room for the largest delta and no more, beyond the reserve, so that the second delta can only be
+    // downloaded once the first has been applied and deleted
+    VeloTest::TempDirectory temp;
+    std::filesystem::copy_file(VeloTest::fixture("MyApp-1.0.0-full.nupkg"), temp / "MyApp-1.0.0-full.nupkg");
+    uint64_t largest = (std::max)(std::filesystem::file_size(VeloTest::fixture("MyApp-2.0.0-delta.nupkg")),
+                                  std::filesystem::file_size(VeloTest::fixture("MyApp-3.0.0-delta.nupkg")));
+    auto available = [&temp](uint64_t capacity)
+    {
+        return [&temp, capacity](const std::filesystem::path &)
+        {
+            uint64_t used = 0;
+            for (const auto &entry : std::filesystem::directory_iterator(temp.path()))
+            {
+                if (entry.path().filename().string().find("-delta.nupkg") != std::string::npos)
+                    used += entry.file_size();
+            }
+            return VELO_PIPELINE_DISK_RESERVE + capacity - (std::min)(used, capacity);
+        };
+    };
+    auto original = VeloDisk_Available;
+    ScriptedSource source([](const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                          { std::filesystem::copy_file(VeloTest::fixture(asset.fileName), localFile); });
+    try
+    {
+        VeloDisk_Available = available(largest);
+        UpdatePlan plan = chainPlan({ true, false, false }, 0);
+        for (size_t i = 1; i < plan.assets.size(); i++)
+            plan.assets[i]->size = (int64_t)std::filesystem::file_size(VeloTest::fixture(plan.assets[i]->fileName));
+        executeUpdatePlan(plan, source, temp.path().string(), temp / "out.nupkg");
+        checkMatchesFullPackage(temp / "out.nupkg");
+
+        // with nothing left to apply, a download which does not fit fails
+        std::filesystem::remove(temp / "out.nupkg");
+        VeloDisk_Available = available(largest - 1);
+        CHECK_THROWS(executeUpdatePlan(plan, source, temp.path().string(), temp / "out.nupkg"), std::runtime_error, "not enough free disk space");
+    }
+    catch (...)
+    {
+        VeloDisk_Available = original;
+        throw;
+    }
+    VeloDisk_Available = original;
+}
@@ -0,0 +1,530 @@
+//  VelopackAssetFeed index tests: ordering, lookups by file name and by version, delta ranges and update plans, and
+//  deciding which release is an update. Each feed is a table of (version, type, file name) rows in feed order, so a
+//  case reads like the releases.json it stands for.
+
+namespace
+{
+    struct FeedRow
+    {
+        const char *version;
+        const char *type;
+        const char *fileName;
+        int64_t size = 1000;
+    };
+
+    VelopackAssetFeed makeFeed(const std::vector<FeedRow> &rows)
+    {
+        std::string json = "{\"Assets\":[";
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            json += std::string(i ? "," : "") + "{\"PackageId\":\"MyApp\",\"Version\":\"" + rows[i].version + "\",\"Type\":\"" + rows[i].type +
+                    "\",\"FileName\":\"" + rows[i].fileName + "\",\"Size\":" + std::to_string(rows[i].size) + "}";
+        }
+        return VelopackAssetFeed::fromJson(json + "]}");
+    }
+
+    std::string fileNames(const std::vector<std::shared_ptr<VelopackAsset>> &assets)
+    {
+        std::string result;
+        for (const auto &asset : assets)
+            result += (result.empty() ? "" : " ") + asset->fileName;
+        return result;
+    }
+
+    // Releases 1.0.0 to 4.0.0 with a delta to each, shuffled, plus a pre-release, build metadata, a duplicate file
+    // name (in a different case) and versions which do not parse.
+    const std::vector<FeedRow> mixedFeed = {
+        { "3.0.0", "Delta", "d3" },
+        { "not-a-version", "Full", "bad1" },
+        { "1.0.0", "Full", "f1" },
+        { "3.0.0", "Full", "f3" },
+        { "2.0.0", "Delta", "d2" },
+        { "2.0.0-beta.1", "Full", "f2b" },
+        { "4.0.0+build.7", "Full", "f4" },
+        { "2.0.0", "Full", "f2" },
+        { "", "Full", "bad2" },
+        { "4.0.0", "Delta", "d4" },
+        { "4.0.0", "Full", "F4-duplicate" },
+        { "3.0.0", "Full", "F3" },
+        { "1.2", "Full", "bad3" },
+    };
+}
+
+VELO_TEST(feed, SortsOldestFirst)
+{
+    struct Case
+    {
+        std::vector<FeedRow> rows;
+        const char *order;
+    };
+    const Case cases[] = {
+        { {}, "" },
+        { mixedFeed, "bad1 bad2 bad3 f1 f2b f2 d2 f3 F3 d3 f4 F4-duplicate d4" },
+        // a full package before the delta of its version, and equal versions kept in feed order
+        { { { "1.0.0", "Delta", "d" }, { "1.0.0", "Full", "a" }, { "1.0.0", "Full", "b" } }, "a b d" },
+        // pre-release precedence (the SemVer 2.0 example), and build metadata ignored for ordering
+        { { { "1.0.0", "Full", "7" }, { "1.0.0-rc.1", "Full", "6" }, { "1.0.0-beta.11", "Full", "5" }, { "1.0.0-beta.2", "Full", "4" },
+            { "1.0.0-beta", "Full", "3" }, { "1.0.0-alpha.beta", "Full", "2" }, { "1.0.0-alpha.1+b", "Full", "1" }, { "1.0.0-alpha", "Full", "0" } },
+          "0 1 2 3 4 5 6 7" },
+        // unparsable versions keep their feed order, before every valid one
+        { { { "2.0.0", "Full", "v" }, { "x", "Full", "b" }, { "01.0.0", "Full", "a" }, { "1.0", "Full", "c" } }, "b a c v" },
+    };
+    for (const auto &test : cases)
+    {
+        VelopackAssetFeed feed = makeFeed(test.rows);
+        CHECK_EQ(fileNames(feed.assets), std::string(test.order));
+        // the assets live in one block, in that order
+        for (size_t i = 1; i < feed.assets.size(); i++)
+            CHECK(feed.assets[i].get() == feed.assets[i - 1].get() + 1);
+    }
+}
+
+VELO_TEST(feed, FindsByFileName)
+{
+    VelopackAssetFeed feed = makeFeed(mixedFeed);
+    const std::pair<const char *, const char *> cases[] = {
+        { "f1", "f1" },
+        { "D3", "d3" },     // case insensitive
+        { "f3", "f3" },     // of "f3" and "F3", the first in the feed wins
+        { "bad2", "bad2" }, // assets without a valid version can still be found by name
+        { "missing", nullptr },
+    };
+    for (auto [name, expected] : cases)
+    {
+        const VelopackAsset *found = feed.find(name);
+        CHECK_EQ(found ? found->fileName : std::string("(null)"), std::string(expected ? expected : "(null)"));
+    }
+
+    // a feed whose assets were changed without reindex() falls back to a linear search
+    VelopackAssetFeed changed = feed;
+    changed.assets.erase(changed.assets.begin());
+    CHECK(changed.find("bad1") == nullptr);
+    CHECK(changed.find("F4-DUPLICATE") != nullptr);
+}
+
+VELO_TEST(feed, FindsByVersionAndType)
+{
+    VelopackAssetFeed feed = makeFeed(mixedFeed);
+    struct Case
+    {
+        const char *version;
+        VelopackAssetType type;
+        const char *expected;
+    };
+    const Case cases[] = {
+        { "1.0.0", VelopackAssetType::full, "f1" },
+        { "1.0.0", VelopackAssetType::delta, nullptr },
+        { "3.0.0", VelopackAssetType::full, "f3" }, // the first of two with the same version
+        { "3.0.0", VelopackAssetType::delta, "d3" },
+        { "4.0.0", VelopackAssetType::full, "f4" },          // build metadata in the feed is ignored
+        { "4.0.0+other", VelopackAssetType::full, "f4" },    // and in the query
+        { "2.0.0-beta.1", VelopackAssetType::full, "f2b" },
+        { "2.0.0-beta.2", VelopackAssetType::full, nullptr },
+        { "5.0.0", VelopackAssetType::full, nullptr },
+    };
+    for (const auto &test : cases)
+    {
+        auto found = feed.find(SemanticVersion::parse(test.version), test.type);
+        CHECK_EQ(found ? found->fileName : std::string("(null)"), std::string(test.expected ? test.expected : "(null)"));
+    }
+
+    CHECK_EQ(feed.latest()->fileName, std::string("f4"));
+    CHECK_EQ(feed.latest(VelopackAssetType::delta)->fileName, std::string("d4"));
+    CHECK(feed.latest(VelopackAssetType::unknown) == nullptr);
+    CHECK(makeFeed({ { "bad", "Full", "only-invalid" } }).latest() == nullptr);
+}
+
+VELO_TEST(feed, ReturnsDeltaRanges)
+{
+    VelopackAssetFeed feed = makeFeed(mixedFeed);
+    struct Case
+    {
+        const char *from;
+        const char *to; // null for deltasNewerThan
+        const char *expected;
+    };
+    const Case cases[] = {
+        { "0.0.1", nullptr, "d2 d3 d4" },
+        { "2.0.0", nullptr, "d3 d4" },
+        { "2.0.0-beta.1", nullptr, "d2 d3 d4" },
+        { "4.0.0", nullptr, "" },
+        { "1.0.0", "3.0.0", "d2 d3" }, // (from, to]
+        { "2.0.0", "2.0.0", "" },
+        { "3.0.0", "9.0.0", "d4" },
+        { "4.0.0", "1.0.0", "" },
+    };
+    for (const auto &test : cases)
+    {
+        SemanticVersion from = SemanticVersion::parse(test.from);
+        auto deltas = test.to ? feed.deltasBetween(from, SemanticVersion::parse(test.to)) : feed.deltasNewerThan(from);
+        CHECK_EQ(fileNames(deltas), std::string(test.expected));
+    }
+}
+
+VELO_BENCHMARK(feed, LookupsIn50kAssets)
+{
+    // 25k releases, each with a full package and a delta, in shuffled order
+    std::vector<std::string> versions;
+    std::vector<FeedRow> rows;
+    for (int i = 0; i < 25000; i++)
+        versions.push_back(std::to_string(i / 1000) + "." + std::to_string(i / 10 % 100) + "." + std::to_string(i % 10));
+    std::vector<std::string> names;
+    names.reserve(50000);
+    for (int i = 0; i < 25000; i++)
+    {
+        names.push_back("MyApp-" + versions[i] + "-full.nupkg");
+        names.push_back("MyApp-" + versions[i] + "-delta.nupkg");
+    }
+    for (int i = 0; i < 25000; i++)
+    {
+        rows.push_back({ versions[i].c_str(), "Full", names[2 * i].c_str() });
+        rows.push_back({ versions[i].c_str(), "Delta", names[2 * i + 1].c_str() });
+    }
+    std::shuffle(rows.begin(), rows.end(), std::mt19937(42));
+
+    auto start = std::chrono::steady_clock::now();
+    VelopackAssetFeed feed = makeFeed(rows);
+    std::printf("           fromJson (parse, sort and index)  %10.1f ms\n", VeloTest::millisecondsSince(start));
+    start = std::chrono::steady_clock::now();
+    feed.reindex();
+    std::printf("           reindex                           %10.1f ms\n", VeloTest::millisecondsSince(start));
+
+    const int lookups = 100000;
+    std::vector<SemanticVersion> parsed;
+    for (int i = 0; i < lookups; i++)
+        parsed.push_back(SemanticVersion::parse(versions[(size_t)i * 7919 % versions.size()]));
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++)
+        found += feed.find(names[(size_t)i * 7919 % names.size()]) != nullptr;
+    std::printf("           find(fileName)                    %10.3f us\n", VeloTest::millisecondsSince(start) * 1000 / lookups);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++)
+        found += feed.find(parsed[(size_t)i], VelopackAssetType::full) != nullptr;
+    std::printf("           find(version, type)               %10.3f us\n", VeloTest::millisecondsSince(start) * 1000 / lookups);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++)
+        found += feed.latest() != nullptr;
+    std::printf("           latest()                          %10.3f us\n", VeloTest::millisecondsSince(start) * 1000 / 1000);
+    SemanticVersion recent = SemanticVersion::parse(versions[versions.size() - 100]);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++)
+        found += feed.deltasNewerThan(recent).size();
+    std::printf("           deltasNewerThan (99 results)      %10.3f us\n", VeloTest::millisecondsSince(start) * 1000 / 1000);
+    CHECK(found > 0);
+}
+
+VELO_TEST(feed, PlansTheCheapestUpdate)
+{
+    // downloads take 0.5s plus 1ms a byte unless set otherwise, and deltas are applied at 10k bytes a second
+    struct Case
+    {
+        const char *name;
+        std::vector<FeedRow> rows;
+        std::vector<std::pair<const char *, size_t>> files; // in the packages directory, with their sizes
+        const char *target;
+        const char *assets; // the plan, or "" when there is none
+        const char *cached;
+        uint64_t downloadBytes;
+        double seconds;
+        double secondsPerDownload = 0.5;
+    };
+    const std::vector<FeedRow> chain = {
+        { "1.0.0", "Full", "f1", 1000 },
+        { "2.0.0", "Delta", "d2", 100 },
+        { "3.0.0", "Delta", "d3", 100 },
+        { "3.0.0", "Full", "f3", 5000 },
+    };
+    const std::vector<FeedRow> gap = {
+        { "1.0.0", "Full", "f1", 1000 },
+        { "2.0.0", "Full", "f2", 5000 },
+        { "3.0.0", "Delta", "d3", 100 },
+        { "3.0.0", "Full", "f3", 5000 },
+    };
+    const Case cases[] = {
+        { "nothing cached", chain, {}, "3.0.0", "f1 d2 d3", "no no no", 1200, 1.5 + 0.1 + 0.61 + 0.61 + 0.5 },
+        { "base cached", chain, { { "f1", 1 } }, "3.0.0", "f1 d2 d3", "yes no no", 200, 0.1 + 0.61 + 0.61 + 0.5 },
+        { "chain cached", chain, { { "f1", 1000 }, { "d2", 100 }, { "D3", 100 } }, "3.0.0", "f1 d2 d3", "yes yes yes", 0, 0.1 + 0.01 + 0.01 + 0.5 },
+        { "target cached", chain, { { "f3", 1 } }, "3.0.0", "f3", "yes", 0, 0 },
+        { "delta of the wrong size", chain, { { "f1", 1000 }, { "d2", 99 }, { "d3", 100 } }, "3.0.0", "f1 d2 d3", "yes no yes", 100, 0.1 + 0.61 + 0.01 + 0.5 },
+        { "latency favours one download", chain, {}, "3.0.0", "f3", "no", 5000, 15, 10 },
+        { "build metadata in the target", chain, { { "f1", 1 } }, "3.0.0+other", "f1 d2 d3", "yes no no", 200, 0.1 + 0.61 + 0.61 + 0.5 },
+        { "no delta to the target", chain, {}, "2.0.0", "f1 d2", "no no", 1100, 1.5 + 0.1 + 0.61 + 0.1 },
+        { "gap in the chain", gap, { { "f1", 1 } }, "3.0.0", "f3", "no", 5000, 5.5 },
+        { "chain from the release after the gap", gap, { { "f2", 1 } }, "3.0.0", "f2 d3", "yes no", 100, 0.5 + 0.61 + 0.5 },
+        { "not in the feed", chain, {}, "4.0.0", "", "", 0, 0 },
+        { "pre-release not in the feed", chain, {}, "3.0.0-rc.1", "", "", 0, 0 },
+        { "no full package to start from", { { "2.0.0", "Delta", "d2", 100 }, { "3.0.0", "Delta", "d3", 100 } }, {}, "3.0.0", "", "", 0, 0 },
+    };
+    for (const auto &test : cases)
+    {
+        // PackageIndex only lists .nupkg files, so the packages get that extension, which is dropped again below
+        VeloTest::TempDirectory temp;
+        for (auto [name, size] : test.files)
+            VeloTest::writeFile(temp / (name + std::string(".nupkg")), std::string(size, 'x'));
+        PackageIndex packages(temp.path().string());
+        std::vector<std::string> names;
+        for (const auto &row : test.rows)
+            names.push_back(row.fileName + std::string(".nupkg"));
+        std::vector<FeedRow> rows = test.rows;
+        for (size_t i = 0; i < rows.size(); i++)
+            rows[i].fileName = names[i].c_str();
+        VelopackAssetFeed feed = makeFeed(rows);
+        UpdatePlanOptions options;
+        options.downloadBytesPerSecond = 1000;
+        options.secondsPerDownload = test.secondsPerDownload;
+        options.applyBytesPerSecond = 10000;
+
+        // the packages directory is listed, or looked up in its index, with the same result
+        for (bool indexed : { false, true })
+        {
+            options.packagesDir = indexed ? std::string() : temp.path().string();
+            options.packages = indexed ? &packages : nullptr;
+            UpdatePlan plan = feed.planUpdate(SemanticVersion::parse(test.target), options);
+            std::string cached;
+            for (bool value : plan.cached)
+                cached.append(cached.empty() ? "" : " ").append(value ? "yes" : "no");
+            std::string what = std::string(test.name) + (indexed ? " (indexed)" : "") + ": ";
+            std::string assets = fileNames(plan.assets);
+            for (size_t at; (at = assets.find(".nupkg")) != std::string::npos;)
+                assets.erase(at, 6);
+            CHECK_EQ(what + assets, what + test.assets);
+            CHECK_EQ(what + cached, what + test.cached);
+            CHECK_EQ(plan.downloadBytes, test.downloadBytes);
+            if (std::abs(plan.estimatedSeconds - test.seconds) > 1e-9)
+                VeloTest::fail(__FILE__, __LINE__, what + "estimated " + std::to_string(plan.estimatedSeconds) + "s, expected " + std::to_string(test.seconds) + "s");
+            CHECK_EQ(plan.isDelta(), plan.assets.size() > 1);
+        }
+    }
+}
+
+VELO_TEST(feed, FindsTheUpdate)
+{
+    // the result is the version found, with " (downgrade)" if it is one, "none", or the error thrown
+    struct Case
+    {
+        const char *name;
+        std::vector<FeedRow> rows;
+        const char *appVersion;
+        const char *channel; // the app is on "stable"
+        bool allowDowngrade;
+        const char *result;
+    };
+    const std::vector<FeedRow> releases = { { "1.0.0", "Full", "f1" }, { "2.0.0", "Full", "f2" }, { "2.0.0", "Delta", "d2" } };
+    const Case cases[] = {
+        { "newer", releases, "1.0.0", "stable", false, "2.0.0" },
+        { "same", releases, "2.0.0", "stable", false, "none" },
+        { "same, allowing downgrades", releases, "2.0.0", "stable", true, "none" },
+        { "older", releases, "3.0.0", "stable", false, "none" },
+        { "older, allowing downgrades", releases, "3.0.0", "stable", true, "2.0.0 (downgrade)" },
+        { "same on another channel", releases, "2.0.0", "beta", false, "none" },
+        { "same on another channel, allowing downgrades", releases, "2.0.0", "beta", true, "2.0.0 (downgrade)" },
+        { "newer on another channel", releases, "1.0.0", "beta", true, "2.0.0" },
+        { "release of a pre-release", releases, "2.0.0-rc.1", "stable", false, "2.0.0" },
+        { "build metadata is the same version", releases, "2.0.0+build.7", "stable", false, "none" },
+        { "only a delta is newer", { { "1.0.0", "Full", "f1" }, { "2.0.0", "Delta", "d2" } }, "1.0.0", "stable", false, "none" },
+        { "empty feed", {}, "1.0.0", "stable", false, "Zero assets found in releases feed." },
+        { "no full release", { { "2.0.0", "Delta", "d2" } }, "1.0.0", "stable", false, "No valid full releases found in feed." },
+    };
+    for (const auto &test : cases)
+    {
+        VelopackManifest app;
+        app.id = "MyApp";
+        app.version = test.appVersion;
+        app.channel = "stable";
+        std::string result;
+        try
+        {
+            std::shared_ptr<UpdateInfo> update = findUpdate(makeFeed(test.rows), app, test.channel, test.allowDowngrade, "");
+            result = !update ? "none" : update->targetFullRelease->version + (update->isDowngrade ? " (downgrade)" : "");
+        }
+        catch (const std::exception &e)
+        {
+            result = e.what();
+        }
+        CHECK_EQ(std::string(test.name) + ": " + result, std::string(test.name) + ": " + test.result);
+    }
+}
+
+VELO_TEST(feed, RolloutBucketsAreStableAndMonotonic)
+{
+    VelopackAsset asset;
+    asset.packageId = "MyApp";
+    asset.version = "2.0.0";
+    std::vector<std::string> clients;
+    for (int i = 0; i < 2000; i++)
+        clients.push_back("client-" + std::to_string(i));
+
+    // the percentage at which each client first gets the release, which never goes back as the percentage rises
+    std::vector<double> reached(clients.size(), -1);
+    for (int step = 0; step <= 200; step++)
+    {
+        asset.rolloutPercentage = step / 2.0;
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            bool rolledOut = isRolledOut(asset, clients[i]);
+            if (rolledOut != isRolledOut(asset, clients[i]))
+                VeloTest::fail(__FILE__, __LINE__, clients[i] + " got a different answer when asked again");
+            if (reached[i] < 0 && rolledOut)
+                reached[i] = asset.rolloutPercentage;
+            else if (reached[i] >= 0 && !rolledOut)
+                VeloTest::fail(__FILE__, __LINE__, clients[i] + " lost the release at " + std::to_string(asset.rolloutPercentage) + "%");
+        }
+    }
+    CHECK(std::count(reached.begin(), reached.end(), 0.0) == 0); // 0% reaches nobody
+    CHECK(std::count(reached.begin(), reached.end(), -1.0) == 0); // 100% reaches everybody
+
+    // the buckets are spread evenly, and differ between releases
+    asset.rolloutPercentage = 30;
+    size_t first = (size_t)std::count_if(clients.begin(), clients.end(), [&](const std::string &id) { return isRolledOut(asset, id); });
+    CHECK(first > 500 && first < 700);
+    VelopackAsset next = asset;
+    next.version = "3.0.0";
+    size_t both = (size_t)std::count_if(clients.begin(), clients.end(), [&](const std::string &id) { return isRolledOut(asset, id) && isRolledOut(next, id); });
+    CHECK(both < first);
+
+    // out-of-range percentages are clamped, and a feed without one is fully rolled out
+    asset.rolloutPercentage = -5;
+    CHECK(!isRolledOut(asset, clients[0]));
+    asset.rolloutPercentage = 150;
+    CHECK(isRolledOut(asset, clients[0]));
+    CHECK(isRolledOut(*makeFeed({ { "2.0.0", "Full", "f2" } }).assets[0], clients[0]));
+}
+
+VELO_TEST(feed, LatestRolledOutFallsBackToEarlierRelease)
+{
+    // 3.0.0 is at 50% and 4.0.0 (only a delta) at 0%, so clients outside 3.0.0's half keep getting 2.0.0
+    VelopackAssetFeed feed = makeFeed({ { "1.0.0", "Full", "f1" }, { "2.0.0", "Full", "f2" }, { "3.0.0", "Full", "f3" }, { "3.0.0", "Delta", "d3" },
+                                        { "4.0.0", "Delta", "d4" } });
+    for (const auto &asset : feed.assets)
+    {
+        if (asset->version == "3.0.0")
+            asset->rolloutPercentage = 50;
+        if (asset->version == "4.0.0")
+            asset->rolloutPercentage = 0;
+    }
+    std::string inside, outside;
+    for (int i = 0; (inside.empty() || outside.empty()) && i < 1000; i++)
+    {
+        std::string id = "client-" + std::to_string(i);
+        (isRolledOut(*feed.find(SemanticVersion::parse("3.0.0"), VelopackAssetType::full), id) ? inside : outside) = id;
+    }
+    CHECK(!inside.empty() && !outside.empty());
+
+    CHECK_EQ(feed.latest(VelopackAssetType::full, inside)->fileName, std::string("f3"));
+    CHECK_EQ(feed.latest(VelopackAssetType::full, outside)->fileName, std::string("f2"));
+    CHECK_EQ(feed.latest(VelopackAssetType::delta, inside)->fileName, std::string("d3"));
+    CHECK_EQ(feed.latest(VelopackAssetType::delta, outside), std::shared_ptr<VelopackAsset>());
+    CHECK_EQ(feed.latest(VelopackAssetType::full)->fileName, std::string("f3")); // without an id, rollouts are ignored
+
+    // a client which has no release yet is told there is no update, rather than that the feed is broken
+    for (const auto &asset : feed.assets)
+        asset->rolloutPercentage = 0;
+    CHECK_EQ(feed.latest(VelopackAssetType::full, inside), std::shared_ptr<VelopackAsset>());
+    VelopackManifest app;
+    app.id = "MyApp";
+    app.version = "1.0.0";
+    CHECK(findUpdate(feed, app, "", false, inside) == nullptr);
+}
+
+VELO_TEST(feed, FileSourceRoundTrip)
+{
+    std::string data = VeloTest::randomData(3 * 1024 * 1024 + 7, 11);
+    VeloTest::TempDirectory temp;
+    std::filesystem::create_directories(temp.path() / "releases");
+    VeloTest::writeFile(temp.path() / "releases" / "MyApp-2.0.0-full.nupkg", data);
+    VeloTest::writeFile(temp.path() / "releases" / "releases.stable.json",
+                        R"({"Assets":[{"PackageId":"MyApp","Version":"2.0.0","Type":"Full","FileName":"MyApp-2.0.0-full.nupkg","SHA1":")" +
+                            VeloTest::sha1(data) + R"(","Size":)" + std::to_string(data.size()) + "}]}");
+    VelopackManifest app;
+    app.id = "MyApp";
+    app.version = "1.0.0";
+    FileSource source(temp / "releases");
+
+    VelopackAssetFeed feed = source.getReleaseFeed("stable", app);
+    CHECK_EQ(fileNames(feed.assets), std::string("MyApp-2.0.0-full.nupkg"));
+    std::vector<int16_t> progress;
+    source.downloadReleaseEntry(*feed.assets[0], temp / "copy.nupkg", [&progress](int16_t value) { progress.push_back(value); });
+    CHECK(VeloTest::readFile(temp / "copy.nupkg") == data);
+    CHECK(!progress.empty() && progress.back() == 100);
+    CHECK(std::is_sorted(progress.begin(), progress.end()));
+
+    // a copy which does not match the feed is deleted
+    VelopackAsset wrong = *feed.assets[0];
+    wrong.sha1 = VeloTest::sha1("something else");
+    CHECK_THROWS(source.downloadReleaseEntry(wrong, temp / "wrong.nupkg"), std::runtime_error, "is corrupt");
+    CHECK(!std::filesystem::exists(temp / "wrong.nupkg"));
+
+    CHECK_THROWS(source.getReleaseFeed("beta", app), std::runtime_error, "Releases file not found");
+    CancellationToken cancelled;
+    cancelled.cancel();
+    CHECK_THROWS(source.getReleaseFeed("stable", app, cancelled), ProcessCancelledException, "cancelled");
+    CHECK_THROWS(source.downloadReleaseEntry(*feed.assets[0], temp / "cancelled.nupkg", {}, cancelled), ProcessCancelledException, "cancelled");
+}
+
+VELO_TEST(feed, ChecksForUpdatesInProcess)
+{
+    // an installed copy of the test binary checks a local feed with UpdateManager, which reads and compares the feed
+    // in-process (there is no Vfusion to fall back to)
+    struct Case
+    {
+        const char *installed;
+        std::vector<FeedRow> rows;
+        std::vector<std::string> arguments;
+        const char *result;
+    };
+    const Case cases[] = {
+        { "1.0.0", { { "1.0.0", "Full", "f1" }, { "2.0.0", "Full", "f2" } }, { "upgrade" }, "2.0.0" },
+        { "2.0.0", { { "1.0.0", "Full", "f1" }, { "2.0.0", "Full", "f2" } }, { "upgrade" }, "none" },
+        { "3.0.0", { { "1.0.0", "Full", "f1" }, { "2.0.0", "Full", "f2" } }, { "downgrade" }, "2.0.0 (downgrade)" },
+        { "2.0.0", { { "2.0.0", "Full", "f2" } }, { "downgrade", "beta" }, "2.0.0 (downgrade)" },
+    };
+    VeloTest::TempDirectory install, feeds;
+    for (const auto &test : cases)
+    {
+        std::string exe = installTestApp(install, test.installed);
+        std::string json = "{\"Assets\":[";
+        for (size_t i = 0; i < test.rows.size(); i++)
+            json += std::string(i ? "," : "") + "{\"PackageId\":\"VelopackTestApp\",\"Version\":\"" + test.rows[i].version + "\",\"Type\":\"" +
+                    test.rows[i].type + "\",\"FileName\":\"" + test.rows[i].fileName + "\",\"Size\":1000}";
+        std::string channel = test.arguments.size() > 1 ? test.arguments[1] : "stable";
+        VeloTest::writeFile(feeds / ("releases." + channel + ".json"), json + "]}");
+
+        std::vector<std::string> command{ exe, "--child", "check-for-updates", feeds.path().string() };
+        command.insert(command.end(), test.arguments.begin(), test.arguments.end());
+        CHECK_EQ(nativeStartProcessBlocking(&command), std::string(test.result) + "\n");
+    }
+}
+
+VELO_BENCHMARK(feed, PlanAcross25kReleases)
+{
+    // 25k releases, each with a full package and a delta, planned from the oldest full package, which is cached
+    std::vector<std::string> versions, names;
+    for (int i = 0; i < 25000; i++)
+    {
+        versions.push_back(std::to_string(i / 1000) + "." + std::to_string(i / 10 % 100) + "." + std::to_string(i % 10));
+        names.push_back("MyApp-" + versions.back() + "-full.nupkg");
+        names.push_back("MyApp-" + versions.back() + "-delta.nupkg");
+    }
+    std::vector<FeedRow> rows;
+    for (int i = 0; i < 25000; i++)
+    {
+        rows.push_back({ versions[i].c_str(), "Full", names[2 * i].c_str(), 100000000 });
+        rows.push_back({ versions[i].c_str(), "Delta", names[2 * i + 1].c_str(), 1000 });
+    }
+    VelopackAssetFeed feed = makeFeed(rows);
+    VeloTest::TempDirectory temp;
+    VeloTest::writeFile(temp / names[0], "x");
+    PackageIndex packages(temp.path().string());
+    UpdatePlanOptions options;
+    options.packages = &packages;
+    options.secondsPerDownload = 0; // so that the cheapest plan is the whole chain of deltas
+
+    SemanticVersion target = SemanticVersion::parse(versions.back());
+    auto start = std::chrono::steady_clock::now();
+    UpdatePlan plan;
+    for (int i = 0; i < 10; i++)
+        plan = feed.planUpdate(target, options);
+    std::printf("           planUpdate over 25k releases       %10.2f ms (%zu packages)\n", VeloTest::millisecondsSince(start) / 10, plan.assets.size());
+    CHECK(!plan.assets.empty());
+}
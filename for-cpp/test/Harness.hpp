@@ -0,0 +1,291 @@
+//  A small test harness, so that the tests build with nothing but a C++20 compiler.
+//
+//  Tests are registered with VELO_TEST(group, name) and run by group: `VelopackTests zip delta` runs the tests of those
+//  two groups, and no arguments runs them all. CTest runs each group as its own test (see CMakeLists.txt). Benchmarks
+//  are registered with VELO_BENCHMARK(group, name), and only run with `VelopackTests --bench [group...]`. A test which
+//  needs something the build lacks (such as an optional library) calls VELO_SKIP, and is counted as skipped.
+//
+//  The test binary also stands in for child processes: `VelopackTests --child <command> [args...]` runs one of the
+//  stubs in childMain (VelopackTests.cpp) instead of the tests. A copy with a `<path>.child` file next to it runs the
+//  stub listed in that file, whatever arguments it is started with.
+
+#ifndef VELOPACK_TEST_HARNESS_H_INCLUDED
+#define VELOPACK_TEST_HARNESS_H_INCLUDED
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace VeloTest
+{
+    struct Case
+    {
+        std::string group;
+        std::string name;
+        void (*run)();
+        bool benchmark;
+    };
+
+    inline std::vector<Case> &cases()
+    {
+        static std::vector<Case> registered;
+        return registered;
+    }
+
+    struct Registration
+    {
+        Registration(const char *group, const char *name, void (*run)(), bool benchmark)
+        {
+            cases().push_back({ group, name, run, benchmark });
+        }
+    };
+
+    // Thrown by the CHECK macros. Any other exception which escapes a test fails it too.
+    class Failure : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // Thrown by VELO_SKIP, for a test which needs something this build does not have. It is reported, not passed.
+    class Skipped : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    template <typename T>
+    std::string describe(const T &value)
+    {
+        if constexpr (std::is_same_v<T, bool>)
+            return value ? "true" : "false";
+        else if constexpr (std::is_convertible_v<const T &, std::string_view>)
+            return "\"" + std::string(std::string_view(value)) + "\"";
+        else if constexpr (requires(std::ostream &out) { out << value; })
+        {
+            std::ostringstream out;
+            out << value;
+            return out.str();
+        }
+        else
+            return "(value)";
+    }
+
+    [[noreturn]] inline void fail(const char *file, int line, const std::string &message)
+    {
+        throw Failure(std::filesystem::path(file).filename().string() + ":" + std::to_string(line) + ": " + message);
+    }
+
+    // The directory of the shared test fixtures (src/fixtures), which the C# tests use as well.
+    inline std::string fixture(const std::string &name)
+    {
+        return (std::filesystem::path(VELOPACK_FIXTURES_DIR) / name).string();
+    }
+
+    // The absolute path of the test binary, for tests which launch it as a child process.
+    inline std::string &selfPath()
+    {
+        static std::string path;
+        return path;
+    }
+
+    inline std::string readFile(const std::filesystem::path &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Unable to read " + path.string());
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    inline void writeFile(const std::filesystem::path &path, std::string_view data)
+    {
+        if (path.has_parent_path())
+            std::filesystem::create_directories(path.parent_path());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), (std::streamsize)data.size());
+        if (!out)
+            throw std::runtime_error("Unable to write " + path.string());
+    }
+
+    // Data which does not compress, from a fixed seed so that failures reproduce.
+    inline std::string randomData(size_t size, uint64_t seed = 1)
+    {
+        std::string data(size, '\0');
+        uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+        for (size_t i = 0; i < size; i++)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            data[i] = (char)(state >> 24);
+        }
+        return data;
+    }
+
+    inline double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Waits up to `timeout` for the condition to become true, and returns whether it did.
+    inline bool waitFor(const std::function<bool()> &condition, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!condition())
+        {
+            if (std::chrono::steady_clock::now() >= deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }
+
+    // A fresh directory for one test, removed again afterwards.
+    class TempDirectory
+    {
+    public:
+        TempDirectory()
+        {
+            static int counter = 0;
+            static const unsigned seed = std::random_device{}();
+            _path = std::filesystem::temp_directory_path() /
+                    ("velopack-test-" + std::to_string(seed) + "-" + std::to_string(counter++));
+            std::filesystem::create_directories(_path);
+        }
+        ~TempDirectory()
+        {
+            std::error_code ec;
+            std::filesystem::remove_all(_path, ec);
+        }
+        TempDirectory(const TempDirectory &) = delete;
+        TempDirectory &operator=(const TempDirectory &) = delete;
+
+        const std::filesystem::path &path() const { return _path; }
+        std::string operator/(const std::string &name) const { return (_path / name).string(); }
+
+    private:
+        std::filesystem::path _path;
+    };
+
+    int childMain(const std::vector<std::string> &args);
+
+    inline int main(int argc, char **argv)
+    {
+        selfPath() = std::filesystem::absolute(argv[0]).string();
+        std::vector<std::string> args(argv + 1, argv + argc);
+        std::ifstream stub(selfPath() + ".child");
+        if (stub)
+        {
+            // a copy standing in for another binary runs the child command written next to it, one argument per line
+            std::vector<std::string> command;
+            for (std::string line; std::getline(stub, line);)
+                command.push_back(line);
+            return childMain(command);
+        }
+        if (!args.empty() && args[0] == "--child")
+        {
+            return childMain(std::vector<std::string>(args.begin() + 1, args.end()));
+        }
+        bool benchmarks = !args.empty() && args[0] == "--bench";
+        if (benchmarks)
+        {
+            args.erase(args.begin());
+        }
+
+        int passed = 0, skipped = 0, failed = 0;
+        for (const Case &test : cases())
+        {
+            if (test.benchmark != benchmarks || (!args.empty() && std::find(args.begin(), args.end(), test.group) == args.end()))
+                continue;
+            std::string name = test.group + "." + test.name;
+            std::cout << (benchmarks ? "[ BENCH  ] " : "[ RUN    ] ") << name << std::endl;
+            auto start = std::chrono::steady_clock::now();
+            try
+            {
+                test.run();
+                passed++;
+                std::cout << "[     OK ] " << name << " (" << (int)millisecondsSince(start) << " ms)" << std::endl;
+            }
+            catch (const Skipped &e)
+            {
+                skipped++;
+                std::cout << "[ SKIPPED] " << name << ": " << e.what() << std::endl;
+            }
+            catch (const std::exception &e)
+            {
+                failed++;
+                std::cout << "[ FAILED ] " << name << ": " << e.what() << std::endl;
+            }
+        }
+        if (passed + skipped + failed == 0)
+        {
+            std::cout << "No tests matched." << std::endl;
+            return 1;
+        }
+        std::cout << passed << " passed, " << skipped << " skipped, " << failed << " failed." << std::endl;
+        return failed == 0 ? 0 : 1;
+    }
+}
+
+#define VELO_TEST_REGISTER(group, name, benchmark)                                                                    \
+    static void velo_test_##group##_##name();                                                                          \
+    static VeloTest::Registration velo_test_registration_##group##_##name(#group, #name, velo_test_##group##_##name, \
+                                                                         benchmark);                                   \
+    static void velo_test_##group##_##name()
+
+#define VELO_TEST(group, name) VELO_TEST_REGISTER(group, name, false)
+#define VELO_BENCHMARK(group, name) VELO_TEST_REGISTER(group, name, true)
+
+#define VELO_SKIP(reason) throw VeloTest::Skipped(reason)
+
+#define CHECK(condition)                                                  \
+    do                                                                    \
+    {                                                                     \
+        if (!(condition))                                                 \
+            VeloTest::fail(__FILE__, __LINE__, "CHECK(" #condition ")"); \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                                  \
+    do                                                                                                              \
+    {                                                                                                               \
+        const auto &velo_actual = (actual);                                                                         \
+        const auto &velo_expected = (expected);                                                                     \
+        if (!(velo_actual == velo_expected))                                                                        \
+            VeloTest::fail(__FILE__, __LINE__, "CHECK_EQ(" #actual ", " #expected "): got " +                       \
+                                                   VeloTest::describe(velo_actual) + ", expected " + VeloTest::describe(velo_expected)); \
+    } while (0)
+
+// Checks that the expression throws an exception of the given type (or a subclass) whose message contains `text`.
+#define CHECK_THROWS(expression, type, text)                                                                         \
+    do                                                                                                               \
+    {                                                                                                                \
+        bool velo_threw = false;                                                                                     \
+        try                                                                                                          \
+        {                                                                                                            \
+            (void)(expression);                                                                                      \
+        }                                                                                                            \
+        catch (const type &velo_error)                                                                               \
+        {                                                                                                            \
+            velo_threw = true;                                                                                       \
+            if (std::string(velo_error.what()).find(text) == std::string::npos)                                      \
+                VeloTest::fail(__FILE__, __LINE__, "CHECK_THROWS(" #expression "): unexpected message: " + std::string(velo_error.what())); \
+        }                                                                                                            \
+        if (!velo_threw)                                                                                             \
+            VeloTest::fail(__FILE__, __LINE__, "CHECK_THROWS(" #expression "): did not throw " #type);               \
+    } while (0)
+
+#endif // VELOPACK_TEST_HARNESS_H_INCLUDED
@@ -0,0 +1,130 @@
+//  VeloHash tests: the known-answer vectors of FIPS 180 (and the NIST examples), at the lengths where the padding
+//  changes shape, for the portable and the SHA-NI compression functions.
+
+namespace
+{
+    struct KnownAnswer
+    {
+        std::string message;
+        const char *sha1;
+        const char *sha256;
+    };
+
+    const std::vector<KnownAnswer> &knownAnswers()
+    {
+        static const std::vector<KnownAnswer> vectors = {
+            // the empty message, and "abc", a single block
+            { "", "da39a3ee5e6b4b0d3255bfef95601890afd80709", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+            { "abc", "a9993e364706816aba3e25717850c26c9cd0d89d", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+            // 55 bytes is the longest message whose padding and length fit in one block
+            { std::string(55, 'a'), "c1c8bbdc22796e28c0e15163d20899b65621d65a", "9f4390f8d30c2dd92ec9f095b65e2b9ae9b0a925a5258e241c9f1e910f734318" },
+            // 56 bytes (448 bits) pushes the length into a second block
+            { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+            { std::string(63, 'a'), "03f09f5b158a7a8cdad920bddc29b81c18a551f5", "7d3e74a05d7db15bce4ad9ec0658ea98e3f06eeecf16b4c6fff2da457ddc2f34" },
+            // exactly one block, and the padding is a block of its own
+            { std::string(64, 'a'), "0098ba824b5c16427bd7a1122a5a442a25ec644d", "ffe054fe7ae0cb6dc65c3af9b61d5209f439851db43d0ba5997337df154668eb" },
+            // 112 bytes (896 bits), two blocks
+            { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+              "a49b2446a02c645bf419f995b67091253a04a259", "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1" },
+            // one million 'a', many blocks
+            { std::string(1000000, 'a'), "34aa973cd4c4daa4f61eeb2bdbad27316534016f", "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+        };
+        return vectors;
+    }
+
+    struct Implementation
+    {
+        const char *name;
+        VeloHash::Compress sha1;
+        VeloHash::Compress sha256;
+    };
+
+    // The portable compression functions, and the SHA-NI ones if this CPU has them.
+    std::vector<Implementation> implementations()
+    {
+        std::vector<Implementation> result{ { "portable", VeloSha1_CompressPortable, VeloSha256_CompressPortable } };
+#if defined(VELOPACK_HAS_SHA_NI)
+        if (VeloCpu_HasShaNi())
+            result.push_back({ "sha-ni", VeloSha1_CompressShaNi, VeloSha256_CompressShaNi });
+        else
+            std::cout << "           (this CPU does not have SHA-NI, only the portable version is tested)" << std::endl;
+#endif
+        return result;
+    }
+
+    // Hashes `data`, passing it to update() `step` bytes at a time.
+    std::string hashInSteps(VeloHash hash, std::string_view data, size_t step)
+    {
+        for (size_t i = 0; i < data.size(); i += step)
+            hash.update(data.data() + i, (std::min)(step, data.size() - i));
+        return hash.finishHex();
+    }
+}
+
+VELO_TEST(hash, KnownAnswers)
+{
+    for (const auto &implementation : implementations())
+    {
+        for (const auto &vector : knownAnswers())
+        {
+            // whole, byte by byte, and in steps which straddle the block boundaries
+            for (size_t step : { vector.message.size() + 1, (size_t)1, (size_t)63, (size_t)64, (size_t)65, (size_t)4096 })
+            {
+                if (step == 1 && vector.message.size() > 1000)
+                    continue;
+                std::string context = std::string(implementation.name) + ", " + std::to_string(vector.message.size()) + " bytes, steps of " + std::to_string(step);
+                std::string sha1 = hashInSteps(VeloHash::sha1(implementation.sha1), vector.message, step);
+                std::string sha256 = hashInSteps(VeloHash::sha256(implementation.sha256), vector.message, step);
+                if (sha1 != vector.sha1 || sha256 != vector.sha256)
+                    VeloTest::fail(__FILE__, __LINE__, "wrong digest (" + context + "): " + sha1 + " " + sha256);
+            }
+        }
+    }
+}
+
+VELO_TEST(hash, ImplementationsAgree)
+{
+    // every length over a few blocks, so that each tail length and padding case is compared
+    std::string data = VeloTest::randomData(100000);
+    auto all = implementations();
+    for (size_t length = 0; length <= 300; length++)
+    {
+        std::string_view message(data.data(), length);
+        for (const auto &implementation : all)
+        {
+            CHECK_EQ(hashInSteps(VeloHash::sha1(implementation.sha1), message, 7), hashInSteps(VeloHash::sha1(all[0].sha1), message, 300));
+            CHECK_EQ(hashInSteps(VeloHash::sha256(implementation.sha256), message, 7), hashInSteps(VeloHash::sha256(all[0].sha256), message, 300));
+        }
+    }
+    for (const auto &implementation : all)
+    {
+        CHECK_EQ(hashInSteps(VeloHash::sha1(implementation.sha1), data, 1000), hashInSteps(VeloHash::sha1(all[0].sha1), data, data.size()));
+        CHECK_EQ(hashInSteps(VeloHash::sha256(implementation.sha256), data, 1000), hashInSteps(VeloHash::sha256(all[0].sha256), data, data.size()));
+    }
+}
+
+VELO_TEST(hash, DefaultImplementationMatches)
+{
+    // whichever function sha1() and sha256() pick, they must give the same answers
+    for (const auto &vector : knownAnswers())
+    {
+        CHECK_EQ(hashInSteps(VeloHash::sha1(), vector.message, 4096), std::string(vector.sha1));
+        CHECK_EQ(hashInSteps(VeloHash::sha256(), vector.message, 4096), std::string(vector.sha256));
+    }
+}
+
+VELO_BENCHMARK(hash, Throughput)
+{
+    std::string data = VeloTest::randomData(256 * 1024 * 1024);
+    for (const auto &implementation : implementations())
+    {
+        for (bool sha256 : { false, true })
+        {
+            auto start = std::chrono::steady_clock::now();
+            hashInSteps(sha256 ? VeloHash::sha256(implementation.sha256) : VeloHash::sha1(implementation.sha1), data, 65536);
+            double ms = VeloTest::millisecondsSince(start);
+            std::printf("           %-7s %-9s %8.0f MB/s\n", sha256 ? "sha256" : "sha1", implementation.name, 256 * 1000.0 / ms);
+        }
+    }
+}
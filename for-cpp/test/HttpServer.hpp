@@ -0,0 +1,165 @@
+//  A loopback HTTP server for tests, built on the same VeloSocket as the library's client. Each connection is served
+//  on its own thread by a handler which writes the raw response, so tests can send exactly the bytes they want to
+//  test against: chunked bodies, truncated responses, wrong ranges and so on. Connections are never reused.
+
+#ifndef VELOPACK_TEST_HTTP_SERVER_H_INCLUDED
+#define VELOPACK_TEST_HTTP_SERVER_H_INCLUDED
+
+namespace VeloTest
+{
+    struct HttpServerRequest
+    {
+        std::string target;
+        std::vector<std::pair<std::string, std::string>> headers;
+
+        // The value of a header (case insensitive), or an empty string if it was not sent.
+        std::string header(std::string_view name) const
+        {
+            for (const auto &[key, value] : headers)
+            {
+                if (VeloString_EqualsIgnoreCase(key, name))
+                    return value;
+            }
+            return {};
+        }
+
+        // The path of the target, without its query string.
+        std::string path() const { return target.substr(0, target.find('?')); }
+    };
+
+    class HttpServer
+    {
+    public:
+        using Handler = std::function<void(const HttpServerRequest &request, VeloSocket &client)>;
+
+        explicit HttpServer(Handler handler) : _handler(std::move(handler)), _listener(VeloSocket::listen("127.0.0.1", 0))
+        {
+            _thread = std::thread([this] { acceptLoop(); });
+        }
+
+        ~HttpServer()
+        {
+            _stopping = true;
+            _thread.join();
+            std::lock_guard lock(_mutex);
+            for (auto &connection : _connections)
+                connection.join();
+        }
+
+        HttpServer(const HttpServer &) = delete;
+        HttpServer &operator=(const HttpServer &) = delete;
+
+        std::string url(std::string_view path = "") const { return "http://127.0.0.1:" + std::to_string(_listener.localPort()) + std::string(path); }
+
+        // Every request received so far, in the order they arrived.
+        std::vector<HttpServerRequest> requests() const
+        {
+            std::lock_guard lock(_mutex);
+            return _requests;
+        }
+
+        // Builds a complete response with a Content-Length header.
+        static std::string response(int status, std::string_view body, const std::vector<std::pair<std::string, std::string>> &headers = {})
+        {
+            std::string head = "HTTP/1.1 " + std::to_string(status) + " Test\r\nConnection: close\r\n";
+            for (const auto &[name, value] : headers)
+                head += name + ": " + value + "\r\n";
+            return head + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + std::string(body);
+        }
+
+        // Answers a request for `data`, honouring a Range header (a single "bytes=first-[last]" range) with a 206. At
+        // most `limit` bytes of the body are sent, after which the connection is closed as if it had dropped. Returns
+        // the number of bytes of the body which were sent.
+        static size_t serveRanges(const HttpServerRequest &request, VeloSocket &client, std::string_view data,
+                                  const std::string &etag = "\"test\"", size_t limit = SIZE_MAX)
+        {
+            std::string range = request.header("range");
+            std::string_view body = data;
+            std::vector<std::pair<std::string, std::string>> headers{ { "ETag", etag } };
+            int status = 200;
+            if (!range.empty() && (request.header("if-range").empty() || request.header("if-range") == etag))
+            {
+                uint64_t first = std::stoull(range.substr(6));
+                size_t dash = range.find('-');
+                uint64_t last = dash + 1 < range.size() ? std::stoull(range.substr(dash + 1)) : data.size() - 1;
+                last = (std::min)(last, (uint64_t)data.size() - 1);
+                body = data.substr((size_t)first, (size_t)(last - first + 1));
+                headers.emplace_back("Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(data.size()));
+                status = 206;
+            }
+            std::string full = response(status, body, headers);
+            size_t head = full.size() - body.size();
+            size_t sent = (std::min)(limit, body.size());
+            client.sendAll(std::string_view(full).substr(0, head + sent));
+            return sent;
+        }
+
+    private:
+        void acceptLoop()
+        {
+            while (!_stopping)
+            {
+                if (!_listener.waitReadable(20))
+                    continue;
+                VeloSocket client = _listener.accept();
+                if (!client.valid())
+                    continue;
+                std::lock_guard lock(_mutex);
+                _connections.emplace_back([this, socket = std::move(client)]() mutable { serve(socket); });
+            }
+        }
+
+        void serve(VeloSocket &client)
+        {
+            try
+            {
+                HttpServerRequest request;
+                if (!readRequest(client, request))
+                    return;
+                {
+                    std::lock_guard lock(_mutex);
+                    _requests.push_back(request);
+                }
+                _handler(request, client);
+            }
+            catch (const std::exception &)
+            {
+                // the client went away, which some tests do on purpose
+            }
+        }
+
+        static bool readRequest(VeloSocket &client, HttpServerRequest &request)
+        {
+            std::string head;
+            char buffer[4096];
+            while (head.find("\r\n\r\n") == std::string::npos)
+            {
+                size_t received = client.receive(buffer, sizeof(buffer));
+                if (received == 0)
+                    return false;
+                head.append(buffer, received);
+            }
+            std::istringstream lines(head.substr(0, head.find("\r\n\r\n")));
+            std::string line, method, version;
+            std::getline(lines, line);
+            std::istringstream(line) >> method >> request.target >> version;
+            while (std::getline(lines, line))
+            {
+                size_t colon = line.find(':');
+                if (colon != std::string::npos)
+                    request.headers.emplace_back(line.substr(0, colon), std::string(VeloString_Trim(line.substr(colon + 1))));
+            }
+            return true;
+        }
+
+        Handler _handler;
+        VeloSocket _listener;
+        std::atomic<bool> _stopping{ false };
+        mutable std::mutex _mutex;
+        std::vector<HttpServerRequest> _requests;
+        std::vector<std::thread> _connections;
+        std::thread _thread;
+    };
+}
+
+#endif // VELOPACK_TEST_HTTP_SERVER_H_INCLUDED
@@ -0,0 +1,454 @@
+//  Tests of the built-in HttpClient and of HttpSource, against the loopback server in HttpServer.hpp.
+
+namespace
+{
+    const char *const feedJson = R"({"Assets":[
+        {"PackageId":"MyApp","Version":"1.0.0","Type":"Full","FileName":"MyApp-1.0.0-full.nupkg","SHA1":"aa","Size":10},
+        {"PackageId":"MyApp","Version":"2.0.0","Type":"Full","FileName":"MyApp-2.0.0-full.nupkg","SHA1":"bb","Size":20}]})";
+
+    VelopackManifest testApp()
+    {
+        VelopackManifest app;
+        app.id = "MyApp";
+        app.version = "1.0.0";
+        return app;
+    }
+
+    VelopackAsset assetFor(const std::string &fileName, std::string_view data)
+    {
+        VelopackAsset asset;
+        asset.packageId = "MyApp";
+        asset.version = "2.0.0";
+        asset.type = VelopackAssetType::full;
+        asset.fileName = fileName;
+        asset.size = (int64_t)data.size();
+        asset.sha1 = VeloTest::sha1(data);
+        return asset;
+    }
+
+    // Serves the feed above with an ETag, and answers a matching If-None-Match with 304 Not Modified.
+    void serveFeed(const VeloTest::HttpServerRequest &request, VeloSocket &client)
+    {
+        if (request.header("if-none-match") == "\"v1\"")
+            client.sendAll("HTTP/1.1 304 Not Modified\r\nConnection: close\r\nETag: \"v1\"\r\n\r\n");
+        else
+            client.sendAll(VeloTest::HttpServer::response(200, feedJson, { { "ETag", "\"v1\"" } }));
+    }
+}
+
+VELO_TEST(http, FeedIsRevalidatedWithETag)
+{
+    VeloTest::HttpServer server(serveFeed);
+    HttpSource source(server.url("/feed"));
+    VelopackAssetFeed first = source.getReleaseFeed("stable", testApp());
+    VelopackAssetFeed second = source.getReleaseFeed("stable", testApp());
+
+    auto requests = server.requests();
+    CHECK_EQ(requests.size(), (size_t)2);
+    CHECK_EQ(requests[0].target, std::string("/feed/releases.stable.json?localVersion=1.0.0&id=MyApp"));
+    CHECK_EQ(requests[0].header("if-none-match"), std::string());
+    CHECK_EQ(requests[1].header("if-none-match"), std::string("\"v1\""));
+    CHECK_EQ(second.assets.size(), (size_t)2);
+    CHECK_EQ(second.latest()->fileName, std::string("MyApp-2.0.0-full.nupkg"));
+    CHECK(!first.validator.empty());
+    CHECK_EQ(second.validator, first.validator);
+}
+
+VELO_TEST(http, FeedCacheDirectorySurvivesRestart)
+{
+    VeloTest::HttpServer server(serveFeed);
+    VeloTest::TempDirectory cache;
+    {
+        HttpSource source(server.url("/feed"));
+        source.setCacheDirectory(cache.path().string());
+        source.getReleaseFeed("stable", testApp());
+    }
+    HttpSource restarted(server.url("/feed"));
+    restarted.setCacheDirectory(cache.path().string());
+    VelopackAssetFeed feed = restarted.getReleaseFeed("stable", testApp());
+    CHECK_EQ(server.requests().back().header("if-none-match"), std::string("\"v1\""));
+    CHECK_EQ(feed.assets.size(), (size_t)2);
+    CHECK(!feed.validator.empty()); // so that UpdateManager can skip the rest of a check
+
+    // the feed read from disk is kept in memory, the next poll does not need the file
+    std::string body_file = cache / "releases.stable.json";
+    std::string body = VeloTest::readFile(body_file);
+    std::filesystem::remove(body_file);
+    VelopackAssetFeed polled = restarted.getReleaseFeed("stable", testApp());
+    CHECK_EQ(server.requests().back().header("if-none-match"), std::string("\"v1\""));
+    CHECK_EQ(polled.assets.size(), (size_t)2);
+    CHECK_EQ(polled.validator, feed.validator);
+
+    // without the body, the validators stored next to it are not sent
+    HttpSource without_body(server.url("/feed"));
+    without_body.setCacheDirectory(cache.path().string());
+    CHECK_EQ(without_body.getReleaseFeed("stable", testApp()).assets.size(), (size_t)2);
+    CHECK_EQ(server.requests().back().header("if-none-match"), std::string());
+
+    // a body damaged after the 304 was asked for is fetched again, unconditionally
+    VeloTest::writeFile(body_file, "{ damaged");
+    size_t before = server.requests().size();
+    HttpSource damaged(server.url("/feed"));
+    damaged.setCacheDirectory(cache.path().string());
+    CHECK_EQ(damaged.getReleaseFeed("stable", testApp()).assets.size(), (size_t)2);
+    auto requests = server.requests();
+    CHECK_EQ(requests.size(), before + 2);
+    CHECK_EQ(requests[before].header("if-none-match"), std::string("\"v1\""));
+    CHECK_EQ(requests[before + 1].header("if-none-match"), std::string());
+    CHECK(VeloTest::readFile(body_file) == body);
+
+    // a different request (another local version) must not reuse the cached body
+    VelopackManifest other = testApp();
+    other.version = "2.0.0";
+    HttpSource again(server.url("/feed"));
+    again.setCacheDirectory(cache.path().string());
+    again.getReleaseFeed("stable", other);
+    CHECK_EQ(server.requests().back().header("if-none-match"), std::string());
+}
+
+VELO_TEST(http, SlowFeedIsCancelledAndTimesOut)
+{
+    // the head arrives at once, then the body a byte every 20ms, so the whole feed would take 20 seconds
+    VeloTest::HttpServer server([](const VeloTest::HttpServerRequest &, VeloSocket &client)
+                                {
+        client.sendAll("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 1000\r\n\r\n");
+        for (int i = 0; i < 1000; i++)
+        {
+            client.sendAll(" "); // throws once the client has hung up
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        } });
+
+    {
+        HttpSource source(server.url());
+        CancellationToken cancellation;
+        std::thread canceller([cancellation]
+                              {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            cancellation.cancel(); });
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(source.getReleaseFeed("stable", testApp(), cancellation), ProcessCancelledException, "cancelled");
+        canceller.join();
+        CHECK(VeloTest::millisecondsSince(start) < 1000);
+    }
+
+    {
+        HttpSource source(server.url());
+        source.setFeedTimeout(std::chrono::milliseconds(200));
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(source.getReleaseFeed("stable", testApp()), ProcessTimeoutException, "did not arrive within 200 ms");
+        CHECK(VeloTest::millisecondsSince(start) < 1000);
+    }
+
+    // a token which is already cancelled sends no request at all
+    size_t requests = server.requests().size();
+    CancellationToken cancelled;
+    cancelled.cancel();
+    CHECK_THROWS(HttpSource(server.url()).getReleaseFeed("stable", testApp(), cancelled), ProcessCancelledException, "cancelled");
+    CHECK_EQ(server.requests().size(), requests);
+}
+
+VELO_TEST(http, ReadsChunkedBodies)
+{
+    VeloTest::HttpServer server([](const VeloTest::HttpServerRequest &, VeloSocket &client)
+                                {
+        // chunks split across writes, a chunk extension, and a trailer
+        client.sendAll("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n");
+        client.sendAll("5\r\nhello\r\n1;ext=1\r\n \r\n");
+        client.sendAll("1A\r\nabcdefghijklmnopqrstuvwxyz\r\n");
+        client.sendAll("0\r\nX-Trailer: yes\r\n\r\n"); });
+    HttpResponse response = HttpClient::createDefault()->get({ server.url("/chunked"), {} });
+    CHECK_EQ(response.statusCode, 200);
+    CHECK_EQ(response.body, std::string("hello abcdefghijklmnopqrstuvwxyz"));
+}
+
+VELO_TEST(http, ReadsContentLengthBodies)
+{
+    std::string body = VeloTest::randomData(300000);
+    VeloTest::HttpServer server([&body](const VeloTest::HttpServerRequest &request, VeloSocket &client)
+                                {
+        if (request.path() == "/whole")
+            client.sendAll(VeloTest::HttpServer::response(200, body, { { "X-Test", "value" } }));
+        else if (request.path() == "/until-close")
+            client.sendAll("HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n" + body);
+        else if (request.path() == "/truncated")
+            client.sendAll("HTTP/1.1 200 OK\r\nContent-Length: 1000\r\nConnection: close\r\n\r\n" + body.substr(0, 500));
+        else if (request.path() == "/redirect")
+            client.sendAll(VeloTest::HttpServer::response(302, "moved", { { "Location", "/whole" } })); });
+
+    auto client = HttpClient::createDefault();
+    HttpResponse response = client->get({ server.url("/whole"), {} });
+    CHECK_EQ(response.statusCode, 200);
+    CHECK_EQ(response.header("X-TEST"), std::string("value"));
+    CHECK(response.body == body);
+
+    // streamed to a handler rather than collected
+    size_t streamed = 0;
+    client->get({ server.url("/until-close"), {} }, [&streamed](const HttpResponse &, const char *, size_t size) { streamed += size; });
+    CHECK_EQ(streamed, body.size());
+
+    CHECK_THROWS(client->get({ server.url("/truncated"), {} }), std::runtime_error, "connection closed unexpectedly");
+    CHECK(client->get({ server.url("/redirect"), {} }).body == body);
+}
+
+VELO_TEST(http, DownloadsRangesInParallel)
+{
+    // three segments, so the download is split between connections
+    std::string data = VeloTest::randomData(2 * VELO_DOWNLOAD_SEGMENT_SIZE + 12345);
+    VeloTest::HttpServer server([&data](const VeloTest::HttpServerRequest &request, VeloSocket &client)
+                                { VeloTest::HttpServer::serveRanges(request, client, data); });
+    VeloTest::TempDirectory temp;
+    HttpSource source(server.url());
+    std::vector<int16_t> progress;
+    std::mutex progress_mutex;
+    source.downloadReleaseEntry(assetFor("MyApp-2.0.0-full.nupkg", data), temp / "MyApp-2.0.0-full.nupkg", [&](int16_t p)
+                                {
+        std::lock_guard lock(progress_mutex);
+        progress.push_back(p); });
+
+    CHECK(VeloTest::readFile(temp.path() / "MyApp-2.0.0-full.nupkg") == data);
+    CHECK(!std::filesystem::exists(temp / "MyApp-2.0.0-full.nupkg.state"));
+    auto requests = server.requests();
+    CHECK_EQ(requests.size(), (size_t)3);
+    std::set<std::string> ranges;
+    for (const auto &request : requests)
+    {
+        ranges.insert(request.header("range"));
+    }
+    CHECK(ranges.count("bytes=0-" + std::to_string(VELO_DOWNLOAD_SEGMENT_SIZE - 1)) == 1);
+    CHECK(ranges.count("bytes=" + std::to_string(2 * VELO_DOWNLOAD_SEGMENT_SIZE) + "-" + std::to_string(data.size() - 1)) == 1);
+    CHECK_EQ(progress.back(), (int16_t)100);
+}
+
+VELO_TEST(http, DownloadsWholeFileWithoutRangeSupport)
+{
+    std::string data = VeloTest::randomData(2 * VELO_DOWNLOAD_SEGMENT_SIZE + 1);
+    VeloTest::HttpServer server([&data](const VeloTest::HttpServerRequest &, VeloSocket &client)
+                                { client.sendAll(VeloTest::HttpServer::response(200, data)); });
+    VeloTest::TempDirectory temp;
+    HttpSource source(server.url());
+    source.downloadReleaseEntry(assetFor("MyApp-2.0.0-full.nupkg", data), temp / "MyApp-2.0.0-full.nupkg");
+    CHECK(VeloTest::readFile(temp.path() / "MyApp-2.0.0-full.nupkg") == data);
+    // the probe for Range support, then one plain request
+    CHECK_EQ(server.requests().size(), (size_t)2);
+    CHECK_EQ(server.requests().back().header("range"), std::string());
+}
+
+VELO_TEST(http, RejectsCorruptDownload)
+{
+    std::string data = VeloTest::randomData(1000);
+    VeloTest::HttpServer server([&data](const VeloTest::HttpServerRequest &request, VeloSocket &client)
+                                {
+        if (request.path() == "/missing.nupkg")
+            client.sendAll(VeloTest::HttpServer::response(404, "not found"));
+        else
+            client.sendAll(VeloTest::HttpServer::response(200, data)); });
+    VeloTest::TempDirectory temp;
+    HttpSource source(server.url());
+    VelopackAsset asset = assetFor("MyApp-2.0.0-full.nupkg", data);
+    asset.sha1 = VeloTest::sha1("something else");
+    CHECK_THROWS(source.downloadReleaseEntry(asset, temp / "out.nupkg"), std::runtime_error, "is corrupt");
+    CHECK(!std::filesystem::exists(temp / "out.nupkg"));
+    CHECK_THROWS(source.downloadReleaseEntry(assetFor("missing.nupkg", data), temp / "out.nupkg"), std::runtime_error, "HTTP status 404");
+}
+
+namespace
+{
+    // Serves `data` in ranges. While `interrupt` is set, the first segment is cut off after `cut` bytes, and a range
+    // requested again (the retry) gets 404 so that the download gives up. Counts the bytes of body sent.
+    struct InterruptingServer
+    {
+        std::string data;
+        size_t cut;
+        std::atomic<bool> interrupt{ true };
+        std::atomic<uint64_t> served{ 0 };
+        std::mutex mutex;
+        std::set<std::string> seen;
+        VeloTest::HttpServer server;
+
+        InterruptingServer(std::string data, size_t cut)
+            : data(std::move(data)), cut(cut), server([this](const VeloTest::HttpServerRequest &request, VeloSocket &client) { serve(request, client); })
+        {
+        }
+
+        void serve(const VeloTest::HttpServerRequest &request, VeloSocket &client)
+        {
+            std::string range = request.header("range");
+            if (interrupt)
+            {
+                std::lock_guard lock(mutex);
+                // a retry asks for the rest of the same segment, which ends where it did
+                if (!seen.insert(range.substr(range.find('-'))).second)
+                {
+                    client.sendAll(VeloTest::HttpServer::response(404, "gone"));
+                    return;
+                }
+            }
+            served += VeloTest::HttpServer::serveRanges(request, client, data, "\"test\"", interrupt && range.starts_with("bytes=0-") ? cut : SIZE_MAX);
+        }
+    };
+
+    // The `hashed prefix` field of a download's .state file.
+    uint64_t hashedPrefix(const std::string &statePath)
+    {
+        std::istringstream lines(VeloTest::readFile(statePath));
+        std::string line;
+        for (int i = 0; i < 7; i++)
+            std::getline(lines, line);
+        return std::stoull(line);
+    }
+}
+
+VELO_TEST(http, ResumesInterruptedDownload)
+{
+    // cut the first segment off part way through a 64 byte block, so the saved hash state has a partial block
+    const size_t cut = 3 * 1024 * 1024 + 13;
+    std::string data = VeloTest::randomData(2 * VELO_DOWNLOAD_SEGMENT_SIZE + 4321);
+    InterruptingServer origin(data, cut);
+    VeloTest::TempDirectory temp;
+    std::string path = temp / "MyApp-2.0.0-full.nupkg";
+    VelopackAsset asset = assetFor("MyApp-2.0.0-full.nupkg", data);
+
+    HttpSource source(origin.server.url());
+    CHECK_THROWS(source.downloadReleaseEntry(asset, path), std::runtime_error, "HTTP status 404");
+    CHECK(std::filesystem::exists(path + ".state"));
+    CHECK_EQ(hashedPrefix(path + ".state"), (uint64_t)cut);
+    uint64_t first = origin.served;
+
+    origin.interrupt = false;
+    origin.served = 0;
+    source.downloadReleaseEntry(asset, path);
+    CHECK(VeloTest::readFile(path) == data);
+    CHECK(!std::filesystem::exists(path + ".state"));
+    // nothing which arrived the first time was fetched again
+    CHECK_EQ(origin.served + first, (uint64_t)data.size());
+    CHECK_EQ(origin.server.requests().back().header("if-range"), std::string("\"test\""));
+}
+
+VELO_TEST(http, ResumeRehashesWhenHashStateIsUnusable)
+{
+    const size_t cut = 1024 * 1024 + 7;
+    std::string data = VeloTest::randomData(2 * VELO_DOWNLOAD_SEGMENT_SIZE + 99, 2);
+    InterruptingServer origin(data, cut);
+    VeloTest::TempDirectory temp;
+    std::string path = temp / "MyApp-2.0.0-full.nupkg";
+    VelopackAsset asset = assetFor("MyApp-2.0.0-full.nupkg", data);
+
+    HttpSource source(origin.server.url());
+    CHECK_THROWS(source.downloadReleaseEntry(asset, path), std::runtime_error, "HTTP status 404");
+    uint64_t first = origin.served;
+
+    // damage the hash state, keeping the rest of the file intact
+    std::string state = VeloTest::readFile(path + ".state");
+    std::vector<std::string> lines;
+    std::istringstream in(state);
+    for (std::string line; std::getline(in, line);)
+        lines.push_back(line);
+    lines[6] = lines[6].substr(0, lines[6].rfind(' ')) + " not-hex";
+    std::string damaged;
+    for (const auto &line : lines)
+        damaged += line + "\n";
+    VeloTest::writeFile(path + ".state", damaged);
+    // writing the state must not look like a change to the download itself
+    std::filesystem::last_write_time(path + ".state", std::filesystem::last_write_time(path));
+
+    origin.interrupt = false;
+    origin.served = 0;
+    source.downloadReleaseEntry(asset, path);
+    CHECK(VeloTest::readFile(path) == data);
+    CHECK_EQ(origin.served + first, (uint64_t)data.size());
+}
+
+VELO_TEST(http, CancelledDownloadStopsAndCanResume)
+{
+    // ranges are sent 64KB at a time, slowly enough that the download is still running when it is cancelled
+    std::string data = VeloTest::randomData(2 * VELO_DOWNLOAD_SEGMENT_SIZE + 555, 3);
+    std::atomic<bool> slow{ true };
+    VeloTest::HttpServer server([&](const VeloTest::HttpServerRequest &request, VeloSocket &client)
+                                {
+        if (!slow)
+        {
+            VeloTest::HttpServer::serveRanges(request, client, data);
+            return;
+        }
+        std::string range = request.header("range");
+        uint64_t first = std::stoull(range.substr(6)), last = std::stoull(range.substr(range.find('-') + 1));
+        client.sendAll("HTTP/1.1 206 Test\r\nConnection: close\r\nETag: \"test\"\r\nContent-Range: bytes " + std::to_string(first) + "-" +
+                       std::to_string(last) + "/" + std::to_string(data.size()) + "\r\nContent-Length: " + std::to_string(last - first + 1) + "\r\n\r\n");
+        for (uint64_t offset = first; offset <= last; offset += 65536)
+        {
+            client.sendAll(std::string_view(data).substr((size_t)offset, (size_t)(std::min)((uint64_t)65536, last + 1 - offset)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        } });
+    VeloTest::TempDirectory temp;
+    std::string path = temp / "MyApp-2.0.0-full.nupkg";
+    VelopackAsset asset = assetFor("MyApp-2.0.0-full.nupkg", data);
+    HttpSource source(server.url());
+
+    CancellationToken cancellation;
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(source.downloadReleaseEntry(asset, path, [&cancellation](int16_t) { cancellation.cancel(); }, cancellation),
+                 ProcessCancelledException, "cancelled");
+    CHECK(VeloTest::millisecondsSince(start) < 2000);
+    // not retried, and the progress is kept
+    CHECK_EQ(server.requests().size(), (size_t)3);
+    CHECK(std::filesystem::exists(path + ".state"));
+
+    slow = false;
+    source.downloadReleaseEntry(asset, path);
+    CHECK(VeloTest::readFile(path) == data);
+}
+
+VELO_TEST(http, LimiterWaitsStopOnCancellation)
+{
+    auto cancelLater = [](const CancellationToken &cancellation)
+    {
+        return std::thread([cancellation]
+                           {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            cancellation.cancel(); });
+    };
+
+    // paused, which no amount of time ends
+    {
+        BandwidthLimiter limiter;
+        limiter.pause();
+        CancellationToken cancellation;
+        std::thread canceller = cancelLater(cancellation);
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(limiter.acquire(1000, cancellation), ProcessCancelledException, "cancelled");
+        canceller.join();
+        CHECK(VeloTest::millisecondsSince(start) < 1000);
+    }
+
+    // throttled, with the bucket in debt for a thousand seconds
+    {
+        BandwidthLimiter limiter(1000);
+        limiter.acquire(1000000);
+        CancellationToken cancellation;
+        std::thread canceller = cancelLater(cancellation);
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(limiter.acquire(1000, cancellation), ProcessCancelledException, "cancelled");
+        canceller.join();
+        CHECK(VeloTest::millisecondsSince(start) < 1000);
+        CHECK_EQ(limiter.totalBytes(), (uint64_t)1000000); // nothing was taken by the cancelled call
+    }
+
+    // a download held back by a paused limiter
+    {
+        std::string data = VeloTest::randomData(1000);
+        VeloTest::HttpServer server([&data](const VeloTest::HttpServerRequest &, VeloSocket &client)
+                                    { client.sendAll(VeloTest::HttpServer::response(200, data)); });
+        VeloTest::TempDirectory temp;
+        HttpSource source(server.url());
+        auto limiter = std::make_shared<BandwidthLimiter>();
+        limiter->pause();
+        source.setBandwidthLimiter(limiter);
+        CancellationToken cancellation;
+        std::thread canceller = cancelLater(cancellation);
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(source.downloadReleaseEntry(assetFor("MyApp-2.0.0-full.nupkg", data), temp / "out.nupkg", {}, cancellation),
+                     ProcessCancelledException, "cancelled");
+        canceller.join();
+        CHECK(VeloTest::millisecondsSince(start) < 1000);
+    }
+}
@@ -0,0 +1,117 @@
+//  Package manifest tests: the minimal XML reader, VelopackManifest::parse on top of it, and VelopackLocator finding
+//  an installed app from the path of its executable.
+
+VELO_TEST(manifest, ReadsXmlText)
+{
+    // the result is each (element, text) the reader reports, as "element=text" separated by "|", or the error thrown
+    struct Case
+    {
+        const char *xml;
+        const char *result;
+    };
+    const Case cases[] = {
+        { "<a><b>x</b></a>", "b=x" },
+        { "<a>x<b>y</b>z</a>", "a=x|b=y|a=z" },
+        { "<a>  <b>t</b>\n  </a>", "b=t" }, // whitespace between elements is not text
+        { "<a>&lt;&amp;&gt;&quot;&apos;&#65;&#x42;&#xe9;&#x1F600;</a>", "a=<&>\"'AB\xC3\xA9\xF0\x9F\x98\x80" },
+        { "<a><![CDATA[<b>&amp;</b>]]></a>", "a=<b>&amp;</b>" },
+        { "<a>x<![CDATA[]]>y</a>", "a=xy" },
+        { "<a>x<!-- <b>y</b> & -->z</a>", "a=xz" },
+        { "<a><b/><c attr='1' />text<d></d></a>", "a=text" },
+        { "<a x=\"1>2\" y='<'>t</a>", "a=t" },
+        { "<nuspec:a xmlns:nuspec=\"urn:x\">t</nuspec:a>", "a=t" },
+        { "<?xml version='1.0' encoding='utf-8'?><!DOCTYPE a><a>t</a>", "a=t" },
+        { "", "" },
+        { "<a>&nbsp;</a>", "Invalid XML, unknown entity '&nbsp;'." },
+        { "<a>&#xZZ;</a>", "Invalid XML, bad character reference '&#xZZ;'." },
+        { "<a>&#x110000;</a>", "Invalid XML, bad character reference '&#x110000;'." },
+        { "<a>&amp</a>", "Invalid XML, unterminated character reference." },
+        { "<a><!-- x</a>", "Invalid XML, unexpected end of document." },
+        { "<a><![CDATA[x</a>", "Invalid XML, unexpected end of document." },
+        { "<a x='>", "Invalid XML, unexpected end of document." },
+    };
+    for (const auto &test : cases)
+    {
+        std::string result;
+        try
+        {
+            VeloXml_ReadText(test.xml, [&result](std::string_view element, const std::string &text)
+                             { result += (result.empty() ? "" : "|") + std::string(element) + "=" + text; });
+        }
+        catch (const std::exception &e)
+        {
+            result = e.what();
+        }
+        CHECK_EQ(std::string(test.xml) + " -> " + result, std::string(test.xml) + " -> " + test.result);
+    }
+}
+
+VELO_TEST(manifest, ParsesManifest)
+{
+    VelopackManifest manifest = VelopackManifest::parse(R"(<?xml version="1.0" encoding="utf-8"?>
+<!-- written by vpk -->
+<package xmlns="http://schemas.microsoft.com/packaging/2013/05/nuspec.xsd">
+  <metadata>
+    <id>MyApp</id>
+    <version>2.0.0-beta.1+build.7</version>
+    <title>My &amp; App</title>
+    <authors><![CDATA[Smith & <Jones>]]></authors>
+    <description>
+      Two
+      lines
+    </description>
+    <releaseNotes/>
+    <mainExe>MyApp.exe</mainExe>
+    <channel>beta</channel>
+    <unknown>ignored</unknown>
+  </metadata>
+</package>)");
+    CHECK_EQ(manifest.id, std::string("MyApp"));
+    CHECK_EQ(manifest.version, std::string("2.0.0-beta.1+build.7"));
+    CHECK_EQ(manifest.title, std::string("My & App"));
+    CHECK_EQ(manifest.authors, std::string("Smith & <Jones>"));
+    CHECK_EQ(manifest.description, std::string("\n      Two\n      lines\n    ")); // text is kept as written
+    CHECK_EQ(manifest.mainExe, std::string("MyApp.exe"));
+    CHECK_EQ(manifest.channel, std::string("beta"));
+
+    // the title defaults to the id, and the id and version are required
+    VelopackManifest untitled = VelopackManifest::parse("<package><metadata><id>A</id><version>1.0.0</version><mainExe>a</mainExe></metadata></package>");
+    CHECK_EQ(untitled.title, std::string("A"));
+    CHECK_THROWS(VelopackManifest::parse("<package><metadata><version>1.0.0</version></metadata></package>"), std::runtime_error, "Missing 'id'");
+    CHECK_THROWS(VelopackManifest::parse("<package><metadata><id>A</id><version/></metadata></package>"), std::runtime_error, "Missing 'version'");
+    CHECK_THROWS(VelopackManifest::read((std::filesystem::temp_directory_path() / "missing.nuspec").string()), std::runtime_error, "Unable to read");
+}
+
+VELO_TEST(manifest, LocatesInstalledApp)
+{
+    VeloTest::TempDirectory temp;
+    std::string exe = installTestApp(temp, "1.2.3");
+    VelopackLocator locator = VelopackLocator::locate(exe);
+    CHECK_EQ(locator.manifest.id, std::string("VelopackTestApp"));
+    CHECK_EQ(locator.manifest.version, std::string("1.2.3"));
+    CHECK_EQ(locator.manifest.channel, std::string("stable"));
+#if defined(_WIN32)
+    CHECK_EQ(locator.rootAppDir, temp.path().string());
+    CHECK_EQ(locator.updateExePath, temp / "Update.exe");
+    CHECK_EQ(locator.packagesDir, temp / "packages");
+    // a binary nested deeper in current/ belongs to the same app
+    std::filesystem::create_directories(temp.path() / "current" / "bin");
+    CHECK_EQ(VelopackLocator::locate(temp / "current\\bin\\Tool.exe").rootAppDir, temp.path().string());
+#else
+#if defined(__APPLE__)
+    std::filesystem::path root = temp.path() / "VelopackTestApp.app";
+    CHECK_EQ(locator.updateExePath, (root / "Contents" / "MacOS" / "UpdateMac").string());
+    CHECK_EQ(locator.packagesDir, (std::filesystem::path(nativeGetHomeDirectory()) / "Library" / "Caches" / "velopack" / "VelopackTestApp" / "packages").string());
+#else
+    std::filesystem::path root = temp.path();
+    CHECK_EQ(locator.updateExePath, (root / "usr" / "bin" / "UpdateNix").string());
+    CHECK_EQ(locator.packagesDir, std::string("/var/tmp/velopack/VelopackTestApp/packages"));
+#endif
+    CHECK_EQ(locator.rootAppDir, root.string());
+#endif
+
+    // an executable outside of an install, or an install without the updater, is not located
+    CHECK_THROWS(VelopackLocator::locate((temp.path() / "elsewhere" / "app").string()), std::runtime_error, "Unable to locate");
+    std::filesystem::remove(locator.updateExePath);
+    CHECK_THROWS(VelopackLocator::locate(exe), std::runtime_error, "Unable to locate");
+}
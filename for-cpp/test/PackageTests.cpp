@@ -0,0 +1,236 @@
+//  PackageIndex::collectGarbage tests: which packages a retention policy keeps. Each case starts from the same
+//  packages directory, with the installed release 2.0.0 and the latest 3.0.0, and uses the feed tables of FeedTests.cpp.
+//  Then SharedCacheSource: concurrent updaters download a package once, and who the cache directory may belong to.
+
+namespace
+{
+    struct PackageFile
+    {
+        const char *name;
+        size_t size;
+        int ageHours;
+    };
+
+    const std::vector<FeedRow> retentionFeed = {
+        { "1.0.0", "Full", "MyApp-1.0.0-full.nupkg", 1000 },
+        { "2.0.0", "Delta", "MyApp-2.0.0-delta.nupkg", 100 },
+        { "2.0.0", "Full", "MyApp-2.0.0-full.nupkg", 1000 },
+        { "2.5.0", "Delta", "MyApp-2.5.0-delta.nupkg", 100 },
+        { "2.5.0", "Full", "MyApp-2.5.0-full.nupkg", 1000 },
+        { "3.0.0", "Delta", "MyApp-3.0.0-delta.nupkg", 100 },
+        { "3.0.0", "Full", "MyApp-3.0.0-full.nupkg", 1000 },
+    };
+
+    const std::vector<PackageFile> retentionFiles = {
+        { "MyApp-1.0.0-full.nupkg", 1000, 400 },           // older than the installed release
+        { "MyApp-2.0.0-delta.nupkg", 100, 300 },           // leads to the installed release
+        { "MyApp-2.0.0-full.nupkg", 1000, 240 },           // the installed release, pinned
+        { "MyApp-2.5.0-delta.nupkg", 100, 6 },
+        { "MyApp-2.5.0-full.nupkg", 1000, 4 },
+        { "MyApp-3.0.0-delta.nupkg", 100, 3 },
+        { "MyApp-3.0.0-full.nupkg", 1000, 100 },           // the latest release, pinned
+        { "MyApp-3.0.0-delta.nupkg.partial", 50, 2 },      // goes with the 3.0.0 delta
+        { "Other-1.0.0-full.nupkg", 1000, 1 },             // not in the feed
+        { "MyApp-1.0.0-full.nupkg.partial.state", 10, 1 }, // goes with the 1.0.0 package
+        { "notes.txt", 10, 1000 },                         // not a package
+    };
+}
+
+VELO_TEST(packages, CollectGarbageKeepsWhatUpdatesCanUse)
+{
+    struct Case
+    {
+        const char *name;
+        uint64_t maxBytes;
+        int maxAgeHours; // 0 for no limit
+        std::vector<std::string> removed;
+    };
+    const std::vector<std::string> unusable = { "MyApp-1.0.0-full.nupkg", "MyApp-1.0.0-full.nupkg.partial.state", "MyApp-2.0.0-delta.nupkg",
+                                                "Other-1.0.0-full.nupkg" };
+    auto with = [&unusable](std::vector<std::string> more)
+    {
+        more.insert(more.end(), unusable.begin(), unusable.end());
+        std::sort(more.begin(), more.end());
+        return more;
+    };
+    const Case cases[] = {
+        { "no limits", 0, 0, with({}) },
+        { "the default age", 0, 24 * 30, with({}) },
+        // pinned packages are kept however old they are
+        { "older than 5h", 0, 5, with({ "MyApp-2.5.0-delta.nupkg" }) },
+        { "older than 1h", 0, 1,
+          with({ "MyApp-2.5.0-delta.nupkg", "MyApp-2.5.0-full.nupkg", "MyApp-3.0.0-delta.nupkg", "MyApp-3.0.0-delta.nupkg.partial" }) },
+        // 3250 bytes are kept without limits, of which 2000 are pinned. The oldest unpinned files go first.
+        { "3250 bytes", 3250, 0, with({}) },
+        { "3200 bytes", 3200, 0, with({ "MyApp-2.5.0-delta.nupkg" }) },
+        { "2300 bytes", 2300, 0, with({ "MyApp-2.5.0-delta.nupkg", "MyApp-2.5.0-full.nupkg" }) },
+        { "1 byte", 1, 0, with({ "MyApp-2.5.0-delta.nupkg", "MyApp-2.5.0-full.nupkg", "MyApp-3.0.0-delta.nupkg", "MyApp-3.0.0-delta.nupkg.partial" }) },
+        { "1 byte and 5h", 1, 5,
+          with({ "MyApp-2.5.0-delta.nupkg", "MyApp-2.5.0-full.nupkg", "MyApp-3.0.0-delta.nupkg", "MyApp-3.0.0-delta.nupkg.partial" }) },
+    };
+    VelopackAssetFeed feed = makeFeed(retentionFeed);
+    for (const auto &test : cases)
+    {
+        VeloTest::TempDirectory temp;
+        auto now = std::filesystem::file_time_type::clock::now();
+        for (const auto &file : retentionFiles)
+        {
+            VeloTest::writeFile(temp / file.name, std::string(file.size, 'x'));
+            std::filesystem::last_write_time(temp / file.name, now - std::chrono::hours(file.ageHours));
+        }
+        PackageIndex packages(temp.path().string());
+        PackageRetention retention;
+        retention.maxBytes = test.maxBytes;
+        retention.maxAge = std::chrono::hours(test.maxAgeHours);
+
+        std::vector<std::string> removed = packages.collectGarbage(feed, SemanticVersion(2, 0, 0), retention);
+        std::sort(removed.begin(), removed.end());
+        std::string what = std::string(test.name) + ": ";
+        auto join = [](const std::vector<std::string> &names)
+        {
+            std::string result;
+            for (const auto &name : names)
+                result.append(result.empty() ? "" : " ").append(name);
+            return result;
+        };
+        CHECK_EQ(what + join(removed), what + join(test.removed));
+
+        // the files are gone from the directory and from the index
+        for (const auto &file : retentionFiles)
+        {
+            bool expected = !std::binary_search(test.removed.begin(), test.removed.end(), std::string(file.name));
+            if (std::filesystem::exists(temp / file.name) != expected)
+                VeloTest::fail(__FILE__, __LINE__, what + file.name + (expected ? " was removed" : " was kept"));
+        }
+        for (const LocalPackage &package : packages.packages())
+        {
+            if (std::binary_search(test.removed.begin(), test.removed.end(), package.fileName))
+                VeloTest::fail(__FILE__, __LINE__, what + package.fileName + " is still in the index");
+        }
+    }
+}
+
+VELO_TEST(packages, CollectGarbageRemovesDeltasOfTheWrongSize)
+{
+    VeloTest::TempDirectory temp;
+    VeloTest::writeFile(temp / "MyApp-2.0.0-full.nupkg", "x");
+    VeloTest::writeFile(temp / "MyApp-3.0.0-delta.nupkg", std::string(99, 'x'));
+    // a full package rebuilt from deltas differs from the one in the feed, so its size does not matter
+    VeloTest::writeFile(temp / "MyApp-3.0.0-full.nupkg", std::string(12, 'x'));
+    PackageIndex packages(temp.path().string());
+    std::vector<std::string> removed = packages.collectGarbage(makeFeed(retentionFeed), SemanticVersion(2, 0, 0));
+    CHECK_EQ(removed.size(), (size_t)1);
+    CHECK_EQ(removed.at(0), std::string("MyApp-3.0.0-delta.nupkg"));
+}
+
+namespace
+{
+    VelopackAsset cacheAsset(std::string_view data)
+    {
+        VelopackAsset asset;
+        asset.packageId = "MyApp";
+        asset.version = "2.0.0";
+        asset.type = VelopackAssetType::full;
+        asset.fileName = "MyApp-2.0.0-full.nupkg";
+        asset.size = (int64_t)data.size();
+        asset.sha1 = VeloTest::sha1(data);
+        return asset;
+    }
+}
+
+VELO_TEST(packages, SharedCacheDownloadsEachPackageOnce)
+{
+    // two updaters, each with a cache of its own over the same directory, want the same package at once
+    std::string data = VeloTest::randomData(200000, 7);
+    VelopackAsset asset = cacheAsset(data);
+    VeloTest::TempDirectory temp;
+    std::atomic<int> downloads{ 0 }, inside{ 0 }, overlapped{ 0 };
+    auto origin = std::make_shared<ScriptedSource>([&](const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                                                   {
+        downloads++;
+        if (inside++ > 0)
+            overlapped++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        VeloTest::writeFile(localFile, data);
+        inside--; });
+    std::vector<std::thread> threads;
+    std::vector<std::string> errors(2);
+    for (int i = 0; i < 2; i++)
+    {
+        threads.emplace_back([&, i]
+                             {
+            try
+            {
+                SharedCacheSource cache(origin, temp / "cache");
+                cache.downloadReleaseEntry(asset, temp / ("app" + std::to_string(i) + ".nupkg"));
+            }
+            catch (const std::exception &e)
+            {
+                errors[i] = e.what();
+            } });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    CHECK_EQ(errors[0] + errors[1], std::string());
+    CHECK_EQ(downloads.load(), 1);
+    CHECK_EQ(overlapped.load(), 0);
+    CHECK(VeloTest::readFile(temp / "app0.nupkg") == data);
+    CHECK(VeloTest::readFile(temp / "app1.nupkg") == data);
+
+    // a damaged object is fetched again rather than used
+    std::filesystem::path object = std::filesystem::path(temp / "cache") / VeloString_ToUpper(asset.sha1).substr(0, 2) / VeloString_ToUpper(asset.sha1);
+    std::filesystem::remove(temp / "app0.nupkg");
+    std::filesystem::remove(temp / "app1.nupkg");
+    std::filesystem::permissions(object, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+    VeloTest::writeFile(object, "damaged");
+    SharedCacheSource(origin, temp / "cache").downloadReleaseEntry(asset, temp / "app2.nupkg");
+    CHECK_EQ(downloads.load(), 2);
+    CHECK(VeloTest::readFile(temp / "app2.nupkg") == data);
+}
+
+VELO_TEST(packages, SharedCacheLockWaitIsCancellable)
+{
+    std::string data = VeloTest::randomData(1000, 8);
+    VelopackAsset asset = cacheAsset(data);
+    VeloTest::TempDirectory temp;
+    std::string key = VeloString_ToUpper(asset.sha1);
+    std::filesystem::create_directories(std::filesystem::path(temp / "cache") / key.substr(0, 2));
+    // another updater holds the lock of the package for as long as the test runs
+    VeloFileLock held(std::filesystem::path(temp / "cache") / key.substr(0, 2) / (key + ".lock"));
+    auto origin = std::make_shared<ScriptedSource>([&](const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                                                   { VeloTest::writeFile(localFile, data); });
+    SharedCacheSource cache(origin, temp / "cache");
+    CancellationToken cancellation;
+    std::thread canceller([&cancellation]
+                          {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        cancellation.cancel(); });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(cache.downloadReleaseEntry(asset, temp / "app.nupkg", {}, cancellation), ProcessCancelledException, "cancelled");
+    canceller.join();
+    CHECK(VeloTest::millisecondsSince(start) < 2000);
+    CHECK(!std::filesystem::exists(temp / "app.nupkg"));
+}
+
+#if !defined(_WIN32)
+VELO_TEST(packages, SharedCacheIsNotUsedWhenOthersCanWriteToIt)
+{
+    std::string data = VeloTest::randomData(1000, 9);
+    VelopackAsset asset = cacheAsset(data);
+    VeloTest::TempDirectory temp;
+    auto origin = std::make_shared<ScriptedSource>([&](const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                                                   { VeloTest::writeFile(localFile, data); });
+
+    // a cache the source creates is private to its owner
+    SharedCacheSource(origin, temp / "private").downloadReleaseEntry(asset, temp / "app0.nupkg");
+    CHECK((std::filesystem::status(temp / "private").permissions() & std::filesystem::perms::all) == std::filesystem::perms::owner_all);
+    CHECK(std::filesystem::exists(std::filesystem::path(temp / "private") / VeloString_ToUpper(asset.sha1).substr(0, 2)));
+
+    // a directory which others may write to is bypassed
+    std::filesystem::create_directories(temp / "open");
+    std::filesystem::permissions(temp / "open", std::filesystem::perms::all);
+    SharedCacheSource(origin, temp / "open").downloadReleaseEntry(asset, temp / "app1.nupkg");
+    CHECK(VeloTest::readFile(temp / "app1.nupkg") == data);
+    CHECK(std::filesystem::is_empty(temp / "open"));
+}
+#endif
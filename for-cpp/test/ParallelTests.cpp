@@ -0,0 +1,266 @@
+//  VeloParallel_For tests, and a benchmark of extracting a package with many small files, stored and deflated.
+
+namespace
+{
+    // Compresses with the fixed Huffman codes of RFC 1951 and greedy matches of up to 258 bytes, found through a hash
+    // of the next three bytes. Far from the best ratio, but real deflate data for the extraction benchmark.
+    std::string deflateFixed(std::string_view data)
+    {
+        std::string out;
+        uint32_t bits = 0;
+        int count = 0;
+        auto put = [&](uint32_t value, int length)
+        {
+            bits |= value << count;
+            for (count += length; count >= 8; count -= 8, bits >>= 8)
+                out.push_back((char)(bits & 0xff));
+        };
+        auto putCode = [&](uint32_t code, int length) // Huffman codes are sent most significant bit first
+        {
+            uint32_t reversed = 0;
+            for (int i = 0; i < length; i++)
+                reversed |= ((code >> i) & 1) << (length - 1 - i);
+            put(reversed, length);
+        };
+        auto putSymbol = [&](int symbol)
+        {
+            if (symbol < 144)
+                putCode(0x30 + symbol, 8);
+            else if (symbol < 256)
+                putCode(0x190 + symbol - 144, 9);
+            else if (symbol < 280)
+                putCode(symbol - 256, 7);
+            else
+                putCode(0xc0 + symbol - 280, 8);
+        };
+        static const uint16_t lengthBase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t lengthExtra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t distanceBase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+                                                 4097, 6145, 8193, 12289, 16385, 24577 };
+
+        put(1, 1); // the final block
+        put(1, 2); // with fixed codes
+        std::vector<int64_t> last(1 << 15, -1);
+        for (size_t i = 0; i < data.size();)
+        {
+            size_t length = 0, distance = 0;
+            if (i + 3 <= data.size())
+            {
+                uint32_t hash = (((uint8_t)data[i] << 10) ^ ((uint8_t)data[i + 1] << 5) ^ (uint8_t)data[i + 2]) & 0x7fff;
+                int64_t candidate = last[hash];
+                last[hash] = (int64_t)i;
+                if (candidate >= 0 && i - (size_t)candidate <= 32768)
+                {
+                    while (length < 258 && i + length < data.size() && data[(size_t)candidate + length] == data[i + length])
+                        length++;
+                    distance = i - (size_t)candidate;
+                }
+            }
+            if (length < 3)
+            {
+                putSymbol((uint8_t)data[i++]);
+                continue;
+            }
+            int code = 28;
+            while (lengthBase[code] > length)
+                code--;
+            putSymbol(257 + code);
+            put((uint32_t)(length - lengthBase[code]), lengthExtra[code]);
+            int distanceCode = 29;
+            while (distanceBase[distanceCode] > distance)
+                distanceCode--;
+            putCode((uint32_t)distanceCode, 5);
+            put((uint32_t)(distance - distanceBase[distanceCode]), distanceCode < 4 ? 0 : distanceCode / 2 - 1);
+            i += length;
+        }
+        putSymbol(256);
+        put(0, 7); // flush the last byte
+        return out;
+    }
+
+    // Appends little-endian integers, as zip records store them.
+    void put16(std::string &out, uint16_t value)
+    {
+        out.push_back((char)(value & 0xFF));
+        out.push_back((char)(value >> 8));
+    }
+
+    void put32(std::string &out, uint32_t value)
+    {
+        put16(out, (uint16_t)(value & 0xFFFF));
+        put16(out, (uint16_t)(value >> 16));
+    }
+
+    // Writes a zip of stored or deflated entries, with a local header and a central directory record for each.
+    void writeZip(const std::string &path, const std::vector<std::pair<std::string, std::string>> &files, bool deflate = false)
+    {
+        std::string body, directory;
+        for (const auto &[name, data] : files)
+        {
+            VeloCrc32 crc;
+            crc.update(data.data(), data.size());
+            std::string stored = deflate ? deflateFixed(data) : data;
+            uint16_t method = deflate ? 8 : 0;
+            uint32_t offset = (uint32_t)body.size();
+            put32(body, 0x04034b50);
+            for (uint16_t value : { (uint16_t)20, (uint16_t)0x0800, method, (uint16_t)0, (uint16_t)0x0021 })
+                put16(body, value);
+            put32(body, crc.value());
+            put32(body, (uint32_t)stored.size());
+            put32(body, (uint32_t)data.size());
+            put16(body, (uint16_t)name.size());
+            put16(body, 0);
+            body += name + stored;
+
+            put32(directory, 0x02014b50);
+            for (uint16_t value : { (uint16_t)20, (uint16_t)20, (uint16_t)0x0800, method, (uint16_t)0, (uint16_t)0x0021 })
+                put16(directory, value);
+            put32(directory, crc.value());
+            put32(directory, (uint32_t)stored.size());
+            put32(directory, (uint32_t)data.size());
+            for (uint16_t value : { (uint16_t)name.size(), (uint16_t)0, (uint16_t)0, (uint16_t)0, (uint16_t)0 })
+                put16(directory, value);
+            put32(directory, 0);
+            put32(directory, offset);
+            directory += name;
+        }
+        std::string end;
+        put32(end, 0x06054b50);
+        for (uint16_t value : { (uint16_t)0, (uint16_t)0, (uint16_t)files.size(), (uint16_t)files.size() })
+            put16(end, value);
+        put32(end, (uint32_t)directory.size());
+        put32(end, (uint32_t)body.size());
+        put16(end, 0);
+        VeloTest::writeFile(path, body + directory + end);
+    }
+}
+
+VELO_TEST(parallel, RunsEveryIndexExactlyOnce)
+{
+    for (size_t count : { 0, 1, 2, 3, 7, 64, 1000, 100003 })
+    {
+        for (unsigned threads : { 0u, 1u, 2u, 3u, 8u, 64u })
+        {
+            std::vector<std::atomic<int>> runs(count);
+            VeloParallel_For(count, threads, [&runs](size_t i) { runs[i]++; });
+            for (size_t i = 0; i < count; i++)
+            {
+                if (runs[i] != 1)
+                    VeloTest::fail(__FILE__, __LINE__, "index " + std::to_string(i) + " of " + std::to_string(count) + " ran " +
+                                                           std::to_string(runs[i]) + " times on " + std::to_string(threads) + " threads");
+            }
+        }
+    }
+}
+
+VELO_TEST(parallel, StealsFromSlowShares)
+{
+    // the first share holds all the slow items, which the other threads must take over
+    const size_t count = 400;
+    std::vector<std::atomic<int>> runs(count);
+    std::mutex mutex;
+    std::set<std::thread::id> threads;
+    VeloParallel_For(count, 4, [&](size_t i)
+                     {
+        if (i < count / 4)
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        runs[i]++;
+        std::lock_guard lock(mutex);
+        threads.insert(std::this_thread::get_id()); });
+    for (size_t i = 0; i < count; i++)
+        CHECK_EQ(runs[i].load(), 1);
+    CHECK_EQ(threads.size(), (size_t)4);
+}
+
+VELO_TEST(parallel, PropagatesExceptions)
+{
+    for (unsigned threads : { 1u, 4u })
+    {
+        std::atomic<int> running{ 0 }, ran{ 0 };
+        auto run = [&]
+        {
+            VeloParallel_For(10000, threads, [&](size_t i)
+                             {
+                running++;
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                ran++;
+                running--;
+                if (i == 100)
+                    throw std::invalid_argument("item 100 failed"); });
+        };
+        CHECK_THROWS(run(), std::invalid_argument, "item 100 failed");
+        // every thread has stopped by the time the exception is rethrown, and the rest of the items were skipped
+        CHECK_EQ(running.load(), 0);
+        CHECK(ran < 10000);
+    }
+
+    // with several failures, one of them is rethrown
+    CHECK_THROWS(VeloParallel_For(100, 8, [](size_t i) { throw std::runtime_error("item " + std::to_string(i)); }), std::runtime_error, "item ");
+}
+
+VELO_TEST(parallel, ExtractsDeflatedEntries)
+{
+    // the benchmark's own deflate encoder, checked against the library's inflater over matches of every length
+    std::string text;
+    std::mt19937 random(7);
+    const char *words[] = { "velopack ", "update ", "package ", "delta ", "release ", "a", "b", "\n" };
+    while (text.size() < 200000)
+        text += words[random() % std::size(words)];
+    std::vector<std::pair<std::string, std::string>> files = {
+        { "text.txt", text },
+        { "random.bin", VeloTest::randomData(70000, 2) },
+        { "runs.bin", std::string(1000, 'x') + std::string(259, 'y') + std::string(3, 'z') },
+        { "empty.txt", "" },
+    };
+    VeloTest::TempDirectory temp;
+    writeZip(temp / "deflated.nupkg", files, true);
+    BundleZip zip = BundleZip::open(temp / "deflated.nupkg");
+    for (const auto &[name, data] : files)
+    {
+        const BundleEntry *entry = zip.find(name);
+        CHECK(entry != nullptr && entry->method == 8);
+        CHECK(zip.read(*entry) == data);
+    }
+    CHECK(zip.find("text.txt")->compressedSize < text.size() / 2);
+}
+
+VELO_BENCHMARK(parallel, ExtractManySmallFiles)
+{
+    VeloTest::TempDirectory temp;
+    std::vector<std::pair<std::string, std::string>> files;
+    std::string data;
+    std::mt19937 random(3);
+    const char *words[] = { "velopack ", "update ", "package ", "delta ", "release ", "install ", "channel ", "\n" };
+    while (data.size() < 64 * 1024)
+        data += words[random() % std::size(words)];
+    for (int i = 0; i < 10000; i++)
+    {
+        size_t size = 256 + (size_t)(i * 7919 % 8192);
+        files.emplace_back("lib/app/dir" + std::to_string(i % 100) + "/file" + std::to_string(i) + ".bin", data.substr(i % 1024, size));
+    }
+
+    // stored entries are mostly file system work, deflated ones add the inflating which threads spread out
+    for (bool deflate : { false, true })
+    {
+        std::string package = temp / (deflate ? "deflated.nupkg" : "stored.nupkg");
+        writeZip(package, files, deflate);
+        BundleZip zip = BundleZip::open(package);
+        double single = 0;
+        for (int threads : { 1, 2, 4, 0 })
+        {
+            std::string directory = temp / ("out-" + std::to_string(threads));
+            auto start = std::chrono::steady_clock::now();
+            zip.extractAll(directory, {}, threads);
+            double ms = VeloTest::millisecondsSince(start);
+            single = threads == 1 ? ms : single;
+            std::printf("           10000 %s files, %-8s %8.0f ms %10.0f files/s %6.2fx\n", deflate ? "deflated" : "stored  ",
+                        threads == 0 ? "all cpus" : (std::to_string(threads) + " thr").c_str(), ms, 10000 * 1000.0 / ms, single / ms);
+            if (threads == 0)
+            {
+                for (size_t i = 0; i < files.size(); i += 97)
+                    CHECK(VeloTest::readFile(std::filesystem::path(directory) / files[i].first) == files[i].second);
+            }
+            std::filesystem::remove_all(directory);
+        }
+    }
+}
@@ -0,0 +1,277 @@
+//  Peer sharing tests: which requests PeerServer accepts, how it answers Range requests, PeerSource falling back from
+//  a peer which sends the wrong bytes, and sharing between processes (the server is this test binary, run with
+//  `--child peer-server`). Everything runs on 127.0.0.1, with a discovery port of its own per test run so that peers
+//  on the machine (or another run of the tests) do not answer.
+
+namespace
+{
+    PeerSharingOptions loopbackPeers()
+    {
+        static const uint16_t port = (uint16_t)(40000 + std::random_device{}() % 20000);
+        PeerSharingOptions options;
+        options.interfaceAddress = "127.0.0.1";
+        options.discoveryPort = port;
+        options.discoveryTimeout = std::chrono::milliseconds(500);
+        return options;
+    }
+
+    VelopackAsset peerAsset(std::string_view data)
+    {
+        VelopackAsset asset;
+        asset.packageId = "MyApp";
+        asset.version = "2.0.0";
+        asset.type = VelopackAssetType::full;
+        asset.fileName = "MyApp-2.0.0-full.nupkg";
+        asset.size = (int64_t)data.size();
+        asset.sha1 = VeloTest::sha1(data);
+        return asset;
+    }
+
+    struct RawResponse
+    {
+        int status = 0;
+        std::string head;
+        std::string body;
+    };
+
+    // Sends a request as written, so that paths which a client would normalise reach the server unchanged.
+    RawResponse rawRequest(uint16_t port, const std::string &requestLine, const std::string &headers = {})
+    {
+        VeloSocket socket = VeloSocket::connect("127.0.0.1", std::to_string(port));
+        socket.sendAll(requestLine + "\r\nHost: 127.0.0.1\r\n" + headers + "\r\n");
+        std::string all;
+        char buffer[65536];
+        for (size_t received; (received = socket.receive(buffer, sizeof(buffer))) > 0;)
+            all.append(buffer, received);
+        RawResponse response;
+        size_t end = all.find("\r\n\r\n");
+        response.head = all.substr(0, end);
+        response.body = end == std::string::npos ? std::string() : all.substr(end + 4);
+        response.status = std::stoi(all.substr(9, 3));
+        return response;
+    }
+
+    // Answers every discovery request for `sha1` with the port of an HTTP server which sends the wrong bytes.
+    struct RoguePeer
+    {
+        std::string sha1;
+        VeloTest::HttpServer http;
+        VeloSocket discovery = VeloSocket::udp();
+        std::atomic<bool> stopping{ false };
+        std::thread thread;
+
+        RoguePeer(const PeerSharingOptions &options, std::string sha1_, std::string data)
+            : sha1(std::move(sha1_)), http([data](const VeloTest::HttpServerRequest &request, VeloSocket &client)
+                                           { VeloTest::HttpServer::serveRanges(request, client, data); })
+        {
+            int reuse = 1;
+            setsockopt(discovery.handle(), SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+#if defined(SO_REUSEPORT)
+            setsockopt(discovery.handle(), SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse, sizeof(reuse));
+#endif
+            struct sockaddr_in local = VeloSocket::ipv4("", options.discoveryPort);
+            if (::bind(discovery.handle(), (const struct sockaddr *)&local, sizeof(local)) != 0)
+                throw std::runtime_error("Unable to bind the rogue peer.");
+            struct ip_mreq membership = {};
+            membership.imr_multiaddr = VeloSocket::ipv4(options.multicastGroup, 0).sin_addr;
+            membership.imr_interface = VeloSocket::ipv4(options.interfaceAddress, 0).sin_addr;
+            setsockopt(discovery.handle(), IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&membership, sizeof(membership));
+            std::string port = http.url().substr(http.url().rfind(':') + 1);
+            thread = std::thread([this, port]
+                                 {
+                while (!stopping)
+                {
+                    if (!discovery.waitReadable(20))
+                        continue;
+                    char datagram[512];
+                    struct sockaddr_in from = {};
+                    socklen_t from_length = sizeof(from);
+                    int received = (int)recvfrom(discovery.handle(), datagram, sizeof(datagram), 0, (struct sockaddr *)&from, &from_length);
+                    if (received <= 0 || std::string_view(datagram, (size_t)received).find(" WANT " + sha1 + " ") == std::string_view::npos)
+                        continue;
+                    std::string reply = std::string(VELO_PEER_PROTOCOL) + " HAVE " + sha1 + " " + port;
+                    sendto(discovery.handle(), reply.data(), (int)reply.size(), 0, (const struct sockaddr *)&from, sizeof(from));
+                } });
+        }
+
+        ~RoguePeer()
+        {
+            stopping = true;
+            thread.join();
+        }
+    };
+}
+
+VELO_TEST(peer, ValidatesRequests)
+{
+    const std::string sha1 = "0123456789ABCDEFabcdef0123456789abcdef01";
+    const std::pair<std::string, bool> fileNames[] = {
+        { "MyApp-1.0.0-full.nupkg", true },
+        { "my app 1.0.nupkg", false },       // spaces would split the discovery datagram
+        { "MyApp-1.0.0-full.zip", false },
+        { ".nupkg", false },
+        { ".hidden.nupkg", false },
+        { "../MyApp.nupkg", false },
+        { "a..b.nupkg", false },
+        { "dir/MyApp.nupkg", false },
+        { "dir\\MyApp.nupkg", false },
+        { "C:MyApp.nupkg", false },
+        { "MyApp%2e.nupkg", false },
+        { "MyApp?x.nupkg", false },
+        { "MyApp#x.nupkg", false },
+        { std::string("MyApp\0.nupkg", 12), false },
+        { "MyApp\n.nupkg", false },
+        { std::string(249, 'a') + ".nupkg", true }, // 255 characters
+        { std::string(250, 'a') + ".nupkg", false },
+    };
+    for (const auto &[fileName, valid] : fileNames)
+    {
+        if (VeloPeer_IsValidRequest(sha1, fileName) != valid)
+            VeloTest::fail(__FILE__, __LINE__, "\"" + fileName + "\" should be " + (valid ? "valid" : "invalid"));
+    }
+    const std::pair<std::string, bool> hashes[] = {
+        { sha1, true },
+        { sha1.substr(1), false },
+        { sha1 + "0", false },
+        { sha1.substr(1) + "g", false },
+        { "", false },
+    };
+    for (const auto &[hash, valid] : hashes)
+    {
+        if (VeloPeer_IsValidRequest(hash, "MyApp.nupkg") != valid)
+            VeloTest::fail(__FILE__, __LINE__, "the SHA1 \"" + hash + "\" should be " + (valid ? "valid" : "invalid"));
+    }
+}
+
+VELO_TEST(peer, ServesRanges)
+{
+    std::string data = VeloTest::randomData(100000, 5);
+    VeloTest::TempDirectory temp;
+    VeloTest::writeFile(temp / "MyApp-2.0.0-full.nupkg", data);
+    PeerServer server(std::make_shared<PackageIndex>(temp.path().string()), loopbackPeers());
+    std::string sha1 = VeloTest::sha1(data);
+    std::string path = "/velopack/" + sha1 + "/MyApp-2.0.0-full.nupkg";
+    std::string size = std::to_string(data.size());
+
+    struct Case
+    {
+        std::string range; // the value of the Range header, or empty for none
+        int status;
+        std::string contentRange;
+        size_t first, length;
+    };
+    const Case cases[] = {
+        { "", 200, "", 0, data.size() },
+        { "bytes=0-0", 206, "bytes 0-0/" + size, 0, 1 },
+        { "bytes=10-19", 206, "bytes 10-19/" + size, 10, 10 },
+        { "bytes=99990-", 206, "bytes 99990-99999/" + size, 99990, 10 },
+        { "bytes=99990-200000", 206, "bytes 99990-99999/" + size, 99990, 10 }, // the end is clamped
+        { "bytes=100000-", 416, "", 0, 0 },
+        { "bytes=20-10", 416, "", 0, 0 },
+        { "bytes=-10", 200, "", 0, data.size() },       // suffix ranges are not supported, the whole file is sent
+        { "bytes=0-9,20-29", 206, "bytes 0-9/" + size, 0, 10 }, // only the first of several ranges
+        { "items=0-9", 200, "", 0, data.size() },
+    };
+    uint64_t served = 0;
+    for (const auto &test : cases)
+    {
+        RawResponse response = rawRequest(server.port(), "GET " + path + " HTTP/1.1", test.range.empty() ? "" : "Range: " + test.range + "\r\n");
+        std::string what = "'" + test.range + "': ";
+        CHECK_EQ(what + std::to_string(response.status), what + std::to_string(test.status));
+        bool has_range = response.head.find("\r\nContent-Range: " + test.contentRange + "\r\n") != std::string::npos;
+        CHECK_EQ(what + (has_range ? "has" : "lacks") + " the Content-Range", what + (test.contentRange.empty() ? "lacks" : "has") + " the Content-Range");
+        if (response.body != data.substr(test.first, test.length))
+            VeloTest::fail(__FILE__, __LINE__, what + "got " + std::to_string(response.body.size()) + " bytes which are not the ones requested");
+        served += test.length;
+    }
+    CHECK_EQ(server.bytesServed(), served);
+
+    // requests which do not name a package of the directory, by its SHA1
+    const std::pair<std::string, int> refused[] = {
+        { "GET /velopack/" + VeloString_ToLower(sha1) + "/MyApp-2.0.0-full.nupkg HTTP/1.1", 200 },
+        { "POST " + path + " HTTP/1.1", 405 },
+        { "GET /velopack/" + VeloTest::sha1("other") + "/MyApp-2.0.0-full.nupkg HTTP/1.1", 404 },
+        { "GET /velopack/" + sha1 + "/../MyApp-2.0.0-full.nupkg HTTP/1.1", 404 },
+        { "GET /velopack/" + sha1 + "/MyApp-1.0.0-full.nupkg HTTP/1.1", 404 },
+        { "GET /velopack/" + sha1 + "/ HTTP/1.1", 404 },
+        { "GET /other/" + sha1 + "/MyApp-2.0.0-full.nupkg HTTP/1.1", 404 },
+        { "GET " + path, 405 },
+    };
+    for (const auto &[line, status] : refused)
+        CHECK_EQ(line + ": " + std::to_string(rawRequest(server.port(), line).status), line + ": " + std::to_string(status));
+}
+
+VELO_TEST(peer, DownloadsFromPeerAndFallsBackOnHashMismatch)
+{
+    std::string data = VeloTest::randomData(300000, 6);
+    VelopackAsset asset = peerAsset(data);
+    PeerSharingOptions options = loopbackPeers();
+    std::atomic<int> fromOrigin{ 0 };
+    auto origin = std::make_shared<ScriptedSource>([&](const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                                                   {
+        fromOrigin++;
+        VeloTest::writeFile(localFile, data); });
+    PeerSource source(origin, options);
+    VeloTest::TempDirectory temp;
+
+    // no peers: straight to the origin, once discovery has waited
+    source.downloadReleaseEntry(asset, temp / "none.nupkg");
+    CHECK_EQ(fromOrigin.load(), 1);
+    CHECK(VeloTest::readFile(temp / "none.nupkg") == data);
+
+    // a peer which has the package
+    {
+        VeloTest::TempDirectory shared;
+        VeloTest::writeFile(shared / asset.fileName, data);
+        PeerServer server(std::make_shared<PackageIndex>(shared.path().string()), options);
+        CHECK_EQ(source.discover(asset).size(), (size_t)1);
+        source.downloadReleaseEntry(asset, temp / "peer.nupkg");
+        CHECK_EQ(fromOrigin.load(), 1);
+        CHECK(VeloTest::readFile(temp / "peer.nupkg") == data);
+        CHECK_EQ(server.bytesServed(), (uint64_t)data.size());
+    }
+
+    // a peer which sends other bytes under the same SHA1 is discarded, and the origin is used
+    {
+        std::string wrong = data;
+        wrong[wrong.size() / 2] ^= 1;
+        RoguePeer rogue(options, VeloString_ToUpper(asset.sha1), wrong);
+        CHECK_EQ(source.discover(asset).size(), (size_t)1);
+        source.downloadReleaseEntry(asset, temp / "rogue.nupkg");
+        CHECK_EQ(fromOrigin.load(), 2);
+        CHECK(VeloTest::readFile(temp / "rogue.nupkg") == data);
+        CHECK(!std::filesystem::exists(temp / "rogue.nupkg.state"));
+        CHECK(!rogue.http.requests().empty());
+    }
+}
+
+VELO_TEST(peer, DownloadsFromPeerInAnotherProcess)
+{
+    std::string data = VeloTest::randomData(500000, 10);
+    VelopackAsset asset = peerAsset(data);
+    PeerSharingOptions options = loopbackPeers();
+    VeloTest::TempDirectory temp;
+    std::string shared = temp / "shared";
+    VeloTest::writeFile(std::filesystem::path(shared) / asset.fileName, data);
+
+    AsyncProcess server(child({ "peer-server", shared, std::to_string(options.discoveryPort) }));
+    CHECK(VeloTest::waitFor([&] { return std::filesystem::exists(shared + ".ready"); }));
+    std::string url = "http://127.0.0.1:" + VeloTest::readFile(shared + ".ready");
+
+    std::atomic<int> fromOrigin{ 0 };
+    auto origin = std::make_shared<ScriptedSource>([&](const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &)
+                                                   {
+        fromOrigin++;
+        VeloTest::writeFile(localFile, data); });
+    PeerSource source(origin, options);
+    std::vector<std::string> peers = source.discover(asset);
+    CHECK_EQ(peers.size(), (size_t)1);
+    CHECK_EQ(peers.at(0), url);
+    source.downloadReleaseEntry(asset, temp / "app.nupkg");
+    VeloTest::writeFile(shared + ".stop", "");
+    runToCompletion(server);
+
+    CHECK_EQ(fromOrigin.load(), 0);
+    CHECK(VeloTest::readFile(temp / "app.nupkg") == data);
+    CHECK_EQ(server.result(), std::to_string(data.size()) + "\n");
+}
@@ -0,0 +1,212 @@
+//  Child process supervision tests. The children are this test binary itself, run with `--child` (see childMain in
+//  VelopackTests.cpp), so that they behave the same on every platform. Calls through UpdateManager run in a copy of
+//  the binary installed as an app, with a stub in place of its Vfusion.
+
+namespace
+{
+    std::vector<std::string> child(std::initializer_list<std::string> args)
+    {
+        std::vector<std::string> command{ VeloTest::selfPath(), "--child" };
+        command.insert(command.end(), args);
+        return command;
+    }
+
+    // Installs a copy of this test binary in the layout VelopackLocator recognises, as `version` of an app on the
+    // "stable" channel, and returns the path of the copy.
+    std::string installTestApp(const VeloTest::TempDirectory &temp, const std::string &version)
+    {
+        std::string manifest = "<?xml version=\"1.0\"?><package><metadata><id>VelopackTestApp</id><version>" + version +
+                               "</version><channel>stable</channel><mainExe>VelopackTests.exe</mainExe></metadata></package>";
+#if defined(_WIN32)
+        std::filesystem::path directory = temp.path() / "current", update = temp.path() / "Update.exe";
+        std::filesystem::path exe = directory / "VelopackTests.exe";
+#elif defined(__APPLE__)
+        std::filesystem::path directory = temp.path() / "VelopackTestApp.app" / "Contents" / "MacOS", update = directory / "UpdateMac";
+        std::filesystem::path exe = directory / "VelopackTests";
+#else
+        std::filesystem::path directory = temp.path() / "usr" / "bin", update = directory / "UpdateNix";
+        std::filesystem::path exe = directory / "VelopackTests";
+#endif
+        std::filesystem::create_directories(directory);
+        VeloTest::writeFile(update, "");
+        VeloTest::writeFile(directory / "sq.version", manifest);
+        std::filesystem::copy_file(VeloTest::selfPath(), exe, std::filesystem::copy_options::overwrite_existing);
+        return exe.string();
+    }
+
+    // Installs a copy of this test binary as the Vfusion of an app installed by installTestApp, which runs the child
+    // command `args` however it is started (see main in Harness.hpp).
+    void installFusionStub(const std::string &exe, std::initializer_list<std::string> args)
+    {
+#if defined(_WIN32)
+        std::filesystem::path fusion = std::filesystem::path(exe).parent_path() / "Vfusion.exe";
+#elif defined(__APPLE__)
+        std::filesystem::path fusion = std::filesystem::path(exe).parent_path() / "VfusionMac";
+#else
+        std::filesystem::path fusion = std::filesystem::path(exe).parent_path() / "VfusionNix";
+#endif
+        std::filesystem::copy_file(VeloTest::selfPath(), fusion, std::filesystem::copy_options::overwrite_existing);
+        std::string lines;
+        for (const std::string &arg : args)
+            lines += arg + "\n";
+        VeloTest::writeFile(fusion.string() + ".child", lines);
+    }
+
+    // Drives an AsyncProcess the way a reactor would, waiting on its descriptors with poll().
+    void runToCompletion(AsyncProcess &process)
+    {
+        while (!process.poll())
+        {
+#if defined(_WIN32)
+            std::this_thread::sleep_for(process.nextTimeout());
+#else
+            std::vector<pollfd> fds;
+            for (int fd : { process.stdoutFd(), process.stderrFd(), process.pidFd() })
+            {
+                if (fd >= 0)
+                    fds.push_back({ fd, POLLIN, 0 });
+            }
+            ::poll(fds.data(), (nfds_t)fds.size(), (int)process.nextTimeout().count());
+#endif
+        }
+    }
+}
+
+VELO_TEST(process, ReturnsOutput)
+{
+    auto command = child({ "echo", "hello" });
+    CHECK_EQ(nativeStartProcessBlocking(&command), std::string("hello\n"));
+
+    AsyncProcess process(command);
+    int pid = process.processId();
+    runToCompletion(process);
+    CHECK_EQ(process.result(), std::string("hello\n"));
+    CHECK(VeloTest::isReaped(pid));
+}
+
+VELO_TEST(process, ReportsExitCodeAndStandardError)
+{
+    auto command = child({ "exit", "3", "something went wrong" });
+    try
+    {
+        nativeStartProcessBlocking(&command);
+        VeloTest::fail(__FILE__, __LINE__, "the process did not fail");
+    }
+    catch (const ProcessException &e)
+    {
+        CHECK_EQ(e.exitCode(), 3);
+        CHECK(e.standardError().find("something went wrong") != std::string::npos);
+    }
+}
+
+VELO_TEST(process, TimeoutTerminatesAndReaps)
+{
+    ProcessOptions options;
+    options.timeout = std::chrono::milliseconds(200);
+    auto command = child({ "sleep", "30000" });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(nativeStartProcessBlocking(&command, options), ProcessTimeoutException, "");
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+
+    AsyncProcess process(command, options);
+    int pid = process.processId();
+    start = std::chrono::steady_clock::now();
+    runToCompletion(process);
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+    CHECK_THROWS(process.result(), ProcessTimeoutException, "");
+    CHECK(VeloTest::isReaped(pid));
+}
+
+VELO_TEST(process, TimeoutAppliesAfterOutputIsClosed)
+{
+    // a child which closes its pipes is not finished until it exits
+    ProcessOptions options;
+    options.timeout = std::chrono::milliseconds(200);
+    auto command = child({ "close-output-and-sleep", "30000" });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(nativeStartProcessBlocking(&command, options), ProcessTimeoutException, "");
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+}
+
+VELO_TEST(process, CancellationTerminatesAndReaps)
+{
+    ProcessOptions options;
+    auto command = child({ "sleep", "30000" });
+    std::thread canceller([&options]
+                          {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        options.cancellation.cancel(); });
+    auto start = std::chrono::steady_clock::now();
+    CHECK_THROWS(nativeStartProcessBlocking(&command, options), ProcessCancelledException, "");
+    canceller.join();
+    CHECK(VeloTest::millisecondsSince(start) < 5000);
+
+    // a token which is already cancelled stops the process straight away
+    AsyncProcess process(command, options);
+    int pid = process.processId();
+    runToCompletion(process);
+    CHECK_THROWS(process.result(), ProcessCancelledException, "");
+    CHECK(VeloTest::isReaped(pid));
+
+    // as does a token linked to one which is cancelled later
+    CancellationToken parent;
+    ProcessOptions linked;
+    linked.cancellation = CancellationToken::linked(parent, CancellationToken());
+    AsyncProcess other(command, linked);
+    CHECK(!other.poll());
+    parent.cancel();
+    runToCompletion(other);
+    CHECK_THROWS(other.result(), ProcessCancelledException, "");
+}
+
+VELO_TEST(process, TerminateAndDestructionReap)
+{
+    auto command = child({ "sleep", "30000" });
+    AsyncProcess terminated(command);
+    int pid = terminated.processId();
+    CHECK(!terminated.poll());
+    terminated.terminate();
+    runToCompletion(terminated);
+    CHECK_THROWS(terminated.result(), ProcessCancelledException, "");
+    CHECK(VeloTest::isReaped(pid));
+
+    {
+        AsyncProcess dropped(command);
+        pid = dropped.processId();
+        CHECK_THROWS(dropped.result(), ProcessException, "");
+    }
+    CHECK(VeloTest::isReaped(pid));
+}
+
+VELO_TEST(process, ManagerCallsTerminateAndReap)
+{
+    // the calls run in a copy of this binary installed as an app, whose Vfusion never finishes on its own
+    VeloTest::TempDirectory temp;
+    std::string exe = installTestApp(temp, "1.0.0");
+    installFusionStub(exe, { "sleep", "30000" });
+    std::vector<std::string> command{ exe, "--child", "manager-calls", "https://localhost.invalid/" };
+    auto start = std::chrono::steady_clock::now();
+    CHECK_EQ(nativeStartProcessBlocking(&command), std::string("dropped check: reaped\ncancelAll: cancelled\ntimeout: timed out\n"));
+    CHECK(VeloTest::millisecondsSince(start) < 10000);
+}
+
+VELO_TEST(process, FireAndForgetOutlivesTheLaunch)
+{
+    // the launch only waits for the process to start, which carries on (detached, in a session of its own) afterwards
+    VeloTest::TempDirectory temp;
+    std::string marker = temp / "marker", output = temp / "output.log";
+    auto command = child({ "write-file-later", marker, "300" });
+    auto start = std::chrono::steady_clock::now();
+    nativeStartProcessFireAndForget(&command, output);
+    CHECK(VeloTest::millisecondsSince(start) < 300);
+    CHECK(!std::filesystem::exists(marker));
+
+    CHECK(VeloTest::waitFor([&] { return std::filesystem::exists(marker); }));
+#if !defined(_WIN32)
+    CHECK(VeloTest::readFile(marker) != std::to_string(getsid(0)));
+#endif
+    CHECK(VeloTest::waitFor([&] { return VeloTest::readFile(output).find("wrote " + marker) != std::string::npos; }));
+
+    auto missing = std::vector<std::string>{ (temp.path() / "missing").string() };
+    CHECK_THROWS(nativeStartProcessFireAndForget(&missing), ProcessException, "Unable to start process");
+}
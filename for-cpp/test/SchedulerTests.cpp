@@ -0,0 +1,253 @@
+//  UpdateScheduler tests: when checks run (jitter, back-off, checkNow, canCheck), stopping while a check is running,
+//  and checks of different schedulers not waiting for each other. The manager is given a locator for an app in a
+//  temporary directory, and a source whose feed and downloads each test scripts.
+
+namespace
+{
+    struct StubSource : UpdateSource
+    {
+        std::function<VelopackAssetFeed(const CancellationToken &cancellation)> feed;
+        std::atomic<int> feedCalls{ 0 };
+        std::atomic<int> downloads{ 0 };
+
+        VelopackAssetFeed getReleaseFeed(const std::string &, const VelopackManifest &, const CancellationToken &cancellation) override
+        {
+            feedCalls++;
+            return feed(cancellation);
+        }
+
+        void downloadReleaseEntry(const VelopackAsset &, const std::string &localFile, const ProgressHandler &, const CancellationToken &) override
+        {
+            downloads++;
+            VeloTest::writeFile(localFile, "package");
+        }
+    };
+
+    // A manager for version 1.0.0 of an app whose packages directory is in `temp`, which checks `source`.
+    std::shared_ptr<UpdateManager> stubManager(const VeloTest::TempDirectory &temp, std::shared_ptr<StubSource> source)
+    {
+        VelopackLocator locator;
+        locator.rootAppDir = temp.path().string();
+        locator.packagesDir = temp / "packages";
+        locator.manifest.id = "MyApp";
+        locator.manifest.version = "1.0.0";
+        locator.manifest.channel = "stable";
+        auto manager = std::make_shared<UpdateManager>();
+        manager->setLocator(locator);
+        manager->setUpdateSource(std::move(source));
+        manager->setRolloutId(std::string(32, '0'));
+        return manager;
+    }
+
+    // Checks start at once and repeat hourly, without jitter, unless a test says otherwise.
+    UpdateScheduleOptions promptChecks()
+    {
+        UpdateScheduleOptions options;
+        options.interval = std::chrono::hours(1);
+        options.jitter = 0;
+        options.firstCheckWithin = std::chrono::milliseconds(0);
+        options.autoDownload = false;
+        return options;
+    }
+
+    std::chrono::milliseconds untilNextCheck(const UpdateScheduler &scheduler, std::chrono::steady_clock::time_point from)
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(scheduler.nextCheck() - from);
+    }
+}
+
+VELO_TEST(scheduler, JitterStaysWithinBounds)
+{
+    VeloTest::TempDirectory temp;
+    auto source = std::make_shared<StubSource>();
+    source->feed = [](const CancellationToken &) { return makeFeed({ { "1.0.0", "Full", "f1" } }); };
+    UpdateScheduleOptions options = promptChecks();
+    options.jitter = 0.25;
+
+    // the delay after each check is the interval moved by up to a quarter, and not the same every time
+    std::set<int64_t> delays;
+    for (int i = 0; i < 10; i++)
+    {
+        UpdateScheduler scheduler(stubManager(temp, source), options);
+        scheduler.start();
+        CHECK(VeloTest::waitFor([&] { return source->feedCalls == i + 1 && untilNextCheck(scheduler, std::chrono::steady_clock::now()).count() > 1000; }));
+        auto delay = untilNextCheck(scheduler, std::chrono::steady_clock::now());
+        CHECK(delay >= std::chrono::minutes(45) - std::chrono::seconds(1) && delay <= std::chrono::minutes(75));
+        delays.insert(delay.count() / 1000);
+    }
+    CHECK(delays.size() > 1);
+
+    // the first check is within firstCheckWithin of start()
+    options.firstCheckWithin = std::chrono::hours(2);
+    for (int i = 0; i < 10; i++)
+    {
+        UpdateScheduler scheduler(stubManager(temp, source), options);
+        auto start = std::chrono::steady_clock::now();
+        scheduler.start();
+        auto delay = untilNextCheck(scheduler, start);
+        CHECK(delay >= std::chrono::milliseconds(0) && delay <= std::chrono::hours(2));
+    }
+}
+
+VELO_TEST(scheduler, BacksOffAfterFailures)
+{
+    // each check records when it started and when the scheduler had planned it, which is the delay after the one before
+    VeloTest::TempDirectory temp;
+    auto source = std::make_shared<StubSource>();
+    std::mutex mutex;
+    std::vector<std::pair<std::chrono::steady_clock::time_point, std::chrono::steady_clock::time_point>> checks;
+    std::atomic<bool> failing{ true };
+    UpdateScheduler *running = nullptr;
+    source->feed = [&](const CancellationToken &)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            checks.emplace_back(std::chrono::steady_clock::now(), running->nextCheck());
+        }
+        if (failing)
+            throw std::runtime_error("The feed is down.");
+        return makeFeed({ { "1.0.0", "Full", "f1" } });
+    };
+    UpdateScheduleOptions options = promptChecks();
+    options.retryDelay = std::chrono::milliseconds(10);
+    options.maxBackoff = std::chrono::milliseconds(80);
+    std::atomic<int> errors{ 0 };
+    options.onError = [&errors](std::exception_ptr) { errors++; };
+    UpdateScheduler scheduler(stubManager(temp, source), options);
+    running = &scheduler;
+    scheduler.start();
+
+    // 10, 20, 40, 80 and then capped at 80
+    const int expected[] = { 10, 20, 40, 80, 80, 80 };
+    CHECK(VeloTest::waitFor([&] { return source->feedCalls > (int)std::size(expected); }));
+    failing = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < std::size(expected); i++)
+        {
+            auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(checks[i + 1].second - checks[i].first).count();
+            if (delay < expected[i] || delay > expected[i] + 50)
+                VeloTest::fail(__FILE__, __LINE__, "delay " + std::to_string(i + 1) + " was " + std::to_string(delay) + " ms, expected " + std::to_string(expected[i]));
+        }
+    }
+    CHECK(errors >= (int)std::size(expected));
+
+    // a check which succeeds resets the count, and the next one is an interval away
+    CHECK(VeloTest::waitFor([&] { return scheduler.failureCount() == 0; }));
+    CHECK(untilNextCheck(scheduler, std::chrono::steady_clock::now()) > std::chrono::minutes(59));
+}
+
+VELO_TEST(scheduler, CheckNowAndCanCheck)
+{
+    VeloTest::TempDirectory temp;
+    auto source = std::make_shared<StubSource>();
+    source->feed = [](const CancellationToken &) { return makeFeed({ { "1.0.0", "Full", "f1" } }); };
+    UpdateScheduleOptions options = promptChecks();
+    options.firstCheckWithin = std::chrono::hours(1);
+    options.retryDelay = std::chrono::hours(1);
+    std::atomic<bool> allowed{ false };
+    std::atomic<int> asked{ 0 };
+    options.canCheck = [&]
+    {
+        asked++;
+        return allowed.load();
+    };
+    UpdateScheduler scheduler(stubManager(temp, source), options);
+
+    // has no effect while stopped
+    scheduler.checkNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_EQ(asked.load(), 0);
+
+    // a check which canCheck refuses is postponed by retryDelay, without reading the feed
+    scheduler.start();
+    scheduler.checkNow();
+    CHECK(VeloTest::waitFor([&] { return asked == 1 && untilNextCheck(scheduler, std::chrono::steady_clock::now()) > std::chrono::minutes(59); }));
+    CHECK_EQ(source->feedCalls.load(), 0);
+    CHECK_EQ(scheduler.failureCount(), 0u);
+
+    allowed = true;
+    scheduler.checkNow();
+    CHECK(VeloTest::waitFor([&] { return source->feedCalls == 1; }));
+    CHECK_EQ(asked.load(), 2);
+}
+
+VELO_TEST(scheduler, DownloadsEachUpdateOnce)
+{
+    VeloTest::TempDirectory temp;
+    auto source = std::make_shared<StubSource>();
+    source->feed = [](const CancellationToken &) { return makeFeed({ { "1.0.0", "Full", "MyApp-1.0.0-full.nupkg" }, { "2.0.0", "Full", "MyApp-2.0.0-full.nupkg" } }); };
+    UpdateScheduleOptions options = promptChecks();
+    options.autoDownload = true;
+    std::atomic<int> available{ 0 }, downloaded{ 0 };
+    options.onUpdateAvailable = [&available](std::shared_ptr<UpdateInfo>) { available++; };
+    options.onUpdateDownloaded = [&downloaded](std::shared_ptr<UpdateInfo> update)
+    {
+        if (update->targetFullRelease->version == "2.0.0")
+            downloaded++;
+    };
+    UpdateScheduler scheduler(stubManager(temp, source), options);
+    scheduler.start();
+    CHECK(VeloTest::waitFor([&] { return downloaded == 1 && untilNextCheck(scheduler, std::chrono::steady_clock::now()) > std::chrono::minutes(59); }));
+    CHECK(std::filesystem::exists(temp.path() / "packages" / "MyApp-2.0.0-full.nupkg"));
+
+    // the feed is read by the check, and again by the download to plan it
+    CHECK_EQ(source->feedCalls.load(), 2);
+    scheduler.checkNow();
+    CHECK(VeloTest::waitFor([&] { return source->feedCalls == 3 && untilNextCheck(scheduler, std::chrono::steady_clock::now()) > std::chrono::minutes(59); }));
+    CHECK_EQ(available.load(), 1);
+    CHECK_EQ(downloaded.load(), 1);
+    CHECK_EQ(source->downloads.load(), 1);
+}
+
+VELO_TEST(scheduler, StopCancelsRunningCheck)
+{
+    VeloTest::TempDirectory temp;
+    auto source = std::make_shared<StubSource>();
+    std::atomic<bool> started{ false }, cancelled{ false };
+    source->feed = [&](const CancellationToken &cancellation) -> VelopackAssetFeed
+    {
+        started = true;
+        waitForCancellation(cancellation, cancelled);
+        return {};
+    };
+    UpdateScheduleOptions options = promptChecks();
+    std::atomic<int> errors{ 0 };
+    options.onError = [&errors](std::exception_ptr) { errors++; };
+    UpdateScheduler scheduler(stubManager(temp, source), options);
+    scheduler.start();
+    CHECK(VeloTest::waitFor([&] { return started.load(); }));
+
+    auto start = std::chrono::steady_clock::now();
+    scheduler.stop();
+    CHECK(VeloTest::millisecondsSince(start) < 1000);
+    CHECK(cancelled.load());
+    CHECK(!scheduler.isRunning());
+    CHECK_EQ(errors.load(), 0); // a check which was stopped is not a failure
+    CHECK_EQ(scheduler.failureCount(), 0u);
+}
+
+VELO_TEST(scheduler, ChecksDoNotWaitForOtherSchedulers)
+{
+    // one scheduler's check is held up until the end of the test, the other's still runs
+    VeloTest::TempDirectory temp;
+    auto stuck = std::make_shared<StubSource>();
+    std::atomic<bool> started{ false }, cancelled{ false };
+    stuck->feed = [&](const CancellationToken &cancellation) -> VelopackAssetFeed
+    {
+        started = true;
+        waitForCancellation(cancellation, cancelled);
+        return {};
+    };
+    auto quick = std::make_shared<StubSource>();
+    quick->feed = [](const CancellationToken &) { return makeFeed({ { "1.0.0", "Full", "f1" } }); };
+
+    UpdateScheduler first(stubManager(temp, stuck), promptChecks());
+    first.start();
+    CHECK(VeloTest::waitFor([&] { return started.load(); }));
+    UpdateScheduler second(stubManager(temp, quick), promptChecks());
+    second.start();
+    CHECK(VeloTest::waitFor([&] { return quick->feedCalls == 1; }));
+    first.stop();
+    CHECK(cancelled.load());
+}
@@ -0,0 +1,57 @@
+//  String helper tests: VeloString_Trim around the 16-byte blocks its vector path scans, and which bytes count as
+//  whitespace.
+
+VELO_TEST(string, TrimsAroundBlockBoundaries)
+{
+    // whitespace cycles through all six ASCII space characters, so every one of them lands in every lane
+    const std::string spaces = " \t\n\v\f\r";
+    auto whitespace = [&spaces](size_t length)
+    {
+        std::string s;
+        for (size_t i = 0; i < length; i++)
+            s += spaces[i % spaces.size()];
+        return s;
+    };
+
+    for (size_t length : { 0, 1, 15, 16, 17, 31, 32, 33, 48 })
+    {
+        std::string label = "length " + std::to_string(length);
+        std::string blank = whitespace(length);
+        CHECK_EQ(label + ": [" + std::string(VeloString_Trim(blank)) + "]", label + ": []");
+
+        // one non-space character at each position, and a pair spanning every start and end
+        for (size_t i = 0; i < length; i++)
+        {
+            std::string s = blank;
+            s[i] = 'x';
+            std::string_view trimmed = VeloString_Trim(s);
+            CHECK_EQ(label + " at " + std::to_string(i) + ": " + std::string(trimmed), label + " at " + std::to_string(i) + ": x");
+            CHECK(trimmed.data() == s.data() + i);
+            for (size_t j = i + 1; j < length; j++)
+            {
+                std::string pair = s;
+                pair[j] = 'y';
+                std::string_view inner = VeloString_Trim(pair);
+                if (inner.data() != pair.data() + i || inner.size() != j - i + 1)
+                    VeloTest::fail(__FILE__, __LINE__, label + ": x at " + std::to_string(i) + " and y at " + std::to_string(j) + " trimmed to offset " +
+                                                           std::to_string(inner.data() - pair.data()) + ", size " + std::to_string(inner.size()));
+            }
+        }
+    }
+}
+
+VELO_TEST(string, TrimsOnlyAsciiWhitespace)
+{
+    // each of these bytes is kept, both alone and padded out past a whole block on either side
+    const char kept[] = { '\0', '\x08', '\x0e', '\x1f', '!', '\x7f', '\x85', '\xa0', '\xff' };
+    for (char c : kept)
+    {
+        std::string label = "byte " + std::to_string((unsigned char)c);
+        CHECK_EQ(label + ": " + std::string(VeloString_Trim(std::string(1, c))), label + ": " + std::string(1, c));
+        std::string padded = std::string(20, ' ') + c + std::string(20, '\n');
+        CHECK_EQ(label + ": " + std::string(VeloString_Trim(padded)), label + ": " + std::string(1, c));
+    }
+
+    // interior whitespace, including newlines, is kept
+    CHECK_EQ(std::string(VeloString_Trim("\r\n  {\n  \"a\": 1\n}\r\n")), std::string("{\n  \"a\": 1\n}"));
+}
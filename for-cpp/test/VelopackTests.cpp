@@ -0,0 +1,168 @@
+//  The C++ library tests. See Harness.hpp for how the tests are registered and run.
+
+#include "Velopack.cpp"
+#include "Harness.hpp"
+#include "HttpServer.hpp"
+
+using namespace Velopack;
+
+namespace VeloTest
+{
+    std::string sha1(std::string_view data)
+    {
+        VeloHash hash = VeloHash::sha1();
+        hash.update(data.data(), data.size());
+        return hash.finishHex();
+    }
+
+    // True once the process is gone for good, which a zombie (an exited child which was never waited on) is not.
+    // Take the pid before the process completes, as processId() is 0 once the child has been reaped.
+    bool isReaped(int pid)
+    {
+#if defined(_WIN32)
+        (void)pid;
+        return true;
+#else
+        return ::kill(pid, 0) != 0 && errno == ESRCH;
+#endif
+    }
+
+    // The stubs which tests launch as child processes, with `VelopackTests --child <command> [args...]`.
+    int childMain(const std::vector<std::string> &args)
+    {
+        std::string command = args.empty() ? std::string() : args[0];
+        if (command == "echo" && args.size() == 2)
+        {
+            std::cout << args[1] << std::endl;
+            return 0;
+        }
+        if (command == "exit" && args.size() == 3)
+        {
+            std::cerr << args[2] << std::endl;
+            return std::stoi(args[1]);
+        }
+        if (command == "sleep" && args.size() == 2)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(args[1])));
+            return 0;
+        }
+        if (command == "close-output-and-sleep" && args.size() == 2)
+        {
+            std::fclose(stdout);
+            std::fclose(stderr);
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(args[1])));
+            return 0;
+        }
+        if (command == "write-file-later" && args.size() == 3)
+        {
+            // writes its session id (where there is one) to a file after a delay, then says so on stdout
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(args[2])));
+#if defined(_WIN32)
+            std::string session;
+#else
+            std::string session = std::to_string(getsid(0));
+#endif
+            writeFile(args[1] + ".tmp", session);
+            std::filesystem::rename(args[1] + ".tmp", args[1]);
+            std::cout << "wrote " << args[1] << std::endl;
+            return 0;
+        }
+        if (command == "peer-server" && args.size() == 3)
+        {
+            // shares the packages of a directory until <directory>.stop appears, having written its port to
+            // <directory>.ready, and prints the number of bytes it served
+            PeerSharingOptions options;
+            options.interfaceAddress = "127.0.0.1";
+            options.discoveryPort = (uint16_t)std::stoi(args[2]);
+            PeerServer server(std::make_shared<PackageIndex>(args[1]), options);
+            writeFile(args[1] + ".ready", std::to_string(server.port()));
+            waitFor([&args] { return std::filesystem::exists(args[1] + ".stop"); }, std::chrono::seconds(30));
+            std::cout << server.bytesServed() << std::endl;
+            return 0;
+        }
+        if (command == "check-for-updates" && args.size() >= 3)
+        {
+            // checks <urlOrPath> for updates to the app this copy of the binary is installed as, optionally allowing
+            // downgrades and on an explicit channel, and prints the version found
+            UpdateManager manager;
+            manager.setUrlOrPath(args[1]);
+            manager.setAllowDowngrade(args[2] == "downgrade");
+            if (args.size() > 3)
+                manager.setExplicitChannel(args[3]);
+            manager.setRolloutId(std::string(32, '0'));
+            std::shared_ptr<UpdateInfo> update = manager.checkForUpdates();
+            if (!update)
+                std::cout << "none" << std::endl;
+            else
+                std::cout << update->targetFullRelease->version << (update->isDowngrade ? " (downgrade)" : "") << std::endl;
+            return 0;
+        }
+        if (command == "manager-calls" && args.size() == 2)
+        {
+            // makes calls which start Vfusion for <urlOrPath>, and stops each of them a different way: dropping an
+            // operation, cancelAll from another thread, and the process timeout
+            UpdateManager manager;
+            manager.setUrlOrPath(args[1]);
+            int pid = 0;
+            {
+                UpdateCheckOperation check = manager.beginCheckForUpdates();
+                pid = check.process().processId();
+            }
+            std::cout << "dropped check: " << (isReaped(pid) ? "reaped" : "running") << std::endl;
+
+            auto outcome = [&manager]() -> std::string
+            {
+                try
+                {
+                    manager.checkForUpdates();
+                    return "returned";
+                }
+                catch (const ProcessCancelledException &)
+                {
+                    return "cancelled";
+                }
+                catch (const ProcessTimeoutException &)
+                {
+                    return "timed out";
+                }
+            };
+            // cancelAll only stops the calls already running, so it is repeated until this one has started
+            std::atomic<bool> done{ false };
+            std::thread canceller([&]
+            {
+                while (!done)
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    manager.cancelAll();
+                }
+            });
+            std::cout << "cancelAll: " << outcome() << std::endl;
+            done = true;
+            canceller.join();
+            manager.setProcessTimeout(std::chrono::milliseconds(200));
+            std::cout << "timeout: " << outcome() << std::endl;
+            return 0;
+        }
+        std::cerr << "Unknown child command: " << command << std::endl;
+        return 2;
+    }
+}
+
+#include "ZipTests.cpp"
+#include "DeltaTests.cpp"
+#include "ProcessTests.cpp"
+#include "HttpTests.cpp"
+#include "HashTests.cpp"
+#include "ParallelTests.cpp"
+#include "VersionTests.cpp"
+#include "FeedTests.cpp"
+#include "PackageTests.cpp"
+#include "PeerTests.cpp"
+#include "SchedulerTests.cpp"
+#include "ManifestTests.cpp"
+#include "StringTests.cpp"
+
+int main(int argc, char **argv)
+{
+    return VeloTest::main(argc, argv);
+}
@@ -0,0 +1,154 @@
+//  SemanticVersion tests: what parses, SemVer 2.0 precedence, and a benchmark of sorting many versions.
+
+static_assert(SemanticVersion::parse("1.2.3-beta.1+build") < SemanticVersion::parse("1.2.3"), "versions compare at compile time");
+
+VELO_TEST(version, ParsesValidVersions)
+{
+    struct Case
+    {
+        const char *text;
+        uint64_t major, minor, patch;
+        const char *prerelease;
+        const char *build;
+    };
+    const Case cases[] = {
+        { "0.0.0", 0, 0, 0, "", "" },
+        { "1.2.3", 1, 2, 3, "", "" },
+        { "10.20.30", 10, 20, 30, "", "" },
+        { "1.0.0-alpha", 1, 0, 0, "alpha", "" },
+        { "1.0.0-alpha.1", 1, 0, 0, "alpha.1", "" },
+        { "1.0.0-0.3.7", 1, 0, 0, "0.3.7", "" },
+        { "1.0.0-x.7.z.92", 1, 0, 0, "x.7.z.92", "" },
+        { "1.0.0-x-y-z.--", 1, 0, 0, "x-y-z.--", "" },
+        { "1.0.0-alpha+001", 1, 0, 0, "alpha", "001" }, // build identifiers may have leading zeros
+        { "1.0.0+20130313144700", 1, 0, 0, "", "20130313144700" },
+        { "1.0.0-beta+exp.sha.5114f85", 1, 0, 0, "beta", "exp.sha.5114f85" },
+        { "1.0.0+21AF26D3----117B344092BD", 1, 0, 0, "", "21AF26D3----117B344092BD" },
+        { "9999999999999999999.0.0", 9999999999999999999ull, 0, 0, "", "" },
+    };
+    for (const auto &test : cases)
+    {
+        SemanticVersion version;
+        if (!SemanticVersion::tryParse(test.text, version))
+            VeloTest::fail(__FILE__, __LINE__, std::string("\"") + test.text + "\" did not parse");
+        CHECK_EQ(version.major(), test.major);
+        CHECK_EQ(version.minor(), test.minor);
+        CHECK_EQ(version.patch(), test.patch);
+        CHECK_EQ(std::string(version.prerelease()), std::string(test.prerelease));
+        CHECK_EQ(std::string(version.build()), std::string(test.build));
+        CHECK_EQ(version.toString(), std::string(test.text));
+    }
+}
+
+VELO_TEST(version, RejectsInvalidVersions)
+{
+    const char *cases[] = {
+        "", "1", "1.2", "1.2.3.4", "v1.2.3", " 1.2.3", "1.2.3 ", "01.2.3", "1.02.3", "1.2.03", "-1.2.3", "1.2.-3",
+        "1.2.3-", "1.2.3+", "1.2.3-+b", "1.2.3-beta.", "1.2.3-.beta", "1.2.3-beta..1", "1.2.3-01", "1.2.3-beta.01",
+        "1.2.3-beta_1", "1.2.3+build+more", "1.2.3+build..5", "1.2.x", "a.b.c", "99999999999999999999.0.0",
+    };
+    for (const char *text : cases)
+    {
+        SemanticVersion version(7, 7, 7);
+        if (SemanticVersion::tryParse(text, version))
+            VeloTest::fail(__FILE__, __LINE__, std::string("\"") + text + "\" parsed");
+        CHECK(version == SemanticVersion(7, 7, 7)); // left unchanged
+        CHECK_THROWS(SemanticVersion::parse(text), std::invalid_argument, "");
+    }
+}
+
+VELO_TEST(version, ComparesByPrecedence)
+{
+    // each row is lower than the next
+    const char *ascending[] = {
+        "0.0.0-0",
+        "0.0.0",
+        "0.0.1",
+        "0.1.0",
+        "0.9.0",
+        "0.10.0",
+        "1.0.0-0",
+        "1.0.0-1",
+        "1.0.0-2",
+        "1.0.0-10",
+        "1.0.0-255",
+        "1.0.0-256",  // numeric identifiers of different lengths in bytes
+        "1.0.0-65536",
+        "1.0.0-9999999999999999999",
+        "1.0.0-A",    // numeric identifiers sort before alphanumeric ones
+        "1.0.0-Beta", // which compare in ASCII order
+        "1.0.0-alpha",
+        "1.0.0-alpha.1",
+        "1.0.0-alpha.beta",
+        "1.0.0-alpha-1", // one identifier, which is greater than "alpha"
+        "1.0.0-beta",
+        "1.0.0-beta.2",
+        "1.0.0-beta.11",
+        "1.0.0-beta.11.0",
+        "1.0.0-beta.11.a",
+        "1.0.0-rc.1",
+        "1.0.0-rc.1.averylongidentifier.1", // longer than the 8 byte key, so compared in full
+        "1.0.0-rc.1.averylongidentifier.2",
+        "1.0.0-rc.1.averylongidentifier.a",
+        "1.0.0-rc.1.averylongidentifiers",
+        "1.0.0",
+        "1.0.1",
+        "2.0.0",
+        "18446744073.0.0",
+    };
+    const size_t count = sizeof(ascending) / sizeof(ascending[0]);
+    std::vector<SemanticVersion> versions;
+    for (const char *text : ascending)
+        versions.push_back(SemanticVersion::parse(text));
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t j = 0; j < count; j++)
+        {
+            auto expected = i <=> j;
+            if ((versions[i] <=> versions[j]) != expected)
+                VeloTest::fail(__FILE__, __LINE__, std::string(ascending[i]) + " and " + ascending[j] + " compare the wrong way");
+            CHECK_EQ(versions[i] == versions[j], i == j);
+        }
+    }
+
+    // build metadata does not affect precedence
+    const std::pair<const char *, const char *> equal[] = {
+        { "1.0.0", "1.0.0+build" },
+        { "1.0.0+a", "1.0.0+b" },
+        { "1.0.0-rc.1+a", "1.0.0-rc.1+b.2" },
+        { "1.0.0-rc.1.averylongidentifier+a", "1.0.0-rc.1.averylongidentifier" },
+    };
+    for (auto [a, b] : equal)
+    {
+        CHECK(SemanticVersion::parse(a) == SemanticVersion::parse(b));
+        CHECK((SemanticVersion::parse(a) <=> SemanticVersion::parse(b)) == 0);
+    }
+}
+
+VELO_BENCHMARK(version, ParseAndSort50k)
+{
+    // the shape of a long-lived feed: mostly releases, with a few pre-releases of each
+    std::vector<std::string> texts;
+    std::mt19937 random(42);
+    for (int i = 0; i < 50000; i++)
+    {
+        std::string text = std::to_string(i / 2000) + "." + std::to_string(i / 40 % 50) + "." + std::to_string(i / 4 % 10);
+        if (i % 4 == 1)
+            text += "-beta." + std::to_string(i % 7);
+        else if (i % 4 == 2)
+            text += "-rc.1.build-" + std::to_string(random() % 100000);
+        texts.push_back(text);
+    }
+    std::shuffle(texts.begin(), texts.end(), random);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SemanticVersion> versions;
+    versions.reserve(texts.size());
+    for (const auto &text : texts)
+        versions.push_back(SemanticVersion::parse(text));
+    std::printf("           parse 50k                          %10.1f ms\n", VeloTest::millisecondsSince(start));
+    start = std::chrono::steady_clock::now();
+    std::sort(versions.begin(), versions.end());
+    std::printf("           sort 50k                           %10.1f ms\n", VeloTest::millisecondsSince(start));
+    CHECK(std::is_sorted(versions.begin(), versions.end()));
+}
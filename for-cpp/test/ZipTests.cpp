@@ -0,0 +1,144 @@
+//  BundleZip tests, against the packages in src/fixtures:
+//
+//  bundle-entries.zip       stored, deflated (fixed, dynamic and uncompressed blocks) and empty entries, a directory,
+//                           and an executable, all with Unix permissions.
+//  bundle-zip64.zip         every size and offset in zip64 extra fields, with a zip64 end of central directory.
+//  bundle-bad-crc.zip       good.txt is intact; stored.txt has a bit of its data flipped, and deflated.txt has a wrong
+//                           CRC-32 in the central directory.
+//  bundle-traversal.zip     ok.txt, and entries named ../escaped.txt, lib/../../escaped.txt and /absolute.txt.
+
+namespace
+{
+    struct ExpectedEntry
+    {
+        const char *name;
+        uint16_t method;
+        uint64_t size;
+        const char *sha1;
+    };
+
+    const ExpectedEntry bundleEntries[] = {
+        { "stored.txt", 0, 1368, "fc9c3a673d5e134d6dbba455ef2779c6f288c73a" },
+        { "deflate-fixed.txt", 8, 27, "d9051e7c3cbddb02f28e8988c15b2f5581d23d85" },
+        { "deflate-dynamic.txt", 8, 275199, "aef0f09bb2ee99dbb78c1aa4c20fcda21bb84204" },
+        { "deflate-raw-blocks.bin", 8, 70000, "77de54ca8104c864800c56089a98f7b7c70c9c3c" },
+        { "empty.txt", 8, 0, "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+        { "lib/app/run.sh", 8, 18, "b2b62c101a156f5f12dd7197cf7ae9424164b115" },
+    };
+
+    const ExpectedEntry zip64Entries[] = {
+        { "first.txt", 8, 2061, "250a6bbcc4e9c13d6f2ee9c5090b066d78d583dd" },
+        { "second.bin", 0, 5000, "eb6c1db7688cdb38b9133eb84789a6c1dbfd76f0" },
+        { "nested/third.txt", 8, 339, "4eb63d2671e1715ccb0376e8598bbe7758b92b81" },
+    };
+
+    void checkEntries(const BundleZip &zip, const ExpectedEntry *expected, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const BundleEntry *entry = zip.find(expected[i].name);
+            CHECK(entry != nullptr);
+            CHECK_EQ(entry->method, expected[i].method);
+            CHECK_EQ(entry->size, expected[i].size);
+            CHECK_EQ(VeloTest::sha1(zip.read(*entry)), std::string(expected[i].sha1));
+
+            // the streaming reader must see the same bytes as the one which reads into memory
+            VeloHash streamed = VeloHash::sha1();
+            zip.read(*entry, [&streamed](const char *data, size_t size) { streamed.update(data, size); });
+            CHECK_EQ(streamed.finishHex(), std::string(expected[i].sha1));
+        }
+    }
+}
+
+VELO_TEST(zip, ReadsStoredAndDeflatedEntries)
+{
+    BundleZip zip = BundleZip::open(VeloTest::fixture("bundle-entries.zip"));
+    CHECK_EQ(zip.entries().size(), (size_t)7);
+    checkEntries(zip, bundleEntries, std::size(bundleEntries));
+
+    const BundleEntry *directory = zip.find("lib/app/");
+    CHECK(directory != nullptr && directory->isDirectory());
+    CHECK_EQ(zip.find("lib/app/run.sh")->unixMode & 0777, 0755u);
+    CHECK_EQ(zip.find("stored.txt")->unixMode & 0777, 0644u);
+    CHECK(zip.find("missing.txt") == nullptr);
+    CHECK_EQ(std::string(zip.find([](std::string_view name) { return name.ends_with(".bin"); })->name), std::string("deflate-raw-blocks.bin"));
+}
+
+VELO_TEST(zip, ReadsZip64)
+{
+    BundleZip zip = BundleZip::open(VeloTest::fixture("bundle-zip64.zip"));
+    CHECK_EQ(zip.entries().size(), (size_t)3);
+    checkEntries(zip, zip64Entries, std::size(zip64Entries));
+    CHECK_EQ(zip.calculateSize().second, (uint64_t)(2061 + 5000 + 339));
+}
+
+VELO_TEST(zip, RejectsCrcMismatch)
+{
+    BundleZip zip = BundleZip::open(VeloTest::fixture("bundle-bad-crc.zip"));
+    CHECK_EQ(zip.read(*zip.find("good.txt")).size(), (size_t)656);
+    CHECK_THROWS(zip.read(*zip.find("stored.txt")), std::runtime_error, "'stored.txt' is corrupt");
+    CHECK_THROWS(zip.read(*zip.find("deflated.txt")), std::runtime_error, "'deflated.txt' is corrupt");
+
+    // a corrupt entry must not be left behind half written
+    VeloTest::TempDirectory temp;
+    CHECK_THROWS(zip.extract(*zip.find("deflated.txt"), temp / "deflated.txt"), std::runtime_error, "is corrupt");
+    CHECK(!std::filesystem::exists(temp / "deflated.txt"));
+    CHECK_THROWS(zip.extractAll(temp.path().string()), std::runtime_error, "is corrupt");
+    CHECK(!std::filesystem::exists(temp / "stored.txt"));
+}
+
+VELO_TEST(zip, ExtractAllRejectsPathTraversal)
+{
+    BundleZip zip = BundleZip::open(VeloTest::fixture("bundle-traversal.zip"));
+    for (const char *bad : { "../escaped.txt", "lib/../../escaped.txt", "/absolute.txt" })
+    {
+        VeloTest::TempDirectory temp;
+        std::filesystem::path target = temp.path() / "target";
+        auto only = [bad](const BundleEntry &entry) { return entry.name == "ok.txt" || entry.name == bad ? std::string(entry.name) : std::string(); };
+        CHECK_THROWS(zip.extractAll(target.string(), only), std::runtime_error, "would be extracted outside");
+        CHECK(!std::filesystem::exists(temp / "escaped.txt"));
+        CHECK(!std::filesystem::exists(target / "ok.txt"));
+    }
+
+    // the entries can still be extracted under names chosen by the caller
+    VeloTest::TempDirectory temp;
+    int index = 0;
+    zip.extractAll(temp.path().string(), [&index](const BundleEntry &) { return "safe/" + std::to_string(index++) + ".txt"; });
+    CHECK_EQ(VeloTest::readFile(temp.path() / "safe" / "1.txt"), std::string("payload of ../escaped.txt"));
+}
+
+VELO_TEST(zip, ExtractAllWritesEveryEntry)
+{
+    BundleZip zip = BundleZip::open(VeloTest::fixture("bundle-entries.zip"));
+    for (int threads : { 1, 4 })
+    {
+        VeloTest::TempDirectory temp;
+        std::vector<int16_t> progress;
+        std::mutex progress_mutex;
+        zip.extractAll(temp.path().string(), {}, threads, [&](int16_t p)
+                       {
+            std::lock_guard lock(progress_mutex);
+            progress.push_back(p); });
+
+        for (const auto &expected : bundleEntries)
+        {
+            CHECK_EQ(VeloTest::sha1(VeloTest::readFile(temp.path() / expected.name)), std::string(expected.sha1));
+        }
+        CHECK(std::filesystem::is_directory(temp.path() / "lib" / "app"));
+#if !defined(_WIN32)
+        auto permissions = std::filesystem::status(temp.path() / "lib" / "app" / "run.sh").permissions();
+        CHECK((permissions & std::filesystem::perms::owner_exec) != std::filesystem::perms::none);
+#endif
+        CHECK(!progress.empty());
+        CHECK(std::is_sorted(progress.begin(), progress.end()));
+        CHECK_EQ(progress.back(), (int16_t)100);
+    }
+}
+
+VELO_TEST(zip, RejectsFilesWhichAreNotZips)
+{
+    VeloTest::TempDirectory temp;
+    VeloTest::writeFile(temp.path() / "not-a-zip.nupkg", std::string(1000, 'x'));
+    CHECK_THROWS(BundleZip::open(temp / "not-a-zip.nupkg"), std::runtime_error, "Not a zip file");
+    CHECK_THROWS(BundleZip::open(temp / "missing.nupkg"), std::runtime_error, "");
+}
@@ -600,6 +600,11 @@ namespace Velopack
         }
 
         public static string GetFusionExePath()
+        {
+            return FindFusionExePath();
+        }
+
+        public static string FindFusionExePath()
         {
             string path = Impl_GetFusionExePath();
             if (!FileExists(path))
@@ -610,6 +615,11 @@ namespace Velopack
         }
 
         public static string GetUpdateExePath()
+        {
+            return FindUpdateExePath();
+        }
+
+        public static string FindUpdateExePath()
         {
             string path = Impl_GetUpdateExePath();
             if (!FileExists(path))
@@ -666,7 +676,7 @@ namespace Velopack
         public static string StrTrim(string str)
         {
             Match match;
-            if ((match = Regex.Match(str, "(\\S.*\\S|\\S)")).Success)
+            if ((match = Regex.Match(str, "(\\S[\\s\\S]*\\S|\\S)")).Success)
             {
                 return match.Groups[1].Value;
             }
@@ -841,9 +851,15 @@ namespace Velopack
         /// <summary>The SHA1 checksum of the update package containing this release.</summary>
         public string Sha1 = "";
 
+        /// <summary>The SHA256 checksum of the update package containing this release, if the feed provides one.</summary>
+        public string Sha256 = "";
+
         /// <summary>The size in bytes of the update package containing this release.</summary>
         public long Size = 0;
 
+        /// <summary>The percentage of clients (0 to 100) this release is rolled out to. Releases without one are available to everyone.</summary>
+        public double RolloutPercentage = 100;
+
         /// <summary>The release notes in markdown format, as passed to Velopack when packaging the release.</summary>
         public string NotesMarkdown = "";
 
@@ -880,9 +896,15 @@ namespace Velopack
                     case "sha1":
                         asset.Sha1 = v.AsString();
                         break;
+                    case "sha256":
+                        asset.Sha256 = v.AsString();
+                        break;
                     case "size":
                         asset.Size = (long)v.AsNumber();
                         break;
+                    case "rolloutpercentage":
+                        asset.RolloutPercentage = v.AsNumber();
+                        break;
                     case "markdown":
                         asset.NotesMarkdown = v.AsString();
                         break;
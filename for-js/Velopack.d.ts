@@ -81,10 +81,18 @@ export declare class VelopackAsset {
      * The SHA1 checksum of the update package containing this release.
      */
     sha1: string;
+    /**
+     * The SHA256 checksum of the update package containing this release, if the feed provides one.
+     */
+    sha256: string;
     /**
      * The size in bytes of the update package containing this release.
      */
     size: bigint;
+    /**
+     * The percentage of clients (0 to 100) this release is rolled out to. Releases without one are available to everyone.
+     */
+    rolloutPercentage: number;
     /**
      * The release notes in markdown format, as passed to Velopack when packaging the release.
      */
@@ -655,6 +655,9 @@ class Platform {
             _a.fileExists(__classPrivateFieldGet(_a, _a, "m", _Platform_impl_GetUpdateExePath).call(_a)));
     }
     static getFusionExePath() {
+        return _a.findFusionExePath();
+    }
+    static findFusionExePath() {
         let path = __classPrivateFieldGet(_a, _a, "m", _Platform_impl_GetFusionExePath).call(_a);
         if (!_a.fileExists(path)) {
             throw new Error("Is the app installed? Fusion is not at: " + path);
@@ -662,6 +665,9 @@ class Platform {
         return path;
     }
     static getUpdateExePath() {
+        return _a.findUpdateExePath();
+    }
+    static findUpdateExePath() {
         let path = __classPrivateFieldGet(_a, _a, "m", _Platform_impl_GetUpdateExePath).call(_a);
         if (!_a.fileExists(path)) {
             throw new Error("Is the app installed? Update is not at: " + path);
@@ -670,7 +676,7 @@ class Platform {
     }
     static strTrim(str) {
         let match;
-        if ((match = /(\S.*\S|\S)/.exec(str)) != null) {
+        if ((match = /(\S[\s\S]*\S|\S)/.exec(str)) != null) {
             return match[1];
         }
         return str;
@@ -839,10 +845,18 @@ class VelopackAsset {
          * The SHA1 checksum of the update package containing this release.
          */
         this.sha1 = "";
+        /**
+         * The SHA256 checksum of the update package containing this release, if the feed provides one.
+         */
+        this.sha256 = "";
         /**
          * The size in bytes of the update package containing this release.
          */
         this.size = 0n;
+        /**
+         * The percentage of clients (0 to 100) this release is rolled out to. Releases without one are available to everyone.
+         */
+        this.rolloutPercentage = 100;
         /**
          * The release notes in markdown format, as passed to Velopack when packaging the release.
          */
@@ -884,9 +898,15 @@ class VelopackAsset {
                 case "sha1":
                     asset.sha1 = v.asString();
                     break;
+                case "sha256":
+                    asset.sha256 = v.asString();
+                    break;
                 case "size":
                     asset.size = BigInt(Math.trunc(v.asNumber()));
                     break;
+                case "rolloutpercentage":
+                    asset.rolloutPercentage = v.asNumber();
+                    break;
                 case "markdown":
                     asset.notesMarkdown = v.asString();
                     break;
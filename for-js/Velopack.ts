@@ -716,6 +716,10 @@ class Platform {
   }
 
   public static getFusionExePath(): string {
+    return Platform.findFusionExePath();
+  }
+
+  public static findFusionExePath(): string {
     let path: string = Platform.#impl_GetFusionExePath();
     if (!Platform.fileExists(path)) {
       throw new Error("Is the app installed? Fusion is not at: " + path);
@@ -724,6 +728,10 @@ class Platform {
   }
 
   public static getUpdateExePath(): string {
+    return Platform.findUpdateExePath();
+  }
+
+  public static findUpdateExePath(): string {
     let path: string = Platform.#impl_GetUpdateExePath();
     if (!Platform.fileExists(path)) {
       throw new Error("Is the app installed? Update is not at: " + path);
@@ -768,7 +776,7 @@ class Platform {
 
   public static strTrim(str: string): string {
     let match: RegExpMatchArray | null;
-    if ((match = /(\S.*\S|\S)/.exec(str)) != null) {
+    if ((match = /(\S[\s\S]*\S|\S)/.exec(str)) != null) {
       return match[1];
     }
     return str;
@@ -919,10 +927,18 @@ export class VelopackAsset {
    * The SHA1 checksum of the update package containing this release.
    */
   sha1: string = "";
+  /**
+   * The SHA256 checksum of the update package containing this release, if the feed provides one.
+   */
+  sha256: string = "";
   /**
    * The size in bytes of the update package containing this release.
    */
   size: bigint = 0n;
+  /**
+   * The percentage of clients (0 to 100) this release is rolled out to. Releases without one are available to everyone.
+   */
+  rolloutPercentage: number = 100;
   /**
    * The release notes in markdown format, as passed to Velopack when packaging the release.
    */
@@ -965,9 +981,15 @@ export class VelopackAsset {
         case "sha1":
           asset.sha1 = v.asString();
           break;
+        case "sha256":
+          asset.sha256 = v.asString();
+          break;
         case "size":
           asset.size = BigInt(Math.trunc(v.asNumber()));
           break;
+        case "rolloutpercentage":
+          asset.rolloutPercentage = v.asNumber();
+          break;
         case "markdown":
           asset.notesMarkdown = v.asString();
           break;
@@ -2,12 +2,30 @@
 #include <filesystem>
 #include <algorithm>
 #include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <functional>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <bit>
+#include <exception>
+#include <limits>
 #include "Velopack.hpp"
 // #include "subprocess.h"
 
@@ -16,9 +34,62 @@
 #define WIN32_LEAN_AND_MEAN
 #define PATH_MAX MAX_PATH
 #include <Windows.h> // For GetCurrentProcessId, GetModuleFileName, MultiByteToWideChar, WideCharToMultiByte, LCMapStringEx
+#include <winsock2.h> // For the built-in HttpClient
+#include <ws2tcpip.h> // For getaddrinfo
+#pragma comment(lib, "ws2_32.lib")
 #elif defined(__unix__) || defined(__APPLE__)
-#include <unistd.h>  // For getpid
+#include <unistd.h>  // For getpid, read, readlink
+#include <poll.h>    // For poll
+#include <fcntl.h>   // For open, fcntl
+#include <cerrno>
+#include <sys/socket.h>  // For the built-in HttpClient
+#include <netdb.h>       // For getaddrinfo
+#include <netinet/in.h>
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <arpa/inet.h>   // For inet_pton, inet_ntop
+#include <sys/mman.h>    // For mmap, madvise
+#include <sys/stat.h>    // For fstat
+#include <sys/file.h>    // For flock
+#include <signal.h>      // For pthread_sigmask
+#endif
+
+#if defined(__APPLE__)
 #include <libproc.h> // For proc_pidpath
+#include <pwd.h>     // For getpwuid
+#include <sys/clonefile.h> // For clonefile
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h> // For SYS_pidfd_open, SYS_getdents64
+#include <dirent.h>      // For DT_REG
+#include <sys/ioctl.h>   // For ioctl
+#include <linux/fs.h>    // For FICLONE
+#include <sys/sendfile.h> // For sendfile
+#endif
+
+#if defined(VELOPACK_ZSTD)
+#include <zstd.h> // For applying .zsdiff patches in DeltaApplier
+#endif
+
+#if defined(VELOPACK_BZIP2)
+#include <bzlib.h> // For applying .bsdiff patches in DeltaApplier
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VELOPACK_HAS_SSE2
+#include <emmintrin.h> // For the vectorized whitespace scan in VeloString_Trim
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VELOPACK_HAS_SHA_NI
+#define VELO_SHA_NI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#include <immintrin.h> // For the SHA-NI compression functions of VeloHash
+#include <cpuid.h>     // For __get_cpuid_count
+#elif defined(_M_X64) || defined(_M_IX86)
+#define VELOPACK_HAS_SHA_NI
+#define VELO_SHA_NI_TARGET
+#include <immintrin.h>
+#include <intrin.h> // For __cpuidex
 #endif
 
 // unicode string manipulation support
@@ -98,6 +169,64 @@ static std::string VeloString_ToUpper(std::string_view s)
 
 #endif
 
+// whitespace trimming support, this matches the ASCII whitespace set of \s in
+// the regex it replaces, but runs in a single linear pass and does not allocate.
+static inline bool VeloString_IsSpace(unsigned char c)
+{
+    return c == ' ' || (unsigned char)(c - '\t') <= ('\r' - '\t');
+}
+
+#if defined(VELOPACK_HAS_SSE2)
+// Returns a 16-bit mask with a bit set for every byte in the block which is not whitespace.
+static inline unsigned VeloString_NonSpaceMask16(const char *p)
+{
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    const __m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+    const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8('\r' - '\t')), ctl);
+    return ~(unsigned)_mm_movemask_epi8(_mm_or_si128(space, in_range)) & 0xFFFFu;
+}
+#endif
+
+static std::string_view VeloString_Trim(std::string_view s)
+{
+    const char *data = s.data();
+    size_t begin = 0;
+    size_t end = s.size();
+
+#if defined(VELOPACK_HAS_SSE2)
+    // most strings only have a few bytes of leading/trailing whitespace, so the
+    // vector path only pays off for long runs (eg. padded process output).
+    constexpr size_t block = 16;
+    while (end - begin >= block)
+    {
+        unsigned mask = VeloString_NonSpaceMask16(data + begin);
+        if (mask != 0)
+        {
+            begin += std::countr_zero(mask);
+            break;
+        }
+        begin += block;
+    }
+    while (end - begin >= block)
+    {
+        unsigned mask = VeloString_NonSpaceMask16(data + end - block);
+        if (mask != 0)
+        {
+            end -= std::countl_zero(mask) - 16;
+            break;
+        }
+        end -= block;
+    }
+#endif
+
+    while (begin < end && VeloString_IsSpace((unsigned char)data[begin]))
+        ++begin;
+    while (end > begin && VeloString_IsSpace((unsigned char)data[end - 1]))
+        --end;
+    return s.substr(begin, end - begin);
+}
+
 static std::string nativeCurrentOsName()
 {
 #if defined(__APPLE__)
@@ -140,13 +269,20 @@ static std::string nativeGetCurrentProcessPath()
 #if defined(_WIN32)
     HMODULE hMod = GetModuleHandleA(NULL);
     bytes_read = GetModuleFileNameA(hMod, path_buf, buf_size);
-#else
+#elif defined(__APPLE__)
     // Inspired by: https://stackoverflow.com/a/8149380
     bytes_read = proc_pidpath(getpid(), path_buf, sizeof(path_buf));
     if (bytes_read <= 0)
     {
         throw std::runtime_error("Can't find current process path");
     }
+#else
+    ssize_t length = readlink("/proc/self/exe", path_buf, sizeof(path_buf));
+    if (length <= 0)
+    {
+        throw std::runtime_error("Can't find current process path");
+    }
+    bytes_read = (size_t)length;
 #endif
 
     return std::string(path_buf, bytes_read);
@@ -168,144 +304,7416 @@ static subprocess_s nativeStartProcess(const std::vector<std::string> *command_l
 
     if (result != 0)
     {
-        throw std::runtime_error("Unable to start process.");
+        throw Velopack::ProcessException("Unable to start process.");
     }
 
     return subprocess;
 }
 
-static void nativeStartProcessFireAndForget(const std::vector<std::string> *command_line)
+// Owns a started subprocess_s. The destructor terminates the child if it is still running, reaps
+// it and closes its pipes, so no exit path (including exceptions) can leave a child or a zombie behind.
+class VeloChildProcess
 {
-    nativeStartProcess(command_line, subprocess_option_no_window | subprocess_option_inherit_environment);
-}
+public:
+    explicit VeloChildProcess(subprocess_s process) : _process(process) {}
+    ~VeloChildProcess()
+    {
+        terminate();
+        // subprocess_destroy only closes stderr when stdout is still open, so close any remaining streams here.
+        closeStream(0);
+        closeStream(1);
+        subprocess_destroy(&_process);
+    }
+    VeloChildProcess(const VeloChildProcess &) = delete;
+    VeloChildProcess &operator=(const VeloChildProcess &) = delete;
+
+    subprocess_s *get() { return &_process; }
+
+    bool isRunning() { return subprocess_alive(&_process) > 0; }
+
+    void terminate()
+    {
+        // never signal a child which has already been reaped. On posix its pid has been reset
+        // to 0 at that point, and kill(0, SIGKILL) would take down our whole process group.
+        if (isRunning())
+        {
+            subprocess_terminate(&_process);
+        }
+        subprocess_join(&_process, nullptr);
+    }
+
+    int join()
+    {
+        int return_code = -1;
+        if (subprocess_join(&_process, &return_code) != 0)
+        {
+            throw Velopack::ProcessException("Unable to wait for process to exit.");
+        }
+        return return_code;
+    }
+
+    // Closes one of the child's output streams (0 = stdout, 1 = stderr), eg. once it has reached EOF.
+    void closeStream(int index)
+    {
+        FILE *&stream = index == 0 ? _process.stdout_file : _process.stderr_file;
+        if (stream)
+        {
+            fclose(stream);
+            stream = nullptr;
+        }
+    }
+
+private:
+    subprocess_s _process;
+};
 
-static std::string nativeStartProcessBlocking(const std::vector<std::string> *command_line)
+// Keeps only the most recent `capacity` bytes written to it. Used to hold on to the tail of a
+// child's stderr for diagnostics without letting a chatty process grow our memory without bound.
+class VeloRingBuffer
 {
-    subprocess_s subprocess = nativeStartProcess(command_line, subprocess_option_no_window | subprocess_option_inherit_environment);
-    FILE *p_stdout = subprocess_stdout(&subprocess);
+public:
+    explicit VeloRingBuffer(size_t capacity) : _capacity(capacity) {}
+
+    void write(const char *data, size_t size)
+    {
+        if (_capacity == 0)
+        {
+            return;
+        }
+        if (size >= _capacity)
+        {
+            _buffer.assign(data + size - _capacity, data + size);
+            _head = 0;
+            return;
+        }
+        if (_buffer.size() < _capacity)
+        {
+            size_t fill = (std::min)(size, _capacity - _buffer.size());
+            _buffer.insert(_buffer.end(), data, data + fill);
+            data += fill;
+            size -= fill;
+        }
+        while (size > 0)
+        {
+            // the buffer is full, _head is the oldest byte and is overwritten first
+            size_t chunk = (std::min)(size, _capacity - _head);
+            std::copy(data, data + chunk, _buffer.begin() + _head);
+            _head = (_head + chunk) % _capacity;
+            data += chunk;
+            size -= chunk;
+        }
+    }
 
-    if (!p_stdout)
+    std::string str() const
     {
-        throw std::runtime_error("Failed to open subprocess stdout.");
+        std::string result;
+        result.reserve(_buffer.size());
+        result.append(_buffer.begin() + _head, _buffer.end());
+        result.append(_buffer.begin(), _buffer.begin() + _head);
+        return result;
     }
 
-    std::stringstream buffer;
-    constexpr size_t bufferSize = 4096; // Adjust buffer size as necessary
-    char readBuffer[bufferSize];
+private:
+    std::vector<char> _buffer;
+    size_t _capacity;
+    size_t _head = 0;
+};
+
+// Applies ProcessOptions while we wait on a child. Blocking waits are capped by nextWaitMs() so
+// that cancellation is noticed promptly, and check() terminates the child and throws once the
+// deadline has passed or the token has been cancelled.
+class VeloProcessSupervisor
+{
+public:
+    VeloProcessSupervisor(const std::vector<std::string> *command_line, const Velopack::ProcessOptions &options)
+        : _options(options), _start(std::chrono::steady_clock::now())
+    {
+        _name = command_line->empty() ? std::string() : std::filesystem::path(command_line->front()).filename().string();
+    }
 
-    // Read the output in chunks
-    while (!feof(p_stdout) && !ferror(p_stdout))
+    void check(VeloChildProcess &child, const VeloRingBuffer &standard_error) const
     {
-        size_t bytesRead = fread(readBuffer, 1, bufferSize, p_stdout);
-        if (bytesRead > 0)
+        if (_options.cancellation.isCancelled())
+        {
+            child.terminate();
+            throw Velopack::ProcessCancelledException("Process '" + _name + "' was cancelled.", -1, standard_error.str());
+        }
+        if (_options.timeout.count() > 0 && std::chrono::steady_clock::now() - _start >= _options.timeout)
         {
-            buffer.write(readBuffer, bytesRead);
+            child.terminate();
+            throw Velopack::ProcessTimeoutException("Process '" + _name + "' did not exit within " +
+                                                    std::to_string(_options.timeout.count()) + "ms and was terminated.",
+                                                    -1, standard_error.str());
         }
     }
 
-    int return_code;
-    subprocess_join(&subprocess, &return_code);
+    const std::string &name() const { return _name; }
 
-    if (return_code != 0)
+    int nextWaitMs(int max_wait_ms) const
     {
-        throw std::runtime_error("Process returned non-zero exit code. Check the log for more details.");
+        if (_options.timeout.count() <= 0)
+        {
+            return max_wait_ms;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - _start);
+        auto remaining = (_options.timeout - elapsed).count();
+        return (int)std::clamp<long long>(remaining, 0, max_wait_ms);
     }
 
-    if (ferror(p_stdout))
+private:
+    Velopack::ProcessOptions _options;
+    std::chrono::steady_clock::time_point _start;
+    std::string _name;
+};
+
+// How long a single wait may block before cancellation and the deadline are checked again.
+static constexpr int VELO_PROCESS_POLL_MS = 50;
+
+#if defined(_WIN32)
+// Quotes a single argument so that CommandLineToArgvW / the MSVC runtime parse it back verbatim.
+static std::wstring VeloWin32QuoteArgument(const std::wstring &arg)
+{
+    if (!arg.empty() && arg.find_first_of(L" \t\n\v\"") == std::wstring::npos)
+    {
+        return arg;
+    }
+    std::wstring quoted = L"\"";
+    size_t backslashes = 0;
+    for (wchar_t c : arg)
     {
-        throw std::runtime_error("Error reading subprocess output.");
+        if (c == L'\\')
+        {
+            backslashes++;
+            continue;
+        }
+        // backslashes are only special when they precede a quote
+        quoted.append(c == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+        quoted.push_back(c);
+        backslashes = 0;
     }
+    quoted.append(backslashes * 2, L'\\');
+    quoted.push_back(L'"');
+    return quoted;
+}
 
-    return buffer.str();
+static std::wstring VeloWin32Utf8ToWide(const std::string &s)
+{
+    int size = MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), nullptr, 0);
+    std::wstring wide(size, 0);
+    MultiByteToWideChar(CP_UTF8, 0, s.data(), (int)s.size(), wide.data(), size);
+    return wide;
 }
+#endif
 
-// static std::thread nativeStartProcessAsyncReadLine(const std::vector<std::string> *command_line, Velopack::ProcessReadLineHandler *handler)
-// {
-//     subprocess_s subprocess = nativeStartProcess(command_line, subprocess_option_no_window | subprocess_option_enable_async);
+// Starts a process which is fully detached from this one, and keeps nothing for it: no pipes, no handles,
+// and (on posix) no child to reap. Its stdio goes to output_path, or to the null device if that is empty.
+static void nativeStartProcessFireAndForget(const std::vector<std::string> *command_line, const std::string &output_path = {})
+{
+#if defined(_WIN32)
+    std::wstring application = VeloWin32Utf8ToWide(command_line->at(0));
+    std::wstring arguments;
+    for (const auto &arg : *command_line)
+    {
+        if (!arguments.empty())
+            arguments.push_back(L' ');
+        arguments += VeloWin32QuoteArgument(VeloWin32Utf8ToWide(arg));
+    }
 
-//     std::thread outputThread([subprocess, handler]() mutable
-//     {
-//         const unsigned BUFFER_SIZE = 1024;
-//         char readBuffer[BUFFER_SIZE];
-//         std::string accumulatedData;
+    SECURITY_ATTRIBUTES sa = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+    std::wstring output = output_path.empty() ? L"NUL" : VeloWin32Utf8ToWide(output_path);
+    HANDLE hOutput = CreateFileW(output.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, &sa,
+                                 OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    HANDLE hInput = CreateFileW(L"NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &sa, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hOutput == INVALID_HANDLE_VALUE || hInput == INVALID_HANDLE_VALUE)
+    {
+        if (hOutput != INVALID_HANDLE_VALUE)
+            CloseHandle(hOutput);
+        if (hInput != INVALID_HANDLE_VALUE)
+            CloseHandle(hInput);
+        throw Velopack::ProcessException("Unable to open output for detached process: " + (output_path.empty() ? std::string("NUL") : output_path));
+    }
 
-//         // read all stdout from the process one line at a time
-//         while (true) {
-//             unsigned bytesRead = subprocess_read_stdout(&subprocess, readBuffer, BUFFER_SIZE - 1);
+    // only these two handles may be inherited, even though bInheritHandles must be TRUE to pass them at all
+    HANDLE inherit[2] = { hInput, hOutput };
+    SIZE_T attr_size = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attr_size);
+    std::vector<char> attr_buffer(attr_size);
+    auto attrs = reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attr_buffer.data());
+    bool attrs_ok = InitializeProcThreadAttributeList(attrs, 1, 0, &attr_size) &&
+                    UpdateProcThreadAttribute(attrs, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherit, sizeof(inherit), NULL, NULL);
 
-//             if (bytesRead == 0) {
-//                 // bytesRead is 0, indicating the process has completed
-//                 // Process any remaining data in accumulatedData as the last line if needed
-//                 if (!accumulatedData.empty()) {
-//                     handler->handleProcessOutputLine(accumulatedData);
-//                 }
-//                 return;
-//             }
+    STARTUPINFOEXW si = {};
+    si.StartupInfo.cb = sizeof(si);
+    si.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    si.StartupInfo.hStdInput = hInput;
+    si.StartupInfo.hStdOutput = hOutput;
+    si.StartupInfo.hStdError = hOutput;
+    si.lpAttributeList = attrs;
 
-//             accumulatedData += std::string(readBuffer, bytesRead);
+    PROCESS_INFORMATION pi = {};
+    DWORD flags = CREATE_NO_WINDOW | CREATE_NEW_PROCESS_GROUP | CREATE_UNICODE_ENVIRONMENT | EXTENDED_STARTUPINFO_PRESENT;
+    BOOL created = attrs_ok && CreateProcessW(application.c_str(), arguments.data(), NULL, NULL, TRUE, flags, NULL, NULL, &si.StartupInfo, &pi);
+    DWORD error = GetLastError();
 
-//             // Process accumulated data for lines
-//             size_t pos;
-//             while ((pos = accumulatedData.find('\n')) != std::string::npos) {
-//                 std::string line = accumulatedData.substr(0, pos);
-//                 if (handler->handleProcessOutputLine(line)) {
-//                     return; // complete or err
-//                 }
-//                 accumulatedData.erase(0, pos + 1);
-//             }
-//         }
-//     });
+    if (attrs_ok)
+        DeleteProcThreadAttributeList(attrs);
+    CloseHandle(hInput);
+    CloseHandle(hOutput);
 
-//     return outputThread;
-// }
+    if (!created)
+    {
+        throw Velopack::ProcessException("Unable to start process (error " + std::to_string(error) + ").");
+    }
 
-namespace Velopack
+    // we will never wait on this process, so don't hold on to it
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+#else
+    // everything the children need is prepared before fork(), so that they only make async-signal-safe calls
+    std::vector<char *> argv;
+    for (const auto &arg : *command_line)
+    {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    const char *output = output_path.empty() ? "/dev/null" : output_path.c_str();
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 65536)
+        max_fd = 65536;
+
+    // the grandchild reports a failed exec through this pipe. It is close-on-exec, so EOF means exec succeeded. On
+    // Linux it is created that way, so that a process started by another thread meanwhile can not inherit it (which
+    // would keep the pipe open, and us waiting, for as long as that process runs).
+    int status_pipe[2];
+#if defined(__linux__)
+    if (pipe2(status_pipe, O_CLOEXEC) != 0)
+    {
+        throw Velopack::ProcessException("Unable to start process.");
+    }
+#else
+    if (pipe(status_pipe) != 0)
+    {
+        throw Velopack::ProcessException("Unable to start process.");
+    }
+    fcntl(status_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(status_pipe[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    pid_t intermediate = fork();
+    if (intermediate < 0)
+    {
+        close(status_pipe[0]);
+        close(status_pipe[1]);
+        throw Velopack::ProcessException("Unable to start process.");
+    }
+
+    if (intermediate == 0)
+    {
+        // new session, so the process is not tied to our terminal or process group, then fork again so
+        // that the final process is re-parented to init (which reaps it) and can never reacquire a terminal.
+        close(status_pipe[0]);
+        setsid();
+        pid_t grandchild = fork();
+        if (grandchild != 0)
+        {
+            _exit(grandchild < 0 ? 1 : 0);
+        }
+
+        int in = open("/dev/null", O_RDONLY);
+        int out = open(output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (in < 0 || out < 0 || dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(out, STDERR_FILENO) < 0)
+        {
+            int err = errno;
+            (void)!write(status_pipe[1], &err, sizeof(err));
+            _exit(127);
+        }
+        for (long fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+        {
+            if (fd != status_pipe[1])
+                close((int)fd);
+        }
+        execv(argv[0], argv.data());
+        int err = errno;
+        (void)!write(status_pipe[1], &err, sizeof(err));
+        _exit(127);
+    }
+
+    close(status_pipe[1]);
+    int status = 0;
+    while (waitpid(intermediate, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+
+    int child_errno = 0;
+    ssize_t n;
+    while ((n = read(status_pipe[0], &child_errno, sizeof(child_errno))) < 0 && errno == EINTR)
+    {
+    }
+    close(status_pipe[0]);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        throw Velopack::ProcessException("Unable to start process.");
+    }
+    if (n > 0)
+    {
+        throw Velopack::ProcessException("Unable to start process '" + command_line->at(0) + "': " + std::strerror(child_errno));
+    }
+#endif
+}
+
+// Builds the exception for a child which exited with a non-zero code, including the tail of its stderr.
+static Velopack::ProcessException VeloProcessExitError(const std::string &name, int return_code, std::string standard_error)
 {
-#if UNICODE
-    void startup(wchar_t **args, size_t c_args)
+    std::string message = "Process '" + name + "' returned non-zero exit code (" + std::to_string(return_code) + ").";
+    std::string_view tail = VeloString_Trim(standard_error);
+    constexpr size_t max_message_tail = 1024; // the full (bounded) output is available from standardError()
+    if (tail.empty())
+        message += " Check the log for more details.";
+    else if (tail.size() > max_message_tail)
+        message += "\n..." + std::string(tail.substr(tail.size() - max_message_tail));
+    else
+        message += "\n" + std::string(tail);
+    return Velopack::ProcessException(message, return_code, std::move(standard_error));
+}
+
+// The state behind Velopack::AsyncProcess. poll() is the whole state machine: it drains whatever output is
+// available without blocking, closes each stream at EOF, reaps the child once it has exited, and turns the
+// outcome (exit code, timeout or cancellation) into either the captured stdout or a stored exception.
+struct Velopack::AsyncProcess::Impl
+{
+    Impl(const std::vector<std::string> &command_line, const ProcessOptions &options)
+        : supervisor(&command_line, options),
+          child(nativeStartProcess(&command_line, subprocess_option_no_window | subprocess_option_inherit_environment)),
+          errors(options.maxStandardErrorBytes)
     {
-        for (size_t i = 0; i < c_args; ++i)
+        if (!subprocess_stdout(child.get()) || !subprocess_stderr(child.get()))
         {
-            if (::std::wstring(args[i]) == L"--veloapp-install")
+            throw ProcessException("Failed to open subprocess stdout/stderr.");
+        }
+#if !defined(_WIN32)
+        for (FILE *stream : { child.get()->stdout_file, child.get()->stderr_file })
+        {
+            int fd = fileno(stream);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+#if defined(SYS_pidfd_open)
+        // pidfds are close-on-exec by default. Older kernels return ENOSYS, and we fall back to polling for exit.
+        pid_fd = (int)syscall(SYS_pidfd_open, child.get()->child, 0);
+#endif
+#endif
+    }
+
+    ~Impl()
+    {
+        closePidFd();
+    }
+
+    VeloProcessSupervisor supervisor;
+    VeloChildProcess child;
+    VeloRingBuffer errors;
+    std::string output;
+    std::exception_ptr error;
+    int pid_fd = -1;
+    int exit_code = -1;
+    bool exited = false;
+    bool complete = false;
+
+    FILE *stream(int index) { return index == 0 ? child.get()->stdout_file : child.get()->stderr_file; }
+
+    bool poll()
+    {
+        if (complete)
+        {
+            return true;
+        }
+        try
+        {
+            supervisor.check(child, errors);
+            drain(0);
+            drain(1);
+            if (!exited && !child.isRunning())
             {
-                exit(0);
+                exit_code = child.join();
+                exited = true;
+                closePidFd();
             }
-            if (::std::wstring(args[i]) == L"--veloapp-updated")
+            // the process may exit before a grandchild which inherited its pipes does, so wait for both
+            if (exited && !stream(0) && !stream(1))
             {
-                exit(0);
+                if (exit_code != 0)
+                {
+                    error = std::make_exception_ptr(VeloProcessExitError(supervisor.name(), exit_code, errors.str()));
+                }
+                complete = true;
             }
-            if (::std::wstring(args[i]) == L"--veloapp-obsolete")
+        }
+        catch (...)
+        {
+            fail(std::current_exception());
+        }
+        return complete;
+    }
+
+    void fail(std::exception_ptr e)
+    {
+        child.terminate();
+        child.closeStream(0);
+        child.closeStream(1);
+        closePidFd();
+        error = e;
+        complete = true;
+    }
+
+    // Reads everything currently available from one stream without blocking, and closes it at EOF.
+    void drain(int index)
+    {
+        FILE *file = stream(index);
+        if (!file)
+        {
+            return;
+        }
+        char buffer[4096];
+#if defined(_WIN32)
+        HANDLE pipe = (HANDLE)_get_osfhandle(_fileno(file));
+        while (true)
+        {
+            DWORD available = 0;
+            DWORD bytesRead = 0;
+            if (!PeekNamedPipe(pipe, NULL, 0, NULL, &available, NULL) ||
+                (available > 0 && !ReadFile(pipe, buffer, (DWORD)(std::min)((size_t)available, sizeof(buffer)), &bytesRead, NULL)))
             {
-                exit(0);
+                if (GetLastError() != ERROR_BROKEN_PIPE)
+                {
+                    throw ProcessException("Error reading subprocess output.", -1, errors.str());
+                }
+                child.closeStream(index); // the child has closed its end of the pipe
+                return;
             }
-            if (::std::wstring(args[i]) == L"--veloapp-uninstall")
+            if (bytesRead == 0)
             {
-                exit(0);
+                return;
             }
+            append(index, buffer, bytesRead);
         }
-    }
-#endif // UNICODE
-
-    void startup(char **args, size_t c_args)
-    {
-        for (size_t i = 0; i < c_args; ++i)
+#else
+        int fd = fileno(file);
+        while (true)
         {
-            if (::std::string(args[i]) == "--veloapp-install")
+            ssize_t bytesRead = read(fd, buffer, sizeof(buffer));
+            if (bytesRead > 0)
             {
-                exit(0);
+                append(index, buffer, (size_t)bytesRead);
+                continue;
             }
-            if (::std::string(args[i]) == "--veloapp-updated")
+            if (bytesRead == 0)
             {
-                exit(0);
+                child.closeStream(index); // EOF, the child has closed its end of the pipe
+                return;
             }
-            if (::std::string(args[i]) == "--veloapp-obsolete")
+            if (errno == EINTR)
             {
-                exit(0);
+                continue;
             }
-            if (::std::string(args[i]) == "--veloapp-uninstall")
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
             {
-                exit(0);
+                return;
             }
+            throw ProcessException("Error reading subprocess output.", -1, errors.str());
+        }
+#endif
+    }
+
+    void append(int index, const char *data, size_t size)
+    {
+        if (index == 0)
+            output.append(data, size);
+        else
+            errors.write(data, size);
+    }
+
+    void closePidFd()
+    {
+#if !defined(_WIN32)
+        if (pid_fd >= 0)
+        {
+            close(pid_fd);
+            pid_fd = -1;
+        }
+#endif
+    }
+};
+
+static std::string nativeStartProcessBlocking(const std::vector<std::string> *command_line, const Velopack::ProcessOptions &options = {})
+{
+    // Drain stdout and stderr together from this thread. If we only read stdout, a child which fills
+    // the stderr pipe (~64KB) would block forever on its next write while we block waiting for stdout.
+    // No single wait is longer than nextTimeout(), so a hung child can still be timed out or cancelled.
+    Velopack::AsyncProcess process(*command_line, options);
+    while (!process.poll())
+    {
+        int wait_ms = (int)process.nextTimeout().count();
+#if defined(_WIN32)
+        Sleep((DWORD)(std::min)(wait_ms, 10));
+#else
+        struct pollfd fds[3];
+        nfds_t count = 0;
+        for (int fd : { process.stdoutFd(), process.stderrFd(), process.pidFd() })
+        {
+            if (fd >= 0)
+                fds[count++] = { fd, POLLIN, 0 };
         }
+        if (poll(fds, count, wait_ms) < 0 && errno != EINTR)
+        {
+            throw Velopack::ProcessException("Error waiting for subprocess.");
+        }
+#endif
+    }
+    return process.result();
+}
+
+#if defined(__APPLE__)
+static std::string nativeGetHomeDirectory()
+{
+    const char *home = getenv("HOME");
+    if (!home || !*home)
+    {
+        struct passwd *pw = getpwuid(getuid());
+        home = pw ? pw->pw_dir : nullptr;
+    }
+    if (!home || !*home)
+    {
+        throw std::runtime_error("Could not locate user home directory via $HOME or /etc/passwd");
+    }
+    return home;
+}
+#endif
+
+// Reads a whole file, retrying a few times if it can not be opened (eg. while it is briefly locked by an updater).
+static std::string VeloFile_ReadAllText(const std::filesystem::path &path)
+{
+    for (int delay_ms : { 333, 666, 1000, 0 })
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (file)
+        {
+            std::ostringstream contents;
+            contents << file.rdbuf();
+            if (file.good() || file.eof())
+            {
+                return contents.str();
+            }
+        }
+        if (delay_ms == 0)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    }
+    throw std::runtime_error("Unable to read file: " + path.string());
+}
+
+static void VeloXml_AppendUtf8(std::string &out, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        out.push_back((char)cp);
+    }
+    else if (cp < 0x800)
+    {
+        out.push_back((char)(0xC0 | (cp >> 6)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        out.push_back((char)(0xE0 | (cp >> 12)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+    else
+    {
+        out.push_back((char)(0xF0 | (cp >> 18)));
+        out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Appends character data, decoding the predefined entities and numeric character references.
+static void VeloXml_AppendDecoded(std::string &out, std::string_view text)
+{
+    size_t i = 0;
+    while (i < text.size())
+    {
+        size_t amp = text.find('&', i);
+        if (amp == std::string_view::npos)
+        {
+            out.append(text.substr(i));
+            return;
+        }
+        out.append(text.substr(i, amp - i));
+        size_t semi = text.find(';', amp);
+        if (semi == std::string_view::npos)
+        {
+            throw std::runtime_error("Invalid XML, unterminated character reference.");
+        }
+        std::string_view ref = text.substr(amp + 1, semi - amp - 1);
+        if (ref == "amp")
+            out.push_back('&');
+        else if (ref == "lt")
+            out.push_back('<');
+        else if (ref == "gt")
+            out.push_back('>');
+        else if (ref == "quot")
+            out.push_back('"');
+        else if (ref == "apos")
+            out.push_back('\'');
+        else if (ref.size() > 1 && ref[0] == '#')
+        {
+            bool hex = ref[1] == 'x' || ref[1] == 'X';
+            std::string digits(ref.substr(hex ? 2 : 1));
+            char *end = nullptr;
+            unsigned long cp = std::strtoul(digits.c_str(), &end, hex ? 16 : 10);
+            if (digits.empty() || *end != '\0' || cp > 0x10FFFF)
+            {
+                throw std::runtime_error("Invalid XML, bad character reference '&" + std::string(ref) + ";'.");
+            }
+            VeloXml_AppendUtf8(out, (uint32_t)cp);
+        }
+        else
+        {
+            throw std::runtime_error("Invalid XML, unknown entity '&" + std::string(ref) + ";'.");
+        }
+        i = semi + 1;
+    }
+}
+
+// A minimal XML reader, which is all the package manifest needs. It calls on_text with the local name of the innermost
+// element and its character data, for every element which contains non-whitespace text. Comments, processing
+// instructions, DOCTYPEs and attributes are skipped, and CDATA sections are read verbatim.
+static void VeloXml_ReadText(std::string_view xml, const std::function<void(std::string_view, const std::string &)> &on_text)
+{
+    std::vector<std::string_view> elements;
+    std::string text;
+    auto flush = [&]()
+    {
+        if (!elements.empty() && !VeloString_Trim(text).empty())
+        {
+            on_text(elements.back(), text);
+        }
+        text.clear();
+    };
+    auto skip_past = [&](size_t from, std::string_view terminator)
+    {
+        size_t end = xml.find(terminator, from);
+        if (end == std::string_view::npos)
+        {
+            throw std::runtime_error("Invalid XML, unexpected end of document.");
+        }
+        return end + terminator.size();
+    };
+
+    size_t i = 0;
+    while (i < xml.size())
+    {
+        if (xml[i] != '<')
+        {
+            size_t next = (std::min)(xml.find('<', i), xml.size());
+            VeloXml_AppendDecoded(text, xml.substr(i, next - i));
+            i = next;
+            continue;
+        }
+        std::string_view rest = xml.substr(i);
+        if (rest.starts_with("<!--"))
+        {
+            i = skip_past(i + 4, "-->");
+            continue;
+        }
+        if (rest.starts_with("<![CDATA["))
+        {
+            size_t end = skip_past(i + 9, "]]>");
+            text.append(xml.substr(i + 9, end - 3 - (i + 9)));
+            i = end;
+            continue;
+        }
+        if (rest.starts_with("<?"))
+        {
+            i = skip_past(i + 2, "?>");
+            continue;
+        }
+        if (rest.starts_with("<!"))
+        {
+            i = skip_past(i + 2, ">");
+            continue;
+        }
+
+        // find the end of the tag, '>' may appear inside quoted attribute values
+        size_t end = i + 1;
+        char quote = 0;
+        while (end < xml.size() && (quote || xml[end] != '>'))
+        {
+            if (quote && xml[end] == quote)
+                quote = 0;
+            else if (!quote && (xml[end] == '"' || xml[end] == '\''))
+                quote = xml[end];
+            end++;
+        }
+        if (end >= xml.size())
+        {
+            throw std::runtime_error("Invalid XML, unexpected end of document.");
+        }
+        std::string_view tag = xml.substr(i + 1, end - i - 1);
+        i = end + 1;
+
+        flush();
+        if (tag.starts_with("/"))
+        {
+            if (!elements.empty())
+                elements.pop_back();
+            continue;
+        }
+        size_t name_end = tag.find_first_of(" \t\r\n/");
+        std::string_view name = tag.substr(0, name_end);
+        size_t colon = name.find(':');
+        if (colon != std::string_view::npos)
+        {
+            name = name.substr(colon + 1);
+        }
+        if (!tag.ends_with("/"))
+        {
+            elements.push_back(name);
+        }
+    }
+}
+
+static std::string nativeDefaultChannel()
+{
+#if defined(_WIN32)
+    return "win";
+#elif defined(__APPLE__)
+    return "osx";
+#else
+    return "linux";
+#endif
+}
+
+// Install metadata which can not change while this process is alive. Each value is resolved the first time it is
+// needed, exactly once even if several threads ask for it at the same time. A resolver which throws (eg. because the
+// app is not installed) leaves the value unset, so it is resolved again on the next call. The context lives in a
+// process-wide slot which invalidate() replaces, callers still holding the previous context can keep using it.
+class VeloInstallContext
+{
+public:
+    static std::shared_ptr<VeloInstallContext> current()
+    {
+        std::lock_guard<std::mutex> lock(slotMutex());
+        auto &context = slot();
+        if (!context)
+        {
+            context = std::make_shared<VeloInstallContext>();
+        }
+        return context;
+    }
+
+    static void invalidate()
+    {
+        std::lock_guard<std::mutex> lock(slotMutex());
+        slot().reset();
+    }
+
+    const std::string &fusionExePath()
+    {
+        return get(_fusionExePath, [] { return Velopack::Platform::findFusionExePath(); });
+    }
+
+    const std::string &updateExePath()
+    {
+        return get(_updateExePath, [this]
+        {
+            const Velopack::VelopackLocator *located = tryLocator();
+            return located ? located->updateExePath : Velopack::Platform::findUpdateExePath();
+        });
+    }
+
+    const Velopack::VelopackLocator &locator()
+    {
+        return get(_locator, [] { return Velopack::VelopackLocator::autoLocate(); });
+    }
+
+    // Returns null instead of throwing if the app is not installed in a layout the locator recognises.
+    const Velopack::VelopackLocator *tryLocator()
+    {
+        try
+        {
+            return &locator();
+        }
+        catch (const std::exception &)
+        {
+            return nullptr;
+        }
+    }
+
+    // The values below are read in-process with the locator. Vfusion is only started for an install layout which the
+    // locator does not recognise, and options only apply if this call is the one which has to start it.
+    const std::string &packagesDir(const Velopack::ProcessOptions &options = {})
+    {
+        return get(_packagesDir, [&]
+        {
+            const Velopack::VelopackLocator *located = tryLocator();
+            return located ? located->packagesDir : runFusion("get-packages", options);
+        });
+    }
+
+    const std::string &currentVersion(const Velopack::ProcessOptions &options = {})
+    {
+        return get(_currentVersion, [&]
+        {
+            const Velopack::VelopackLocator *located = tryLocator();
+            return located ? located->manifest.version : runFusion("get-version", options);
+        });
+    }
+
+    const std::string &channel()
+    {
+        return get(_channel, [this]
+        {
+            const Velopack::VelopackLocator *located = tryLocator();
+            return located && !located->manifest.channel.empty() ? located->manifest.channel : nativeDefaultChannel();
+        });
+    }
+
+private:
+    template <typename T>
+    struct LazyValue
+    {
+        std::once_flag once;
+        T value;
+    };
+
+    template <typename T, typename Resolve>
+    static const T &get(LazyValue<T> &lazy, Resolve &&resolve)
+    {
+        std::call_once(lazy.once, [&] { lazy.value = resolve(); });
+        return lazy.value;
+    }
+
+    std::string runFusion(const char *verb, const Velopack::ProcessOptions &options)
+    {
+        std::vector<std::string> command{ fusionExePath(), verb };
+        return std::string(VeloString_Trim(nativeStartProcessBlocking(&command, options)));
+    }
+
+    static std::shared_ptr<VeloInstallContext> &slot()
+    {
+        static std::shared_ptr<VeloInstallContext> context;
+        return context;
+    }
+
+    static std::mutex &slotMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    LazyValue<Velopack::VelopackLocator> _locator;
+    LazyValue<std::string> _fusionExePath;
+    LazyValue<std::string> _updateExePath;
+    LazyValue<std::string> _packagesDir;
+    LazyValue<std::string> _currentVersion;
+    LazyValue<std::string> _channel;
+};
+
+static bool VeloString_EqualsIgnoreCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y)
+    {
+        return std::tolower(x) == std::tolower(y);
+    });
+}
+
+// Percent-encodes everything except the unreserved characters of RFC 3986, for use in a path segment or query value.
+static std::string VeloUrl_Encode(std::string_view s)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string result;
+    result.reserve(s.size());
+    for (unsigned char c : s)
+    {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+        {
+            result.push_back((char)c);
+        }
+        else
+        {
+            result.push_back('%');
+            result.push_back(hex[c >> 4]);
+            result.push_back(hex[c & 15]);
+        }
+    }
+    return result;
+}
+
+// The parts of an absolute URL which are needed to send an HTTP request.
+struct VeloUrl
+{
+    std::string scheme;
+    std::string host;
+    std::string port;
+    std::string target; // path and query, always starting with '/'
+
+    static VeloUrl parse(const std::string &url)
+    {
+        VeloUrl result;
+        size_t scheme_end = url.find("://");
+        if (scheme_end == std::string::npos || scheme_end == 0)
+        {
+            throw std::runtime_error("Invalid URL: " + url);
+        }
+        result.scheme = url.substr(0, scheme_end);
+        std::transform(result.scheme.begin(), result.scheme.end(), result.scheme.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        size_t authority_start = scheme_end + 3;
+        size_t path_start = (std::min)(url.find_first_of("/?#", authority_start), url.size());
+        std::string authority = url.substr(authority_start, path_start - authority_start);
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos)
+        {
+            authority = authority.substr(at + 1); // credentials are not supported, a custom HttpClient can add them
+        }
+        std::string port;
+        if (authority.starts_with("["))
+        {
+            size_t close = authority.find(']');
+            if (close == std::string::npos)
+            {
+                throw std::runtime_error("Invalid URL: " + url);
+            }
+            result.host = authority.substr(1, close - 1);
+            if (close + 1 < authority.size() && authority[close + 1] == ':')
+                port = authority.substr(close + 2);
+        }
+        else
+        {
+            size_t colon = authority.rfind(':');
+            result.host = authority.substr(0, colon);
+            if (colon != std::string::npos)
+                port = authority.substr(colon + 1);
+        }
+        if (result.host.empty())
+        {
+            throw std::runtime_error("Invalid URL: " + url);
+        }
+        result.port = !port.empty() ? port : result.scheme == "https" ? "443" : "80";
+
+        result.target = url.substr(path_start);
+        size_t fragment = result.target.find('#');
+        if (fragment != std::string::npos)
+            result.target.resize(fragment);
+        if (result.target.empty() || result.target[0] != '/')
+            result.target.insert(0, "/");
+        return result;
+    }
+
+    std::string hostHeader() const
+    {
+        std::string value = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+        bool default_port = (scheme == "http" && port == "80") || (scheme == "https" && port == "443");
+        return default_port ? value : value + ":" + port;
+    }
+
+    // Resolves the target of a redirect (an absolute URL, or a reference relative to this URL).
+    std::string resolve(const std::string &location) const
+    {
+        if (location.find("://") != std::string::npos)
+            return location;
+        if (location.starts_with("//"))
+            return scheme + ":" + location;
+        std::string origin = scheme + "://" + hostHeader();
+        if (location.starts_with("/"))
+            return origin + location;
+        std::string path = target.substr(0, target.find('?'));
+        return origin + path.substr(0, path.rfind('/') + 1) + location;
+    }
+};
+
+#if defined(_WIN32)
+typedef SOCKET VeloSocketHandle;
+static const VeloSocketHandle VELO_INVALID_SOCKET = INVALID_SOCKET;
+#else
+typedef int VeloSocketHandle;
+static const VeloSocketHandle VELO_INVALID_SOCKET = -1;
+#endif
+
+// How long the built-in HttpClient waits to connect, or for any single send or receive, before giving up.
+static constexpr int VELO_HTTP_TIMEOUT_MS = 30000;
+
+// A connected TCP socket, closed on destruction. Sends and receives block, but time out after VELO_HTTP_TIMEOUT_MS.
+class VeloSocket
+{
+public:
+    static VeloSocket connect(const std::string &host, const std::string &port)
+    {
+        startup();
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo *addresses = nullptr;
+        int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if (rc != 0 || !addresses)
+        {
+            throw std::runtime_error("Unable to resolve host '" + host + "': " + std::string(gai_strerror(rc)));
+        }
+
+        std::string error = "no addresses";
+        for (struct addrinfo *address = addresses; address; address = address->ai_next)
+        {
+            VeloSocket socket(::socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+            if (socket._handle == VELO_INVALID_SOCKET)
+            {
+                continue;
+            }
+            if (socket.connectWithTimeout(address->ai_addr, (int)address->ai_addrlen, error))
+            {
+                freeaddrinfo(addresses);
+                return socket;
+            }
+        }
+        freeaddrinfo(addresses);
+        throw std::runtime_error("Unable to connect to '" + host + ":" + port + "': " + error);
+    }
+
+    // Listens for TCP connections on a local IPv4 address, or on every interface if it is empty. Port 0 picks a free port.
+    static VeloSocket listen(const std::string &address, uint16_t port)
+    {
+        startup();
+        VeloSocket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        int reuse = 1;
+        setsockopt(socket._handle, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+        struct sockaddr_in local = ipv4(address, port);
+        if (socket._handle == VELO_INVALID_SOCKET || ::bind(socket._handle, (const struct sockaddr *)&local, sizeof(local)) != 0 ||
+            ::listen(socket._handle, SOMAXCONN) != 0)
+        {
+            throw std::runtime_error("Unable to listen on port " + std::to_string(port) + ": " + lastError());
+        }
+        return socket;
+    }
+
+    // An unbound IPv4 UDP socket.
+    static VeloSocket udp()
+    {
+        startup();
+        VeloSocket socket(::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+        if (socket._handle == VELO_INVALID_SOCKET)
+        {
+            throw std::runtime_error("Unable to create a UDP socket: " + lastError());
+        }
+        return socket;
+    }
+
+    // Parses an IPv4 address, where an empty string is INADDR_ANY.
+    static struct sockaddr_in ipv4(const std::string &address, uint16_t port)
+    {
+        struct sockaddr_in result = {};
+        result.sin_family = AF_INET;
+        result.sin_port = htons(port);
+        result.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (!address.empty() && inet_pton(AF_INET, address.c_str(), &result.sin_addr) != 1)
+        {
+            throw std::runtime_error("Not an IPv4 address: " + address);
+        }
+        return result;
+    }
+
+    // Waits for a connection on a listening socket, with the same timeouts as a connected one.
+    VeloSocket accept()
+    {
+        VeloSocket client(::accept(_handle, nullptr, nullptr));
+        if (client._handle != VELO_INVALID_SOCKET)
+        {
+            client.setTimeouts();
+        }
+        return client;
+    }
+
+    // Waits up to timeout_ms for data (or a connection) to arrive.
+    bool waitReadable(int timeout_ms) const
+    {
+#if defined(_WIN32)
+        WSAPOLLFD pfd = { _handle, POLLIN, 0 };
+        return WSAPoll(&pfd, 1, timeout_ms) > 0;
+#else
+        struct pollfd pfd = { _handle, POLLIN, 0 };
+        return poll(&pfd, 1, timeout_ms) > 0;
+#endif
+    }
+
+    // Makes blocked sends and receives on this socket return, from another thread.
+    void shutdown()
+    {
+#if defined(_WIN32)
+        ::shutdown(_handle, SD_BOTH);
+#else
+        ::shutdown(_handle, SHUT_RDWR);
+#endif
+    }
+
+    uint16_t localPort() const
+    {
+        struct sockaddr_in local = {};
+        socklen_t length = sizeof(local);
+        getsockname(_handle, (struct sockaddr *)&local, &length);
+        return ntohs(local.sin_port);
+    }
+
+    bool valid() const { return _handle != VELO_INVALID_SOCKET; }
+    VeloSocketHandle handle() const { return _handle; }
+
+    VeloSocket(VeloSocket &&other) noexcept : _handle(std::exchange(other._handle, VELO_INVALID_SOCKET)) {}
+    VeloSocket(const VeloSocket &) = delete;
+    VeloSocket &operator=(const VeloSocket &) = delete;
+    ~VeloSocket()
+    {
+        if (_handle != VELO_INVALID_SOCKET)
+        {
+#if defined(_WIN32)
+            closesocket(_handle);
+#else
+            close(_handle);
+#endif
+        }
+    }
+
+    void sendAll(std::string_view data)
+    {
+        while (!data.empty())
+        {
+#if defined(_WIN32)
+            int sent = send(_handle, data.data(), (int)(std::min)(data.size(), (size_t)INT_MAX), 0);
+#elif defined(MSG_NOSIGNAL)
+            ssize_t sent = send(_handle, data.data(), data.size(), MSG_NOSIGNAL);
+#else
+            ssize_t sent = send(_handle, data.data(), data.size(), 0); // SO_NOSIGPIPE is set on this socket
+#endif
+            if (sent <= 0)
+            {
+#if !defined(_WIN32)
+                if (sent < 0 && errno == EINTR)
+                    continue;
+#endif
+                throw std::runtime_error("Error sending HTTP request: " + lastError());
+            }
+            data.remove_prefix((size_t)sent);
+        }
+    }
+
+    // Returns the number of bytes read into buffer, or 0 once the server has closed the connection.
+    size_t receive(char *buffer, size_t size)
+    {
+        while (true)
+        {
+#if defined(_WIN32)
+            int received = recv(_handle, buffer, (int)(std::min)(size, (size_t)INT_MAX), 0);
+#else
+            ssize_t received = recv(_handle, buffer, size, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+#endif
+            if (received < 0)
+            {
+                throw std::runtime_error("Error receiving HTTP response: " + lastError());
+            }
+            return (size_t)received;
+        }
+    }
+
+private:
+    explicit VeloSocket(VeloSocketHandle handle) : _handle(handle) {}
+
+    static void startup()
+    {
+#if defined(_WIN32)
+        static std::once_flag wsa_once;
+        std::call_once(wsa_once, []
+        {
+            WSADATA data;
+            WSAStartup(MAKEWORD(2, 2), &data);
+        });
+#endif
+    }
+
+    bool connectWithTimeout(const struct sockaddr *address, int length, std::string &error)
+    {
+        // connect without blocking, so that an unreachable host fails after our timeout instead of the OS default (minutes)
+#if defined(_WIN32)
+        u_long non_blocking = 1;
+        ioctlsocket(_handle, FIONBIO, &non_blocking);
+        bool pending = ::connect(_handle, address, length) != 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+        WSAPOLLFD pfd = { _handle, POLLOUT, 0 };
+        bool connected = !pending || WSAPoll(&pfd, 1, VELO_HTTP_TIMEOUT_MS) > 0;
+#else
+        int flags = fcntl(_handle, F_GETFL);
+        fcntl(_handle, F_SETFL, flags | O_NONBLOCK);
+        bool pending = ::connect(_handle, address, (socklen_t)length) != 0 && errno == EINPROGRESS;
+        struct pollfd pfd = { _handle, POLLOUT, 0 };
+        bool connected = !pending || poll(&pfd, 1, VELO_HTTP_TIMEOUT_MS) > 0;
+#endif
+        int socket_error = 0;
+        socklen_t error_length = sizeof(socket_error);
+        if (connected)
+        {
+            getsockopt(_handle, SOL_SOCKET, SO_ERROR, (char *)&socket_error, &error_length);
+        }
+        if (!connected || socket_error != 0)
+        {
+#if defined(_WIN32)
+            error = connected ? "error " + std::to_string(socket_error) : "timed out";
+#else
+            error = connected ? std::strerror(socket_error) : "timed out";
+#endif
+            return false;
+        }
+
+        // back to blocking, with a timeout on every send and receive
+#if defined(_WIN32)
+        non_blocking = 0;
+        ioctlsocket(_handle, FIONBIO, &non_blocking);
+#else
+        fcntl(_handle, F_SETFL, flags);
+#endif
+        setTimeouts();
+        return true;
+    }
+
+    void setTimeouts()
+    {
+#if defined(_WIN32)
+        DWORD timeout = VELO_HTTP_TIMEOUT_MS;
+#else
+        struct timeval timeout = { VELO_HTTP_TIMEOUT_MS / 1000, (VELO_HTTP_TIMEOUT_MS % 1000) * 1000 };
+#if defined(SO_NOSIGPIPE)
+        int no_sigpipe = 1;
+        setsockopt(_handle, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+#endif
+        setsockopt(_handle, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+        setsockopt(_handle, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+        int no_delay = 1;
+        setsockopt(_handle, IPPROTO_TCP, TCP_NODELAY, (const char *)&no_delay, sizeof(no_delay));
+    }
+
+    static std::string lastError()
+    {
+#if defined(_WIN32)
+        int code = WSAGetLastError();
+        return code == WSAETIMEDOUT ? "timed out" : "error " + std::to_string(code);
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK ? "timed out" : std::strerror(errno);
+#endif
+    }
+
+    VeloSocketHandle _handle;
+};
+
+// The built-in Velopack::HttpClient. It speaks plain HTTP/1.1 (one request per connection), understands
+// Content-Length, chunked and close-delimited bodies, and follows up to 5 redirects.
+class VeloHttpClient : public Velopack::HttpClient
+{
+public:
+    Velopack::HttpResponse get(const Velopack::HttpRequest &request, const Velopack::HttpBodyHandler &onBody) override
+    {
+        std::string url = request.url;
+        for (int redirects = 0;; redirects++)
+        {
+            VeloUrl target = VeloUrl::parse(url);
+            if (target.scheme != "http")
+            {
+                throw std::runtime_error("The built-in HttpClient only supports http:// URLs, provide a custom HttpClient for: " + url);
+            }
+
+            Connection connection(VeloSocket::connect(target.host, target.port));
+            std::string head = "GET " + target.target + " HTTP/1.1\r\nHost: " + target.hostHeader() +
+                               "\r\nUser-Agent: Velopack\r\nAccept-Encoding: identity\r\nConnection: close\r\n";
+            for (const auto &[name, value] : request.headers)
+            {
+                head += name + ": " + value + "\r\n";
+            }
+            head += "\r\n";
+            connection.socket.sendAll(head);
+
+            Velopack::HttpResponse response = connection.readHead();
+            std::string location = response.header("location");
+            bool redirect = response.statusCode == 301 || response.statusCode == 302 || response.statusCode == 303 ||
+                            response.statusCode == 307 || response.statusCode == 308;
+            if (redirect && !location.empty() && redirects < 5)
+            {
+                url = target.resolve(location); // the body of a redirect is not needed, and the connection is not reused
+                continue;
+            }
+
+            connection.readBody(response, [&](const char *data, size_t size)
+            {
+                if (onBody)
+                    onBody(response, data, size);
+                else
+                    response.body.append(data, size);
+            });
+            return response;
+        }
+    }
+
+private:
+    struct Connection
+    {
+        explicit Connection(VeloSocket socket) : socket(std::move(socket)) {}
+
+        VeloSocket socket;
+        std::string buffer;
+        size_t position = 0;
+
+        bool fill()
+        {
+            if (position > 0)
+            {
+                buffer.erase(0, position);
+                position = 0;
+            }
+            char chunk[16384];
+            size_t received = socket.receive(chunk, sizeof(chunk));
+            buffer.append(chunk, received);
+            return received > 0;
+        }
+
+        std::string readLine()
+        {
+            while (true)
+            {
+                size_t end = buffer.find("\r\n", position);
+                if (end != std::string::npos)
+                {
+                    std::string line = buffer.substr(position, end - position);
+                    position = end + 2;
+                    return line;
+                }
+                if (buffer.size() - position > 65536)
+                {
+                    throw std::runtime_error("Invalid HTTP response, line too long.");
+                }
+                if (!fill())
+                {
+                    throw std::runtime_error("Invalid HTTP response, connection closed unexpectedly.");
+                }
+            }
+        }
+
+        Velopack::HttpResponse readHead()
+        {
+            Velopack::HttpResponse response;
+            std::string status = readLine();
+            if (!status.starts_with("HTTP/") || status.find(' ') == std::string::npos)
+            {
+                throw std::runtime_error("Invalid HTTP response: " + status);
+            }
+            response.statusCode = std::atoi(status.c_str() + status.find(' ') + 1);
+            while (true)
+            {
+                std::string line = readLine();
+                if (line.empty())
+                {
+                    break;
+                }
+                size_t colon = line.find(':');
+                if (colon == std::string::npos)
+                {
+                    continue;
+                }
+                std::string name = line.substr(0, colon);
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+                response.headers.emplace_back(name, std::string(VeloString_Trim(std::string_view(line).substr(colon + 1))));
+            }
+            if (response.statusCode / 100 == 1)
+            {
+                return readHead(); // skip interim responses (eg. 100 Continue)
+            }
+            return response;
+        }
+
+        // Passes up to `limit` bytes of the body to sink, returning the number of bytes passed.
+        uint64_t copy(uint64_t limit, const std::function<void(const char *, size_t)> &sink)
+        {
+            uint64_t copied = 0;
+            while (copied < limit)
+            {
+                if (position == buffer.size() && !fill())
+                {
+                    break;
+                }
+                size_t available = (size_t)(std::min)((uint64_t)(buffer.size() - position), limit - copied);
+                sink(buffer.data() + position, available);
+                position += available;
+                copied += available;
+            }
+            return copied;
+        }
+
+        void readBody(const Velopack::HttpResponse &response, const std::function<void(const char *, size_t)> &sink)
+        {
+            if (response.statusCode == 204 || response.statusCode == 304)
+            {
+                return;
+            }
+            std::string encoding = response.header("transfer-encoding");
+            std::transform(encoding.begin(), encoding.end(), encoding.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            if (encoding.find("chunked") != std::string::npos)
+            {
+                while (true)
+                {
+                    std::string line = readLine();
+                    char *end = nullptr;
+                    uint64_t size = std::strtoull(line.c_str(), &end, 16);
+                    if (end == line.c_str())
+                    {
+                        throw std::runtime_error("Invalid HTTP response, bad chunk size.");
+                    }
+                    if (size == 0)
+                    {
+                        while (!readLine().empty()) {} // trailers
+                        return;
+                    }
+                    if (copy(size, sink) != size)
+                    {
+                        throw std::runtime_error("Invalid HTTP response, connection closed unexpectedly.");
+                    }
+                    readLine();
+                }
+            }
+            std::string length = response.header("content-length");
+            if (!length.empty())
+            {
+                uint64_t expected = std::strtoull(length.c_str(), nullptr, 10);
+                if (copy(expected, sink) != expected)
+                {
+                    throw std::runtime_error("Invalid HTTP response, connection closed unexpectedly.");
+                }
+                return;
+            }
+            copy(UINT64_MAX, sink); // the body ends when the server closes the connection
+        }
+    };
+};
+
+static void VeloHttp_EnsureSuccess(const Velopack::HttpResponse &response, const std::string &url)
+{
+    if (response.statusCode < 200 || response.statusCode >= 300)
+    {
+        throw std::runtime_error("Request to '" + url + "' failed with HTTP status " + std::to_string(response.statusCode) + ".");
+    }
+}
+
+// The SHA-1 and SHA-256 compression functions, each processing `count` 64 byte blocks. The portable versions are used
+// unless the CPU has the SHA extensions (SHA-NI), which are several times faster.
+static void VeloSha1_CompressPortable(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+    for (; count > 0; count--, blocks += 64)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)blocks[i * 4] << 24 | (uint32_t)blocks[i * 4 + 1] << 16 | (uint32_t)blocks[i * 4 + 2] << 8 | blocks[i * 4 + 3];
+        for (int i = 16; i < 80; i++)
+            w[i] = std::rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        auto round = [&](uint32_t f, uint32_t k, uint32_t w)
+        {
+            uint32_t t = std::rotl(a, 5) + f + e + k + w;
+            e = d;
+            d = c;
+            c = std::rotl(b, 30);
+            b = a;
+            a = t;
+        };
+        for (int i = 0; i < 20; i++)
+            round(d ^ (b & (c ^ d)), 0x5A827999, w[i]);
+        for (int i = 20; i < 40; i++)
+            round(b ^ c ^ d, 0x6ED9EBA1, w[i]);
+        for (int i = 40; i < 60; i++)
+            round((b & c) | (d & (b | c)), 0x8F1BBCDC, w[i]);
+        for (int i = 60; i < 80; i++)
+            round(b ^ c ^ d, 0xCA62C1D6, w[i]);
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+}
+
+alignas(16) static const uint32_t VELO_SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void VeloSha256_CompressPortable(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+    for (; count > 0; count--, blocks += 64)
+    {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++)
+            w[i] = (uint32_t)blocks[i * 4] << 24 | (uint32_t)blocks[i * 4 + 1] << 16 | (uint32_t)blocks[i * 4 + 2] << 8 | blocks[i * 4 + 3];
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = std::rotr(w[i - 15], 7) ^ std::rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = std::rotr(w[i - 2], 17) ^ std::rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t t1 = hh + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) + VELO_SHA256_K[i] + w[i];
+            uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+}
+
+#if defined(VELOPACK_HAS_SHA_NI)
+static bool VeloCpu_HasShaNi()
+{
+    static const bool supported = []
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool ssse3 = info[2] & (1 << 9), sse41 = info[2] & (1 << 19);
+        __cpuidex(info, 7, 0);
+        return ssse3 && sse41 && (info[1] & (1 << 29)) != 0;
+#else
+        unsigned a, b, c, d;
+        if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & (1 << 9)) || !(c & (1 << 19)))
+            return false;
+        return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29)) != 0;
+#endif
+    }();
+    return supported;
+}
+
+// Four of the 80 SHA-1 rounds. The message schedule for later rounds is computed alongside (msg1 / xor / msg2).
+template <int I>
+VELO_SHA_NI_TARGET static inline void VeloSha1Ni_Rounds(__m128i &abcd, __m128i (&e)[2], __m128i (&msg)[4], const uint8_t *block)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i &current = e[I % 2];
+    if constexpr (I < 4)
+        msg[I] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * I)), mask);
+    if constexpr (I == 0)
+        current = _mm_add_epi32(current, msg[0]);
+    else
+        current = _mm_sha1nexte_epu32(current, msg[I % 4]);
+    e[(I + 1) % 2] = abcd;
+    if constexpr (I >= 3 && I <= 18)
+        msg[(I + 1) % 4] = _mm_sha1msg2_epu32(msg[(I + 1) % 4], msg[I % 4]);
+    abcd = _mm_sha1rnds4_epu32(abcd, current, I / 5);
+    if constexpr (I >= 1 && I <= 16)
+        msg[(I + 3) % 4] = _mm_sha1msg1_epu32(msg[(I + 3) % 4], msg[I % 4]);
+    if constexpr (I >= 2 && I <= 17)
+        msg[(I + 2) % 4] = _mm_xor_si128(msg[(I + 2) % 4], msg[I % 4]);
+}
+
+template <int... I>
+VELO_SHA_NI_TARGET static inline void VeloSha1Ni_Block(__m128i &abcd, __m128i (&e)[2], const uint8_t *block, std::integer_sequence<int, I...>)
+{
+    __m128i msg[4];
+    (VeloSha1Ni_Rounds<I>(abcd, e, msg, block), ...);
+}
+
+VELO_SHA_NI_TARGET static void VeloSha1_CompressShaNi(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)h[4], 0, 0, 0);
+    for (; count > 0; count--, blocks += 64)
+    {
+        __m128i abcd_save = abcd, e0_save = e0;
+        __m128i e[2] = { e0, _mm_setzero_si128() };
+        VeloSha1Ni_Block(abcd, e, blocks, std::make_integer_sequence<int, 20>());
+        e0 = _mm_sha1nexte_epu32(e[0], e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+    _mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+// Four of the 64 SHA-256 rounds, with the message schedule for later rounds computed alongside (msg1 / alignr / msg2).
+template <int I>
+VELO_SHA_NI_TARGET static inline void VeloSha256Ni_Rounds(__m128i &state0, __m128i &state1, __m128i (&msg)[4], const uint8_t *block)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    if constexpr (I < 4)
+        msg[I] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * I)), mask);
+    __m128i words = _mm_add_epi32(msg[I % 4], _mm_load_si128((const __m128i *)(VELO_SHA256_K + 4 * I)));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+    if constexpr (I >= 3 && I <= 14)
+    {
+        __m128i next = _mm_add_epi32(msg[(I + 1) % 4], _mm_alignr_epi8(msg[I % 4], msg[(I + 3) % 4], 4));
+        msg[(I + 1) % 4] = _mm_sha256msg2_epu32(next, msg[I % 4]);
+    }
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(words, 0x0E));
+    if constexpr (I >= 1 && I <= 12)
+        msg[(I + 3) % 4] = _mm_sha256msg1_epu32(msg[(I + 3) % 4], msg[I % 4]);
+}
+
+template <int... I>
+VELO_SHA_NI_TARGET static inline void VeloSha256Ni_Block(__m128i &state0, __m128i &state1, const uint8_t *block, std::integer_sequence<int, I...>)
+{
+    __m128i msg[4];
+    (VeloSha256Ni_Rounds<I>(state0, state1, msg, block), ...);
+}
+
+VELO_SHA_NI_TARGET static void VeloSha256_CompressShaNi(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+    // the instructions work on the state arranged as ABEF / CDGH
+    __m128i cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(h + 4)), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(cdab, efgh, 8);
+    __m128i state1 = _mm_blend_epi16(efgh, cdab, 0xF0);
+    for (; count > 0; count--, blocks += 64)
+    {
+        __m128i save0 = state0, save1 = state1;
+        VeloSha256Ni_Block(state0, state1, blocks, std::make_integer_sequence<int, 16>());
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+    __m128i feba = _mm_shuffle_epi32(state0, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)h, _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i *)(h + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+#endif
+
+// Incremental SHA-1 or SHA-256, used to verify packages against VelopackAsset::sha1 / sha256 as they are written.
+static int VeloHash_HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+class VeloHash
+{
+public:
+    // Compresses `count` 64 byte blocks into the chaining values `h`.
+    typedef void (*Compress)(uint32_t *h, const uint8_t *blocks, size_t count);
+
+    // By default the fastest compression function the CPU supports is used, a specific one can be given to test it.
+    static VeloHash sha1(Compress compress = nullptr)
+    {
+        static const uint32_t init[] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+#if defined(VELOPACK_HAS_SHA_NI)
+        return VeloHash(init, 5, compress ? compress : VeloCpu_HasShaNi() ? VeloSha1_CompressShaNi : VeloSha1_CompressPortable);
+#else
+        return VeloHash(init, 5, compress ? compress : VeloSha1_CompressPortable);
+#endif
+    }
+
+    static VeloHash sha256(Compress compress = nullptr)
+    {
+        static const uint32_t init[] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+#if defined(VELOPACK_HAS_SHA_NI)
+        return VeloHash(init, 8, compress ? compress : VeloCpu_HasShaNi() ? VeloSha256_CompressShaNi : VeloSha256_CompressPortable);
+#else
+        return VeloHash(init, 8, compress ? compress : VeloSha256_CompressPortable);
+#endif
+    }
+
+    // The hash which verifies an asset: SHA-256 if the feed provides it, otherwise SHA-1. The expected digest is
+    // returned in `expected`, and is empty if the asset has no checksum at all.
+    static VeloHash forAsset(const Velopack::VelopackAsset &asset, std::string &expected)
+    {
+        expected = !asset.sha256.empty() ? asset.sha256 : asset.sha1;
+        return !asset.sha256.empty() ? sha256() : sha1();
+    }
+
+    void update(const void *data, size_t size)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        _length += size;
+        if (_buffered > 0)
+        {
+            size_t take = (std::min)(size, sizeof(_buffer) - _buffered);
+            std::memcpy(_buffer + _buffered, p, take);
+            _buffered += take;
+            p += take;
+            size -= take;
+            if (_buffered < sizeof(_buffer))
+                return;
+            _compress(_h, _buffer, 1);
+            _buffered = 0;
+        }
+        if (size >= 64)
+        {
+            _compress(_h, p, size / 64);
+            p += size / 64 * 64;
+            size %= 64;
+        }
+        std::memcpy(_buffer, p, size);
+        _buffered = size;
+    }
+
+    // Returns the lowercase hex digest. The hash can not be updated afterwards.
+    std::string finishHex()
+    {
+        uint64_t bits = _length * 8;
+        static const uint8_t pad[64] = { 0x80 };
+        update(pad, _buffered < 56 ? 56 - _buffered : 120 - _buffered);
+        uint8_t length[8];
+        for (int i = 0; i < 8; i++)
+            length[i] = (uint8_t)(bits >> (56 - 8 * i));
+        update(length, 8);
+
+        static const char hex[] = "0123456789abcdef";
+        std::string result;
+        for (size_t i = 0; i < _words; i++)
+        {
+            for (int shift = 28; shift >= 0; shift -= 4)
+                result.push_back(hex[(_h[i] >> shift) & 15]);
+        }
+        return result;
+    }
+
+    // Saves the intermediate state: the length, the chaining values and, in hex, the bytes of a partial block.
+    std::string saveState() const
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string result = std::to_string(_length);
+        for (size_t i = 0; i < _words; i++)
+            result += " " + std::to_string(_h[i]);
+        if (_buffered > 0)
+        {
+            result += " ";
+            for (size_t i = 0; i < _buffered; i++)
+            {
+                result.push_back(hex[_buffer[i] >> 4]);
+                result.push_back(hex[_buffer[i] & 15]);
+            }
+        }
+        return result;
+    }
+
+    bool loadState(const std::string &state)
+    {
+        std::istringstream in(state);
+        uint64_t length = 0;
+        uint32_t h[8];
+        std::string tail;
+        if (!(in >> length))
+            return false;
+        for (size_t i = 0; i < _words; i++)
+        {
+            if (!(in >> h[i]))
+                return false;
+        }
+        size_t buffered = (size_t)(length % 64);
+        if ((buffered > 0 && !(in >> tail)) || tail.size() != buffered * 2)
+            return false;
+        uint8_t buffer[64];
+        for (size_t i = 0; i < buffered; i++)
+        {
+            int high = VeloHash_HexDigit(tail[2 * i]), low = VeloHash_HexDigit(tail[2 * i + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            buffer[i] = (uint8_t)(high << 4 | low);
+        }
+        _length = length;
+        _buffered = buffered;
+        std::copy(h, h + _words, _h);
+        std::copy(buffer, buffer + buffered, _buffer);
+        return true;
+    }
+
+private:
+    VeloHash(const uint32_t *init, size_t words, Compress compress) : _compress(compress), _words(words)
+    {
+        std::copy(init, init + words, _h);
+    }
+
+    Compress _compress;
+    size_t _words;
+    uint32_t _h[8] = {};
+    uint8_t _buffer[64];
+    size_t _buffered = 0;
+    uint64_t _length = 0;
+};
+
+// Hashes an existing file (see Velopack::verifyAsset). The file is memory mapped in large views, with the kernel told
+// that it will be read sequentially, so the hash runs at the speed of the disk or of the hash, whichever is slower.
+static std::string VeloFile_Hash(const std::filesystem::path &path, VeloHash hash)
+{
+    static constexpr uint64_t VIEW_SIZE = 256 * 1024 * 1024;
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Unable to open file: " + path.string());
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    uint64_t size = (uint64_t)file_size.QuadPart;
+    HANDLE mapping = size > 0 ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    for (uint64_t offset = 0; offset < size; offset += VIEW_SIZE)
+    {
+        size_t length = (size_t)(std::min)(VIEW_SIZE, size - offset);
+        void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, length) : nullptr;
+        if (!view)
+        {
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            throw std::runtime_error("Unable to map file: " + path.string());
+        }
+        hash.update(view, length);
+        UnmapViewOfFile(view);
+    }
+    if (mapping)
+        CloseHandle(mapping);
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || ::fstat(fd, &info) != 0)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        throw std::runtime_error("Unable to open file: " + path.string());
+    }
+    uint64_t size = (uint64_t)info.st_size;
+    for (uint64_t offset = 0; offset < size; offset += VIEW_SIZE)
+    {
+        size_t length = (size_t)(std::min)(VIEW_SIZE, size - offset);
+        void *view = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+        if (view == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to map file: " + path.string());
+        }
+        ::madvise(view, length, MADV_SEQUENTIAL);
+        ::madvise(view, length, MADV_WILLNEED);
+        hash.update(view, length);
+        ::munmap(view, length);
+    }
+    ::close(fd);
+#endif
+    return hash.finishHex();
+}
+
+// A file which several threads write to at once at explicit offsets (pwrite / overlapped WriteFile). Closed on destruction.
+class VeloRandomAccessFile
+{
+public:
+    VeloRandomAccessFile(const std::filesystem::path &path, bool truncate) : _path(path.string())
+    {
+#if defined(_WIN32)
+        _handle = CreateFileW(VeloWin32Utf8ToWide(_path).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                              truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE)
+#else
+        _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+        if (_fd < 0)
+#endif
+        {
+            throw std::runtime_error("Unable to create file: " + _path);
+        }
+    }
+
+    VeloRandomAccessFile(const VeloRandomAccessFile &) = delete;
+    VeloRandomAccessFile &operator=(const VeloRandomAccessFile &) = delete;
+
+    ~VeloRandomAccessFile()
+    {
+#if defined(_WIN32)
+        CloseHandle(_handle);
+#else
+        ::close(_fd);
+#endif
+    }
+
+    // Sets the length of the file. Growing it reserves the disk space up front where the file system supports it,
+    // so that parallel writers don't fragment the file or fail half way through on a full disk.
+    void resize(uint64_t size)
+    {
+#if defined(_WIN32)
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(_handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(_handle))
+#else
+#if defined(__linux__)
+        int rc = ::ftruncate(_fd, (off_t)size);
+        if (rc == 0 && size > 0)
+        {
+            int ec = ::posix_fallocate(_fd, 0, (off_t)size);
+            rc = ec == 0 || ec == EOPNOTSUPP || ec == EINVAL ? 0 : (errno = ec, -1);
+        }
+        if (rc != 0)
+#else
+        if (::ftruncate(_fd, (off_t)size) != 0)
+#endif
+#endif
+        {
+            throw std::runtime_error("Unable to allocate " + std::to_string(size) + " bytes for file: " + _path);
+        }
+    }
+
+    void writeAt(uint64_t offset, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+#if defined(_WIN32)
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)offset;
+            overlapped.OffsetHigh = (DWORD)(offset >> 32);
+            DWORD written = 0;
+            if (!WriteFile(_handle, data, (DWORD)(std::min)(size, (size_t)1 << 30), &written, &overlapped))
+                written = 0;
+#else
+            ssize_t written = ::pwrite(_fd, data, size, (off_t)offset);
+            if (written < 0 && errno == EINTR)
+                continue;
+#endif
+            if (written <= 0)
+            {
+                throw std::runtime_error("Unable to write file: " + _path);
+            }
+            data += written;
+            size -= (size_t)written;
+            offset += (uint64_t)written;
+        }
+    }
+
+    // Copies a range of another file into this one at `to` inside the kernel, without passing the data through user
+    // space. Returns false if that is not supported here, and nothing has been written.
+    bool copyFrom(int fd, uint64_t from, uint64_t to, uint64_t size)
+    {
+#if defined(__linux__) && defined(SYS_copy_file_range)
+        loff_t in = (loff_t)from, out = (loff_t)to;
+        while (size > 0)
+        {
+            long copied = ::syscall(SYS_copy_file_range, fd, &in, _fd, &out, (size_t)(std::min)(size, (uint64_t)1 << 30), 0u);
+            if (copied < 0 && errno == EINTR)
+                continue;
+            if (copied < 0 && out == (loff_t)to && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+                return false;
+            if (copied <= 0)
+            {
+                throw std::runtime_error("Unable to write file: " + _path);
+            }
+            size -= (uint64_t)copied;
+        }
+        return true;
+#else
+        (void)fd, (void)from, (void)to, (void)size;
+        return false;
+#endif
+    }
+
+    // Sets the Unix permission bits of the file. Does nothing on Windows.
+    void setMode(uint32_t mode)
+    {
+#if !defined(_WIN32)
+        ::fchmod(_fd, (mode_t)mode);
+#else
+        (void)mode;
+#endif
+    }
+
+    void readAt(uint64_t offset, char *data, size_t size)
+    {
+        while (size > 0)
+        {
+#if defined(_WIN32)
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = (DWORD)offset;
+            overlapped.OffsetHigh = (DWORD)(offset >> 32);
+            DWORD read = 0;
+            if (!ReadFile(_handle, data, (DWORD)(std::min)(size, (size_t)1 << 30), &read, &overlapped))
+                read = 0;
+#else
+            ssize_t read = ::pread(_fd, data, size, (off_t)offset);
+            if (read < 0 && errno == EINTR)
+                continue;
+#endif
+            if (read <= 0)
+            {
+                throw std::runtime_error("Unable to read file: " + _path);
+            }
+            data += read;
+            size -= (size_t)read;
+            offset += (uint64_t)read;
+        }
+    }
+
+private:
+    std::string _path;
+#if defined(_WIN32)
+    HANDLE _handle;
+#else
+    int _fd;
+#endif
+};
+
+// An exclusive lock on a file, which is created if it does not exist. The constructor waits until no other process,
+// or other lock in this process, holds it, or until `cancellation` is cancelled: the lock is tried again with a growing
+// delay, as a blocking wait could not be interrupted. The lock is released when the object is destroyed, or the process
+// exits.
+class VeloFileLock
+{
+public:
+    explicit VeloFileLock(const std::filesystem::path &path, const Velopack::CancellationToken &cancellation = {})
+    {
+#if defined(_WIN32)
+        _handle = CreateFileW(VeloWin32Utf8ToWide(path.string()).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Unable to lock file: " + path.string());
+        }
+#else
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (_fd < 0)
+        {
+            throw std::runtime_error("Unable to lock file: " + path.string());
+        }
+#endif
+        for (std::chrono::milliseconds delay(1);; delay = (std::min)(delay * 2, std::chrono::milliseconds(100)))
+        {
+#if defined(_WIN32)
+            OVERLAPPED overlapped = {};
+            if (LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD, &overlapped))
+                return;
+            bool held = GetLastError() == ERROR_LOCK_VIOLATION;
+#else
+            if (::flock(_fd, LOCK_EX | LOCK_NB) == 0)
+                return;
+            bool held = errno == EWOULDBLOCK || errno == EINTR;
+#endif
+            if (!held || cancellation.isCancelled())
+            {
+                release();
+                if (held)
+                    throw Velopack::ProcessCancelledException("The download was cancelled while waiting for " + path.string() + ".");
+                throw std::runtime_error("Unable to lock file: " + path.string());
+            }
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+    VeloFileLock(const VeloFileLock &) = delete;
+    VeloFileLock &operator=(const VeloFileLock &) = delete;
+
+    ~VeloFileLock()
+    {
+        release();
+    }
+
+private:
+    void release()
+    {
+#if defined(_WIN32)
+        CloseHandle(_handle);
+#else
+        ::close(_fd);
+#endif
+    }
+
+#if defined(_WIN32)
+    HANDLE _handle;
+#else
+    int _fd;
+#endif
+};
+
+enum class VeloLinkKind
+{
+    hardLink,
+    clone,
+    copy,
+};
+
+// Places a file at `to` with the contents of `from`, sharing the storage where the file system allows: a hard link,
+// or a copy-on-write clone (FICLONE on Linux, clonefile on macOS), or else a plain copy. `to` is replaced.
+static VeloLinkKind VeloFile_Link(const std::filesystem::path &from, const std::filesystem::path &to)
+{
+    std::error_code ec;
+    std::filesystem::remove(to, ec);
+    std::filesystem::create_hard_link(from, to, ec);
+    if (!ec)
+    {
+        return VeloLinkKind::hardLink;
+    }
+#if defined(__linux__) && defined(FICLONE)
+    int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0)
+    {
+        int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool cloned = out >= 0 && ::ioctl(out, FICLONE, in) == 0;
+        if (out >= 0)
+            ::close(out);
+        ::close(in);
+        if (cloned)
+            return VeloLinkKind::clone;
+    }
+#elif defined(__APPLE__)
+    std::filesystem::remove(to, ec);
+    if (::clonefile(from.c_str(), to.c_str(), 0) == 0)
+    {
+        return VeloLinkKind::clone;
+    }
+#endif
+    std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    return VeloLinkKind::copy;
+}
+
+// Downloads larger than this are split into segments of this size, which are fetched over parallel connections.
+static constexpr uint64_t VELO_DOWNLOAD_SEGMENT_SIZE = 8 * 1024 * 1024;
+// How many times a request is attempted before the download fails. Retries of a segment resume where it stopped.
+static constexpr int VELO_DOWNLOAD_ATTEMPTS = 4;
+
+// Downloads an asset from one URL into a file and verifies its checksum. If the size is known and the server honours
+// Range requests, the file is preallocated and its segments are fetched in parallel, each written in place as it
+// arrives. Otherwise the file is fetched with a single request.
+//
+// The checksum is computed as the bytes arrive: bytes received at the end of the hashed prefix are hashed straight from
+// the receive buffer, and bytes which arrived ahead of it (in a later segment) are read back from the page cache once
+// the prefix reaches them. There is no separate pass over the finished file.
+//
+// Ranged downloads can be resumed: which bytes of each segment have arrived, the validator of the remote file (ETag or
+// Last-Modified) and the hash state of the prefix are kept in '{file}.state'. The next attempt continues where the
+// last one stopped, sending If-Range so that a file which changed in the meantime is downloaded again.
+//
+// The cancellation token is checked as each chunk arrives. A cancelled download is not retried, and keeps its state
+// so that it can be resumed.
+class VeloDownload
+{
+public:
+    VeloDownload(Velopack::HttpClient &client, std::string url, const std::filesystem::path &path,
+                 const Velopack::VelopackAsset &asset, const Velopack::ProgressHandler &progress, Velopack::BandwidthLimiter *limiter = nullptr,
+                 const Velopack::CancellationToken &cancellation = {})
+        : _client(client), _limiter(limiter), _cancellation(cancellation), _url(std::move(url)), _path(path), _statePath(path.string() + ".state"),
+          _size((uint64_t)(std::max)(asset.size, (int64_t)0)), _total(_size), _progress(progress),
+          _emptyHash(VeloHash::forAsset(asset, _expected)), _hashName(!asset.sha256.empty() ? "SHA256" : "SHA1"), _hash(_emptyHash)
+    {
+    }
+
+    void run(int connections)
+    {
+        uint64_t segments = (_size + VELO_DOWNLOAD_SEGMENT_SIZE - 1) / VELO_DOWNLOAD_SEGMENT_SIZE;
+        bool resumed = segments >= 2 && loadState(segments);
+        std::string actual;
+        {
+            VeloRandomAccessFile file(_path, !resumed);
+            _file = &file;
+            bool ranged = segments >= 2 && fetchSegments((std::max)(connections, 1), resumed);
+            if (!ranged && resumed)
+            {
+                // the remote file changed since the last attempt, start over
+                resetState(segments);
+                ranged = fetchSegments((std::max)(connections, 1), false);
+            }
+            if (!ranged)
+            {
+                std::error_code ec;
+                std::filesystem::remove(_statePath, ec);
+                fetchWhole();
+            }
+            actual = _hash.finishHex();
+            _file = nullptr;
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(_statePath, ec);
+        if (!_expected.empty() && !VeloString_EqualsIgnoreCase(actual, _expected))
+        {
+            std::filesystem::remove(_path, ec);
+            throw std::runtime_error("The file downloaded from '" + _url + "' is corrupt, expected " + _hashName + " " + _expected + " but got " + actual + ".");
+        }
+    }
+
+private:
+    // Thrown when the first pending segment is answered without honouring its Range header.
+    struct RangeUnsupported {};
+
+    static bool isRetryable(int statusCode)
+    {
+        return statusCode == 0 || statusCode == 408 || statusCode == 429 || statusCode >= 500;
+    }
+
+    static void backOff(int attempt)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250 << (attempt - 1)));
+    }
+
+    void throwIfCancelled() const
+    {
+        if (_cancellation.isCancelled())
+            throw Velopack::ProcessCancelledException("The download was cancelled.");
+    }
+
+    uint64_t segmentBegin(size_t index) const { return (uint64_t)index * VELO_DOWNLOAD_SEGMENT_SIZE; }
+    uint64_t segmentEnd(size_t index) const { return (std::min)(segmentBegin(index) + VELO_DOWNLOAD_SEGMENT_SIZE, _size); }
+
+    void resetState(uint64_t segments)
+    {
+        _received = std::vector<std::atomic<uint64_t>>((size_t)segments);
+        _hash = _emptyHash;
+        _hashed = 0;
+        _validator.clear();
+        _downloaded = 0;
+    }
+
+    // Restores the progress of an earlier attempt, if it was downloading the same file.
+    bool loadState(uint64_t segments)
+    {
+        resetState(segments);
+        std::error_code ec;
+        if (std::filesystem::file_size(_path, ec) != _size || ec)
+        {
+            return false;
+        }
+        std::ifstream in(_statePath);
+        std::string magic, url, expected, size, validator, modified, hash;
+        if (!std::getline(in, magic) || magic != "velopack-download-2" || !std::getline(in, url) || url != _url ||
+            !std::getline(in, expected) || expected != _hashName + " " + _expected || !std::getline(in, size) || size != std::to_string(_size) ||
+            !std::getline(in, validator) || validator.empty() || !std::getline(in, modified) || !std::getline(in, hash))
+        {
+            return false;
+        }
+        std::istringstream hash_in(hash);
+        std::string hash_state;
+        if (!(hash_in >> _hashed) || !std::getline(hash_in, hash_state) || !_hash.loadState(hash_state) || _hashed > _size ||
+            modified != modifiedTime())
+        {
+            // the file was written after the state was saved (eg. the process was killed), or the hash state is not
+            // usable, so the hashed prefix is hashed again from disk. The received ranges are still kept.
+            _hash = _emptyHash;
+            _hashed = 0;
+        }
+        for (size_t i = 0; i < _received.size(); i++)
+        {
+            uint64_t received = 0;
+            if (!(in >> received) || received > segmentEnd(i) - segmentBegin(i))
+            {
+                resetState(segments);
+                return false;
+            }
+            _received[i] = received;
+            _downloaded += received;
+        }
+        _validator = validator;
+        return true;
+    }
+
+    std::string modifiedTime() const
+    {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(_path, ec);
+        return ec ? std::string() : std::to_string(time.time_since_epoch().count());
+    }
+
+    // Called with _stateMutex held. Only once no more writes are in flight (quiesced) is the modified time of the
+    // file recorded, which lets the next attempt trust the saved hash state.
+    void saveState(bool quiesced)
+    {
+        if (_validator.empty())
+        {
+            return; // without a validator, a later attempt could not tell whether the remote file changed
+        }
+        std::string tmp = _statePath + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            out << "velopack-download-2\n" << _url << "\n" << _hashName << " " << _expected << "\n" << _size << "\n" << _validator << "\n"
+                << (quiesced ? modifiedTime() : "0") << "\n" << _hashed << " " << _hash.saveState() << "\n";
+            for (const auto &received : _received)
+                out << received << " ";
+            out << "\n";
+            if (!out)
+                return;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, _statePath, ec);
+    }
+
+    // Records that `size` bytes were written to a segment at `offset`, and extends the hash over them if they follow the
+    // hashed prefix. Called with _stateMutex held.
+    void written(size_t index, uint64_t offset, const char *data, size_t size)
+    {
+        _received[index] += size;
+        if (offset == _hashed)
+        {
+            _hash.update(data, size);
+            _hashed += size;
+        }
+        hashWrittenPrefix();
+    }
+
+    // Extends the hash over bytes which were written ahead of the hashed prefix, now that the prefix reached them.
+    // Called with _stateMutex held.
+    void hashWrittenPrefix()
+    {
+        char buffer[65536];
+        while (_hashed < _size)
+        {
+            size_t index = (size_t)(_hashed / VELO_DOWNLOAD_SEGMENT_SIZE);
+            uint64_t available = segmentBegin(index) + _received[index] - _hashed;
+            if (available == 0)
+                break;
+            size_t size = (size_t)(std::min)(available, (uint64_t)sizeof(buffer));
+            _file->readAt(_hashed, buffer, size);
+            _hash.update(buffer, size);
+            _hashed += size;
+        }
+    }
+
+    // Returns false, having written nothing useful, if the server does not support Range requests (or, when resuming,
+    // if the remote file changed).
+    bool fetchSegments(int connections, bool resumed)
+    {
+        if (!resumed)
+        {
+            _file->resize(_size);
+        }
+        std::vector<size_t> pending;
+        for (size_t i = 0; i < _received.size(); i++)
+        {
+            if (_received[i] < segmentEnd(i) - segmentBegin(i))
+                pending.push_back(i);
+        }
+        if (pending.empty())
+        {
+            std::lock_guard<std::mutex> lock(_stateMutex);
+            hashWrittenPrefix();
+            return true;
+        }
+
+        // the first pending segment also tells whether the server honours Range, the other connections start once it does
+        std::promise<bool> probe;
+        std::future<bool> ranged = probe.get_future();
+        std::atomic<size_t> next{ 1 };
+        std::mutex error_mutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed{ false };
+
+        auto worker = [&](std::promise<bool> *probe)
+        {
+            try
+            {
+                if (probe)
+                    fetchSegment(pending[0], probe, failed);
+                std::promise<bool> *none = nullptr;
+                for (size_t i = next++; i < pending.size() && !failed; i = next++)
+                    fetchSegment(pending[i], none, failed);
+            }
+            catch (const RangeUnsupported &)
+            {
+                failed = true;
+            }
+            catch (...)
+            {
+                if (probe)
+                    probe->set_value(false); // only reached before the probe response arrived
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+                failed = true;
+            }
+        };
+
+        std::vector<std::thread> workers;
+        workers.emplace_back(worker, &probe);
+        if (!ranged.get())
+        {
+            workers[0].join();
+            if (error)
+            {
+                saveAndRethrow(error);
+            }
+            _file->resize(0);
+            return false; // the single request made by fetchWhole reports any HTTP error
+        }
+        for (int i = 1; i < connections && (size_t)i < pending.size(); i++)
+        {
+            workers.emplace_back(worker, nullptr);
+        }
+        for (auto &thread : workers)
+        {
+            thread.join();
+        }
+        if (error)
+        {
+            saveAndRethrow(error);
+        }
+        return true;
+    }
+
+    // Keeps the progress made so far for the next attempt, then rethrows.
+    [[noreturn]] void saveAndRethrow(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_stateMutex);
+            saveState(true);
+        }
+        std::rethrow_exception(error);
+    }
+
+    void fetchSegment(size_t index, std::promise<bool> *&probe, const std::atomic<bool> &failed)
+    {
+        uint64_t end = segmentEnd(index);
+        for (int attempt = 1;; attempt++)
+        {
+            int status = 0;
+            uint64_t offset = segmentBegin(index) + _received[index];
+            try
+            {
+                Velopack::HttpRequest request{ _url, { { "Range", "bytes=" + std::to_string(offset) + "-" + std::to_string(end - 1) } } };
+                {
+                    std::lock_guard<std::mutex> lock(_stateMutex);
+                    if (!_validator.empty())
+                        request.headers.emplace_back("If-Range", _validator);
+                }
+                std::string expected = "bytes " + std::to_string(offset) + "-";
+                bool checked = false;
+                Velopack::HttpResponse response = _client.get(request, [&](const Velopack::HttpResponse &head, const char *data, size_t size)
+                {
+                    if (probe)
+                    {
+                        bool ranged = head.statusCode == 206;
+                        if (ranged)
+                            rememberValidator(head);
+                        probe->set_value(ranged);
+                        probe = nullptr;
+                        if (!ranged)
+                            throw RangeUnsupported{};
+                    }
+                    if (head.statusCode < 200 || head.statusCode >= 300)
+                    {
+                        return; // an error page, the status is reported below
+                    }
+                    if (head.statusCode != 206)
+                    {
+                        throw std::runtime_error("Request to '" + _url + "' failed, the server stopped honouring Range requests.");
+                    }
+                    if (!checked && !head.header("content-range").starts_with(expected))
+                    {
+                        throw std::runtime_error("Request to '" + _url + "' returned the wrong range: " + head.header("content-range"));
+                    }
+                    checked = true;
+                    throwIfCancelled();
+                    size = (size_t)(std::min)((uint64_t)size, end - offset);
+                    if (_limiter)
+                        _limiter->acquire(size, _cancellation);
+                    _file->writeAt(offset, data, size);
+                    {
+                        std::lock_guard<std::mutex> lock(_stateMutex);
+                        written(index, offset, data, size);
+                    }
+                    offset += size;
+                    report(size);
+                });
+                status = response.statusCode;
+                if (probe)
+                {
+                    probe->set_value(false);
+                    probe = nullptr;
+                    throw RangeUnsupported{};
+                }
+                VeloHttp_EnsureSuccess(response, _url);
+                if (offset < end)
+                {
+                    throw std::runtime_error("Request to '" + _url + "' ended before the requested range was received.");
+                }
+                std::lock_guard<std::mutex> lock(_stateMutex);
+                saveState(false);
+                return;
+            }
+            catch (const std::exception &)
+            {
+                if (attempt >= VELO_DOWNLOAD_ATTEMPTS || !isRetryable(status) || failed || _cancellation.isCancelled())
+                    throw;
+            }
+            backOff(attempt);
+        }
+    }
+
+    // Keeps the validator of the remote file, for If-Range. Weak ETags can not be used with If-Range.
+    void rememberValidator(const Velopack::HttpResponse &head)
+    {
+        std::string etag = head.header("etag");
+        std::lock_guard<std::mutex> lock(_stateMutex);
+        if (_validator.empty())
+            _validator = !etag.empty() && !etag.starts_with("W/") ? etag : head.header("last-modified");
+    }
+
+    void fetchWhole()
+    {
+        for (int attempt = 1;; attempt++)
+        {
+            int status = 0;
+            uint64_t offset = 0;
+            _hash = _emptyHash;
+            try
+            {
+                Velopack::HttpResponse response = _client.get({ _url, {} }, [&](const Velopack::HttpResponse &head, const char *data, size_t size)
+                {
+                    if (head.statusCode < 200 || head.statusCode >= 300)
+                    {
+                        return; // an error page, the status is reported below
+                    }
+                    if (offset == 0)
+                    {
+                        std::string length = head.header("content-length");
+                        if (!length.empty())
+                            _total = std::strtoull(length.c_str(), nullptr, 10);
+                    }
+                    throwIfCancelled();
+                    if (_limiter)
+                        _limiter->acquire(size, _cancellation);
+                    _file->writeAt(offset, data, size);
+                    _hash.update(data, size);
+                    offset += size;
+                    report(size);
+                });
+                status = response.statusCode;
+                VeloHttp_EnsureSuccess(response, _url);
+                _file->resize(offset);
+                return;
+            }
+            catch (const std::exception &)
+            {
+                if (attempt >= VELO_DOWNLOAD_ATTEMPTS || !isRetryable(status) || _cancellation.isCancelled())
+                    throw;
+            }
+            _downloaded = 0;
+            backOff(attempt);
+        }
+    }
+
+    void report(size_t size)
+    {
+        uint64_t downloaded = _downloaded += size;
+        uint64_t total = _total;
+        if (!_progress || total == 0)
+        {
+            return;
+        }
+        // floor to nearest 5% to reduce message spam
+        int16_t progress = (int16_t)((std::min)(downloaded * 20 / total, (uint64_t)20) * 5);
+        std::lock_guard<std::mutex> lock(_progressMutex);
+        if (progress > _lastProgress)
+        {
+            _lastProgress = progress;
+            _progress(progress);
+        }
+    }
+
+    Velopack::HttpClient &_client;
+    Velopack::BandwidthLimiter *_limiter;
+    Velopack::CancellationToken _cancellation;
+    std::string _url;
+    std::filesystem::path _path;
+    std::string _statePath;
+    VeloRandomAccessFile *_file = nullptr;
+    uint64_t _size;
+    std::atomic<uint64_t> _total;
+    std::atomic<uint64_t> _downloaded{ 0 };
+    const Velopack::ProgressHandler &_progress;
+    std::mutex _progressMutex;
+    int16_t _lastProgress = 0;
+
+    std::string _expected;
+    const VeloHash _emptyHash;
+    const std::string _hashName;
+
+    std::mutex _stateMutex; // guards the members below, and writes to the state file
+    std::vector<std::atomic<uint64_t>> _received; // bytes received of each segment, counted from its start
+    std::string _validator;
+    VeloHash _hash;
+    uint64_t _hashed = 0; // the length of the prefix which _hash covers
+};
+
+// CRC-32 (the IEEE polynomial, as used by zip), computed eight bytes at a time with the slicing-by-8 tables.
+class VeloCrc32
+{
+public:
+    void update(const void *data, size_t size)
+    {
+        const uint8_t *p = static_cast<const uint8_t *>(data);
+        const auto &t = tables();
+        uint32_t crc = ~_crc;
+        for (; size >= 8; p += 8, size -= 8)
+        {
+            uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+            uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; size > 0; p++, size--)
+            crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+        _crc = ~crc;
+    }
+
+    uint32_t value() const { return _crc; }
+
+private:
+    typedef uint32_t Tables[8][256];
+
+    static const Tables &tables()
+    {
+        static const struct Init
+        {
+            Tables t;
+            Init()
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++)
+                        c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                    t[0][i] = c;
+                }
+                for (int k = 1; k < 8; k++)
+                {
+                    for (int i = 0; i < 256; i++)
+                        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+                }
+            }
+        } init;
+        return init.t;
+    }
+
+    uint32_t _crc = 0;
+};
+
+// A whole file mapped read-only into memory. Unmapped on destruction.
+class VeloMappedFile
+{
+public:
+    explicit VeloMappedFile(const std::filesystem::path &path)
+    {
+#if defined(_WIN32)
+        HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+        {
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            throw std::runtime_error("Unable to open file: " + path.string());
+        }
+        _size = (uint64_t)size.QuadPart;
+        if (_size > 0)
+        {
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            _data = mapping ? static_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+            if (mapping)
+                CloseHandle(mapping); // the view keeps the mapping alive
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error("Unable to open file: " + path.string());
+        }
+        _size = (uint64_t)info.st_size;
+        if (_size > 0)
+        {
+            void *data = ::mmap(nullptr, (size_t)_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            _data = data != MAP_FAILED ? static_cast<const uint8_t *>(data) : nullptr;
+        }
+        ::close(fd); // the mapping keeps the file open
+#endif
+        if (_size > 0 && !_data)
+        {
+            throw std::runtime_error("Unable to map file: " + path.string());
+        }
+    }
+
+    VeloMappedFile(const VeloMappedFile &) = delete;
+    VeloMappedFile &operator=(const VeloMappedFile &) = delete;
+
+    ~VeloMappedFile()
+    {
+        if (!_data)
+            return;
+#if defined(_WIN32)
+        UnmapViewOfFile(_data);
+#else
+        ::munmap(const_cast<uint8_t *>(_data), (size_t)_size);
+#endif
+    }
+
+    const uint8_t *data() const { return _data; }
+    uint64_t size() const { return _size; }
+
+private:
+    const uint8_t *_data = nullptr;
+    uint64_t _size = 0;
+};
+
+// Decompresses raw deflate data (RFC 1951) which is held entirely in memory, eg. a zip entry in a mapped file. The
+// output is passed to a sink in chunks, and only the last 32 KB (as far as back references can reach) is kept.
+class VeloInflate
+{
+public:
+    // Returns the number of bytes written to the sink. Throws if the data is corrupt or truncated.
+    static uint64_t run(const uint8_t *input, size_t size, const std::function<void(const char *, size_t)> &sink)
+    {
+        VeloInflate inflate(input, size, sink);
+        inflate.inflateBlocks();
+        return inflate._total;
+    }
+
+private:
+    static constexpr size_t WINDOW = 32768;
+    static constexpr size_t CHUNK = 256 * 1024;
+    static constexpr size_t SLACK = 258 + 8; // room for one more match, copied 8 bytes at a time
+    static constexpr int FAST_BITS = 10;
+
+    // A canonical Huffman code. Codes up to FAST_BITS long are decoded with one table lookup, longer ones bit by bit.
+    struct Huffman
+    {
+        uint16_t fast[1 << FAST_BITS]; // symbol | length << 9, or 0 if the code is longer than FAST_BITS
+        uint16_t count[16];
+        uint16_t symbol[288];
+
+        void build(const uint8_t *lengths, int n)
+        {
+            std::fill(std::begin(count), std::end(count), (uint16_t)0);
+            for (int i = 0; i < n; i++)
+                count[lengths[i]]++;
+            count[0] = 0;
+            int left = 1;
+            for (int len = 1; len < 16; len++)
+            {
+                left = (left << 1) - count[len];
+                if (left < 0)
+                    throw std::runtime_error("Invalid deflate data, over-subscribed Huffman code.");
+            }
+
+            uint16_t offsets[16] = {};
+            for (int len = 1; len < 15; len++)
+                offsets[len + 1] = offsets[len] + count[len];
+            for (int i = 0; i < n; i++)
+            {
+                if (lengths[i])
+                    symbol[offsets[lengths[i]]++] = (uint16_t)i;
+            }
+
+            std::fill(std::begin(fast), std::end(fast), (uint16_t)0);
+            int code = 0, index = 0;
+            for (int len = 1; len <= FAST_BITS; len++, code <<= 1)
+            {
+                for (int i = 0; i < count[len]; i++, code++)
+                {
+                    int reversed = 0;
+                    for (int bit = 0; bit < len; bit++)
+                        reversed |= ((code >> bit) & 1) << (len - 1 - bit);
+                    for (int j = reversed; j < (1 << FAST_BITS); j += 1 << len)
+                        fast[j] = (uint16_t)(symbol[index] | len << 9);
+                    index++;
+                }
+            }
+        }
+    };
+
+    VeloInflate(const uint8_t *input, size_t size, const std::function<void(const char *, size_t)> &sink)
+        : _in(input), _end(input + size), _sink(sink), _out(WINDOW + CHUNK + SLACK)
+    {
+    }
+
+    void refill()
+    {
+        if (_end - _in >= 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, _in, 8);
+            if constexpr (std::endian::native == std::endian::big)
+                word = byteSwap(word);
+            _bits |= word << _count;
+            _in += (63 - _count) >> 3;
+            _count |= 56;
+            return;
+        }
+        while (_count <= 56)
+        {
+            if (_in < _end)
+            {
+                _bits |= (uint64_t)*_in++ << _count;
+            }
+            else if (++_padding > 8)
+            {
+                throw std::runtime_error("Invalid deflate data, unexpected end of data.");
+            }
+            _count += 8;
+        }
+    }
+
+    static uint64_t byteSwap(uint64_t v)
+    {
+        uint64_t r = 0;
+        for (int i = 0; i < 8; i++, v >>= 8)
+            r = r << 8 | (v & 0xFF);
+        return r;
+    }
+
+    uint32_t bits(unsigned n)
+    {
+        if (_count < n)
+            refill();
+        uint32_t value = (uint32_t)(_bits & ((1ULL << n) - 1));
+        _bits >>= n;
+        _count -= n;
+        return value;
+    }
+
+    int decode(const Huffman &h)
+    {
+        if (_count < 15)
+            refill();
+        return decodeFilled(h);
+    }
+
+    // Decodes a symbol from the bit buffer, which must hold at least 15 bits.
+    int decodeFilled(const Huffman &h)
+    {
+        uint16_t entry = h.fast[_bits & ((1 << FAST_BITS) - 1)];
+        if (entry)
+        {
+            unsigned len = entry >> 9;
+            _bits >>= len;
+            _count -= len;
+            return entry & 511;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len < 16; len++)
+        {
+            code |= (int)(_bits & 1);
+            _bits >>= 1;
+            _count--;
+            int count = h.count[len];
+            if (code - count < first)
+                return h.symbol[index + (code - first)];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        throw std::runtime_error("Invalid deflate data, bad Huffman code.");
+    }
+
+    // Makes room for at least `size` more bytes of output (up to SLACK), passing completed output to the sink.
+    void reserve(size_t size)
+    {
+        if (_pos + size <= WINDOW + CHUNK)
+            return;
+        flush();
+        size_t keep = (std::min)(_pos, WINDOW);
+        std::memmove(_out.data(), _out.data() + _pos - keep, keep);
+        _pos = _flushed = keep;
+    }
+
+    void flush()
+    {
+        if (_pos > _flushed)
+            _sink(reinterpret_cast<const char *>(_out.data() + _flushed), _pos - _flushed);
+        _flushed = _pos;
+    }
+
+    void inflateBlocks()
+    {
+        bool last;
+        do
+        {
+            last = bits(1);
+            switch (bits(2))
+            {
+            case 0:
+                inflateStored();
+                break;
+            case 1:
+            {
+                static const std::pair<Huffman, Huffman> fixed = []
+                {
+                    uint8_t lengths[288 + 30];
+                    std::fill(lengths, lengths + 144, (uint8_t)8);
+                    std::fill(lengths + 144, lengths + 256, (uint8_t)9);
+                    std::fill(lengths + 256, lengths + 280, (uint8_t)7);
+                    std::fill(lengths + 280, lengths + 288, (uint8_t)8);
+                    std::fill(lengths + 288, lengths + 318, (uint8_t)5);
+                    std::pair<Huffman, Huffman> codes;
+                    codes.first.build(lengths, 288);
+                    codes.second.build(lengths + 288, 30);
+                    return codes;
+                }();
+                inflateCodes(fixed.first, fixed.second);
+                break;
+            }
+            case 2:
+                inflateDynamic();
+                break;
+            default:
+                throw std::runtime_error("Invalid deflate data, bad block type.");
+            }
+        } while (!last);
+        flush();
+    }
+
+    void inflateStored()
+    {
+        // drop the rest of the current byte, then return the whole bytes left in the bit buffer to the input
+        _bits >>= _count & 7;
+        _count &= ~7u;
+        size_t unread = _count / 8;
+        if (unread < _padding)
+            throw std::runtime_error("Invalid deflate data, unexpected end of data.");
+        _in -= unread - _padding;
+        _bits = 0;
+        _count = 0;
+        _padding = 0;
+
+        if (_end - _in < 4)
+            throw std::runtime_error("Invalid deflate data, unexpected end of data.");
+        size_t len = _in[0] | _in[1] << 8;
+        size_t nlen = _in[2] | _in[3] << 8;
+        _in += 4;
+        if (len != (~nlen & 0xFFFF))
+            throw std::runtime_error("Invalid deflate data, bad stored block length.");
+        if ((size_t)(_end - _in) < len)
+            throw std::runtime_error("Invalid deflate data, unexpected end of data.");
+        while (len > 0)
+        {
+            reserve(1);
+            size_t size = (std::min)(len, WINDOW + CHUNK - _pos);
+            std::memcpy(_out.data() + _pos, _in, size);
+            _in += size;
+            _pos += size;
+            _total += size;
+            len -= size;
+        }
+    }
+
+    void inflateDynamic()
+    {
+        static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        int nlen = (int)bits(5) + 257;
+        int ndist = (int)bits(5) + 1;
+        int ncode = (int)bits(4) + 4;
+        if (nlen > 286 || ndist > 30)
+            throw std::runtime_error("Invalid deflate data, bad code counts.");
+
+        uint8_t lengths[320] = {};
+        for (int i = 0; i < ncode; i++)
+            lengths[order[i]] = (uint8_t)bits(3);
+        Huffman code_lengths;
+        code_lengths.build(lengths, 19);
+
+        int index = 0;
+        while (index < nlen + ndist)
+        {
+            int symbol = decode(code_lengths);
+            if (symbol < 16)
+            {
+                lengths[index++] = (uint8_t)symbol;
+                continue;
+            }
+            uint8_t value = 0;
+            int repeat;
+            if (symbol == 16)
+            {
+                if (index == 0)
+                    throw std::runtime_error("Invalid deflate data, repeat with no first length.");
+                value = lengths[index - 1];
+                repeat = 3 + (int)bits(2);
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + (int)bits(3);
+            }
+            else
+            {
+                repeat = 11 + (int)bits(7);
+            }
+            if (index + repeat > nlen + ndist)
+                throw std::runtime_error("Invalid deflate data, too many lengths.");
+            std::fill(lengths + index, lengths + index + repeat, value);
+            index += repeat;
+        }
+        if (lengths[256] == 0)
+            throw std::runtime_error("Invalid deflate data, no end-of-block code.");
+
+        Huffman literals, distances;
+        literals.build(lengths, nlen);
+        distances.build(lengths + nlen, ndist);
+        inflateCodes(literals, distances);
+    }
+
+    void inflateCodes(const Huffman &literals, const Huffman &distances)
+    {
+        static const uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+        uint8_t *out = _out.data();
+        while (true)
+        {
+            // 48 bits cover the longest length code and distance code with their extra bits, so a whole match is
+            // decoded from the bit buffer without refilling it again
+            if (_count < 48)
+                refill();
+            if (_pos > WINDOW + CHUNK)
+                reserve(SLACK);
+
+            int symbol = decodeFilled(literals);
+            if (symbol < 256)
+            {
+                out[_pos++] = (uint8_t)symbol;
+                _total++;
+                continue;
+            }
+            if (symbol == 256)
+                return;
+            symbol -= 257;
+            if (symbol >= 29)
+                throw std::runtime_error("Invalid deflate data, bad length code.");
+            size_t len = length_base[symbol] + take(length_extra[symbol]);
+            int dist_symbol = decodeFilled(distances);
+            if (dist_symbol >= 30)
+                throw std::runtime_error("Invalid deflate data, bad distance code.");
+            size_t dist = dist_base[dist_symbol] + take(dist_extra[dist_symbol]);
+            if (dist > _total)
+                throw std::runtime_error("Invalid deflate data, distance too far back.");
+
+            uint8_t *to = out + _pos;
+            const uint8_t *from = to - dist;
+            if (dist >= 8)
+            {
+                // may copy up to 7 bytes past the match, into the slack at the end of the buffer
+                for (size_t i = 0; i < len; i += 8)
+                    std::memcpy(to + i, from + i, 8);
+            }
+            else if (dist == 1)
+            {
+                std::memset(to, *from, len);
+            }
+            else
+            {
+                for (size_t i = 0; i < len; i++)
+                    to[i] = from[i];
+            }
+            _pos += len;
+            _total += len;
+        }
+    }
+
+    // Takes n bits from the bit buffer, which must hold them.
+    uint32_t take(unsigned n)
+    {
+        uint32_t value = (uint32_t)(_bits & ((1ULL << n) - 1));
+        _bits >>= n;
+        _count -= n;
+        return value;
+    }
+
+    const uint8_t *_in;
+    const uint8_t *_end;
+    uint64_t _bits = 0;
+    unsigned _count = 0;
+    size_t _padding = 0; // zero bytes appended to the bit buffer past the end of the input
+    const std::function<void(const char *, size_t)> &_sink;
+    std::vector<uint8_t> _out;
+    size_t _pos = 0;
+    size_t _flushed = 0;
+    uint64_t _total = 0;
+};
+
+static uint16_t VeloZip_U16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t VeloZip_U32(const uint8_t *p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+static uint64_t VeloZip_U64(const uint8_t *p) { return (uint64_t)VeloZip_U32(p) | (uint64_t)VeloZip_U32(p + 4) << 32; }
+
+// Returns whether a path from a package stays inside the directory it is extracted (or patched) in.
+static bool VeloZip_IsContainedPath(std::string_view name)
+{
+    std::filesystem::path relative = std::filesystem::path(name).lexically_normal();
+    return !relative.empty() && !relative.has_root_path() && *relative.begin() != "..";
+}
+
+// Runs body(i) for every i in [0, count) on up to `threads` threads, the calling thread included. Each thread starts
+// with an equal, contiguous share of the indices. A thread which runs out steals the back half of the largest share
+// left, so that a few slow items don't leave the other threads idle. The first exception stops every thread (items
+// which have started still finish) and is rethrown.
+static void VeloParallel_For(size_t count, unsigned threads, const std::function<void(size_t)> &body)
+{
+    threads = (unsigned)(std::min)((size_t)(std::max)(threads, 1u), count);
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+
+    // a share is packed into one word, begin in the low half and end in the high half, so that both the owner taking
+    // from the front and a thief taking from the back are a single compare-and-swap
+    auto pack = [](uint64_t begin, uint64_t end)
+    { return begin | end << 32; };
+    std::vector<std::atomic<uint64_t>> shares(threads);
+    for (unsigned t = 0; t < threads; t++)
+        shares[t] = pack(count * t / threads, count * (t + 1) / threads);
+
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&](unsigned self)
+    {
+        try
+        {
+            while (!failed.load(std::memory_order_relaxed))
+            {
+                uint64_t share = shares[self].load();
+                uint32_t begin = (uint32_t)share, end = (uint32_t)(share >> 32);
+                if (begin < end)
+                {
+                    if (shares[self].compare_exchange_weak(share, pack(begin + 1, end)))
+                        body(begin);
+                    continue;
+                }
+
+                unsigned victim = self;
+                uint32_t largest = 0;
+                for (unsigned t = 0; t < threads; t++)
+                {
+                    uint64_t other = shares[t].load(std::memory_order_relaxed);
+                    uint32_t left = (uint32_t)(other >> 32) > (uint32_t)other ? (uint32_t)(other >> 32) - (uint32_t)other : 0;
+                    if (left > largest)
+                    {
+                        largest = left;
+                        victim = t;
+                    }
+                }
+                if (largest == 0)
+                    return;
+
+                uint64_t theirs = shares[victim].load();
+                begin = (uint32_t)theirs, end = (uint32_t)(theirs >> 32);
+                uint32_t middle = begin + (end - begin) / 2;
+                if (begin < end && shares[victim].compare_exchange_strong(theirs, pack(begin, middle)))
+                    shares[self].store(pack(middle, end));
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            failed = true;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++)
+        pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &thread : pool)
+        thread.join();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+// Progress of BundleZip::extractAll is weighted by size, plus this much per file for the cost of creating it.
+static constexpr uint64_t VELO_EXTRACT_FILE_COST = 4096;
+
+// BundleZip::extractAll reserves the space of files at least this large before writing them, so that files written
+// at the same time by other threads don't fragment them. Smaller files are written in one go anyway.
+static constexpr uint64_t VELO_EXTRACT_PREALLOCATE_SIZE = 1024 * 1024;
+
+struct Velopack::BundleZip::Impl
+{
+    std::string path;
+    VeloMappedFile file;
+    std::vector<BundleEntry> entries;
+    std::vector<uint32_t> byName; // indices into entries, sorted by name
+
+    explicit Impl(const std::string &path) : path(path), file(path)
+    {
+        const uint8_t *data = file.data();
+        uint64_t size = file.size();
+
+        // the end of central directory record is last, followed by a comment of up to 64 KB
+        uint64_t eocd = size;
+        for (uint64_t pos = size >= 22 ? size - 22 : 0; size >= 22 && size - pos <= 22 + 0xFFFF; pos--)
+        {
+            if (VeloZip_U32(data + pos) == 0x06054b50)
+            {
+                eocd = pos;
+                break;
+            }
+            if (pos == 0)
+                break;
+        }
+        if (eocd == size)
+        {
+            throw std::runtime_error("Not a zip file: " + path);
+        }
+
+        uint64_t count = VeloZip_U16(data + eocd + 10);
+        uint64_t directory_size = VeloZip_U32(data + eocd + 12);
+        uint64_t directory_offset = VeloZip_U32(data + eocd + 16);
+        if (eocd >= 20 && VeloZip_U32(data + eocd - 20) == 0x07064b50)
+        {
+            uint64_t zip64 = VeloZip_U64(data + eocd - 20 + 8);
+            if (zip64 > size - 56 || VeloZip_U32(data + zip64) != 0x06064b50)
+            {
+                throw std::runtime_error("Corrupt zip64 end of central directory: " + path);
+            }
+            count = VeloZip_U64(data + zip64 + 32);
+            directory_size = VeloZip_U64(data + zip64 + 40);
+            directory_offset = VeloZip_U64(data + zip64 + 48);
+        }
+        if (directory_offset > size || directory_size > size - directory_offset)
+        {
+            throw std::runtime_error("Corrupt zip central directory: " + path);
+        }
+
+        const uint8_t *p = data + directory_offset;
+        const uint8_t *end = p + directory_size;
+        entries.reserve((size_t)(std::min)(count, directory_size / 46));
+        for (uint64_t i = 0; i < count; i++)
+        {
+            if (end - p < 46 || VeloZip_U32(p) != 0x02014b50)
+            {
+                throw std::runtime_error("Corrupt zip central directory: " + path);
+            }
+            size_t name_length = VeloZip_U16(p + 28);
+            size_t extra_length = VeloZip_U16(p + 30);
+            size_t comment_length = VeloZip_U16(p + 32);
+            if ((size_t)(end - p) < 46 + name_length + extra_length + comment_length)
+            {
+                throw std::runtime_error("Corrupt zip central directory: " + path);
+            }
+
+            BundleEntry entry;
+            entry.name = std::string_view(reinterpret_cast<const char *>(p + 46), name_length);
+            entry.flags = VeloZip_U16(p + 8);
+            entry.method = VeloZip_U16(p + 10);
+            entry.crc32 = VeloZip_U32(p + 16);
+            entry.compressedSize = VeloZip_U32(p + 20);
+            entry.size = VeloZip_U32(p + 24);
+            entry.localHeaderOffset = VeloZip_U32(p + 42);
+            if ((VeloZip_U16(p + 4) >> 8) == 3) // made by Unix, the mode is in the high half of the external attributes
+                entry.unixMode = (VeloZip_U32(p + 38) >> 16) & 07777;
+
+            // sizes and offsets which do not fit in 32 bits are in the zip64 extra field, in this order
+            const uint8_t *extra = p + 46 + name_length;
+            const uint8_t *extra_end = extra + extra_length;
+            while (extra_end - extra >= 4)
+            {
+                uint16_t id = VeloZip_U16(extra);
+                size_t length = (std::min)((size_t)VeloZip_U16(extra + 2), (size_t)(extra_end - extra - 4));
+                if (id == 1)
+                {
+                    const uint8_t *field = extra + 4;
+                    const uint8_t *field_end = field + length;
+                    for (uint64_t *value : { &entry.size, &entry.compressedSize, &entry.localHeaderOffset })
+                    {
+                        if (*value == 0xFFFFFFFF && field_end - field >= 8)
+                        {
+                            *value = VeloZip_U64(field);
+                            field += 8;
+                        }
+                    }
+                }
+                extra += 4 + length;
+            }
+
+            entries.push_back(entry);
+            p += 46 + name_length + extra_length + comment_length;
+        }
+
+        byName.resize(entries.size());
+        for (uint32_t i = 0; i < byName.size(); i++)
+            byName[i] = i;
+        std::stable_sort(byName.begin(), byName.end(), [this](uint32_t a, uint32_t b)
+                         { return entries[a].name < entries[b].name; });
+    }
+
+    // Returns the stored data of an entry, which follows its local header.
+    const uint8_t *entryData(const BundleEntry &entry) const
+    {
+        const uint8_t *data = file.data();
+        uint64_t size = file.size();
+        uint64_t offset = entry.localHeaderOffset;
+        if (size < 30 || offset > size - 30 || VeloZip_U32(data + offset) != 0x04034b50)
+        {
+            throw std::runtime_error("Corrupt zip local header for '" + std::string(entry.name) + "'.");
+        }
+        uint64_t start = offset + 30 + VeloZip_U16(data + offset + 26) + VeloZip_U16(data + offset + 28);
+        if (start > size || entry.compressedSize > size - start)
+        {
+            throw std::runtime_error("Zip entry '" + std::string(entry.name) + "' extends past the end of the file.");
+        }
+        return data + start;
+    }
+};
+
+// Writes a patched file from front to back, hashing it on the way so that it can be checked against its .shasum.
+class VeloPatchOutput
+{
+public:
+    explicit VeloPatchOutput(const std::filesystem::path &path) : _file(path, true), _hash(VeloHash::sha1()) {}
+
+    void reserve(uint64_t size)
+    {
+        if (size >= VELO_EXTRACT_PREALLOCATE_SIZE)
+            _file.resize(size);
+    }
+
+    void write(const char *data, size_t size)
+    {
+        _file.writeAt(_size, data, size);
+        _hash.update(data, size);
+        _size += size;
+    }
+
+    void setMode(uint32_t mode) { _file.setMode(mode); }
+    uint64_t size() const { return _size; }
+    std::string finishHex() { return _hash.finishHex(); }
+
+private:
+    VeloRandomAccessFile _file;
+    VeloHash _hash;
+    uint64_t _size = 0;
+};
+
+#if defined(VELOPACK_BZIP2)
+// Reads a bzip2 stream which is held in memory, eg. one of the three blocks of a bsdiff patch.
+class VeloBzip2Reader
+{
+public:
+    VeloBzip2Reader(const char *data, size_t size)
+    {
+        if (size > UINT_MAX || BZ2_bzDecompressInit(&_stream, 0, 0) != BZ_OK)
+        {
+            throw std::runtime_error("Unable to read bzip2 data.");
+        }
+        _stream.next_in = const_cast<char *>(data);
+        _stream.avail_in = (unsigned)size;
+    }
+
+    VeloBzip2Reader(const VeloBzip2Reader &) = delete;
+    VeloBzip2Reader &operator=(const VeloBzip2Reader &) = delete;
+    ~VeloBzip2Reader() { BZ2_bzDecompressEnd(&_stream); }
+
+    // Fills the buffer. Throws if the stream ends first.
+    void read(char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            _stream.next_out = data;
+            _stream.avail_out = (unsigned)(std::min)(size, (size_t)1 << 30);
+            unsigned space = _stream.avail_out;
+            int rc = BZ2_bzDecompress(&_stream);
+            size_t produced = space - _stream.avail_out;
+            data += produced;
+            size -= produced;
+            if ((rc != BZ_OK && rc != BZ_STREAM_END) || (size > 0 && (rc == BZ_STREAM_END || produced == 0)))
+            {
+                throw std::runtime_error("Invalid bsdiff patch, the bzip2 data is corrupt or truncated.");
+            }
+        }
+    }
+
+private:
+    bz_stream _stream = {};
+};
+
+// Reads a bsdiff offset, which is a 64 bit little endian integer in sign and magnitude form.
+static int64_t VeloBsdiff_Offset(const uint8_t *p)
+{
+    int64_t value = p[7] & 0x7F;
+    for (int i = 6; i >= 0; i--)
+        value = value << 8 | p[i];
+    return p[7] & 0x80 ? -value : value;
+}
+
+// Applies a bsdiff (BSDIFF40) patch to `old`. The new file is streamed to `out`, block by block.
+static void VeloBsdiff_Apply(const uint8_t *old, uint64_t oldSize, std::string_view patch, VeloPatchOutput &out)
+{
+    const uint8_t *header = reinterpret_cast<const uint8_t *>(patch.data());
+    if (patch.size() < 32 || patch.substr(0, 8) != "BSDIFF40")
+    {
+        throw std::runtime_error("Invalid bsdiff patch, bad header.");
+    }
+    int64_t control_size = VeloBsdiff_Offset(header + 8);
+    int64_t diff_size = VeloBsdiff_Offset(header + 16);
+    int64_t new_size = VeloBsdiff_Offset(header + 24);
+    if (control_size < 0 || diff_size < 0 || new_size < 0 || (uint64_t)control_size > patch.size() - 32 ||
+        (uint64_t)diff_size > patch.size() - 32 - (uint64_t)control_size)
+    {
+        throw std::runtime_error("Invalid bsdiff patch, bad header.");
+    }
+    size_t diff_offset = 32 + (size_t)control_size;
+    size_t extra_offset = diff_offset + (size_t)diff_size;
+    VeloBzip2Reader control(patch.data() + 32, (size_t)control_size);
+    VeloBzip2Reader diff(patch.data() + diff_offset, (size_t)diff_size);
+    VeloBzip2Reader extra(patch.data() + extra_offset, patch.size() - extra_offset);
+    out.reserve((uint64_t)new_size);
+
+    // each control triple adds `add` bytes of diff to the old file, copies `copy` bytes of extra, then seeks the old file
+    std::vector<char> buffer(64 * 1024);
+    int64_t old_pos = 0, new_pos = 0;
+    while (new_pos < new_size)
+    {
+        uint8_t triple[24];
+        control.read(reinterpret_cast<char *>(triple), sizeof(triple));
+        int64_t add = VeloBsdiff_Offset(triple);
+        int64_t copy = VeloBsdiff_Offset(triple + 8);
+        int64_t seek = VeloBsdiff_Offset(triple + 16);
+        if (add < 0 || copy < 0 || add > new_size - new_pos || copy > new_size - new_pos - add)
+        {
+            throw std::runtime_error("Invalid bsdiff patch, bad control data.");
+        }
+
+        for (int64_t left = add; left > 0;)
+        {
+            int64_t n = (std::min)(left, (int64_t)buffer.size());
+            diff.read(buffer.data(), (size_t)n);
+            // bytes outside of the old file are added to nothing
+            int64_t begin = std::clamp(-old_pos, (int64_t)0, n);
+            int64_t end = std::clamp((int64_t)oldSize - old_pos, begin, n);
+            for (int64_t i = begin; i < end; i++)
+                buffer[i] = (char)(buffer[i] + old[old_pos + i]);
+            out.write(buffer.data(), (size_t)n);
+            old_pos += n;
+            left -= n;
+        }
+        for (int64_t left = copy; left > 0;)
+        {
+            int64_t n = (std::min)(left, (int64_t)buffer.size());
+            extra.read(buffer.data(), (size_t)n);
+            out.write(buffer.data(), (size_t)n);
+            left -= n;
+        }
+        new_pos += add + copy;
+        old_pos += seek;
+    }
+}
+#endif
+
+#if defined(VELOPACK_ZSTD)
+// Applies a zstd patch (made with `zstd --patch-from=old`) to `old`. The patch is streamed from the delta package
+// and the new file to `out`, the old file is referenced in place rather than copied into the decoder.
+static void VeloZstd_Apply(const uint8_t *old, uint64_t oldSize, const Velopack::BundleZip &delta, const Velopack::BundleEntry &patch, VeloPatchOutput &out)
+{
+    // a patch refers back across the whole old file, so its window can be larger than the decoder allows by default
+    std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    int window_log = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound;
+    if (!context || ZSTD_isError(ZSTD_DCtx_setParameter(context.get(), ZSTD_d_windowLogMax, window_log)) ||
+        ZSTD_isError(ZSTD_DCtx_refPrefix(context.get(), old, (size_t)oldSize)))
+    {
+        throw std::runtime_error("Unable to create a zstd decoder.");
+    }
+
+    std::vector<char> buffer(ZSTD_DStreamOutSize());
+    size_t pending = 1; // non-zero until the end of the frame has been decoded and flushed
+    auto decode = [&](ZSTD_inBuffer &in)
+    {
+        ZSTD_outBuffer output = { buffer.data(), buffer.size(), 0 };
+        pending = ZSTD_decompressStream(context.get(), &output, &in);
+        if (ZSTD_isError(pending))
+        {
+            throw std::runtime_error(std::string("Invalid zstd patch: ") + ZSTD_getErrorName(pending));
+        }
+        out.write(buffer.data(), output.pos);
+        return output.pos;
+    };
+    delta.read(patch, [&](const char *data, size_t size)
+               {
+                   ZSTD_inBuffer in = { data, size, 0 };
+                   while (in.pos < in.size)
+                       decode(in); });
+    while (pending != 0)
+    {
+        ZSTD_inBuffer in = { nullptr, 0, 0 };
+        if (decode(in) == 0 && pending != 0)
+        {
+            throw std::runtime_error("Invalid zstd patch, the data is truncated.");
+        }
+    }
+}
+#endif
+
+// Returns whether an entry of a package is one of the app's files (under lib/<framework>/), which deltas patch.
+static bool VeloDelta_IsAppFile(std::string_view name)
+{
+    if (!name.starts_with("lib/") && !name.starts_with("lib\\"))
+        return false;
+    size_t slash = name.find_first_of("/\\", 4);
+    return slash != std::string_view::npos && slash + 1 < name.size();
+}
+
+// Reads the SHA1 and size from a .shasum file of a delta package, which has the form "SHA1 [name] size".
+static void VeloDelta_ParseShasum(const std::string &text, std::string &sha1, uint64_t &size)
+{
+    std::string_view trimmed = VeloString_Trim(text);
+    size_t first = trimmed.find_first_of(" \t");
+    size_t last = trimmed.find_last_of(" \t");
+    std::string_view last_token = last == std::string_view::npos ? std::string_view() : trimmed.substr(last + 1);
+    if (first != 40 || last_token.empty() || last_token.find_first_not_of("0123456789") != std::string_view::npos)
+    {
+        throw std::runtime_error("Invalid .shasum file in delta package: " + text);
+    }
+    sha1 = std::string(trimmed.substr(0, 40));
+    size = std::stoull(std::string(last_token));
+}
+
+struct Velopack::DeltaApplier::Impl
+{
+    std::filesystem::path work;
+    unsigned threads;
+
+    ~Impl()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(work, ec);
+    }
+
+    // Lists every file in the working directory, as sorted relative paths with '/' separators.
+    std::vector<std::string> listFiles() const
+    {
+        std::vector<std::string> files;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(work))
+        {
+            if (entry.is_regular_file())
+                files.push_back(entry.path().lexically_relative(work).generic_string());
+        }
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+};
+
+// The zip writer below uses zip64 records for anything at or above this, the largest value the plain fields can hold.
+static constexpr uint64_t VELO_ZIP64_LIMIT = 0xFFFFFFFF;
+
+static void VeloZip_Put16(std::string &out, uint16_t value)
+{
+    out.push_back((char)(value & 0xFF));
+    out.push_back((char)(value >> 8));
+}
+
+static void VeloZip_Put32(std::string &out, uint32_t value)
+{
+    VeloZip_Put16(out, (uint16_t)(value & 0xFFFF));
+    VeloZip_Put16(out, (uint16_t)(value >> 16));
+}
+
+static void VeloZip_Put64(std::string &out, uint64_t value)
+{
+    VeloZip_Put32(out, (uint32_t)(value & 0xFFFFFFFF));
+    VeloZip_Put32(out, (uint32_t)(value >> 32));
+}
+
+// static std::thread nativeStartProcessAsyncReadLine(const std::vector<std::string> *command_line, Velopack::ProcessReadLineHandler *handler)
+// {
+//     subprocess_s subprocess = nativeStartProcess(command_line, subprocess_option_no_window | subprocess_option_enable_async);
+
+//     std::thread outputThread([subprocess, handler]() mutable
+//     {
+//         const unsigned BUFFER_SIZE = 1024;
+//         char readBuffer[BUFFER_SIZE];
+//         std::string accumulatedData;
+
+//         // read all stdout from the process one line at a time
+//         while (true) {
+//             unsigned bytesRead = subprocess_read_stdout(&subprocess, readBuffer, BUFFER_SIZE - 1);
+
+//             if (bytesRead == 0) {
+//                 // bytesRead is 0, indicating the process has completed
+//                 // Process any remaining data in accumulatedData as the last line if needed
+//                 if (!accumulatedData.empty()) {
+//                     handler->handleProcessOutputLine(accumulatedData);
+//                 }
+//                 return;
+//             }
+
+//             accumulatedData += std::string(readBuffer, bytesRead);
+
+//             // Process accumulated data for lines
+//             size_t pos;
+//             while ((pos = accumulatedData.find('\n')) != std::string::npos) {
+//                 std::string line = accumulatedData.substr(0, pos);
+//                 if (handler->handleProcessOutputLine(line)) {
+//                     return; // complete or err
+//                 }
+//                 accumulatedData.erase(0, pos + 1);
+//             }
+//         }
+//     });
+
+//     return outputThread;
+// }
+
+namespace Velopack
+{
+#if UNICODE
+    void startup(wchar_t **args, size_t c_args)
+    {
+        for (size_t i = 0; i < c_args; ++i)
+        {
+            if (::std::wstring(args[i]) == L"--veloapp-install")
+            {
+                exit(0);
+            }
+            if (::std::wstring(args[i]) == L"--veloapp-updated")
+            {
+                exit(0);
+            }
+            if (::std::wstring(args[i]) == L"--veloapp-obsolete")
+            {
+                exit(0);
+            }
+            if (::std::wstring(args[i]) == L"--veloapp-uninstall")
+            {
+                exit(0);
+            }
+        }
+    }
+#endif // UNICODE
+
+    void startup(char **args, size_t c_args)
+    {
+        for (size_t i = 0; i < c_args; ++i)
+        {
+            if (::std::string(args[i]) == "--veloapp-install")
+            {
+                exit(0);
+            }
+            if (::std::string(args[i]) == "--veloapp-updated")
+            {
+                exit(0);
+            }
+            if (::std::string(args[i]) == "--veloapp-obsolete")
+            {
+                exit(0);
+            }
+            if (::std::string(args[i]) == "--veloapp-uninstall")
+            {
+                exit(0);
+            }
+        }
+    }
+
+    void invalidateInstallContext()
+    {
+        VeloInstallContext::invalidate();
+    }
+
+    VelopackManifest VelopackManifest::parse(std::string_view xml)
+    {
+        static const std::pair<std::string_view, std::string VelopackManifest::*> fields[] = {
+            { "id", &VelopackManifest::id },
+            { "version", &VelopackManifest::version },
+            { "title", &VelopackManifest::title },
+            { "authors", &VelopackManifest::authors },
+            { "description", &VelopackManifest::description },
+            { "machineArchitecture", &VelopackManifest::machineArchitecture },
+            { "runtimeDependencies", &VelopackManifest::runtimeDependencies },
+            { "mainExe", &VelopackManifest::mainExe },
+            { "os", &VelopackManifest::os },
+            { "osMinVersion", &VelopackManifest::osMinVersion },
+            { "channel", &VelopackManifest::channel },
+        };
+
+        VelopackManifest manifest;
+        VeloXml_ReadText(xml, [&](std::string_view element, const std::string &text)
+        {
+            for (const auto &[name, field] : fields)
+            {
+                if (element == name)
+                {
+                    manifest.*field = text;
+                    break;
+                }
+            }
+        });
+
+        if (manifest.id.empty())
+        {
+            throw std::runtime_error("Missing 'id' in package manifest. Please contact the application author.");
+        }
+        if (manifest.version.empty())
+        {
+            throw std::runtime_error("Missing 'version' in package manifest. Please contact the application author.");
+        }
+#if defined(_WIN32)
+        if (manifest.mainExe.empty())
+        {
+            throw std::runtime_error("Missing 'mainExe' in package manifest. Please contact the application author.");
+        }
+#endif
+        if (manifest.title.empty())
+        {
+            manifest.title = manifest.id;
+        }
+        return manifest;
+    }
+
+    VelopackManifest VelopackManifest::read(const std::string &path)
+    {
+        if (!std::filesystem::exists(path))
+        {
+            throw std::runtime_error("Unable to read nuspec file in current directory: " + path);
+        }
+        return parse(VeloFile_ReadAllText(path));
+    }
+
+    VelopackLocator VelopackLocator::autoLocate()
+    {
+        return locate(nativeGetCurrentProcessPath());
+    }
+
+    VelopackLocator VelopackLocator::locate(const std::string &exePath)
+    {
+        namespace fs = std::filesystem;
+        VelopackLocator locator;
+#if defined(_WIN32)
+        // check if Update.exe exists in parent dir, if it does, that's the root dir.
+        fs::path root = fs::path(exePath).parent_path().parent_path();
+        if (!fs::exists(root / "Update.exe"))
+        {
+            // see if we can find the current dir in the path, maybe we're more nested than that.
+            size_t idx = exePath.rfind("\\current\\");
+            if (idx == std::string::npos || !fs::exists(fs::path(exePath.substr(0, idx)) / "Update.exe"))
+            {
+                throw std::runtime_error("Unable to locate Update.exe in parent directory, and not able to find '/current' dir in path");
+            }
+            root = exePath.substr(0, idx);
+        }
+        locator.rootAppDir = root.string();
+        locator.updateExePath = (root / "Update.exe").string();
+        locator.packagesDir = (root / "packages").string();
+        locator.manifest = VelopackManifest::read((root / "current" / "sq.version").string());
+#else
+#if defined(__APPLE__)
+        size_t idx = exePath.rfind(".app/");
+        if (idx == std::string::npos)
+        {
+            throw std::runtime_error("Unable to locate '.app' directory in path: " + exePath);
+        }
+        fs::path root = exePath.substr(0, idx + 4);
+        fs::path contents = root / "Contents" / "MacOS";
+        fs::path update = contents / "UpdateMac";
+#else
+        size_t idx = exePath.rfind("/usr/bin/");
+        if (idx == std::string::npos)
+        {
+            throw std::runtime_error("Unable to locate '/usr/bin/' directory in path: " + exePath);
+        }
+        fs::path root = exePath.substr(0, idx);
+        fs::path contents = root / "usr" / "bin";
+        fs::path update = contents / "UpdateNix";
+#endif
+        if (!fs::exists(update))
+        {
+            throw std::runtime_error("Unable to locate " + update.filename().string() + " in directory: " + contents.string());
+        }
+        locator.rootAppDir = root.string();
+        locator.updateExePath = update.string();
+        locator.manifest = VelopackManifest::read((contents / "sq.version").string());
+#if defined(__APPLE__)
+        fs::path packages = fs::path(nativeGetHomeDirectory()) / "Library" / "Caches" / "velopack";
+#else
+        fs::path packages = fs::path("/var/tmp/velopack");
+#endif
+        locator.packagesDir = (packages / locator.manifest.id / "packages").string();
+#endif
+        return locator;
+    }
+
+    std::string_view SemanticVersion::intern(std::string_view text)
+    {
+        if (text.empty())
+            return {};
+        // pre-release and build strings repeat across versions (eg. "beta.1"), so a feed only adds a handful. The set
+        // is never freed, so that versions held in static storage stay valid during shutdown.
+        struct Hash
+        {
+            using is_transparent = void;
+            size_t operator()(std::string_view s) const { return std::hash<std::string_view>()(s); }
+        };
+        static std::mutex mutex;
+        static auto *strings = new std::unordered_set<std::string, Hash, std::equal_to<>>();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = strings->find(text);
+        if (it == strings->end())
+            it = strings->emplace(text).first;
+        return *it;
+    }
+
+    std::string SemanticVersion::toString() const
+    {
+        std::string result = std::to_string(_major) + "." + std::to_string(_minor) + "." + std::to_string(_patch);
+        if (!_prerelease.empty())
+            result.append("-").append(_prerelease);
+        if (!_build.empty())
+            result.append("+").append(_build);
+        return result;
+    }
+
+    // Reads an asset from a release feed. Feeds use the property names of the Velopack asset model (eg. "PackageId"
+    // and "NotesMarkdown"), which differ from the ones VelopackAsset::fromNode reads from Vfusion's output.
+    static void parseFeedAsset(const JsonNode &node, VelopackAsset &asset)
+    {
+        for (const auto &[key, value] : *node.asObject())
+        {
+            if (value->isNull())
+            {
+                continue;
+            }
+            std::string name = Platform::toLower(key);
+            if (name == "packageid" || name == "id")
+                asset.packageId = value->asString();
+            else if (name == "version")
+                asset.version = value->asString();
+            else if (name == "type")
+            {
+                std::string type = Platform::toLower(value->asString());
+                asset.type = type == "full" ? VelopackAssetType::full : type == "delta" ? VelopackAssetType::delta : VelopackAssetType::unknown;
+            }
+            else if (name == "filename")
+                asset.fileName = value->asString();
+            else if (name == "sha1")
+                asset.sha1 = value->asString();
+            else if (name == "sha256")
+                asset.sha256 = value->asString();
+            else if (name == "size")
+                asset.size = (int64_t)value->asNumber();
+            else if (name == "rolloutpercentage")
+                asset.rolloutPercentage = value->asNumber();
+            else if (name == "notesmarkdown" || name == "markdown")
+                asset.notesMarkdown = value->asString();
+            else if (name == "noteshtml" || name == "html")
+                asset.notesHTML = value->asString();
+        }
+    }
+
+    struct VelopackAssetFeed::Index
+    {
+        size_t count = 0;                      // the number of assets when this was built
+        std::vector<uint32_t> order;           // positions in assets, oldest first, with unparsable versions before the rest
+        std::vector<SemanticVersion> versions; // the version of each asset in `order`
+        size_t firstValid = 0;                 // the first entry of `order` which has a version
+        std::unordered_map<std::string, uint32_t> byFileName;    // lower case file name to an entry of `order`
+        std::unordered_map<std::string, uint32_t> byVersionType; // see versionTypeKey, to an entry of `order`
+
+        // Build metadata is left out of the key, as it does not affect precedence.
+        static std::string versionTypeKey(const SemanticVersion &version, VelopackAssetType type)
+        {
+            std::string key = std::to_string(version.major()) + '.' + std::to_string(version.minor()) + '.' + std::to_string(version.patch());
+            if (!version.prerelease().empty())
+                key.append("-").append(version.prerelease());
+            key += '/';
+            key += std::to_string((int)type);
+            return key;
+        }
+
+        static std::vector<const VelopackAsset *> pointers(const std::vector<std::shared_ptr<VelopackAsset>> &assets)
+        {
+            std::vector<const VelopackAsset *> result;
+            result.reserve(assets.size());
+            for (const auto &asset : assets)
+                result.push_back(asset.get());
+            return result;
+        }
+
+        static std::string fileNameKey(std::string_view fileName)
+        {
+            std::string key(fileName);
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c)
+                           { return (char)std::tolower(c); });
+            return key;
+        }
+
+        explicit Index(const std::vector<const VelopackAsset *> &assets) : count(assets.size())
+        {
+            std::vector<SemanticVersion> parsed(assets.size());
+            std::vector<char> valid(assets.size());
+            for (size_t i = 0; i < assets.size(); i++)
+                valid[i] = SemanticVersion::tryParse(assets[i]->version, parsed[i]);
+
+            auto type_rank = [](VelopackAssetType type)
+            { return type == VelopackAssetType::full ? 0 : type == VelopackAssetType::delta ? 1 : 2; };
+            order.resize(assets.size());
+            for (uint32_t i = 0; i < order.size(); i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                             {
+                if (valid[a] != valid[b])
+                    return !valid[a];
+                if (!valid[a])
+                    return false;
+                auto cmp = parsed[a] <=> parsed[b];
+                if (cmp != 0)
+                    return cmp < 0;
+                return type_rank(assets[a]->type) < type_rank(assets[b]->type); });
+
+            versions.reserve(order.size());
+            std::vector<uint32_t> rank(order.size());
+            for (uint32_t i = 0; i < order.size(); i++)
+            {
+                rank[order[i]] = i;
+                versions.push_back(std::move(parsed[order[i]]));
+                if (!valid[order[i]])
+                    firstValid = i + 1;
+            }
+
+            // visited in feed order, so that the first of any duplicates wins (as it did with a linear search)
+            byFileName.reserve(assets.size());
+            byVersionType.reserve(assets.size());
+            for (uint32_t i = 0; i < assets.size(); i++)
+            {
+                byFileName.emplace(fileNameKey(assets[i]->fileName), rank[i]);
+                if (valid[i])
+                    byVersionType.emplace(versionTypeKey(versions[rank[i]], assets[i]->type), rank[i]);
+            }
+        }
+    };
+
+    VelopackAssetFeed VelopackAssetFeed::fromJson(std::string_view json)
+    {
+        VelopackAssetFeed feed;
+        std::shared_ptr<JsonNode> root = JsonNode::parse(json);
+        std::vector<VelopackAsset> parsed;
+        for (const auto &[key, value] : *root->asObject())
+        {
+            if (Platform::toLower(key) == "assets" && !value->isNull())
+            {
+                parsed.reserve(parsed.size() + value->asArray()->size());
+                for (const auto &node : *value->asArray())
+                {
+                    parsed.push_back(VelopackAsset());
+                    parseFeedAsset(*node, parsed.back());
+                }
+            }
+        }
+
+        // the assets are sorted, then moved into one block in that order, which each shared_ptr points into
+        std::vector<const VelopackAsset *> pointers;
+        pointers.reserve(parsed.size());
+        for (const auto &asset : parsed)
+        {
+            pointers.push_back(&asset);
+        }
+        auto index = std::make_shared<Index>(pointers);
+        auto arena = std::make_shared<std::vector<VelopackAsset>>();
+        arena->reserve(parsed.size());
+        for (uint32_t position : index->order)
+        {
+            arena->push_back(std::move(parsed[position]));
+        }
+        feed.assets.reserve(arena->size());
+        for (auto &asset : *arena)
+        {
+            feed.assets.push_back(std::shared_ptr<VelopackAsset>(arena, &asset));
+        }
+        std::iota(index->order.begin(), index->order.end(), 0u);
+        feed._index = std::move(index);
+        return feed;
+    }
+
+    void VelopackAssetFeed::reindex()
+    {
+        auto index = std::make_shared<Index>(Index::pointers(assets));
+        std::vector<std::shared_ptr<VelopackAsset>> sorted;
+        sorted.reserve(assets.size());
+        for (uint32_t position : index->order)
+        {
+            sorted.push_back(std::move(assets[position]));
+        }
+        assets = std::move(sorted);
+        std::iota(index->order.begin(), index->order.end(), 0u);
+        _index = std::move(index);
+    }
+
+    std::shared_ptr<const VelopackAssetFeed::Index> VelopackAssetFeed::index() const
+    {
+        if (_index && _index->count == assets.size())
+        {
+            return _index;
+        }
+        return std::make_shared<const Index>(Index::pointers(assets));
+    }
+
+    const VelopackAsset *VelopackAssetFeed::find(std::string_view fileName) const
+    {
+        if (_index && _index->count == assets.size())
+        {
+            auto it = _index->byFileName.find(Index::fileNameKey(fileName));
+            return it != _index->byFileName.end() ? assets[_index->order[it->second]].get() : nullptr;
+        }
+        for (const auto &asset : assets) // a one-off search is quicker than building the index first
+        {
+            if (VeloString_EqualsIgnoreCase(asset->fileName, fileName))
+            {
+                return asset.get();
+            }
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<VelopackAsset> VelopackAssetFeed::find(const SemanticVersion &version, VelopackAssetType type) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+        auto it = index->byVersionType.find(Index::versionTypeKey(version, type));
+        return it != index->byVersionType.end() ? assets[index->order[it->second]] : nullptr;
+    }
+
+    std::shared_ptr<VelopackAsset> VelopackAssetFeed::latest(VelopackAssetType type) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+        for (size_t i = index->order.size(); i > index->firstValid; i--)
+        {
+            if (assets[index->order[i - 1]]->type != type)
+                continue;
+            // of several assets with the same version, return the first in the feed
+            size_t first = i - 1;
+            while (first > index->firstValid && index->versions[first - 1] == index->versions[i - 1] && assets[index->order[first - 1]]->type == type)
+                first--;
+            return assets[index->order[first]];
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<VelopackAsset> VelopackAssetFeed::latest(VelopackAssetType type, std::string_view rolloutId) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+        for (size_t i = index->order.size(); i > index->firstValid; i--)
+        {
+            if (assets[index->order[i - 1]]->type != type)
+                continue;
+            size_t first = i - 1;
+            while (first > index->firstValid && index->versions[first - 1] == index->versions[i - 1] && assets[index->order[first - 1]]->type == type)
+                first--;
+            if (isRolledOut(*assets[index->order[first]], rolloutId))
+                return assets[index->order[first]];
+            i = first + 1; // continue with the version before
+        }
+        return nullptr;
+    }
+
+    bool isRolledOut(const VelopackAsset &asset, std::string_view rolloutId)
+    {
+        if (!(asset.rolloutPercentage < 100))
+        {
+            return true;
+        }
+        if (!(asset.rolloutPercentage > 0))
+        {
+            return false;
+        }
+        std::string key(rolloutId);
+        key.append("/").append(VeloString_ToLower(asset.packageId)).append("/").append(asset.version);
+        VeloHash hash = VeloHash::sha1();
+        hash.update(key.data(), key.size());
+        uint64_t bucket = std::stoull(hash.finishHex().substr(0, 16), nullptr, 16) % 10000; // in hundredths of a percent
+        return (double)bucket < asset.rolloutPercentage * 100;
+    }
+
+    std::vector<std::shared_ptr<VelopackAsset>> VelopackAssetFeed::deltasNewerThan(const SemanticVersion &version) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+        std::vector<std::shared_ptr<VelopackAsset>> result;
+        auto begin = std::upper_bound(index->versions.begin() + (ptrdiff_t)index->firstValid, index->versions.end(), version);
+        for (auto it = begin; it != index->versions.end(); ++it)
+        {
+            const auto &asset = assets[index->order[(size_t)(it - index->versions.begin())]];
+            if (asset->type == VelopackAssetType::delta)
+                result.push_back(asset);
+        }
+        return result;
+    }
+
+    std::vector<std::shared_ptr<VelopackAsset>> VelopackAssetFeed::deltasBetween(const SemanticVersion &from, const SemanticVersion &to) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+        std::vector<std::shared_ptr<VelopackAsset>> result;
+        auto first = index->versions.begin() + (ptrdiff_t)index->firstValid;
+        auto begin = std::upper_bound(first, index->versions.end(), from);
+        auto end = std::upper_bound(begin, index->versions.end(), to);
+        for (auto it = begin; it < end; ++it)
+        {
+            const auto &asset = assets[index->order[(size_t)(it - index->versions.begin())]];
+            if (asset->type == VelopackAssetType::delta)
+                result.push_back(asset);
+        }
+        return result;
+    }
+
+    UpdatePlan VelopackAssetFeed::planUpdate(const SemanticVersion &target, const UpdatePlanOptions &options) const
+    {
+        std::shared_ptr<const Index> index = this->index();
+
+        // the file names and sizes of the packages which are already present
+        std::unordered_map<std::string, uint64_t> present;
+        if (options.packages)
+        {
+            for (const LocalPackage &package : options.packages->packages())
+                present.emplace(Index::fileNameKey(package.fileName), package.size);
+        }
+        else if (!options.packagesDir.empty())
+        {
+            std::error_code ec;
+            for (std::filesystem::directory_iterator it(options.packagesDir, ec), end; !ec && it != end; it.increment(ec))
+            {
+                std::error_code entry_ec;
+                if (it->is_regular_file(entry_ec))
+                    present.emplace(Index::fileNameKey(it->path().filename().string()), it->file_size(entry_ec));
+            }
+        }
+        auto is_cached = [&](const VelopackAsset &asset)
+        {
+            auto it = present.find(Index::fileNameKey(asset.fileName));
+            return it != present.end() && (asset.type == VelopackAssetType::full || asset.size <= 0 || it->second == (uint64_t)asset.size);
+        };
+        auto size_of = [](const VelopackAsset &asset)
+        { return (uint64_t)(std::max)(asset.size, (int64_t)0); };
+        auto download_cost = [&](const VelopackAsset &asset)
+        { return options.secondsPerDownload + (double)size_of(asset) / options.downloadBytesPerSecond; };
+
+        // one node per release up to the target, oldest first. A release is either available as a full package
+        // (downloaded or cached), or as the files of a DeltaApplier, which come from extracting the full package of
+        // the release before it, or from applying its delta to the files of that release. The package is written once,
+        // at the end of a chain, so a single pass over both states finds the cheapest way to reach every release.
+        constexpr double unreachable = std::numeric_limits<double>::infinity();
+        struct Node
+        {
+            size_t full = SIZE_MAX; // entries of `order`
+            size_t delta = SIZE_MAX;
+            uint64_t size = 0; // the size of the full package, taken from the release before if it is not in the feed
+            double fullCost = unreachable;
+            uint64_t fullBytes = 0;
+            double filesCost = unreachable;
+            uint64_t filesBytes = 0;
+            bool filesFromFull = false; // the files were extracted from the full package of the release before
+        };
+        std::vector<Node> nodes;
+        auto first = index->versions.begin() + (ptrdiff_t)index->firstValid;
+        size_t end = (size_t)(std::upper_bound(first, index->versions.end(), target) - index->versions.begin());
+        for (size_t i = index->firstValid; i < end; i++)
+        {
+            if (nodes.empty() || index->versions[i] != index->versions[i - 1])
+                nodes.emplace_back();
+            VelopackAssetType type = assets[index->order[i]]->type;
+            if (type == VelopackAssetType::full && nodes.back().full == SIZE_MAX)
+                nodes.back().full = i;
+            else if (type == VelopackAssetType::delta && nodes.back().delta == SIZE_MAX)
+                nodes.back().delta = i;
+        }
+        if (nodes.empty() || index->versions[end - 1] != target)
+        {
+            return {};
+        }
+
+        for (size_t n = 0; n < nodes.size(); n++)
+        {
+            Node &node = nodes[n];
+            node.size = n > 0 ? nodes[n - 1].size : 0;
+            if (node.full != SIZE_MAX)
+            {
+                const VelopackAsset &full = *assets[index->order[node.full]];
+                bool cached = is_cached(full);
+                node.size = size_of(full);
+                node.fullCost = cached ? 0 : download_cost(full);
+                node.fullBytes = cached ? 0 : node.size;
+            }
+            if (node.delta != SIZE_MAX && n > 0)
+            {
+                const Node &previous = nodes[n - 1];
+                const VelopackAsset &delta = *assets[index->order[node.delta]];
+                bool cached = is_cached(delta);
+                double extract = previous.fullCost + (double)previous.size / options.applyBytesPerSecond;
+                node.filesFromFull = extract < previous.filesCost;
+                double base = node.filesFromFull ? extract : previous.filesCost;
+                node.filesCost = base + (cached ? 0 : download_cost(delta)) + (double)size_of(delta) / options.applyBytesPerSecond;
+                node.filesBytes = (node.filesFromFull ? previous.fullBytes : previous.filesBytes) + (cached ? 0 : size_of(delta));
+            }
+        }
+
+        UpdatePlan plan;
+        const Node &last = nodes.back();
+        double rebuild = last.filesCost + (double)last.size / options.applyBytesPerSecond;
+        if (last.fullCost == unreachable && rebuild == unreachable)
+        {
+            return plan; // the target has no full package, and no chain of deltas leads to it
+        }
+        bool via_delta = rebuild < last.fullCost;
+        plan.downloadBytes = via_delta ? last.filesBytes : last.fullBytes;
+        plan.estimatedSeconds = via_delta ? rebuild : last.fullCost;
+        for (size_t n = nodes.size() - 1;; n--)
+        {
+            const std::shared_ptr<VelopackAsset> &asset = assets[index->order[via_delta ? nodes[n].delta : nodes[n].full]];
+            plan.assets.push_back(asset);
+            plan.cached.push_back(is_cached(*asset));
+            if (!via_delta)
+                break;
+            via_delta = !nodes[n].filesFromFull;
+        }
+        std::reverse(plan.assets.begin(), plan.assets.end());
+        std::reverse(plan.cached.begin(), plan.cached.end());
+        return plan;
+    }
+
+    BundleZip::BundleZip(std::unique_ptr<Impl> impl) : _impl(std::move(impl)) {}
+    BundleZip::~BundleZip() = default;
+    BundleZip::BundleZip(BundleZip &&) noexcept = default;
+    BundleZip &BundleZip::operator=(BundleZip &&) noexcept = default;
+
+    BundleZip BundleZip::open(const std::string &path)
+    {
+        return BundleZip(std::make_unique<Impl>(path));
+    }
+
+    const std::vector<BundleEntry> &BundleZip::entries() const
+    {
+        return _impl->entries;
+    }
+
+    const BundleEntry *BundleZip::find(std::string_view name) const
+    {
+        auto it = std::lower_bound(_impl->byName.begin(), _impl->byName.end(), name, [this](uint32_t index, std::string_view value)
+                                   { return _impl->entries[index].name < value; });
+        if (it != _impl->byName.end() && _impl->entries[*it].name == name)
+        {
+            return &_impl->entries[*it];
+        }
+        return nullptr;
+    }
+
+    const BundleEntry *BundleZip::find(const std::function<bool(std::string_view name)> &predicate) const
+    {
+        for (const auto &entry : _impl->entries)
+        {
+            if (predicate(entry.name))
+            {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    std::pair<uint64_t, uint64_t> BundleZip::calculateSize() const
+    {
+        std::pair<uint64_t, uint64_t> total;
+        for (const auto &entry : _impl->entries)
+        {
+            total.first += entry.compressedSize;
+            total.second += entry.size;
+        }
+        return total;
+    }
+
+    std::string BundleZip::read(const BundleEntry &entry) const
+    {
+        std::string result;
+        result.reserve((size_t)entry.size);
+        read(entry, [&result](const char *data, size_t size)
+             { result.append(data, size); });
+        return result;
+    }
+
+    void BundleZip::read(const BundleEntry &entry, const std::function<void(const char *data, size_t size)> &sink) const
+    {
+        if (entry.flags & 1)
+        {
+            throw std::runtime_error("Zip entry '" + std::string(entry.name) + "' is encrypted, which is not supported.");
+        }
+        const uint8_t *data = _impl->entryData(entry);
+
+        VeloCrc32 crc;
+        uint64_t written = 0;
+        std::function<void(const char *, size_t)> checked = [&](const char *chunk, size_t size)
+        {
+            crc.update(chunk, size);
+            written += size;
+            sink(chunk, size);
+        };
+
+        if (entry.method == 0) // stored
+        {
+            const size_t CHUNK = 1024 * 1024;
+            for (uint64_t offset = 0; offset < entry.compressedSize; offset += CHUNK)
+            {
+                checked(reinterpret_cast<const char *>(data + offset), (size_t)(std::min)((uint64_t)CHUNK, entry.compressedSize - offset));
+            }
+        }
+        else if (entry.method == 8) // deflated
+        {
+            VeloInflate::run(data, (size_t)entry.compressedSize, checked);
+        }
+        else
+        {
+            throw std::runtime_error("Zip entry '" + std::string(entry.name) + "' uses an unsupported compression method (" + std::to_string(entry.method) + ").");
+        }
+
+        if (written != entry.size || crc.value() != entry.crc32)
+        {
+            throw std::runtime_error("Zip entry '" + std::string(entry.name) + "' is corrupt (size or CRC-32 mismatch).");
+        }
+    }
+
+    void BundleZip::extract(const BundleEntry &entry, const std::string &path) const
+    {
+        std::filesystem::path target(path);
+        if (entry.isDirectory())
+        {
+            std::filesystem::create_directories(target);
+            return;
+        }
+        if (target.has_parent_path())
+        {
+            std::filesystem::create_directories(target.parent_path());
+        }
+
+        std::ofstream out(target, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            throw std::runtime_error("Unable to create file: " + path);
+        }
+        try
+        {
+            read(entry, [&out, &path](const char *data, size_t size)
+                 {
+                     if (!out.write(data, (std::streamsize)size))
+                         throw std::runtime_error("Unable to write file: " + path); });
+            out.close();
+            if (entry.unixMode)
+            {
+                std::filesystem::permissions(target, (std::filesystem::perms)entry.unixMode);
+            }
+        }
+        catch (...)
+        {
+            out.close();
+            std::error_code ec;
+            std::filesystem::remove(target, ec);
+            throw;
+        }
+    }
+
+    void BundleZip::extractAll(const std::string &directory, const std::function<std::string(const BundleEntry &entry)> &pathFor,
+                               int threads, const ProgressHandler &progress) const
+    {
+        struct Job
+        {
+            const BundleEntry *entry;
+            std::filesystem::path path;
+        };
+
+        std::filesystem::path root(directory);
+        std::vector<Job> jobs;
+        std::vector<std::filesystem::path> directories{root};
+        uint64_t total = 0;
+        for (const auto &entry : _impl->entries)
+        {
+            std::string name = pathFor ? pathFor(entry) : std::string(entry.name);
+            if (name.empty())
+                continue;
+            if (!VeloZip_IsContainedPath(name))
+            {
+                throw std::runtime_error("Zip entry '" + std::string(entry.name) + "' would be extracted outside of '" + directory + "'.");
+            }
+            std::filesystem::path relative = std::filesystem::path(name).lexically_normal();
+            if (entry.isDirectory())
+            {
+                directories.push_back(root / relative);
+                continue;
+            }
+            jobs.push_back({&entry, root / relative});
+            directories.push_back(jobs.back().path.parent_path());
+            total += entry.size + VELO_EXTRACT_FILE_COST;
+        }
+
+        // create every directory once up front, rather than checking the parents of each file as it is written
+        std::sort(directories.begin(), directories.end());
+        directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+        for (const auto &path : directories)
+        {
+            std::filesystem::create_directories(path);
+        }
+
+        // stored entries are copied from the package by the kernel where possible, after checking their CRC-32
+        int package_fd = -1;
+#if defined(__linux__)
+        package_fd = ::open(_impl->path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+        std::atomic<uint64_t> done{0};
+        std::mutex progress_mutex;
+        int16_t reported = -1;
+        unsigned count = threads > 0 ? (unsigned)threads : std::thread::hardware_concurrency();
+        try
+        {
+            VeloParallel_For(jobs.size(), count, [&](size_t i)
+                             {
+                const Job &job = jobs[i];
+                const BundleEntry &entry = *job.entry;
+                try
+                {
+                    VeloRandomAccessFile file(job.path, true);
+                    if (entry.size >= VELO_EXTRACT_PREALLOCATE_SIZE)
+                    {
+                        file.resize(entry.size);
+                    }
+                    bool copied = false;
+                    if (package_fd >= 0 && entry.method == 0 && entry.size > 0)
+                    {
+                        read(entry, [](const char *, size_t) {});
+                        copied = file.copyFrom(package_fd, (uint64_t)(_impl->entryData(entry) - _impl->file.data()), 0, entry.size);
+                    }
+                    if (!copied)
+                    {
+                        uint64_t offset = 0;
+                        read(entry, [&file, &offset](const char *data, size_t size)
+                             {
+                                 file.writeAt(offset, data, size);
+                                 offset += size; });
+                    }
+                    if (entry.unixMode)
+                    {
+                        file.setMode(entry.unixMode);
+                    }
+                }
+                catch (...)
+                {
+                    std::error_code ec;
+                    std::filesystem::remove(job.path, ec);
+                    throw;
+                }
+
+                uint64_t now = done += entry.size + VELO_EXTRACT_FILE_COST;
+                if (progress)
+                {
+                    int16_t percent = (int16_t)(now * 100 / total);
+                    std::lock_guard<std::mutex> lock(progress_mutex);
+                    if (percent > reported)
+                    {
+                        reported = percent;
+                        progress(percent);
+                    }
+                } });
+        }
+        catch (...)
+        {
+#if defined(__linux__)
+            if (package_fd >= 0)
+                ::close(package_fd);
+#endif
+            throw;
+        }
+#if defined(__linux__)
+        if (package_fd >= 0)
+            ::close(package_fd);
+#endif
+    }
+
+    VelopackManifest BundleZip::readManifest() const
+    {
+        const BundleEntry *nuspec = find([](std::string_view name)
+                                         { return name.ends_with(".nuspec"); });
+        if (!nuspec)
+        {
+            throw std::runtime_error("This package is missing a package manifest (.nuspec).");
+        }
+        return VelopackManifest::parse(read(*nuspec));
+    }
+
+    DeltaApplier::DeltaApplier(const std::string &basePackage, const std::string &workDirectory, int threads)
+        : _impl(std::make_unique<Impl>())
+    {
+        _impl->work = workDirectory;
+        _impl->threads = threads > 0 ? (unsigned)threads : std::thread::hardware_concurrency();
+        std::filesystem::remove_all(_impl->work);
+        BundleZip::open(basePackage).extractAll(workDirectory, {}, (int)_impl->threads);
+    }
+
+    DeltaApplier::~DeltaApplier() = default;
+    DeltaApplier::DeltaApplier(DeltaApplier &&) noexcept = default;
+    DeltaApplier &DeltaApplier::operator=(DeltaApplier &&) noexcept = default;
+
+    void DeltaApplier::apply(const std::string &deltaPackage, const ProgressHandler &progress)
+    {
+        struct Patch
+        {
+            const BundleEntry *entry;
+            std::string target;
+        };
+
+        // app files which changed are patches (or an empty .diff if they did not), anything else is stored in full
+        BundleZip delta = BundleZip::open(deltaPackage);
+        std::unordered_set<std::string> keep; // every file of the new version, relative to the working directory
+        std::unordered_set<std::string_view> copies;
+        std::vector<Patch> patches;
+        for (const auto &entry : delta.entries())
+        {
+            std::string_view name = entry.name;
+            if (entry.isDirectory() || (VeloDelta_IsAppFile(name) && name.ends_with(".shasum")))
+                continue;
+            std::string_view suffix;
+            if (VeloDelta_IsAppFile(name))
+            {
+                for (std::string_view candidate : { ".zsdiff", ".bsdiff", ".diff" })
+                {
+                    if (name.ends_with(candidate))
+                    {
+                        suffix = candidate;
+                        break;
+                    }
+                }
+            }
+            if (suffix.empty())
+            {
+                keep.insert(std::string(name));
+                copies.insert(name);
+                continue;
+            }
+            std::string target(name.substr(0, name.size() - suffix.size()));
+            if (!VeloZip_IsContainedPath(target))
+            {
+                throw std::runtime_error("Delta entry '" + std::string(name) + "' would patch a file outside of '" + _impl->work.string() + "'.");
+            }
+            if (!std::filesystem::is_regular_file(_impl->work / target))
+            {
+                throw std::runtime_error("Unable to apply delta package, '" + target + "' is not in the base package.");
+            }
+            if (suffix != ".diff" || entry.size > 0)
+                patches.push_back({ &entry, target });
+            keep.insert(std::move(target));
+        }
+
+        std::atomic<size_t> done{0};
+        size_t total = patches.size() + copies.size();
+        std::mutex progress_mutex;
+        int16_t reported = -1;
+        auto report = [&](size_t now)
+        {
+            if (!progress || total == 0)
+                return;
+            int16_t percent = (int16_t)(now * 100 / total);
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            if (percent > reported)
+            {
+                reported = percent;
+                progress(percent);
+            }
+        };
+
+        VeloParallel_For(patches.size(), _impl->threads, [&](size_t i)
+                         {
+            const Patch &patch = patches[i];
+            std::string_view name = patch.entry->name;
+            const BundleEntry *shasum = delta.find(patch.target + ".shasum");
+            if (!shasum)
+            {
+                throw std::runtime_error("Unable to apply delta package, '" + patch.target + ".shasum' is missing.");
+            }
+            std::string expected_sha1;
+            uint64_t expected_size;
+            VeloDelta_ParseShasum(delta.read(*shasum), expected_sha1, expected_size);
+
+            // the patched file is written next to the old one, which is replaced once it has been checked
+            std::filesystem::path path = _impl->work / patch.target;
+            std::filesystem::path temp = path;
+            temp += ".velopatch";
+            try
+            {
+                std::string actual_sha1;
+                uint64_t actual_size;
+                {
+                    VeloMappedFile old(path);
+                    VeloPatchOutput out(temp);
+                    if (name.ends_with(".zsdiff"))
+                    {
+#if defined(VELOPACK_ZSTD)
+                        VeloZstd_Apply(old.data(), old.size(), delta, *patch.entry, out);
+#else
+                        throw std::runtime_error("Unable to apply '" + std::string(name) + "', zstd patches are not enabled (see VELOPACK_ZSTD).");
+#endif
+                    }
+                    else
+                    {
+                        std::string data = delta.read(*patch.entry);
+                        if (!data.starts_with("BSDIFF40"))
+                        {
+                            throw std::runtime_error("Unable to apply '" + std::string(name) + "', it is not a bsdiff patch.");
+                        }
+#if defined(VELOPACK_BZIP2)
+                        VeloBsdiff_Apply(old.data(), old.size(), data, out);
+#else
+                        throw std::runtime_error("Unable to apply '" + std::string(name) + "', bsdiff patches are not enabled (see VELOPACK_BZIP2).");
+#endif
+                    }
+                    out.setMode((uint32_t)std::filesystem::status(path).permissions() & 07777);
+                    actual_size = out.size();
+                    actual_sha1 = out.finishHex();
+                }
+                if (actual_size != expected_size || !VeloString_EqualsIgnoreCase(actual_sha1, expected_sha1))
+                {
+                    throw std::runtime_error("Patched file '" + patch.target + "' does not match its checksum, expected SHA1 " + expected_sha1 +
+                                             " (" + std::to_string(expected_size) + " bytes) but got " + actual_sha1 + " (" + std::to_string(actual_size) + " bytes).");
+                }
+                std::filesystem::rename(temp, path);
+            }
+            catch (...)
+            {
+                std::error_code ec;
+                std::filesystem::remove(temp, ec);
+                throw;
+            }
+            report(++done); });
+
+        if (!copies.empty())
+        {
+            size_t patched = done;
+            delta.extractAll(
+                _impl->work.string(), [&copies](const BundleEntry &entry)
+                { return copies.count(entry.name) ? std::string(entry.name) : std::string(); },
+                (int)_impl->threads, [&](int16_t percent)
+                { report(patched + copies.size() * percent / 100); });
+        }
+
+        // files which are not in the new version are deleted, and then any directories which that leaves empty
+        for (const auto &file : _impl->listFiles())
+        {
+            if (!keep.count(file))
+                std::filesystem::remove(_impl->work / file);
+        }
+        std::vector<std::filesystem::path> directories;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(_impl->work))
+        {
+            if (entry.is_directory())
+                directories.push_back(entry.path());
+        }
+        std::sort(directories.rbegin(), directories.rend());
+        for (const auto &directory : directories)
+        {
+            std::error_code ec;
+            std::filesystem::remove(directory, ec); // fails if it is not empty
+        }
+    }
+
+    void DeltaApplier::finish(const std::string &outputPackage) const
+    {
+        struct File
+        {
+            std::string name;
+            uint64_t size = 0;
+            uint32_t crc32 = 0;
+            uint32_t mode = 0;
+        };
+        std::vector<File> files;
+        for (auto &name : _impl->listFiles())
+        {
+            files.push_back({ std::move(name) });
+        }
+
+        // a local header needs the CRC-32 before the data, so the files are checksummed (in parallel) first
+        VeloParallel_For(files.size(), _impl->threads, [&](size_t i)
+                         {
+            File &file = files[i];
+            std::filesystem::path path = _impl->work / file.name;
+            VeloMappedFile mapped(path);
+            VeloCrc32 crc;
+            crc.update(mapped.data(), (size_t)mapped.size());
+            file.size = mapped.size();
+            file.crc32 = crc.value();
+#if !defined(_WIN32)
+            file.mode = (uint32_t)std::filesystem::status(path).permissions() & 07777;
+#endif
+        });
+
+#if defined(_WIN32)
+        const uint16_t made_by = 45; // MS-DOS, zip 4.5
+#else
+        const uint16_t made_by = 3 << 8 | 45; // Unix, zip 4.5
+#endif
+        try
+        {
+            VeloRandomAccessFile out(outputPackage, true);
+            std::string directory;
+            uint64_t offset = 0;
+            for (const auto &file : files)
+            {
+                bool zip64 = file.size >= VELO_ZIP64_LIMIT;
+                std::string header;
+                VeloZip_Put32(header, 0x04034b50);
+                VeloZip_Put16(header, zip64 ? 45 : 20); // version needed to extract
+                VeloZip_Put16(header, 0x0800);          // names are UTF-8
+                VeloZip_Put16(header, 0);               // stored
+                VeloZip_Put16(header, 0);               // 00:00
+                VeloZip_Put16(header, 0x0021);          // 1980-01-01
+                VeloZip_Put32(header, file.crc32);
+                VeloZip_Put32(header, zip64 ? 0xFFFFFFFF : (uint32_t)file.size);
+                VeloZip_Put32(header, zip64 ? 0xFFFFFFFF : (uint32_t)file.size);
+                VeloZip_Put16(header, (uint16_t)file.name.size());
+                VeloZip_Put16(header, zip64 ? 20 : 0);
+                header += file.name;
+                if (zip64)
+                {
+                    VeloZip_Put16(header, 1);
+                    VeloZip_Put16(header, 16);
+                    VeloZip_Put64(header, file.size);
+                    VeloZip_Put64(header, file.size);
+                }
+                out.writeAt(offset, header.data(), header.size());
+                {
+                    VeloMappedFile mapped(_impl->work / file.name);
+                    out.writeAt(offset + header.size(), reinterpret_cast<const char *>(mapped.data()), (size_t)mapped.size());
+                }
+
+                std::string extra;
+                if (zip64)
+                {
+                    VeloZip_Put64(extra, file.size);
+                    VeloZip_Put64(extra, file.size);
+                }
+                if (offset >= VELO_ZIP64_LIMIT)
+                {
+                    VeloZip_Put64(extra, offset);
+                }
+                VeloZip_Put32(directory, 0x02014b50);
+                VeloZip_Put16(directory, made_by);
+                directory.append(header, 4, 24); // version needed to extract, through to the name length
+                VeloZip_Put16(directory, (uint16_t)(extra.empty() ? 0 : extra.size() + 4));
+                VeloZip_Put16(directory, 0); // comment length
+                VeloZip_Put16(directory, 0); // disk number
+                VeloZip_Put16(directory, 0); // internal attributes
+                VeloZip_Put32(directory, file.mode ? (0100000 | file.mode) << 16 : 0);
+                VeloZip_Put32(directory, offset >= VELO_ZIP64_LIMIT ? 0xFFFFFFFF : (uint32_t)offset);
+                directory += file.name;
+                if (!extra.empty())
+                {
+                    VeloZip_Put16(directory, 1);
+                    VeloZip_Put16(directory, (uint16_t)extra.size());
+                    directory += extra;
+                }
+                offset += header.size() + file.size;
+            }
+
+            uint64_t directory_size = directory.size();
+            bool zip64 = files.size() >= 0xFFFF || offset >= VELO_ZIP64_LIMIT || directory_size >= VELO_ZIP64_LIMIT;
+            if (zip64)
+            {
+                VeloZip_Put32(directory, 0x06064b50);
+                VeloZip_Put64(directory, 44); // size of the rest of this record
+                VeloZip_Put16(directory, made_by);
+                VeloZip_Put16(directory, 45);
+                VeloZip_Put32(directory, 0);
+                VeloZip_Put32(directory, 0);
+                VeloZip_Put64(directory, files.size());
+                VeloZip_Put64(directory, files.size());
+                VeloZip_Put64(directory, directory_size);
+                VeloZip_Put64(directory, offset);
+                VeloZip_Put32(directory, 0x07064b50);
+                VeloZip_Put32(directory, 0);
+                VeloZip_Put64(directory, offset + directory_size);
+                VeloZip_Put32(directory, 1);
+            }
+            VeloZip_Put32(directory, 0x06054b50);
+            VeloZip_Put16(directory, 0);
+            VeloZip_Put16(directory, 0);
+            VeloZip_Put16(directory, zip64 ? 0xFFFF : (uint16_t)files.size());
+            VeloZip_Put16(directory, zip64 ? 0xFFFF : (uint16_t)files.size());
+            VeloZip_Put32(directory, zip64 ? 0xFFFFFFFF : (uint32_t)directory_size);
+            VeloZip_Put32(directory, zip64 ? 0xFFFFFFFF : (uint32_t)offset);
+            VeloZip_Put16(directory, 0); // comment length
+            out.writeAt(offset, directory.data(), directory.size());
+        }
+        catch (...)
+        {
+            std::error_code ec;
+            std::filesystem::remove(outputPackage, ec);
+            throw;
+        }
+    }
+
+    void applyDeltaPackages(const std::string &basePackage, const std::vector<std::string> &deltaPackages,
+                            const std::string &outputPackage, const ProgressHandler &progress)
+    {
+        // extracting the base, each delta and writing the package are a step each
+        size_t steps = deltaPackages.size() + 2;
+        auto report = [&](size_t step, int16_t percent)
+        {
+            if (progress)
+                progress((int16_t)((step * 100 + (size_t)percent) / steps));
+        };
+
+        DeltaApplier applier(basePackage, outputPackage + ".work");
+        report(1, 0);
+        for (size_t i = 0; i < deltaPackages.size(); i++)
+        {
+            applier.apply(deltaPackages[i], [&](int16_t percent)
+                          { report(i + 1, percent); });
+        }
+        applier.finish(outputPackage);
+        report(steps, 0);
+    }
+
+    std::string HttpResponse::header(std::string_view name) const
+    {
+        for (const auto &[key, value] : headers)
+        {
+            if (VeloString_EqualsIgnoreCase(key, name))
+            {
+                return value;
+            }
+        }
+        return {};
+    }
+
+    std::shared_ptr<HttpClient> HttpClient::createDefault()
+    {
+        return std::make_shared<VeloHttpClient>();
+    }
+
+    struct BandwidthLimiter::Impl
+    {
+        using Clock = std::chrono::steady_clock;
+        // how long a waiting acquire may go without looking at its cancellation token, which can not wake it
+        static constexpr std::chrono::milliseconds cancellationPoll{ 100 };
+
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+        uint64_t rate = 0;
+        double tokens = 0; // may go below zero after a large acquire, which the next ones then wait out
+        Clock::time_point refilled = Clock::now();
+        bool paused = false;
+        std::function<bool()> isIdle;
+        Clock::time_point idleChecked;
+        bool idle = true;
+        uint64_t total = 0;
+        mutable std::deque<std::pair<Clock::time_point, uint64_t>> samples; // (time, total) at most every 250ms
+
+        // the bucket holds a quarter of a second of traffic, but no less than the size of a typical network read
+        double capacity() const
+        {
+            return (std::max)((double)rate / 4, 64.0 * 1024);
+        }
+
+        void refill(Clock::time_point now)
+        {
+            double elapsed = std::chrono::duration<double>(now - refilled).count();
+            tokens = (std::min)(capacity(), tokens + elapsed * (double)rate);
+            refilled = now;
+        }
+
+        void dropOldSamples(Clock::time_point now) const
+        {
+            while (!samples.empty() && now - samples.front().first > std::chrono::seconds(2))
+                samples.pop_front();
+        }
+    };
+
+    BandwidthLimiter::BandwidthLimiter(uint64_t bytesPerSecond) : _impl(std::make_unique<Impl>())
+    {
+        _impl->rate = bytesPerSecond;
+        _impl->tokens = _impl->capacity();
+    }
+
+    BandwidthLimiter::~BandwidthLimiter() = default;
+
+    void BandwidthLimiter::setBytesPerSecond(uint64_t bytesPerSecond)
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        _impl->refill(Impl::Clock::now());
+        _impl->rate = bytesPerSecond;
+        _impl->tokens = (std::min)(_impl->tokens, _impl->capacity());
+        _impl->changed.notify_all();
+    }
+
+    uint64_t BandwidthLimiter::bytesPerSecond() const
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        return _impl->rate;
+    }
+
+    void BandwidthLimiter::pause()
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        _impl->paused = true;
+    }
+
+    void BandwidthLimiter::resume()
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        _impl->paused = false;
+        _impl->changed.notify_all();
+    }
+
+    bool BandwidthLimiter::isPaused() const
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        return _impl->paused;
+    }
+
+    void BandwidthLimiter::setIdleCondition(std::function<bool()> isIdle)
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        _impl->isIdle = std::move(isIdle);
+        _impl->idleChecked = {};
+        _impl->idle = true;
+        _impl->changed.notify_all();
+    }
+
+    double BandwidthLimiter::throughput() const
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        auto now = Impl::Clock::now();
+        _impl->dropOldSamples(now);
+        if (_impl->samples.empty())
+        {
+            return 0;
+        }
+        double seconds = (std::max)(std::chrono::duration<double>(now - _impl->samples.front().first).count(), 0.25);
+        return (double)(_impl->total - _impl->samples.front().second) / seconds;
+    }
+
+    uint64_t BandwidthLimiter::totalBytes() const
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        return _impl->total;
+    }
+
+    void BandwidthLimiter::acquire(size_t bytes, const CancellationToken &cancellation)
+    {
+        std::unique_lock<std::mutex> lock(_impl->mutex);
+        for (;;)
+        {
+            if (cancellation.isCancelled())
+            {
+                throw ProcessCancelledException("The download was cancelled.");
+            }
+            auto now = Impl::Clock::now();
+            auto poll = now + Impl::cancellationPoll;
+            if (_impl->isIdle && now - _impl->idleChecked >= std::chrono::seconds(1))
+            {
+                // asked without the lock, the app's check may take its own locks
+                std::function<bool()> is_idle = _impl->isIdle;
+                _impl->idleChecked = now;
+                lock.unlock();
+                bool idle = is_idle();
+                lock.lock();
+                _impl->idle = idle;
+                continue;
+            }
+            if (_impl->paused || (_impl->isIdle && !_impl->idle))
+            {
+                if (_impl->isIdle)
+                    _impl->changed.wait_until(lock, (std::min)(poll, _impl->idleChecked + std::chrono::seconds(1)));
+                else
+                    _impl->changed.wait_until(lock, poll);
+                continue;
+            }
+            if (_impl->rate == 0)
+            {
+                break;
+            }
+            _impl->refill(now);
+            if (_impl->tokens >= 0)
+            {
+                _impl->tokens -= (double)bytes;
+                break;
+            }
+            auto wait = std::chrono::duration<double>(-_impl->tokens / (double)_impl->rate);
+            _impl->changed.wait_until(lock, (std::min)(poll, now + std::chrono::duration_cast<Impl::Clock::duration>(wait)));
+        }
+
+        auto now = Impl::Clock::now();
+        if (_impl->samples.empty() || now - _impl->samples.back().first >= std::chrono::milliseconds(250))
+        {
+            _impl->samples.emplace_back(now, _impl->total);
+            _impl->dropOldSamples(now);
+        }
+        _impl->total += bytes;
+    }
+
+    HttpSource::HttpSource(std::string url, std::shared_ptr<HttpClient> client)
+        : _url(std::move(url)), _client(client ? std::move(client) : HttpClient::createDefault())
+    {
+    }
+
+    std::string HttpSource::getFileUrl(std::string_view fileName) const
+    {
+        std::string base = _url;
+        while (!base.empty() && base.back() == '/')
+        {
+            base.pop_back();
+        }
+        return base + "/" + VeloUrl_Encode(fileName);
+    }
+
+    void HttpSource::setCacheDirectory(std::string directory)
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        _cacheDirectory = std::move(directory);
+    }
+
+    void HttpSource::setFeedTimeout(std::chrono::milliseconds timeout)
+    {
+        _feedTimeout = timeout;
+    }
+
+    VelopackAssetFeed HttpSource::getReleaseFeed(const std::string &channel, const VelopackManifest &app, const CancellationToken &cancellation)
+    {
+        std::string file_name = "releases." + channel + ".json";
+        std::string url = getFileUrl(file_name) + "?localVersion=" + VeloUrl_Encode(app.version) + "&id=" + VeloUrl_Encode(app.id);
+
+        // the disk cache holds one feed per channel, and is only valid for the exact same request
+        CachedFeed cached;
+        std::filesystem::path body_path, meta_path;
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            if (!_cacheDirectory.empty())
+            {
+                body_path = std::filesystem::path(_cacheDirectory) / file_name;
+                meta_path = std::filesystem::path(_cacheDirectory) / (file_name + ".meta");
+            }
+            auto it = _cache.find(url);
+            if (it != _cache.end())
+                cached = it->second;
+        }
+        std::error_code exists_ec;
+        if (!cached.feed && !meta_path.empty() && std::filesystem::is_regular_file(body_path, exists_ec))
+        {
+            // the validators are only sent while the body they describe is there to be reused
+            std::ifstream meta(meta_path);
+            std::string meta_url;
+            if (meta && std::getline(meta, meta_url) && meta_url == url)
+            {
+                std::getline(meta, cached.etag);
+                std::getline(meta, cached.lastModified);
+            }
+        }
+
+        // cancellation and the deadline are checked as the body arrives, so a server which sends it slowly can not
+        // hold up the caller (eg. UpdateScheduler::stop) for longer than it takes to send one chunk
+        std::chrono::milliseconds timeout = _feedTimeout;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto check_aborted = [&]
+        {
+            if (cancellation.isCancelled())
+                throw ProcessCancelledException("The update check was cancelled.");
+            if (std::chrono::steady_clock::now() > deadline)
+                throw ProcessTimeoutException("The release feed " + url + " did not arrive within " + std::to_string(timeout.count()) + " ms.");
+        };
+        auto fetch = [&](const HttpRequest &request)
+        {
+            check_aborted();
+            std::string body;
+            HttpResponse response = _client->get(request, [&](const HttpResponse &, const char *data, size_t size)
+            {
+                check_aborted();
+                body.append(data, size);
+            });
+            check_aborted();
+            response.body = std::move(body);
+            return response;
+        };
+
+        HttpRequest request{ url, {} };
+        if (!cached.etag.empty())
+            request.headers.emplace_back("If-None-Match", cached.etag);
+        if (!cached.lastModified.empty())
+            request.headers.emplace_back("If-Modified-Since", cached.lastModified);
+        HttpResponse response = fetch(request);
+
+        std::shared_ptr<const VelopackAssetFeed> feed;
+        if (response.statusCode == 304 && (!cached.etag.empty() || !cached.lastModified.empty()))
+        {
+            // not modified: reuse the feed parsed earlier, or parse the body stored on disk by a previous process
+            feed = cached.feed;
+            if (!feed)
+            {
+                try
+                {
+                    std::ifstream body(body_path, std::ios::binary);
+                    std::ostringstream contents;
+                    contents << body.rdbuf();
+                    auto parsed = std::make_shared<VelopackAssetFeed>(VelopackAssetFeed::fromJson(contents.str()));
+                    parsed->validator = url + "\n" + cached.etag + "\n" + cached.lastModified;
+                    feed = parsed;
+                }
+                catch (const std::exception &)
+                {
+                    // the body went away or was damaged since it was checked for: ask again without the validators
+                    cached = CachedFeed();
+                    response = fetch(HttpRequest{ url, {} });
+                }
+            }
+        }
+        if (!feed)
+        {
+            VeloHttp_EnsureSuccess(response, url);
+            auto parsed = std::make_shared<VelopackAssetFeed>(VelopackAssetFeed::fromJson(response.body));
+            cached.etag = response.header("etag");
+            cached.lastModified = response.header("last-modified");
+            if (!cached.etag.empty() || !cached.lastModified.empty())
+            {
+                parsed->validator = url + "\n" + cached.etag + "\n" + cached.lastModified;
+            }
+            feed = parsed;
+            if (!body_path.empty())
+            {
+                // best effort, a failure to write the cache only costs a full download next time
+                std::error_code ec;
+                std::filesystem::create_directories(body_path.parent_path(), ec);
+                std::filesystem::path body_tmp = body_path.string() + ".tmp", meta_tmp = meta_path.string() + ".tmp";
+                std::ofstream(body_tmp, std::ios::binary | std::ios::trunc) << response.body;
+                std::ofstream(meta_tmp, std::ios::binary | std::ios::trunc) << url << "\n" << cached.etag << "\n" << cached.lastModified << "\n";
+                std::filesystem::rename(body_tmp, body_path, ec);
+                if (!ec)
+                    std::filesystem::rename(meta_tmp, meta_path, ec);
+            }
+        }
+
+        if (!feed->validator.empty())
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            cached.feed = feed;
+            _cache[url] = cached;
+        }
+        return *feed;
+    }
+
+    void HttpSource::setMaxConnections(int connections)
+    {
+        _maxConnections = (std::max)(connections, 1);
+    }
+
+    void HttpSource::setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter)
+    {
+        std::lock_guard<std::mutex> lock(_limiterMutex);
+        _limiter = std::move(limiter);
+    }
+
+    void HttpSource::downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress,
+                                          const CancellationToken &cancellation)
+    {
+        std::shared_ptr<BandwidthLimiter> limiter;
+        {
+            std::lock_guard<std::mutex> lock(_limiterMutex);
+            limiter = _limiter;
+        }
+        std::string url = getFileUrl(asset.fileName);
+        VeloDownload download(*_client, url, localFile, asset, progress, limiter.get(), cancellation);
+        download.run(_maxConnections);
+    }
+
+    FileSource::FileSource(std::string path) : _path(std::move(path)) {}
+
+    void FileSource::setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter)
+    {
+        std::lock_guard<std::mutex> lock(_limiterMutex);
+        _limiter = std::move(limiter);
+    }
+
+    VelopackAssetFeed FileSource::getReleaseFeed(const std::string &channel, const VelopackManifest &, const CancellationToken &cancellation)
+    {
+        if (cancellation.isCancelled())
+        {
+            throw ProcessCancelledException("The update check was cancelled.");
+        }
+        std::filesystem::path releases = std::filesystem::path(_path) / ("releases." + channel + ".json");
+        if (!std::filesystem::exists(releases))
+        {
+            throw std::runtime_error("Releases file not found: " + releases.string());
+        }
+        return VelopackAssetFeed::fromJson(VeloFile_ReadAllText(releases));
+    }
+
+    void FileSource::downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress,
+                                          const CancellationToken &cancellation)
+    {
+        std::filesystem::path source_path = std::filesystem::path(_path) / asset.fileName;
+        std::ifstream source(source_path, std::ios::binary);
+        if (!source)
+        {
+            throw std::runtime_error("Unable to open file: " + source_path.string());
+        }
+        std::ofstream target(localFile, std::ios::binary | std::ios::trunc);
+        if (!target)
+        {
+            throw std::runtime_error("Unable to create file: " + localFile);
+        }
+
+        std::shared_ptr<BandwidthLimiter> limiter;
+        {
+            std::lock_guard<std::mutex> lock(_limiterMutex);
+            limiter = _limiter;
+        }
+
+        // copy and hash in one pass, rather than verifying the copy afterwards
+        std::string expected;
+        VeloHash hash = VeloHash::forAsset(asset, expected);
+        std::error_code ec;
+        uint64_t total = std::filesystem::file_size(source_path, ec);
+        uint64_t copied = 0;
+        int16_t last_progress = 0;
+        std::vector<char> buffer(limiter ? 64 * 1024 : 1024 * 1024); // smaller chunks keep a throttled copy smooth
+        while (source)
+        {
+            source.read(buffer.data(), (std::streamsize)buffer.size());
+            size_t size = (size_t)source.gcount();
+            if (cancellation.isCancelled())
+            {
+                throw ProcessCancelledException("The copy was cancelled.");
+            }
+            if (limiter)
+                limiter->acquire(size, cancellation);
+            hash.update(buffer.data(), size);
+            target.write(buffer.data(), (std::streamsize)size);
+            copied += size;
+            if (progress && total > 0)
+            {
+                // floor to nearest 5% to reduce message spam
+                int16_t new_progress = (int16_t)((std::min)(copied * 20 / total, (uint64_t)20) * 5);
+                if (new_progress > last_progress)
+                {
+                    last_progress = new_progress;
+                    progress(last_progress);
+                }
+            }
+        }
+        target.close();
+        if (source.bad() || !target)
+        {
+            throw std::runtime_error("Unable to copy '" + source_path.string() + "' to '" + localFile + "'.");
+        }
+        std::string actual = hash.finishHex();
+        if (!expected.empty() && !VeloString_EqualsIgnoreCase(actual, expected))
+        {
+            std::filesystem::remove(localFile, ec);
+            throw std::runtime_error("The file '" + source_path.string() + "' is corrupt, expected " + (asset.sha256.empty() ? "SHA1 " : "SHA256 ") +
+                                     expected + " but got " + actual + ".");
+        }
+        if (progress && last_progress < 100)
+            progress(100);
+    }
+
+    SharedCacheSource::SharedCacheSource(std::shared_ptr<UpdateSource> inner, std::string directory)
+        : _inner(std::move(inner)), _directory(directory.empty() ? defaultDirectory() : std::move(directory))
+    {
+        if (!_inner)
+        {
+            throw std::invalid_argument("SharedCacheSource needs a source to download packages from.");
+        }
+    }
+
+    std::string SharedCacheSource::defaultDirectory()
+    {
+#if defined(_WIN32)
+        const wchar_t *local_app_data = _wgetenv(L"LOCALAPPDATA");
+        std::filesystem::path root = local_app_data ? std::filesystem::path(local_app_data) : std::filesystem::temp_directory_path();
+        return (root / "velopack" / "shared").string();
+#elif defined(__APPLE__)
+        return (std::filesystem::path(nativeGetHomeDirectory()) / "Library" / "Caches" / "velopack" / "shared").string();
+#else
+        // next to the packages directories, so that hard links work, and one for each account
+        return "/var/tmp/velopack/shared-" + std::to_string(::geteuid());
+#endif
+    }
+
+    const std::string &SharedCacheSource::directory() const
+    {
+        return _directory;
+    }
+
+    VelopackAssetFeed SharedCacheSource::getReleaseFeed(const std::string &channel, const VelopackManifest &app, const CancellationToken &cancellation)
+    {
+        return _inner->getReleaseFeed(channel, app, cancellation);
+    }
+
+    void SharedCacheSource::downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress,
+                                                 const CancellationToken &cancellation)
+    {
+        std::string key = VeloString_ToUpper(asset.sha1);
+        if (key.size() != 40 || !std::all_of(key.begin(), key.end(), [](char c)
+                                             { return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F'); }))
+        {
+            _inner->downloadReleaseEntry(asset, localFile, progress, cancellation); // nothing to address it by
+            return;
+        }
+
+#if !defined(_WIN32)
+        // the cache belongs to one account. Anyone else who could write to it could also change a package after it
+        // was checked, so a directory which another account owns or may write to is not used.
+        if (std::filesystem::create_directories(_directory))
+        {
+            std::filesystem::permissions(_directory, std::filesystem::perms::owner_all);
+        }
+        struct stat info;
+        if (::stat(_directory.c_str(), &info) != 0 || info.st_uid != ::geteuid() || (info.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+        {
+            _inner->downloadReleaseEntry(asset, localFile, progress, cancellation);
+            return;
+        }
+#endif
+
+        // objects are spread over 256 directories by the first byte of their hash. Whoever holds the lock of an
+        // object fetches it, and other updaters which want the same package wait and then link to it.
+        std::filesystem::path shard = std::filesystem::path(_directory) / key.substr(0, 2);
+        std::filesystem::create_directories(shard);
+        std::filesystem::path object = shard / key;
+        VeloFileLock lock(shard / (key + ".lock"), cancellation);
+
+        // objects only appear once complete, but one may have been damaged on disk since, so it is checked before use
+        std::error_code ec;
+        if (std::filesystem::exists(object, ec) && !VeloString_EqualsIgnoreCase(VeloFile_Hash(object, VeloHash::sha1()), key))
+        {
+            std::filesystem::remove(object, ec);
+        }
+        if (std::filesystem::exists(object, ec))
+        {
+            std::filesystem::last_write_time(object, std::filesystem::file_time_type::clock::now(), ec); // see prune
+            if (progress)
+                progress(100);
+        }
+        else
+        {
+            // an interrupted download resumes from here, whichever app started it
+            std::filesystem::path partial = object;
+            partial += ".partial";
+            _inner->downloadReleaseEntry(asset, partial.string(), progress, cancellation);
+            if (!asset.sha256.empty() && !VeloString_EqualsIgnoreCase(VeloFile_Hash(partial, VeloHash::sha1()), key))
+            {
+                std::filesystem::remove(partial, ec);
+                throw std::runtime_error("The package '" + asset.fileName + "' does not match its SHA1 " + key + ".");
+            }
+#if !defined(_WIN32)
+            std::filesystem::permissions(partial, std::filesystem::perms::owner_read | std::filesystem::perms::group_read | std::filesystem::perms::others_read, ec);
+#endif
+            std::filesystem::rename(partial, object);
+        }
+        VeloFile_Link(object, localFile);
+    }
+
+    uint64_t SharedCacheSource::prune(std::chrono::hours unusedFor)
+    {
+        uint64_t freed = 0;
+        auto cutoff = std::filesystem::file_time_type::clock::now() - unusedFor;
+        std::error_code ec;
+        for (std::filesystem::directory_iterator shards(_directory, ec), end; !ec && shards != end; shards.increment(ec))
+        {
+            std::error_code shard_ec;
+            for (std::filesystem::directory_iterator it(shards->path(), shard_ec); !shard_ec && it != end; it.increment(shard_ec))
+            {
+                std::string name = it->path().filename().string();
+                bool is_object = name.size() == 40;
+                bool is_partial = name.size() > 40 && name.find(".partial") == 40;
+                if (!is_object && !is_partial)
+                    continue;
+                std::error_code file_ec;
+                if (it->last_write_time(file_ec) > cutoff || file_ec)
+                    continue;
+                VeloFileLock lock(shards->path() / (name.substr(0, 40) + ".lock"));
+                uint64_t size = it->file_size(file_ec);
+                // an object which an app still links to costs no extra space, and the next update may want it
+                if (is_object && std::filesystem::hard_link_count(it->path(), file_ec) > 1)
+                    continue;
+                if (std::filesystem::remove(it->path(), file_ec))
+                    freed += size;
+            }
+        }
+        // the lock files are kept: removing one could let two processes lock different files for the same package
+        return freed;
+    }
+
+    bool verifyAsset(const std::string &path, const VelopackAsset &asset)
+    {
+        std::string expected;
+        VeloHash hash = VeloHash::forAsset(asset, expected);
+        return !expected.empty() && VeloString_EqualsIgnoreCase(VeloFile_Hash(path, hash), expected);
+    }
+
+    struct CancellationToken::State
+    {
+        std::atomic<bool> cancelled{ false };
+        std::shared_ptr<State> parents[2];
+
+        bool isCancelled() const
+        {
+            if (cancelled.load(std::memory_order_acquire))
+                return true;
+            for (const auto &parent : parents)
+            {
+                if (parent && parent->isCancelled())
+                    return true;
+            }
+            return false;
+        }
+    };
+
+    CancellationToken::CancellationToken() : _state(std::make_shared<State>()) {}
+
+    CancellationToken CancellationToken::linked(const CancellationToken &a, const CancellationToken &b)
+    {
+        CancellationToken token;
+        token._state->parents[0] = a._state;
+        token._state->parents[1] = b._state;
+        return token;
+    }
+
+    void CancellationToken::cancel() const
+    {
+        _state->cancelled.store(true, std::memory_order_release);
+    }
+
+    bool CancellationToken::isCancelled() const
+    {
+        return _state->isCancelled();
+    }
+
+    AsyncProcess::AsyncProcess(const std::vector<std::string> &command_line, const ProcessOptions &options)
+        : _impl(std::make_unique<Impl>(command_line, options)) {}
+
+    AsyncProcess::~AsyncProcess() = default;
+    AsyncProcess::AsyncProcess(AsyncProcess &&) noexcept = default;
+    AsyncProcess &AsyncProcess::operator=(AsyncProcess &&) noexcept = default;
+
+    int AsyncProcess::stdoutFd() const
+    {
+#if defined(_WIN32)
+        return -1;
+#else
+        FILE *stream = _impl->stream(0);
+        return stream ? fileno(stream) : -1;
+#endif
+    }
+
+    int AsyncProcess::stderrFd() const
+    {
+#if defined(_WIN32)
+        return -1;
+#else
+        FILE *stream = _impl->stream(1);
+        return stream ? fileno(stream) : -1;
+#endif
+    }
+
+    int AsyncProcess::pidFd() const
+    {
+        return _impl->pid_fd;
+    }
+
+    int AsyncProcess::processId() const
+    {
+#if defined(_WIN32)
+        return (int)GetProcessId(_impl->child.get()->hProcess);
+#else
+        return (int)_impl->child.get()->child;
+#endif
+    }
+
+    void *AsyncProcess::processHandle() const
+    {
+#if defined(_WIN32)
+        return _impl->child.get()->hProcess;
+#else
+        return nullptr;
+#endif
+    }
+
+    std::chrono::milliseconds AsyncProcess::nextTimeout() const
+    {
+        if (_impl->complete)
+        {
+            return std::chrono::milliseconds(0);
+        }
+        int wait_ms = _impl->supervisor.nextWaitMs(VELO_PROCESS_POLL_MS);
+        if (!_impl->stream(0) && !_impl->stream(1) && _impl->pid_fd < 0)
+        {
+            // nothing left to wait on, exit can only be noticed by polling for it
+            wait_ms = (std::min)(wait_ms, 5);
+        }
+        return std::chrono::milliseconds(wait_ms);
+    }
+
+    bool AsyncProcess::poll()
+    {
+        return _impl->poll();
+    }
+
+    bool AsyncProcess::isComplete() const
+    {
+        return _impl->complete;
+    }
+
+    void AsyncProcess::terminate()
+    {
+        if (!_impl->complete)
+        {
+            _impl->fail(std::make_exception_ptr(ProcessCancelledException(
+                "Process '" + _impl->supervisor.name() + "' was terminated.", -1, _impl->errors.str())));
+        }
+    }
+
+    std::string AsyncProcess::result() const
+    {
+        if (!_impl->complete)
+        {
+            throw ProcessException("Process '" + _impl->supervisor.name() + "' has not completed yet.");
+        }
+        if (_impl->error)
+        {
+            std::rethrow_exception(_impl->error);
+        }
+        return _impl->output;
+    }
+
+    static std::shared_ptr<UpdateInfo> parseUpdateInfo(const std::string &output)
+    {
+        std::string json = Platform::strTrim(output);
+        if (json.empty() || json == "null")
+        {
+            return nullptr;
+        }
+        return UpdateInfo::fromJson(json);
+    }
+
+    UpdateCheckOperation::UpdateCheckOperation(AsyncProcess process) : _process(std::move(process)) {}
+
+    AsyncProcess &UpdateCheckOperation::process()
+    {
+        return _process;
+    }
+
+    bool UpdateCheckOperation::poll()
+    {
+        return _process.poll();
+    }
+
+    std::shared_ptr<UpdateInfo> UpdateCheckOperation::result() const
+    {
+        return parseUpdateInfo(_process.result());
+    }
+
+    void UpdateManager::setProcessTimeout(std::chrono::milliseconds timeout)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _processTimeout = timeout;
+    }
+
+    void UpdateManager::cancelAll()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _lifetime.cancel();
+        _lifetime = CancellationToken();
+    }
+
+    ProcessOptions UpdateManager::getProcessOptions(const CancellationToken &cancellation) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ProcessOptions options;
+        options.timeout = _processTimeout;
+        options.cancellation = CancellationToken::linked(cancellation, _lifetime);
+        return options;
+    }
+
+    std::string UpdateManager::getCurrentVersion(const CancellationToken &cancellation) const
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_locator)
+            {
+                return _locator->manifest.version;
+            }
+        }
+        return VeloInstallContext::current()->currentVersion(getProcessOptions(cancellation));
+    }
+
+    void UpdateManager::setLocator(VelopackLocator locator)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _locator = std::make_shared<const VelopackLocator>(std::move(locator));
+        _urlSource.reset(); // its feed cache is in the packages directory
+        _packages.reset();
+    }
+
+    std::shared_ptr<const VelopackLocator> UpdateManager::getLocator() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return findLocator();
+    }
+
+    std::shared_ptr<const VelopackLocator> UpdateManager::findLocator() const
+    {
+        if (_locator)
+        {
+            return _locator;
+        }
+        std::shared_ptr<VeloInstallContext> context = VeloInstallContext::current();
+        const VelopackLocator *located = context->tryLocator();
+        return located ? std::shared_ptr<const VelopackLocator>(context, located) : nullptr;
+    }
+
+    // Picks the latest full release in the feed which has been rolled out to this client, and decides if it is an
+    // update for the installed app.
+    static std::shared_ptr<UpdateInfo> findUpdate(const VelopackAssetFeed &feed, const VelopackManifest &app, const std::string &channel,
+                                                  bool allowDowngrade, std::string_view rolloutId)
+    {
+        if (feed.assets.empty())
+        {
+            throw std::runtime_error("Zero assets found in releases feed.");
+        }
+
+        std::shared_ptr<VelopackAsset> latest = feed.latest(VelopackAssetType::full, rolloutId);
+        if (!latest)
+        {
+            if (feed.latest(VelopackAssetType::full))
+            {
+                return nullptr; // none rolled out to this client yet
+            }
+            throw std::runtime_error("No valid full releases found in feed.");
+        }
+        SemanticVersion latest_version = SemanticVersion::parse(latest->version);
+
+        SemanticVersion app_version = SemanticVersion::parse(app.version);
+        bool is_non_default_channel = channel != app.channel;
+        bool is_downgrade = false;
+        if (latest_version > app_version)
+        {
+            is_downgrade = false;
+        }
+        else if (latest_version < app_version && allowDowngrade)
+        {
+            is_downgrade = true;
+        }
+        else if (latest_version == app_version && allowDowngrade && is_non_default_channel)
+        {
+            is_downgrade = true; // the same version on a different channel
+        }
+        else
+        {
+            return nullptr;
+        }
+
+        auto info = std::make_shared<UpdateInfo>();
+        info->targetFullRelease = latest;
+        info->isDowngrade = is_downgrade;
+        return info;
+    }
+
+    void UpdateManager::setUpdateSource(std::shared_ptr<UpdateSource> source)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _updateSource = std::move(source);
+    }
+
+    void UpdateManager::setHttpClient(std::shared_ptr<HttpClient> client)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _httpClient = std::move(client);
+        _urlSource.reset();
+    }
+
+    void UpdateManager::setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _bandwidthLimiter = std::move(limiter);
+        _urlSource.reset();
+    }
+
+    std::shared_ptr<UpdateSource> UpdateManager::getUpdateSource() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_updateSource)
+        {
+            return _updateSource;
+        }
+        std::string url(getUrlOrPath());
+        if (_urlSource && _urlSourceUrl == url)
+        {
+            return _urlSource; // keep the same source, so its feed cache survives between checks
+        }
+        _urlSource.reset();
+        _urlSourceUrl = url;
+        size_t scheme_end = url.find("://");
+        if (url.empty())
+        {
+            return nullptr;
+        }
+        if (scheme_end == std::string::npos)
+        {
+            auto source = std::make_shared<FileSource>(url);
+            source->setBandwidthLimiter(_bandwidthLimiter);
+            _urlSource = source;
+            return _urlSource;
+        }
+        std::string scheme = Platform::toLower(url.substr(0, scheme_end));
+        if (scheme == "http" || (scheme == "https" && _httpClient))
+        {
+            auto source = std::make_shared<HttpSource>(url, _httpClient);
+            source->setBandwidthLimiter(_bandwidthLimiter);
+            if (std::shared_ptr<const VelopackLocator> locator = findLocator())
+            {
+                source->setCacheDirectory(locator->packagesDir);
+            }
+            _urlSource = source;
+        }
+        return _urlSource;
+    }
+
+    std::string UpdateManager::getPracticalChannel(const VelopackManifest &app) const
+    {
+        std::string channel(getExplicitChannel());
+        if (channel.empty())
+        {
+            channel = app.channel;
+        }
+        return channel.empty() ? nativeDefaultChannel() : channel;
+    }
+
+    VelopackAssetFeed UpdateManager::getReleaseFeed(const CancellationToken &cancellation) const
+    {
+        std::shared_ptr<UpdateSource> source = getUpdateSource();
+        if (!source)
+        {
+            throw std::runtime_error("Please call SetUrlOrPath with a local path or http:// URL (or set an HttpClient for https://) before trying to read the release feed.");
+        }
+        std::shared_ptr<const VelopackLocator> locator = getLocator();
+        if (!locator)
+        {
+            throw std::runtime_error("The release feed can not be read, as the app is not installed.");
+        }
+        const VelopackManifest &app = locator->manifest;
+        return source->getReleaseFeed(getPracticalChannel(app), app, getProcessOptions(cancellation).cancellation);
+    }
+
+    std::shared_ptr<UpdateInfo> UpdateManager::checkForUpdates(const CancellationToken &cancellation) const
+    {
+        std::shared_ptr<UpdateSource> source = getUpdateSource();
+        std::shared_ptr<const VelopackLocator> locator = getLocator();
+        ProcessOptions options = getProcessOptions(cancellation);
+        if (!source || !locator)
+        {
+            std::vector<std::string> command = getCheckForUpdatesCommand();
+            return parseUpdateInfo(nativeStartProcessBlocking(&command, options));
+        }
+
+        const VelopackManifest &app = locator->manifest;
+        std::string channel = getPracticalChannel(app);
+        VelopackAssetFeed feed = source->getReleaseFeed(channel, app, options.cancellation);
+        if (options.cancellation.isCancelled())
+        {
+            throw ProcessCancelledException("The update check was cancelled.");
+        }
+
+        // an unchanged feed (eg. HTTP 304) gives the same answer as last time, without comparing the feed again
+        bool allow_downgrade = getAllowDowngrade();
+        std::string rollout_id = getRolloutId();
+        std::shared_ptr<UpdateInfo> info;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            const CheckResult &last = _lastCheck;
+            if (!feed.validator.empty() && last.validator == feed.validator && last.channel == channel &&
+                last.version == app.version && last.allowDowngrade == allow_downgrade && last.rolloutId == rollout_id)
+            {
+                return last.info ? std::make_shared<UpdateInfo>(*last.info) : nullptr;
+            }
+        }
+        info = findUpdate(feed, app, channel, allow_downgrade, rollout_id);
+        if (!feed.validator.empty())
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _lastCheck = CheckResult{ feed.validator, channel, app.version, allow_downgrade, rollout_id, info };
+        }
+        return info ? std::make_shared<UpdateInfo>(*info) : nullptr;
+    }
+
+    UpdateCheckOperation UpdateManager::beginCheckForUpdates(const CancellationToken &cancellation) const
+    {
+        return UpdateCheckOperation(AsyncProcess(getCheckForUpdatesCommand(), getProcessOptions(cancellation)));
+    }
+
+    struct VeloDirEntry
+    {
+        std::string name;
+        uint64_t size = 0;
+        std::chrono::system_clock::time_point modified;
+    };
+
+#if defined(__linux__)
+    static std::chrono::system_clock::time_point VeloStatx_Time(const struct statx_timestamp &t)
+    {
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::seconds(t.tv_sec) + std::chrono::nanoseconds(t.tv_nsec)));
+    }
+#endif
+
+    // Reads the size and modification time of a regular file. Returns false if it does not exist or is not a file.
+    static bool VeloFile_Stat(const std::filesystem::path &path, VeloDirEntry &entry)
+    {
+#if defined(__linux__)
+        struct statx stx;
+        if (::statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) != 0 ||
+            !S_ISREG(stx.stx_mode))
+        {
+            return false;
+        }
+        entry.size = stx.stx_size;
+        entry.modified = VeloStatx_Time(stx.stx_mtime);
+        return true;
+#else
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(std::filesystem::symlink_status(path, ec)))
+        {
+            return false;
+        }
+        entry.size = std::filesystem::file_size(path, ec);
+        auto modified = std::filesystem::last_write_time(path, ec);
+        if (ec)
+        {
+            return false;
+        }
+        entry.modified = std::chrono::clock_cast<std::chrono::system_clock>(modified);
+        return true;
+#endif
+    }
+
+    // Lists the regular files in a directory, with their size and modification time. On Linux the names are read with
+    // getdents64, many per call, and the attributes with statx on several threads (they do not come with the names).
+    // Elsewhere the directory iterator returns them with the names (eg. FindNextFile on Windows).
+    static std::vector<VeloDirEntry> VeloDir_Scan(const std::filesystem::path &directory)
+    {
+        std::vector<VeloDirEntry> entries;
+#if defined(__linux__)
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return entries;
+            throw std::runtime_error("Unable to open directory '" + directory.string() + "'.");
+        }
+        struct Dirent64
+        {
+            uint64_t ino;
+            int64_t off;
+            unsigned short reclen;
+            unsigned char type;
+            char name[1];
+        };
+        alignas(8) char buffer[32768];
+        while (true)
+        {
+            long read = ::syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+            if (read < 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("Unable to read directory '" + directory.string() + "'.");
+            }
+            if (read == 0)
+                break;
+            for (long offset = 0; offset < read;)
+            {
+                const Dirent64 *dirent = reinterpret_cast<const Dirent64 *>(buffer + offset);
+                offset += dirent->reclen;
+                if (dirent->type == DT_REG || dirent->type == DT_UNKNOWN)
+                    entries.push_back(VeloDirEntry{ .name = dirent->name, .size = 0, .modified = {} });
+            }
+        }
+
+        std::vector<char> valid(entries.size());
+        VeloParallel_For(entries.size(), entries.size() >= 256 ? std::thread::hardware_concurrency() : 1, [&](size_t i)
+                         {
+            struct statx stx;
+            if (::statx(fd, entries[i].name.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE | STATX_MTIME, &stx) == 0 &&
+                S_ISREG(stx.stx_mode))
+            {
+                entries[i].size = stx.stx_size;
+                entries[i].modified = VeloStatx_Time(stx.stx_mtime);
+                valid[i] = 1;
+            } });
+        ::close(fd);
+        size_t kept = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (valid[i] && kept++ != i)
+                entries[kept - 1] = std::move(entries[i]);
+        }
+        entries.resize(kept);
+#else
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end; it.increment(ec))
+        {
+            std::error_code entry_ec;
+            if (!it->is_regular_file(entry_ec))
+                continue;
+            VeloDirEntry entry{ .name = it->path().filename().string(), .size = 0, .modified = {} };
+            entry.size = it->file_size(entry_ec);
+            auto modified = it->last_write_time(entry_ec);
+            if (entry_ec)
+                continue;
+            entry.modified = std::chrono::clock_cast<std::chrono::system_clock>(modified);
+            entries.push_back(std::move(entry));
+        }
+#endif
+        return entries;
+    }
+
+    struct PackageIndex::Impl
+    {
+        struct Entry
+        {
+            LocalPackage package;
+            std::string sha1; // upper case, empty until the file is hashed
+        };
+        std::string directory;
+        mutable std::mutex mutex;
+        mutable std::unordered_map<std::string, Entry> files; // by lower case file name
+
+        static std::string key(std::string_view fileName)
+        {
+            std::string key(fileName);
+            std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c)
+                           { return (char)std::tolower(c); });
+            return key;
+        }
+
+        // Records the state of a file, keeping its hash if the size and time have not changed. Call with the lock held.
+        void record(const VeloDirEntry &found)
+        {
+            Entry &entry = files[key(found.name)];
+            if (entry.package.size != found.size || entry.package.modified != found.modified || entry.package.fileName != found.name)
+                entry.sha1.clear();
+            entry.package = LocalPackage{ found.name, found.size, found.modified };
+        }
+    };
+
+    PackageIndex::PackageIndex(std::string directory) : _impl(std::make_unique<Impl>())
+    {
+        _impl->directory = std::move(directory);
+        rescan();
+    }
+
+    PackageIndex::~PackageIndex() = default;
+    PackageIndex::PackageIndex(PackageIndex &&) noexcept = default;
+    PackageIndex &PackageIndex::operator=(PackageIndex &&) noexcept = default;
+
+    const std::string &PackageIndex::directory() const
+    {
+        return _impl->directory;
+    }
+
+    void PackageIndex::rescan()
+    {
+        std::vector<VeloDirEntry> found = VeloDir_Scan(_impl->directory);
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        std::unordered_map<std::string, Impl::Entry> previous = std::move(_impl->files);
+        _impl->files.clear();
+        for (const VeloDirEntry &entry : found)
+        {
+            auto it = previous.find(Impl::key(entry.name));
+            if (it != previous.end())
+                _impl->files.emplace(it->first, std::move(it->second));
+            _impl->record(entry);
+        }
+    }
+
+    void PackageIndex::update(const std::string &fileName)
+    {
+        VeloDirEntry entry{ .name = fileName, .size = 0, .modified = {} };
+        bool exists = VeloFile_Stat(std::filesystem::path(_impl->directory) / fileName, entry);
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        if (exists)
+            _impl->record(entry);
+        else
+            _impl->files.erase(Impl::key(fileName));
+    }
+
+    std::vector<LocalPackage> PackageIndex::packages() const
+    {
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        std::vector<LocalPackage> result;
+        for (const auto &[key, entry] : _impl->files)
+        {
+            if (key.ends_with(".nupkg"))
+                result.push_back(entry.package);
+        }
+        return result;
+    }
+
+    std::optional<LocalPackage> PackageIndex::find(const VelopackAsset &asset, bool verifyHash) const
+    {
+        std::string key = Impl::key(asset.fileName);
+        LocalPackage package;
+        {
+            std::lock_guard<std::mutex> lock(_impl->mutex);
+            auto it = _impl->files.find(key);
+            if (it == _impl->files.end())
+                return std::nullopt;
+            package = it->second.package;
+            if (asset.type != VelopackAssetType::full && asset.size > 0 && package.size != (uint64_t)asset.size)
+                return std::nullopt;
+            if (!verifyHash)
+                return package;
+        }
+        std::string sha1 = asset.sha1.empty() ? std::string() : this->sha1(package.fileName);
+        return !sha1.empty() && VeloString_EqualsIgnoreCase(sha1, asset.sha1) ? std::optional<LocalPackage>(package) : std::nullopt;
+    }
+
+    std::string PackageIndex::sha1(const std::string &fileName, bool compute) const
+    {
+        std::string key = Impl::key(fileName);
+        LocalPackage package;
+        {
+            std::lock_guard<std::mutex> lock(_impl->mutex);
+            auto it = _impl->files.find(key);
+            if (it == _impl->files.end())
+                return {};
+            if (!it->second.sha1.empty() || !compute)
+                return it->second.sha1;
+            package = it->second.package;
+        }
+
+        // hash without the lock, and only keep the result if the file was not changed in the meantime
+        std::string sha1;
+        try
+        {
+            sha1 = VeloString_ToUpper(VeloFile_Hash(std::filesystem::path(_impl->directory) / package.fileName, VeloHash::sha1()));
+        }
+        catch (const std::exception &)
+        {
+            return {};
+        }
+        std::lock_guard<std::mutex> lock(_impl->mutex);
+        auto it = _impl->files.find(key);
+        if (it != _impl->files.end() && it->second.package.size == package.size && it->second.package.modified == package.modified)
+            it->second.sha1 = sha1;
+        return sha1;
+    }
+
+    std::vector<std::string> PackageIndex::collectGarbage(const VelopackAssetFeed &feed, const SemanticVersion &installed,
+                                                          const PackageRetention &retention)
+    {
+        struct Candidate
+        {
+            LocalPackage package;
+            bool pinned = false; // never removed
+        };
+        std::vector<Candidate> keep;
+        std::vector<std::string> remove;
+
+        std::shared_ptr<VelopackAsset> latest = feed.latest(VelopackAssetType::full);
+        SemanticVersion latest_version;
+        bool has_latest = latest && SemanticVersion::tryParse(latest->version, latest_version);
+        auto now = std::chrono::system_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(_impl->mutex);
+            for (const auto &[key, entry] : _impl->files)
+            {
+                // interrupted downloads ('.partial' and '.partial.state') go with the package they are for
+                std::string_view package_name = key;
+                if (package_name.ends_with(".state"))
+                    package_name.remove_suffix(6);
+                if (package_name.ends_with(".partial"))
+                    package_name.remove_suffix(8);
+                if (!package_name.ends_with(".nupkg"))
+                    continue; // not a package, eg. a feed cached by HttpSource
+                bool is_package = package_name.size() == key.size();
+
+                const VelopackAsset *asset = feed.find(package_name);
+                SemanticVersion version;
+                bool useful = asset && SemanticVersion::tryParse(asset->version, version);
+                if (useful && asset->type == VelopackAssetType::full)
+                    useful = version >= installed;
+                else if (useful && asset->type == VelopackAssetType::delta)
+                    useful = version > installed && (!is_package || asset->size <= 0 || entry.package.size == (uint64_t)asset->size);
+                else
+                    useful = false;
+
+                if (!useful)
+                {
+                    remove.push_back(entry.package.fileName);
+                    continue;
+                }
+                bool pinned = is_package && asset->type == VelopackAssetType::full && (version == installed || (has_latest && version == latest_version));
+                if (!pinned && retention.maxAge.count() > 0 && now - entry.package.modified > retention.maxAge)
+                {
+                    remove.push_back(entry.package.fileName);
+                    continue;
+                }
+                keep.push_back(Candidate{ entry.package, pinned });
+            }
+        }
+
+        if (retention.maxBytes > 0)
+        {
+            uint64_t total = 0;
+            for (const Candidate &candidate : keep)
+                total += candidate.package.size;
+            std::sort(keep.begin(), keep.end(), [](const Candidate &a, const Candidate &b)
+                      { return a.package.modified < b.package.modified; });
+            for (const Candidate &candidate : keep)
+            {
+                if (total <= retention.maxBytes)
+                    break;
+                if (candidate.pinned)
+                    continue;
+                remove.push_back(candidate.package.fileName);
+                total -= candidate.package.size;
+            }
+        }
+
+        std::vector<std::string> removed;
+        for (const std::string &fileName : remove)
+        {
+            std::error_code ec;
+            if (std::filesystem::remove(std::filesystem::path(_impl->directory) / fileName, ec) || !ec)
+                removed.push_back(fileName);
+            update(fileName);
+        }
+        return removed;
+    }
+
+    // The number of packages which may be downloaded ahead of the delta being applied, and the disk space a download
+    // leaves free for the working files.
+    static constexpr size_t VELO_PIPELINE_DEPTH = 2;
+    static constexpr uint64_t VELO_PIPELINE_DISK_RESERVE = 64ull << 20;
+
+    // The free space of the disk a directory is on, or UINT64_MAX if it can not be measured (then downloads are tried
+    // anyway). Tests replace it to stand in for a full disk.
+    static std::function<uint64_t(const std::filesystem::path &)> VeloDisk_Available = [](const std::filesystem::path &directory)
+    {
+        std::error_code ec;
+        std::filesystem::space_info space = std::filesystem::space(directory, ec);
+        return ec ? UINT64_MAX : (uint64_t)space.available;
+    };
+
+    static bool VeloDisk_HasSpace(const std::filesystem::path &directory, uint64_t size)
+    {
+        uint64_t available = VeloDisk_Available(directory);
+        return available >= VELO_PIPELINE_DISK_RESERVE && available - VELO_PIPELINE_DISK_RESERVE >= size;
+    }
+
+    void executeUpdatePlan(const UpdatePlan &plan, UpdateSource &source, const std::string &directory, const std::string &outputPackage,
+                           const ProgressHandler &progress, const CancellationToken &cancellation)
+    {
+        if (plan.assets.empty() || plan.assets.size() != plan.cached.size())
+        {
+            throw std::invalid_argument("The update plan has no packages.");
+        }
+        std::filesystem::create_directories(directory);
+
+        // downloading and applying each report their own percentage, and progress is the average of the two
+        std::mutex progress_mutex;
+        int16_t download_percent = plan.downloadBytes == 0 ? 100 : 0, apply_percent = 0, last_reported = -1;
+        auto report = [&](int16_t *percent, int16_t value)
+        {
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            *percent = (std::max)(*percent, value);
+            int16_t total = (int16_t)((download_percent + apply_percent) / 2);
+            if (progress && total > last_reported)
+            {
+                last_reported = total;
+                progress(total);
+            }
+        };
+
+        struct Ready
+        {
+            std::string path;
+            bool downloaded = false;
+        };
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Ready> ready; // downloaded (or cached) and not yet taken by the applier
+        size_t held = 0;          // downloaded deltas, queued or being applied, which are deleted once applied
+        bool stop = false, finished = false;
+        std::exception_ptr download_error;
+        // cancelled by the caller, or when applying fails, so that a download in progress stops with it
+        CancellationToken abort = CancellationToken::linked(cancellation, CancellationToken());
+
+        std::thread downloader([&]
+                               {
+            try
+            {
+                uint64_t downloaded = 0;
+                for (size_t i = 0; i < plan.assets.size(); i++)
+                {
+                    const VelopackAsset &asset = *plan.assets[i];
+                    std::filesystem::path path = std::filesystem::path(directory) / asset.fileName;
+                    if (!plan.cached[i])
+                    {
+                        uint64_t size = (uint64_t)(std::max)(asset.size, (int64_t)0);
+                        {
+                            // wait for room in the queue, and for the deltas the applier holds to free the disk space this needs.
+                            // Once none are left, there is no more space to wait for.
+                            std::unique_lock<std::mutex> lock(mutex);
+                            changed.wait(lock, [&]
+                                         { return stop || (ready.size() < VELO_PIPELINE_DEPTH && (held == 0 || VeloDisk_HasSpace(directory, size))); });
+                            if (stop)
+                                return;
+                            if (!VeloDisk_HasSpace(directory, size))
+                                throw std::runtime_error("There is not enough free disk space in '" + directory + "' to download '" + asset.fileName + "'.");
+                        }
+                        if (abort.isCancelled())
+                            throw ProcessCancelledException("The download was cancelled.");
+                        std::filesystem::path partial = path;
+                        partial += ".partial";
+                        auto on_progress = [&](int16_t percent)
+                        {
+                            // packages of unknown size count for nothing, so the plan may have no bytes to download
+                            if (plan.downloadBytes > 0)
+                                report(&download_percent, (int16_t)((std::min)((downloaded + size * (uint64_t)percent / 100) * 100 / plan.downloadBytes, (uint64_t)100)));
+                        };
+                        source.downloadReleaseEntry(asset, partial.string(), on_progress, abort);
+                        std::filesystem::rename(partial, path);
+                        downloaded += size;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready.push_back(Ready{ path.string(), !plan.cached[i] });
+                    if (i > 0 && !plan.cached[i])
+                        held++;
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                download_error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            changed.notify_all(); });
+
+        auto next = [&]() -> Ready
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]
+                         { return !ready.empty() || finished; });
+            if (ready.empty())
+            {
+                std::rethrow_exception(download_error);
+            }
+            Ready result = std::move(ready.front());
+            ready.pop_front();
+            changed.notify_all();
+            return result;
+        };
+
+        try
+        {
+            // extracting the base, each delta and writing the package are a step each, as in applyDeltaPackages
+            size_t steps = plan.assets.size() + 1;
+            DeltaApplier applier(next().path, outputPackage + ".work");
+            report(&apply_percent, (int16_t)(100 / steps));
+            for (size_t i = 1; i < plan.assets.size(); i++)
+            {
+                Ready delta = next();
+                if (cancellation.isCancelled())
+                {
+                    throw ProcessCancelledException("The download was cancelled.");
+                }
+                applier.apply(delta.path, [&](int16_t percent)
+                              { report(&apply_percent, (int16_t)((i * 100 + (size_t)percent) / steps)); });
+                if (delta.downloaded)
+                {
+                    std::error_code ec;
+                    std::filesystem::remove(delta.path, ec);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    held--;
+                    changed.notify_all(); // space was freed
+                }
+            }
+            applier.finish(outputPackage);
+            report(&apply_percent, 100);
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            abort.cancel(); // a download in progress stops at its next chunk, and can be resumed later
+            changed.notify_all();
+            downloader.join();
+            throw;
+        }
+        downloader.join();
+    }
+
+    // Checks a full package which was rebuilt from deltas, and so does not match the checksum in the feed: it must
+    // contain the expected version, and every file in it must match its CRC.
+    static bool VeloPackage_VerifyRebuilt(const std::filesystem::path &path, const VelopackAsset &asset)
+    {
+        try
+        {
+            BundleZip bundle = BundleZip::open(path.string());
+            if (SemanticVersion::parse(bundle.readManifest().version) != SemanticVersion::parse(asset.version))
+            {
+                return false;
+            }
+            for (const BundleEntry &entry : bundle.entries())
+            {
+                bundle.read(entry, [](const char *, size_t) {});
+            }
+            return true;
+        }
+        catch (const std::exception &)
+        {
+            return false;
+        }
+    }
+
+    // Peers are discovered with single datagrams of text:
+    //   VELOPACK-PEER/1 WANT <SHA1> <size> <file name>    multicast by PeerSource
+    //   VELOPACK-PEER/1 HAVE <SHA1> <port>                the answer of a PeerServer which has it, sent to the asker
+    // and the package is then fetched with GET /velopack/<SHA1>/<file name> from the port in the answer.
+    static constexpr std::string_view VELO_PEER_PROTOCOL = "VELOPACK-PEER/1";
+
+    // Checks the parts of a request from the network, so that it can only ever name a package in the directory.
+    static bool VeloPeer_IsValidRequest(std::string_view sha1, std::string_view fileName)
+    {
+        auto is_hex = [](char c)
+        { return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f'); };
+        auto is_unsafe = [](char c)
+        { return (unsigned char)c <= ' ' || c == '/' || c == '\\' || c == ':' || c == '%' || c == '?' || c == '#'; };
+        return sha1.size() == 40 && std::all_of(sha1.begin(), sha1.end(), is_hex) && fileName.size() <= 255 && fileName.ends_with(".nupkg") &&
+               !fileName.starts_with(".") && fileName.find("..") == std::string_view::npos && std::none_of(fileName.begin(), fileName.end(), is_unsafe);
+    }
+
+    // Splits a line of text at spaces, the last part keeps the rest of the line.
+    static std::vector<std::string_view> VeloPeer_Split(std::string_view text, size_t parts)
+    {
+        std::vector<std::string_view> result;
+        while (result.size() + 1 < parts)
+        {
+            size_t space = text.find(' ');
+            if (space == std::string_view::npos)
+                break;
+            result.push_back(text.substr(0, space));
+            text.remove_prefix(space + 1);
+        }
+        result.push_back(text);
+        return result;
+    }
+
+    static void VeloPeer_SetMulticastOptions(VeloSocket &socket, const PeerSharingOptions &options)
+    {
+#if defined(_WIN32)
+        DWORD ttl = (DWORD)options.multicastTtl, loop = 1;
+#else
+        unsigned char ttl = (unsigned char)options.multicastTtl, loop = 1; // other peers may run on this machine
+#endif
+        setsockopt(socket.handle(), IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&ttl, sizeof(ttl));
+        setsockopt(socket.handle(), IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&loop, sizeof(loop));
+        if (!options.interfaceAddress.empty())
+        {
+            struct in_addr address = VeloSocket::ipv4(options.interfaceAddress, 0).sin_addr;
+            setsockopt(socket.handle(), IPPROTO_IP, IP_MULTICAST_IF, (const char *)&address, sizeof(address));
+        }
+    }
+
+    struct PeerServer::Impl
+    {
+        std::shared_ptr<PackageIndex> packages;
+        PeerSharingOptions options;
+        VeloSocket discovery;
+        VeloSocket listener;
+        uint16_t port;
+        std::thread network;
+        std::atomic<bool> stopping{ false };
+        std::atomic<uint64_t> served{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+        std::vector<VeloSocketHandle> uploads; // connections being served, shut down when stopping
+        std::condition_variable hashWanted;
+        std::deque<std::string> toHash;         // packages to hash on the hashing thread, by file name
+        std::unordered_set<std::string> hashing; // the same, to queue each once
+
+        Impl(std::shared_ptr<PackageIndex> packages_, PeerSharingOptions options_)
+            : packages(std::move(packages_)), options(std::move(options_)), discovery(VeloSocket::udp()),
+              listener(VeloSocket::listen(options.interfaceAddress, options.httpPort)), port(listener.localPort())
+        {
+            // several servers on one machine (eg. one per app) share the discovery port, and each gets every query
+            int reuse = 1;
+            setsockopt(discovery.handle(), SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+#if defined(SO_REUSEPORT)
+            setsockopt(discovery.handle(), SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse, sizeof(reuse));
+#endif
+            struct sockaddr_in local = VeloSocket::ipv4("", options.discoveryPort);
+            if (::bind(discovery.handle(), (const struct sockaddr *)&local, sizeof(local)) != 0)
+            {
+                throw std::runtime_error("Unable to listen for peers on UDP port " + std::to_string(options.discoveryPort) + ".");
+            }
+            struct ip_mreq membership = {};
+            membership.imr_multiaddr = VeloSocket::ipv4(options.multicastGroup, 0).sin_addr;
+            membership.imr_interface = VeloSocket::ipv4(options.interfaceAddress, 0).sin_addr;
+            if (setsockopt(discovery.handle(), IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&membership, sizeof(membership)) != 0)
+            {
+                throw std::runtime_error("Unable to join the multicast group " + options.multicastGroup + ".");
+            }
+        }
+
+        // Returns the package with this SHA1, or nothing. With `hash`, a package is hashed the first time it is asked
+        // for (see PackageIndex::find). Without, only a hash which is already known is used, and a package which has
+        // not been hashed yet is queued for the hashing thread instead.
+        std::optional<LocalPackage> find(std::string_view sha1, int64_t size, std::string_view fileName, bool hash)
+        {
+            if (!VeloPeer_IsValidRequest(sha1, fileName))
+            {
+                return std::nullopt;
+            }
+            VelopackAsset asset;
+            asset.fileName = std::string(fileName);
+            asset.sha1 = std::string(sha1);
+            asset.size = size; // with an unknown asset type, the size must match if it is given
+            packages->update(asset.fileName);
+            if (hash)
+            {
+                return packages->find(asset, true);
+            }
+            std::optional<LocalPackage> package = packages->find(asset);
+            std::string known = package ? packages->sha1(package->fileName, false) : std::string();
+            if (package && known.empty())
+            {
+                queueHash(package->fileName);
+            }
+            return !known.empty() && VeloString_EqualsIgnoreCase(known, sha1) ? package : std::nullopt;
+        }
+
+        void queueHash(const std::string &fileName)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (hashing.insert(fileName).second)
+            {
+                toHash.push_back(fileName);
+                hashWanted.notify_all();
+            }
+        }
+
+        // Hashes packages off the network thread, so that a request for a large package does not hold up the others.
+        void hashPackages()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping)
+            {
+                if (toHash.empty())
+                {
+                    hashWanted.wait(lock);
+                    continue;
+                }
+                std::string fileName = std::move(toHash.front());
+                toHash.pop_front();
+                lock.unlock();
+                packages->sha1(fileName);
+                lock.lock();
+                hashing.erase(fileName);
+            }
+        }
+
+        bool busy()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return (int)uploads.size() >= (std::max)(options.maxUploads, 1);
+        }
+
+        void answer(std::string_view message, const struct sockaddr_in &from)
+        {
+            std::vector<std::string_view> parts = VeloPeer_Split(message, 5);
+            if (parts.size() != 5 || parts[0] != VELO_PEER_PROTOCOL || parts[1] != "WANT" || busy())
+            {
+                return;
+            }
+            int64_t size = std::strtoll(std::string(parts[3]).c_str(), nullptr, 10);
+            if (size <= 0 || !find(parts[2], size, parts[4], false))
+            {
+                return;
+            }
+            std::string reply = std::string(VELO_PEER_PROTOCOL) + " HAVE " + VeloString_ToUpper(parts[2]) + " " + std::to_string(port);
+            sendto(discovery.handle(), reply.data(), (int)reply.size(), 0, (const struct sockaddr *)&from, sizeof(from));
+        }
+
+        static void respond(VeloSocket &socket, std::string_view status)
+        {
+            socket.sendAll("HTTP/1.1 " + std::string(status) + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        }
+
+        void serve(VeloSocket &socket)
+        {
+            std::string head;
+            char buffer[4096];
+            while (head.find("\r\n\r\n") == std::string::npos)
+            {
+                size_t received = socket.receive(buffer, sizeof(buffer));
+                if (received == 0 || head.size() > 16384)
+                    return;
+                head.append(buffer, received);
+            }
+            std::vector<std::string_view> request = VeloPeer_Split(std::string_view(head).substr(0, head.find("\r\n")), 3);
+            if (request.size() != 3 || request[0] != "GET")
+            {
+                return respond(socket, "405 Method Not Allowed");
+            }
+            std::string_view path = request[1];
+            constexpr std::string_view prefix = "/velopack/";
+            std::optional<LocalPackage> package;
+            std::string sha1;
+            if (path.starts_with(prefix) && path.size() > prefix.size() + 41 && path[prefix.size() + 40] == '/')
+            {
+                sha1 = VeloString_ToUpper(path.substr(prefix.size(), 40));
+                package = find(sha1, 0, path.substr(prefix.size() + 41), true);
+            }
+            if (!package)
+            {
+                return respond(socket, "404 Not Found");
+            }
+
+            // a single range, as sent by the downloader of HttpSource. Anything else gets the whole file.
+            uint64_t begin = 0, end = package->size;
+            std::string lower = VeloString_ToLower(head);
+            size_t range = lower.find("\r\nrange: bytes=");
+            bool partial = false;
+            if (range != std::string::npos)
+            {
+                const char *spec = head.c_str() + range + 15;
+                char *dash = nullptr;
+                uint64_t first = std::strtoull(spec, &dash, 10);
+                if (dash != spec && *dash == '-')
+                {
+                    uint64_t last = std::isdigit((unsigned char)dash[1]) ? std::strtoull(dash + 1, nullptr, 10) : package->size - 1;
+                    if (first > last || first >= package->size)
+                        return respond(socket, "416 Range Not Satisfiable");
+                    begin = first;
+                    end = (std::min)(last + 1, package->size);
+                    partial = true;
+                }
+            }
+
+            std::filesystem::path file = std::filesystem::path(packages->directory()) / package->fileName;
+#if defined(__linux__)
+            int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return respond(socket, "404 Not Found");
+            std::unique_ptr<int, void (*)(int *)> close_fd(&fd, [](int *f) { ::close(*f); });
+#else
+            std::ifstream input(file, std::ios::binary);
+            if (!input)
+                return respond(socket, "404 Not Found");
+            input.seekg((std::streamoff)begin);
+#endif
+            std::string response = partial ? "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(begin) + "-" + std::to_string(end - 1) + "/" +
+                                                 std::to_string(package->size) + "\r\n"
+                                           : "HTTP/1.1 200 OK\r\n";
+            response += "Content-Length: " + std::to_string(end - begin) + "\r\nAccept-Ranges: bytes\r\nETag: \"" + sha1 + "\"\r\nConnection: close\r\n\r\n";
+            socket.sendAll(response);
+
+            uint64_t offset = begin;
+            while (offset < end && !stopping)
+            {
+#if defined(__linux__)
+                // straight from the page cache to the socket
+                off_t position = (off_t)offset;
+                ssize_t sent = ::sendfile(socket.handle(), fd, &position, (size_t)(std::min)(end - offset, (uint64_t)1 << 20));
+                if (sent < 0 && errno == EINTR)
+                    continue;
+                if (sent <= 0)
+                    return;
+#else
+                input.read(buffer, (std::streamsize)(std::min)(end - offset, (uint64_t)sizeof(buffer)));
+                size_t sent = (size_t)input.gcount();
+                if (sent == 0)
+                    return;
+                socket.sendAll(std::string_view(buffer, sent));
+#endif
+                offset += (uint64_t)sent;
+                served += (uint64_t)sent;
+            }
+        }
+
+        void upload(VeloSocket socket)
+        {
+#if !defined(_WIN32)
+            // a peer which goes away while sendfile() writes would raise SIGPIPE, which is left pending on this thread
+            sigset_t pipe;
+            sigemptyset(&pipe);
+            sigaddset(&pipe, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipe, nullptr);
+#endif
+            try
+            {
+                serve(socket);
+            }
+            catch (const std::exception &)
+            {
+                // the peer went away, or timed out
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            uploads.erase(std::find(uploads.begin(), uploads.end(), socket.handle()));
+            finished.notify_all();
+        }
+
+        void run(const std::shared_ptr<Impl> &self)
+        {
+            while (!stopping)
+            {
+#if defined(_WIN32)
+                WSAPOLLFD fds[2] = { { discovery.handle(), POLLIN, 0 }, { listener.handle(), POLLIN, 0 } };
+                if (WSAPoll(fds, 2, 200) <= 0)
+                    continue;
+#else
+                struct pollfd fds[2] = { { discovery.handle(), POLLIN, 0 }, { listener.handle(), POLLIN, 0 } };
+                if (poll(fds, 2, 200) <= 0)
+                    continue;
+#endif
+                if (fds[0].revents & POLLIN)
+                {
+                    char datagram[1024];
+                    struct sockaddr_in from = {};
+                    socklen_t from_length = sizeof(from);
+                    int received = (int)recvfrom(discovery.handle(), datagram, sizeof(datagram), 0, (struct sockaddr *)&from, &from_length);
+                    if (received > 0)
+                        answer(std::string_view(datagram, (size_t)received), from);
+                }
+                if (fds[1].revents & POLLIN)
+                {
+                    VeloSocket socket = listener.accept();
+                    if (!socket.valid())
+                        continue;
+                    if (busy())
+                    {
+                        try
+                        {
+                            respond(socket, "503 Service Unavailable");
+                        }
+                        catch (const std::exception &)
+                        {
+                        }
+                        continue;
+                    }
+                    std::lock_guard<std::mutex> lock(mutex);
+                    uploads.push_back(socket.handle());
+                    std::thread([self, socket = std::move(socket)]() mutable
+                                { self->upload(std::move(socket)); })
+                        .detach();
+                }
+            }
+        }
+    };
+
+    PeerServer::PeerServer(std::shared_ptr<PackageIndex> packages, PeerSharingOptions options)
+        : _impl(std::make_shared<Impl>(std::move(packages), std::move(options)))
+    {
+        // the packages already there are hashed up front, so that discovery can be answered for them straight away
+        for (const LocalPackage &package : _impl->packages->packages())
+        {
+            _impl->queueHash(package.fileName);
+        }
+        std::thread([impl = _impl]
+                    { impl->hashPackages(); })
+            .detach();
+        _impl->network = std::thread([impl = _impl]
+                                     { impl->run(impl); });
+    }
+
+    PeerServer::~PeerServer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_impl->mutex);
+            _impl->stopping = true;
+            _impl->hashWanted.notify_all(); // the hashing thread stops after the package it is on, if any
+        }
+        _impl->network.join();
+        std::unique_lock<std::mutex> lock(_impl->mutex);
+        for (VeloSocketHandle upload : _impl->uploads)
+        {
+#if defined(_WIN32)
+            ::shutdown(upload, SD_BOTH);
+#else
+            ::shutdown(upload, SHUT_RDWR);
+#endif
+        }
+        _impl->finished.wait(lock, [&]
+                             { return _impl->uploads.empty(); });
+    }
+
+    uint16_t PeerServer::port() const
+    {
+        return _impl->port;
+    }
+
+    uint64_t PeerServer::bytesServed() const
+    {
+        return _impl->served;
+    }
+
+    PeerSource::PeerSource(std::shared_ptr<UpdateSource> origin, PeerSharingOptions options)
+        : _origin(std::move(origin)), _options(std::move(options)), _client(HttpClient::createDefault())
+    {
+        if (!_origin)
+        {
+            throw std::invalid_argument("PeerSource needs a source to fall back to.");
+        }
+    }
+
+    VelopackAssetFeed PeerSource::getReleaseFeed(const std::string &channel, const VelopackManifest &app, const CancellationToken &cancellation)
+    {
+        return _origin->getReleaseFeed(channel, app, cancellation);
+    }
+
+    std::vector<std::string> PeerSource::discover(const VelopackAsset &asset) const
+    {
+        std::string sha1 = VeloString_ToUpper(asset.sha1);
+        if (!VeloPeer_IsValidRequest(sha1, asset.fileName) || asset.size <= 0)
+        {
+            return {};
+        }
+        VeloSocket socket = VeloSocket::udp();
+        struct sockaddr_in local = VeloSocket::ipv4(_options.interfaceAddress, 0);
+        if (::bind(socket.handle(), (const struct sockaddr *)&local, sizeof(local)) != 0)
+        {
+            return {};
+        }
+        VeloPeer_SetMulticastOptions(socket, _options);
+        struct sockaddr_in group = VeloSocket::ipv4(_options.multicastGroup, _options.discoveryPort);
+        std::string want = std::string(VELO_PEER_PROTOCOL) + " WANT " + sha1 + " " + std::to_string(asset.size) + " " + asset.fileName;
+        auto send_want = [&]
+        { sendto(socket.handle(), want.data(), (int)want.size(), 0, (const struct sockaddr *)&group, sizeof(group)); };
+
+        // asked twice, in case the first datagram is lost or a peer had yet to hash the package. After the first
+        // answer, others which arrive shortly after are collected too, as fallbacks.
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + _options.discoveryTimeout;
+        bool asked_again = false;
+        send_want();
+        std::vector<std::string> peers;
+        for (;;)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (!asked_again && now >= start + _options.discoveryTimeout / 2 && peers.empty())
+            {
+                send_want();
+                asked_again = true;
+            }
+            if (now >= deadline)
+                break;
+            auto wake = peers.empty() && !asked_again ? (std::min)(deadline, start + _options.discoveryTimeout / 2) : deadline;
+            if (!socket.waitReadable((int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1))
+                continue;
+
+            char datagram[512];
+            struct sockaddr_in from = {};
+            socklen_t from_length = sizeof(from);
+            int received = (int)recvfrom(socket.handle(), datagram, sizeof(datagram), 0, (struct sockaddr *)&from, &from_length);
+            std::vector<std::string_view> parts = VeloPeer_Split(std::string_view(datagram, (size_t)(std::max)(received, 0)), 4);
+            if (parts.size() != 4 || parts[0] != VELO_PEER_PROTOCOL || parts[1] != "HAVE" || !VeloString_EqualsIgnoreCase(parts[2], sha1))
+                continue;
+            char host[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &from.sin_addr, host, sizeof(host));
+            std::string url = "http://" + std::string(host) + ":" + std::to_string(std::strtoul(std::string(parts[3]).c_str(), nullptr, 10));
+            if (std::find(peers.begin(), peers.end(), url) == peers.end())
+                peers.push_back(url);
+            if (peers.size() == 1)
+                deadline = (std::min)(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(20));
+        }
+        return peers;
+    }
+
+    void PeerSource::downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress,
+                                          const CancellationToken &cancellation)
+    {
+        for (const std::string &peer : discover(asset))
+        {
+            try
+            {
+                // verified against the hash from the feed as it is written, like a download from the origin
+                VeloDownload download(*_client, peer + "/velopack/" + VeloString_ToUpper(asset.sha1) + "/" + asset.fileName, localFile, asset, progress,
+                                      nullptr, cancellation);
+                download.run(1);
+                return;
+            }
+            catch (const ProcessCancelledException &)
+            {
+                throw;
+            }
+            catch (const std::exception &)
+            {
+                std::error_code ec;
+                std::filesystem::remove(localFile, ec);
+                std::filesystem::remove(localFile + ".state", ec);
+            }
+        }
+        _origin->downloadReleaseEntry(asset, localFile, progress, cancellation);
+    }
+
+    void UpdateManager::downloadUpdates(const VelopackAsset *toDownload, const CancellationToken &cancellation, const ProgressHandler &progress) const
+    {
+        std::shared_ptr<UpdateSource> source = getUpdateSource();
+        std::shared_ptr<const VelopackLocator> locator = getLocator();
+        if (!source || !locator || !toDownload)
+        {
+            std::vector<std::string> command = getDownloadUpdatesCommand(toDownload);
+            nativeStartProcessBlocking(&command, getProcessOptions(cancellation));
+            return;
+        }
+
+        std::optional<PeerSharingOptions> peer_sharing;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            peer_sharing = _peerSharing;
+        }
+        if (peer_sharing)
+        {
+            source = std::make_shared<PeerSource>(source, *peer_sharing);
+        }
+        std::string shared_cache = getSharedPackageCache();
+        if (!shared_cache.empty())
+        {
+            source = std::make_shared<SharedCacheSource>(source, shared_cache);
+        }
+
+        std::filesystem::path packages_dir(locator->packagesDir);
+        std::filesystem::create_directories(packages_dir);
+        std::filesystem::path target = packages_dir / toDownload->fileName;
+        if (std::filesystem::exists(target))
+        {
+            if ((toDownload->sha1.empty() && toDownload->sha256.empty()) || verifyAsset(target.string(), *toDownload) ||
+                VeloPackage_VerifyRebuilt(target, *toDownload))
+            {
+                return; // already downloaded
+            }
+            std::filesystem::remove(target); // damaged, download it again
+        }
+
+        // a chain of deltas is used when it is cheaper than the full package, for example when the package of the
+        // installed version is still here from the last update. Without a plan, the full package is downloaded.
+        std::shared_ptr<PackageIndex> packages = getPackageIndex();
+        std::optional<VelopackAssetFeed> feed;
+        UpdatePlan plan;
+        try
+        {
+            feed = source->getReleaseFeed(getPracticalChannel(locator->manifest), locator->manifest, cancellation);
+            UpdatePlanOptions plan_options;
+            plan_options.packages = packages.get();
+            plan = feed->planUpdate(SemanticVersion::parse(toDownload->version), plan_options);
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        // without a feed to tell which packages may still be useful, everything else is deleted afterwards
+        std::vector<std::string> to_delete;
+        if (!feed)
+        {
+            for (const auto &entry : std::filesystem::directory_iterator(packages_dir))
+            {
+                std::filesystem::path extension = entry.path().extension();
+                if (entry.is_regular_file() && (extension == ".nupkg" || extension == ".partial" || extension == ".state"))
+                    to_delete.push_back(entry.path().filename().string());
+            }
+        }
+
+        bool rebuilt = false;
+        if (plan.isDelta())
+        {
+            std::filesystem::path partial = target;
+            partial += ".partial";
+            try
+            {
+                executeUpdatePlan(plan, *source, packages_dir.string(), partial.string(), progress, cancellation);
+                if (cancellation.isCancelled())
+                {
+                    throw ProcessCancelledException("The download was cancelled.");
+                }
+                std::filesystem::rename(partial, target);
+                rebuilt = true;
+            }
+            catch (const ProcessCancelledException &)
+            {
+                throw;
+            }
+            catch (const std::exception &)
+            {
+                // a damaged base or delta package, fall back to the full package
+                std::error_code ec;
+                std::filesystem::remove(partial, ec);
+            }
+            for (const auto &asset : plan.assets)
+            {
+                packages->update(asset->fileName);
+            }
+        }
+        if (!rebuilt)
+        {
+            // download next to the target, so that a package which is present is always complete. An interrupted
+            // download leaves '.partial' and '.partial.state' behind, and the next call resumes it.
+            std::filesystem::path partial = target;
+            partial += ".partial";
+            source->downloadReleaseEntry(*toDownload, partial.string(), progress, cancellation);
+            if (cancellation.isCancelled())
+            {
+                throw ProcessCancelledException("The download was cancelled.");
+            }
+            std::filesystem::rename(partial, target);
+        }
+        packages->update(toDownload->fileName);
+
+#if defined(_WIN32)
+        // refresh Update.exe from the new package, as Vfusion does. This is best effort, the download has succeeded.
+        try
+        {
+            BundleZip bundle = BundleZip::open(target.string());
+            const BundleEntry *update_exe = bundle.find([](std::string_view name)
+                                                        { return name.ends_with("Squirrel.exe"); });
+            if (update_exe)
+            {
+                bundle.extract(*update_exe, locator->updateExePath);
+            }
+        }
+        catch (const std::exception &)
+        {
+        }
+#endif
+
+        if (feed)
+        {
+            // keep what a later update could start a chain of deltas from, and the new package (even a downgrade)
+            SemanticVersion installed, downloaded;
+            if (SemanticVersion::tryParse(locator->manifest.version, installed) && SemanticVersion::tryParse(toDownload->version, downloaded))
+            {
+                packages->collectGarbage(*feed, (std::min)(installed, downloaded), getPackageRetention());
+            }
+        }
+        for (const std::string &fileName : to_delete)
+        {
+            std::error_code ec;
+            std::filesystem::remove(packages_dir / fileName, ec);
+            packages->update(fileName);
+        }
+    }
+
+    std::shared_ptr<PackageIndex> UpdateManager::getPackageIndex() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::shared_ptr<const VelopackLocator> locator = findLocator();
+        if (!locator)
+        {
+            throw std::runtime_error("The packages directory is not known, as the app is not installed.");
+        }
+        if (!_packages || _packages->directory() != locator->packagesDir)
+        {
+            _packages = std::make_shared<PackageIndex>(locator->packagesDir);
+        }
+        return _packages;
+    }
+
+    void UpdateManager::setPackageRetention(PackageRetention retention)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _packageRetention = retention;
+    }
+
+    PackageRetention UpdateManager::getPackageRetention() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _packageRetention;
+    }
+
+    void UpdateManager::setSharedPackageCache(std::string directory)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sharedPackageCache = std::move(directory);
+    }
+
+    std::string UpdateManager::getSharedPackageCache() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _sharedPackageCache;
+    }
+
+    void UpdateManager::enablePeerSharing(PeerSharingOptions options)
+    {
+        auto server = std::make_shared<PeerServer>(getPackageIndex(), options);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _peerSharing = std::move(options);
+        _peerServer = std::move(server);
+    }
+
+    void UpdateManager::disablePeerSharing()
+    {
+        std::shared_ptr<PeerServer> server;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _peerSharing.reset();
+            server = std::move(_peerServer);
+        }
+        // stopped here, without the lock, as it waits for uploads in progress to be aborted
+    }
+
+    void UpdateManager::setRolloutId(std::string id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _rolloutId = std::move(id);
+    }
+
+    std::string UpdateManager::getRolloutId() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_rolloutId.empty())
+        {
+            return _rolloutId;
+        }
+
+        std::shared_ptr<const VelopackLocator> locator = findLocator();
+        if (!locator)
+        {
+            throw std::runtime_error("The rollout id is not known, as the app is not installed.");
+        }
+        std::filesystem::path path = std::filesystem::path(locator->packagesDir) / ".rollout-id";
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(path, ec))
+        {
+            std::string id(VeloString_Trim(VeloFile_ReadAllText(path)));
+            if (id.size() == 32 && id.find_first_not_of("0123456789abcdef") == std::string::npos)
+            {
+                return _rolloutId = id;
+            }
+        }
+
+        // if two processes create it at once, both write a complete file and the last rename decides
+        std::random_device random;
+        static const char hex[] = "0123456789abcdef";
+        std::string id;
+        for (int i = 0; i < 32; i += 8)
+        {
+            uint32_t bits = random();
+            for (int shift = 28; shift >= 0; shift -= 4)
+                id.push_back(hex[(bits >> shift) & 15]);
+        }
+        std::filesystem::create_directories(path.parent_path(), ec);
+        std::filesystem::path tmp = path;
+        tmp += "." + std::to_string(nativeCurrentProcessId()) + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out << id << "\n";
+        }
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(tmp, ec); // still usable for this process, another one is chosen next time
+        }
+        return _rolloutId = id;
+    }
+
+    void UpdateManager::setUpdaterOutputPath(std::string path)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _updaterOutputPath = std::move(path);
+    }
+
+    void UpdateManager::applyUpdatesAndExit(const VelopackAsset *toApply) const
+    {
+        std::vector<std::string> command = getUpdateApplyCommand(toApply, false, false, false);
+        startUpdater(&command);
+        Platform::exit(0);
+    }
+
+    void UpdateManager::applyUpdatesAndRestart(const VelopackAsset *toApply, const std::vector<std::string> *restartArgs) const
+    {
+        std::vector<std::string> command = getUpdateApplyCommand(toApply, false, true, false, restartArgs);
+        startUpdater(&command);
+        Platform::exit(0);
+    }
+
+    void UpdateManager::waitExitThenApplyUpdates(const VelopackAsset *toApply, bool silent, bool restart, const std::vector<std::string> *restartArgs) const
+    {
+        std::vector<std::string> command = getUpdateApplyCommand(toApply, silent, restart, true, restartArgs);
+        startUpdater(&command);
+    }
+
+    void UpdateManager::startUpdater(const std::vector<std::string> *command) const
+    {
+        std::string output_path;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            output_path = _updaterOutputPath;
+        }
+        nativeStartProcessFireAndForget(command, output_path);
+    }
+
+    struct UpdateScheduler::Impl
+    {
+        std::shared_ptr<UpdateManager> manager;
+        UpdateScheduleOptions options;
+        std::mt19937_64 random{ std::random_device{}() };
+        // guarded by the mutex of the thread
+        bool started = false;
+        bool busy = false;
+        std::chrono::steady_clock::time_point due;
+        unsigned failures = 0;
+        CancellationToken cancellation;
+        std::thread::id worker; // of the check in progress
+        // only used by the check in progress
+        std::string announced;
+        std::string downloaded;
+
+        std::chrono::milliseconds jittered(std::chrono::milliseconds delay)
+        {
+            double jitter = std::clamp(options.jitter, 0.0, 1.0);
+            std::uniform_real_distribution<double> factor(1.0 - jitter, 1.0 + jitter);
+            return std::chrono::milliseconds(static_cast<int64_t>(static_cast<double>(delay.count()) * factor(random)));
+        }
+
+        std::chrono::milliseconds backoff(unsigned failures) const
+        {
+            std::chrono::milliseconds delay = std::max(options.retryDelay, std::chrono::milliseconds(1));
+            for (unsigned i = 1; i < failures && delay < options.maxBackoff; i++)
+                delay *= 2;
+            return std::min(delay, options.maxBackoff);
+        }
+
+        // runs one check and returns the delay until the next
+        std::chrono::milliseconds run(const CancellationToken &cancellation, unsigned failures_so_far, unsigned &failures_after)
+        {
+            failures_after = failures_so_far;
+            if (options.canCheck && !options.canCheck())
+            {
+                return options.retryDelay;
+            }
+            try
+            {
+                std::shared_ptr<UpdateInfo> update = manager->checkForUpdates(cancellation);
+                if (update && update->targetFullRelease)
+                {
+                    const std::string &version = update->targetFullRelease->version;
+                    if (version != announced)
+                    {
+                        announced = version;
+                        if (options.onUpdateAvailable)
+                            options.onUpdateAvailable(update);
+                    }
+                    if (options.autoDownload && version != downloaded && (!options.canDownload || options.canDownload()))
+                    {
+                        manager->downloadUpdates(update->targetFullRelease.get(), cancellation, options.onDownloadProgress);
+                        downloaded = version;
+                        if (options.onUpdateDownloaded)
+                            options.onUpdateDownloaded(update);
+                    }
+                }
+                failures_after = 0;
+                return options.interval;
+            }
+            catch (...)
+            {
+                if (cancellation.isCancelled())
+                {
+                    return options.interval; // stopped, the scheduler is not rescheduled
+                }
+                failures_after = failures_so_far + 1;
+                if (options.onError)
+                {
+                    try
+                    {
+                        options.onError(std::current_exception());
+                    }
+                    catch (...)
+                    {
+                    }
+                }
+                return backoff(failures_after);
+            }
+        }
+
+        // The one timer thread for every scheduler. It is started with the first scheduler, and exits when the last
+        // one is stopped. It only waits for checks to fall due: each check runs on a thread of its own, so that a long
+        // download for one manager does not hold up the checks of the others. The state is never destroyed, as the
+        // detached threads may still be using it while the process exits.
+        struct Thread
+        {
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::vector<std::shared_ptr<Impl>> jobs;
+            bool running = false;
+        };
+
+        static Thread &thread()
+        {
+            static Thread *thread = new Thread();
+            return *thread;
+        }
+
+        static void runThread();
+        static void runCheck(std::shared_ptr<Impl> job);
+    };
+
+    void UpdateScheduler::Impl::runThread()
+    {
+        Thread &thread = Impl::thread();
+        std::unique_lock<std::mutex> lock(thread.mutex);
+        while (!thread.jobs.empty())
+        {
+            std::shared_ptr<Impl> job;
+            for (const auto &candidate : thread.jobs)
+            {
+                if (!candidate->busy && (!job || candidate->due < job->due))
+                    job = candidate;
+            }
+            if (!job)
+            {
+                thread.changed.wait(lock); // every job is running a check
+                continue;
+            }
+            if (job->due > std::chrono::steady_clock::now())
+            {
+                thread.changed.wait_until(lock, job->due);
+                continue;
+            }
+
+            job->busy = true;
+            std::thread worker(Impl::runCheck, job);
+            job->worker = worker.get_id();
+            worker.detach();
+        }
+        thread.running = false;
+    }
+
+    void UpdateScheduler::Impl::runCheck(std::shared_ptr<Impl> job)
+    {
+        Thread &thread = Impl::thread();
+        std::unique_lock<std::mutex> lock(thread.mutex);
+        CancellationToken cancellation = job->cancellation;
+        unsigned failures = job->failures;
+        lock.unlock();
+        std::chrono::milliseconds delay = job->run(cancellation, failures, failures);
+        lock.lock();
+        job->busy = false;
+        job->worker = {};
+        job->failures = failures;
+        job->due = std::chrono::steady_clock::now() + job->jittered(delay);
+        thread.changed.notify_all();
+    }
+
+    UpdateScheduler::UpdateScheduler(std::shared_ptr<UpdateManager> manager, UpdateScheduleOptions options)
+        : _impl(std::make_shared<Impl>())
+    {
+        if (!manager)
+        {
+            throw std::invalid_argument("UpdateScheduler needs an UpdateManager.");
+        }
+        if (options.interval <= std::chrono::milliseconds::zero())
+        {
+            throw std::invalid_argument("The update check interval must be positive.");
+        }
+        _impl->manager = std::move(manager);
+        _impl->options = std::move(options);
+    }
+
+    UpdateScheduler::~UpdateScheduler()
+    {
+        stop();
+    }
+
+    void UpdateScheduler::start()
+    {
+        Impl::Thread &thread = Impl::thread();
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        if (_impl->started)
+        {
+            return;
+        }
+        auto window = std::max(_impl->options.firstCheckWithin, std::chrono::milliseconds::zero());
+        std::uniform_int_distribution<int64_t> first(0, window.count());
+        _impl->started = true;
+        _impl->due = std::chrono::steady_clock::now() + std::chrono::milliseconds(first(_impl->random));
+        thread.jobs.push_back(_impl);
+        if (!thread.running)
+        {
+            thread.running = true;
+            std::thread(Impl::runThread).detach();
+        }
+        thread.changed.notify_all();
+    }
+
+    void UpdateScheduler::stop()
+    {
+        Impl::Thread &thread = Impl::thread();
+        std::unique_lock<std::mutex> lock(thread.mutex);
+        if (!_impl->started)
+        {
+            return;
+        }
+        _impl->started = false;
+        _impl->cancellation.cancel();
+        _impl->cancellation = CancellationToken();
+        thread.jobs.erase(std::find(thread.jobs.begin(), thread.jobs.end(), _impl));
+        thread.changed.notify_all();
+        if (_impl->worker != std::this_thread::get_id())
+        {
+            thread.changed.wait(lock, [this]
+                                       { return !_impl->busy; });
+        }
+    }
+
+    bool UpdateScheduler::isRunning() const
+    {
+        std::lock_guard<std::mutex> lock(Impl::thread().mutex);
+        return _impl->started;
+    }
+
+    void UpdateScheduler::checkNow()
+    {
+        std::lock_guard<std::mutex> lock(Impl::thread().mutex);
+        if (_impl->started && !_impl->busy)
+        {
+            _impl->due = std::chrono::steady_clock::now();
+            Impl::thread().changed.notify_all();
+        }
+    }
+
+    std::chrono::steady_clock::time_point UpdateScheduler::nextCheck() const
+    {
+        std::lock_guard<std::mutex> lock(Impl::thread().mutex);
+        return _impl->due;
+    }
+
+    unsigned UpdateScheduler::failureCount() const
+    {
+        std::lock_guard<std::mutex> lock(Impl::thread().mutex);
+        return _impl->failures;
     }
 } // namespace Velopack
\ No newline at end of file
@@ -13,10 +13,24 @@
 //
 //  #define VELOPACK_NO_ICU
 
+//  DELTA PACKAGE NOTES
+//
+//  Delta packages store changed files as zstd patches (.zsdiff), or as bsdiff patches (.bsdiff, and .diff in
+//  packages made by Squirrel). DeltaApplier needs libzstd and libbz2 to apply these. To enable either, define
+//  the matching symbol below and link against the library. Patches of a kind which is not enabled fail to apply.
+//
+//  #define VELOPACK_ZSTD
+//  #define VELOPACK_BZIP2
+
 #ifndef VELOPACK_H_INCLUDED
 #define VELOPACK_H_INCLUDED
 
 #include <cstddef>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace Velopack
 {
@@ -24,6 +38,164 @@ namespace Velopack
     void startup(wchar_t **args, size_t c_args);
 #endif // UNICODE
     void startup(char **args, size_t c_args);
+
+    /**
+     * Install metadata (the Vfusion and Update paths, the packages directory, the current version and channel) can not
+     * change while the app is running, so it is resolved once per process and then cached. Call this to discard the cache,
+     * eg. if this process has installed or moved the app since it was first read. Values are resolved again on next use.
+     */
+    void invalidateInstallContext();
+
+    /**
+     * A thread-safe flag used to ask a long running operation (such as waiting on a child process) to stop.
+     * Copies of a token share the same state, so a token can be handed to a worker and cancelled from another thread.
+     */
+    class CancellationToken
+    {
+    public:
+        CancellationToken();
+        /**
+         * Creates a new token which is cancelled when it is cancelled itself, or when either of the given tokens is cancelled.
+         */
+        static CancellationToken linked(const CancellationToken &a, const CancellationToken &b);
+        /**
+         * Signals cancellation. This can not be undone.
+         */
+        void cancel() const;
+        /**
+         * Returns true if this token, or any token it is linked to, has been cancelled.
+         */
+        bool isCancelled() const;
+    private:
+        struct State;
+        std::shared_ptr<State> _state;
+    };
+
+    /**
+     * Controls how a child process started by Velopack is supervised while we wait for it.
+     */
+    struct ProcessOptions
+    {
+        /**
+         * The maximum time the process is allowed to run. Once this elapses, the process is terminated and
+         * ProcessTimeoutException is thrown. Zero (the default) waits forever.
+         */
+        std::chrono::milliseconds timeout{ 0 };
+        /**
+         * If this token is cancelled while the process is running, the process is terminated and
+         * ProcessCancelledException is thrown.
+         */
+        CancellationToken cancellation;
+        /**
+         * The maximum number of bytes of standard error output kept for diagnostics. The process is allowed to
+         * write more than this, but only the most recent output is retained and attached to ProcessException.
+         */
+        size_t maxStandardErrorBytes = 16 * 1024;
+    };
+
+    /**
+     * A child process which is driven by the caller's event loop instead of blocking a thread. Register stdoutFd(),
+     * stderrFd() and pidFd() for readability with your reactor (epoll, an io_uring poll, etc.) and call poll() whenever
+     * one of them is ready, or once nextTimeout() has elapsed. poll() never blocks.
+     *
+     * poll() closes each descriptor as soon as it is no longer needed (at EOF, or once the process has been reaped)
+     * and its accessor then returns -1, so re-read the accessors after every call. A closed descriptor is removed
+     * from epoll automatically. Destroying an AsyncProcess which has not completed terminates and reaps the child.
+     */
+    class AsyncProcess
+    {
+    public:
+        AsyncProcess(const std::vector<std::string> &command_line, const ProcessOptions &options = {});
+        ~AsyncProcess();
+        AsyncProcess(AsyncProcess &&) noexcept;
+        AsyncProcess &operator=(AsyncProcess &&) noexcept;
+        /**
+         * The read end of the child's stdout pipe, or -1 once it has been closed. Always -1 on Windows.
+         */
+        int stdoutFd() const;
+        /**
+         * The read end of the child's stderr pipe, or -1 once it has been closed. Always -1 on Windows.
+         */
+        int stderrFd() const;
+        /**
+         * A Linux pidfd which becomes readable when the child exits, or -1 if it has been reaped or pidfds are not
+         * supported (other platforms, or kernels older than 5.3). Without a pidfd, exit is detected by poll() itself.
+         */
+        int pidFd() const;
+        /**
+         * The process id of the child, for use with platform facilities such as kqueue's EVFILT_PROC.
+         */
+        int processId() const;
+        /**
+         * On Windows, the process HANDLE, which becomes signalled when the child exits. Null on other platforms.
+         */
+        void *processHandle() const;
+        /**
+         * The longest the caller may wait before calling poll() again even if no descriptor becomes ready,
+         * so that ProcessOptions::timeout and cancellation are enforced promptly.
+         */
+        std::chrono::milliseconds nextTimeout() const;
+        /**
+         * Reads any available output and reaps the child if it has exited, without blocking.
+         * Returns true once the process has completed (successfully or not).
+         */
+        bool poll();
+        /**
+         * Returns true once the process has completed. Further calls to poll() do nothing.
+         */
+        bool isComplete() const;
+        /**
+         * Terminates the child if it is still running. The process then completes with ProcessCancelledException.
+         */
+        void terminate();
+        /**
+         * Returns everything the process wrote to stdout. Throws ProcessException (or one of its subclasses) if the process
+         * failed, was cancelled or timed out, or has not completed yet.
+         */
+        std::string result() const;
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+    };
+
+    /**
+     * Thrown when a child process could not be started or did not complete successfully.
+     */
+    class ProcessException : public std::runtime_error
+    {
+    public:
+        explicit ProcessException(const std::string &message, int exitCode = -1, std::string standardError = {})
+            : std::runtime_error(message), _exitCode(exitCode), _standardError(std::move(standardError)) {}
+        /**
+         * The exit code of the process, or -1 if it did not exit on its own (eg. it could not be started or was terminated).
+         */
+        int exitCode() const { return _exitCode; }
+        /**
+         * The tail of what the process wrote to standard error before it failed, bounded by ProcessOptions::maxStandardErrorBytes.
+         */
+        const std::string &standardError() const { return _standardError; }
+    private:
+        int _exitCode;
+        std::string _standardError;
+    };
+
+    /**
+     * Thrown when a child process was terminated because it exceeded ProcessOptions::timeout.
+     */
+    class ProcessTimeoutException : public ProcessException
+    {
+    public:
+        using ProcessException::ProcessException;
+    };
+
+    /**
+     * Thrown when a child process was terminated because its CancellationToken was cancelled.
+     */
+    class ProcessCancelledException : public ProcessException
+    {
+    public:
+        using ProcessException::ProcessException;
+    };
 }
 
 #endif // VELOPACK_H_INCLUDED
\ No newline at end of file
@@ -0,0 +1,1340 @@
+//  C++ EXTENSIONS
+//
+//  The declarations below are only available in the C++ library. They build on
+//  the generated classes above (eg. UpdateManagerSync) in the same way that the
+//  C# and JS libraries add their own UpdateManager on top of UpdateManagerSync.
+
+#ifndef VELOPACK_EXT_H_INCLUDED
+#define VELOPACK_EXT_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <compare>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace Velopack
+{
+    /**
+     * The metadata of the installed package, read from the manifest (sq.version, a nuspec file) which ships with the app.
+     */
+    class VelopackManifest
+    {
+    public:
+        /**
+         * Parses the XML of a package manifest. Throws if the XML is malformed, or if the id or version is missing.
+         */
+        static VelopackManifest parse(std::string_view xml);
+        /**
+         * Reads and parses the package manifest at the given path.
+         */
+        static VelopackManifest read(const std::string &path);
+    public:
+        std::string id;
+        std::string version;
+        std::string title;
+        std::string authors;
+        std::string description;
+        std::string machineArchitecture;
+        std::string runtimeDependencies;
+        std::string mainExe;
+        std::string os;
+        std::string osMinVersion;
+        std::string channel;
+    };
+
+    /**
+     * Locates the important paths of the installed app (its root directory, the Update binary and the packages directory)
+     * and reads its manifest, all in-process. This does not need Vfusion, and takes microseconds instead of a process launch.
+     */
+    class VelopackLocator
+    {
+    public:
+        /**
+         * Locates the app which contains the current process. Throws if the app is not installed.
+         */
+        static VelopackLocator autoLocate();
+        /**
+         * Locates the app which contains the given executable, using the install layout of the current OS.
+         */
+        static VelopackLocator locate(const std::string &exePath);
+    public:
+        /**
+         * The root directory of the current app.
+         */
+        std::string rootAppDir;
+        /**
+         * The path to the Update binary.
+         */
+        std::string updateExePath;
+        /**
+         * The directory where updates are downloaded to.
+         */
+        std::string packagesDir;
+        /**
+         * The manifest of the currently installed package.
+         */
+        VelopackManifest manifest;
+    };
+
+    /**
+     * A semantic version (see https://semver.org), eg. "1.2.3-beta.1+build.5". Versions are ordered by SemVer 2.0
+     * precedence: numeric identifiers compare numerically, a pre-release sorts before the release itself, and build
+     * metadata is ignored.
+     *
+     * Versions are parsed once into a small value that is cheap to copy and compare: the start of the pre-release is
+     * kept in a byte comparable sort key, so most comparisons only look at four integers. Parsing is constexpr, so a
+     * literal can be checked and parsed at compile time (`constexpr auto v = SemanticVersion::parse("1.2.3");`). The
+     * pre-release and build text of versions parsed at runtime is interned, so a version stays valid after the string
+     * it was parsed from is gone.
+     */
+    class SemanticVersion
+    {
+    public:
+        constexpr SemanticVersion() = default;
+        constexpr SemanticVersion(uint64_t major, uint64_t minor, uint64_t patch) : _major(major), _minor(minor), _patch(patch) {}
+        /**
+         * Parses a version string. Throws std::invalid_argument if it is not a valid SemVer 2.0 version.
+         */
+        static constexpr SemanticVersion parse(std::string_view version);
+        /**
+         * Parses a version string, returning false (and leaving result unchanged) if it is not a valid SemVer 2.0 version.
+         */
+        static constexpr bool tryParse(std::string_view version, SemanticVersion &result);
+        std::string toString() const;
+        constexpr uint64_t major() const { return _major; }
+        constexpr uint64_t minor() const { return _minor; }
+        constexpr uint64_t patch() const { return _patch; }
+        /**
+         * The dot separated pre-release identifiers (eg. "beta.1"), or an empty string for a release.
+         */
+        constexpr std::string_view prerelease() const { return _prerelease; }
+        /**
+         * The build metadata (eg. "build.5"), which does not affect precedence.
+         */
+        constexpr std::string_view build() const { return _build; }
+        constexpr std::strong_ordering operator<=>(const SemanticVersion &other) const;
+        constexpr bool operator==(const SemanticVersion &other) const { return (*this <=> other) == 0; }
+
+    private:
+        static std::string_view intern(std::string_view text);
+        static constexpr bool parseNumber(std::string_view s, uint64_t &value);
+        static constexpr bool isValidIdentifiers(std::string_view s, bool prerelease);
+        static constexpr uint64_t prereleaseKey(std::string_view prerelease, bool &complete);
+        static constexpr std::strong_ordering comparePrerelease(std::string_view a, std::string_view b);
+
+        uint64_t _major = 0;
+        uint64_t _minor = 0;
+        uint64_t _patch = 0;
+        // The first 8 bytes of the encoded pre-release (see prereleaseKey), big endian. All ones for a release, which
+        // sorts after any pre-release.
+        uint64_t _key = UINT64_MAX;
+        // Whether _key holds all of the encoded pre-release, so that equal keys mean equal pre-releases.
+        bool _keyComplete = true;
+        // Interned at runtime, or pointing into a literal when parsed at compile time.
+        std::string_view _prerelease;
+        std::string_view _build;
+    };
+
+    // Parses a numeric identifier: digits only, and no leading zeros.
+    constexpr bool SemanticVersion::parseNumber(std::string_view s, uint64_t &value)
+    {
+        if (s.empty() || s.size() > 19 || (s.size() > 1 && s[0] == '0'))
+            return false;
+        value = 0;
+        for (char c : s)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            value = value * 10 + (uint64_t)(c - '0');
+        }
+        return true;
+    }
+
+    // Checks dot separated identifiers are non-empty and only contain [0-9A-Za-z-]. Numeric pre-release
+    // identifiers must not have leading zeros, build identifiers may.
+    constexpr bool SemanticVersion::isValidIdentifiers(std::string_view s, bool prerelease)
+    {
+        size_t start = 0;
+        while (true)
+        {
+            size_t end = (std::min)(s.find('.', start), s.size());
+            std::string_view id = s.substr(start, end - start);
+            if (id.empty())
+                return false;
+            bool numeric = true;
+            for (char c : id)
+            {
+                bool digit = c >= '0' && c <= '9';
+                if (!digit && !(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') && c != '-')
+                    return false;
+                numeric = numeric && digit;
+            }
+            if (prerelease && numeric && id.size() > 1 && id[0] == '0')
+                return false;
+            if (end == s.size())
+                return true;
+            start = end + 1;
+        }
+    }
+
+    // Encodes the pre-release so that comparing the bytes gives SemVer precedence, and returns the first 8 bytes.
+    // Each numeric identifier is 0x01, its length in bytes and its value big endian, each other identifier is 0x02,
+    // its text and a 0x00, and the identifiers end with a 0x00 (so that a larger set of identifiers sorts last).
+    constexpr uint64_t SemanticVersion::prereleaseKey(std::string_view prerelease, bool &complete)
+    {
+        uint64_t key = 0;
+        size_t length = 0;
+        auto put = [&](uint8_t b)
+        {
+            if (length < 8)
+                key |= (uint64_t)b << (56 - 8 * length);
+            length++;
+        };
+        size_t start = 0;
+        while (true)
+        {
+            size_t end = (std::min)(prerelease.find('.', start), prerelease.size());
+            std::string_view id = prerelease.substr(start, end - start);
+            uint64_t value = 0;
+            if (parseNumber(id, value))
+            {
+                int bytes = 1;
+                while (bytes < 8 && (value >> (8 * bytes)) != 0)
+                    bytes++;
+                put(0x01);
+                put((uint8_t)bytes);
+                for (int i = bytes - 1; i >= 0; i--)
+                    put((uint8_t)(value >> (8 * i)));
+            }
+            else
+            {
+                put(0x02);
+                for (char c : id)
+                    put((uint8_t)c);
+                put(0x00);
+            }
+            if (end == prerelease.size() || length > 8)
+                break;
+            start = end + 1;
+        }
+        put(0x00);
+        complete = length <= 8;
+        return key;
+    }
+
+    constexpr std::strong_ordering SemanticVersion::comparePrerelease(std::string_view a, std::string_view b)
+    {
+        while (true)
+        {
+            size_t a_end = (std::min)(a.find('.'), a.size());
+            size_t b_end = (std::min)(b.find('.'), b.size());
+            std::string_view a_id = a.substr(0, a_end), b_id = b.substr(0, b_end);
+            uint64_t a_num = 0, b_num = 0;
+            bool a_numeric = parseNumber(a_id, a_num);
+            bool b_numeric = parseNumber(b_id, b_num);
+            std::strong_ordering c = std::strong_ordering::equal;
+            if (a_numeric && b_numeric)
+                c = a_num <=> b_num;
+            else if (a_numeric != b_numeric)
+                c = a_numeric ? std::strong_ordering::less : std::strong_ordering::greater; // numeric ids sort first
+            else
+                c = a_id.compare(b_id) <=> 0;
+            if (c != 0)
+                return c;
+            bool a_done = a_end == a.size(), b_done = b_end == b.size();
+            if (a_done || b_done)
+                return b_done <=> a_done; // a larger set of identifiers has higher precedence
+            a.remove_prefix(a_end + 1);
+            b.remove_prefix(b_end + 1);
+        }
+    }
+
+    constexpr bool SemanticVersion::tryParse(std::string_view version, SemanticVersion &result)
+    {
+        SemanticVersion parsed;
+        std::string_view prerelease, build;
+        size_t plus = version.find('+');
+        if (plus != std::string_view::npos)
+        {
+            build = version.substr(plus + 1);
+            if (!isValidIdentifiers(build, false))
+                return false;
+            version = version.substr(0, plus);
+        }
+        size_t dash = version.find('-');
+        if (dash != std::string_view::npos)
+        {
+            prerelease = version.substr(dash + 1);
+            if (!isValidIdentifiers(prerelease, true))
+                return false;
+            version = version.substr(0, dash);
+        }
+        size_t dot1 = version.find('.');
+        size_t dot2 = dot1 == std::string_view::npos ? dot1 : version.find('.', dot1 + 1);
+        if (dot2 == std::string_view::npos ||
+            !parseNumber(version.substr(0, dot1), parsed._major) ||
+            !parseNumber(version.substr(dot1 + 1, dot2 - dot1 - 1), parsed._minor) ||
+            !parseNumber(version.substr(dot2 + 1), parsed._patch))
+        {
+            return false;
+        }
+        if (!prerelease.empty())
+            parsed._key = prereleaseKey(prerelease, parsed._keyComplete);
+        if (std::is_constant_evaluated())
+        {
+            parsed._prerelease = prerelease;
+            parsed._build = build;
+        }
+        else
+        {
+            parsed._prerelease = intern(prerelease);
+            parsed._build = intern(build);
+        }
+        result = parsed;
+        return true;
+    }
+
+    constexpr SemanticVersion SemanticVersion::parse(std::string_view version)
+    {
+        SemanticVersion result;
+        if (!tryParse(version, result))
+        {
+            throw std::invalid_argument("'" + std::string(version) + "' is not a valid semantic version.");
+        }
+        return result;
+    }
+
+    constexpr std::strong_ordering SemanticVersion::operator<=>(const SemanticVersion &other) const
+    {
+        if (_major != other._major)
+            return _major <=> other._major;
+        if (_minor != other._minor)
+            return _minor <=> other._minor;
+        if (_patch != other._patch)
+            return _patch <=> other._patch;
+        if (_key != other._key || (_keyComplete && other._keyComplete))
+            return _key <=> other._key;
+        return comparePrerelease(_prerelease, other._prerelease);
+    }
+
+    class PackageIndex;
+
+    /**
+     * The cost model used by VelopackAssetFeed::planUpdate, and where to look for packages which are already present.
+     */
+    struct UpdatePlanOptions
+    {
+        /**
+         * The expected download speed, in bytes per second.
+         */
+        double downloadBytesPerSecond = 4e6;
+        /**
+         * The time each download takes before any data arrives (connecting, redirects), in seconds.
+         */
+        double secondsPerDownload = 0.2;
+        /**
+         * The speed at which packages are processed when deltas are applied, in bytes per second. A chain of deltas
+         * extracts its base package once, reads each delta once, and writes the resulting full package once.
+         */
+        double applyBytesPerSecond = 50e6;
+        /**
+         * A directory holding packages from earlier updates, usually VelopackLocator::packagesDir. A package found
+         * there does not need to be downloaded again. Deltas must also have the size given in the feed, full packages
+         * may have any size, as a full package rebuilt from deltas is not byte for byte the one in the feed.
+         */
+        std::string packagesDir;
+        /**
+         * An index of the packages directory, used instead of listing packagesDir.
+         */
+        const PackageIndex *packages = nullptr;
+    };
+
+    /**
+     * The packages needed to produce the full package of a release, as planned by VelopackAssetFeed::planUpdate.
+     */
+    struct UpdatePlan
+    {
+        /**
+         * A full package, followed by the deltas (if any) which turn it into the target release, oldest first.
+         * Empty if the target release is not in the feed.
+         */
+        std::vector<std::shared_ptr<VelopackAsset>> assets;
+        /**
+         * Whether each package of `assets` is already in the packages directory.
+         */
+        std::vector<bool> cached;
+        /**
+         * The number of bytes to download, the size of every package which is not cached.
+         */
+        uint64_t downloadBytes = 0;
+        /**
+         * The estimated time to download and apply the packages, in seconds.
+         */
+        double estimatedSeconds = 0;
+        /**
+         * Whether the plan applies deltas, rather than using the full package of the target as it is.
+         */
+        bool isDelta() const { return assets.size() > 1; }
+    };
+
+    /**
+     * A feed of Velopack assets, usually retrieved from a remote location (releases.{channel}.json). The assets are
+     * kept in version order, and indexed by file name and by version, so that lookups stay fast on feeds with tens
+     * of thousands of releases.
+     */
+    class VelopackAssetFeed
+    {
+    public:
+        /**
+         * Parses the JSON of a release feed. The assets are allocated together in one block, oldest version first.
+         */
+        static VelopackAssetFeed fromJson(std::string_view json);
+        /**
+         * Sorts the assets oldest version first (a full package before a delta of the same version, and versions
+         * which do not parse before all others), and rebuilds the indexes. fromJson does this; call it again after
+         * changing `assets`, otherwise the queries below have to build the indexes again each time.
+         */
+        void reindex();
+        /**
+         * Finds an asset by file name (case insensitive), or returns null if it is not in the feed.
+         */
+        const VelopackAsset *find(std::string_view fileName) const;
+        /**
+         * Finds the asset of a version and type, or returns null if it is not in the feed. Build metadata is ignored.
+         */
+        std::shared_ptr<VelopackAsset> find(const SemanticVersion &version, VelopackAssetType type) const;
+        /**
+         * Returns the asset of the given type with the highest version, or null if there is none.
+         */
+        std::shared_ptr<VelopackAsset> latest(VelopackAssetType type = VelopackAssetType::full) const;
+        /**
+         * Returns the asset of the given type with the highest version which has been rolled out to the client
+         * `rolloutId` (see isRolledOut), or null if there is none.
+         */
+        std::shared_ptr<VelopackAsset> latest(VelopackAssetType type, std::string_view rolloutId) const;
+        /**
+         * Returns the delta packages newer than `version`, oldest first.
+         */
+        std::vector<std::shared_ptr<VelopackAsset>> deltasNewerThan(const SemanticVersion &version) const;
+        /**
+         * Returns the delta packages newer than `from`, up to and including `to`, oldest first.
+         */
+        std::vector<std::shared_ptr<VelopackAsset>> deltasBetween(const SemanticVersion &from, const SemanticVersion &to) const;
+        /**
+         * Works out the cheapest way to get the full package of `target`: downloading it, or applying a chain of deltas
+         * to the full package of an earlier release. Each delta applies to the release just before it in the feed. The
+         * cost of a path is the estimated time to download the packages which are not cached, and to apply the deltas.
+         * Planning is linear in the number of releases up to the target.
+         */
+        UpdatePlan planUpdate(const SemanticVersion &target, const UpdatePlanOptions &options = {}) const;
+    public:
+        std::vector<std::shared_ptr<VelopackAsset>> assets;
+        /**
+         * Identifies this revision of the feed (eg. from the HTTP ETag), or is empty if the source can not tell.
+         * Two feeds from the same source with the same non-empty validator have the same contents.
+         */
+        std::string validator;
+    private:
+        struct Index;
+        std::shared_ptr<const Index> index() const;
+        std::shared_ptr<const Index> _index; // shared by copies of the feed, which do not change it
+    };
+
+    /**
+     * Decides if a release has been rolled out to a client, for staged rollouts. The client's bucket is a hash of
+     * `rolloutId` with the package id and version, uniformly spread over [0, 100), and the release is available to it
+     * once VelopackAsset::rolloutPercentage is above its bucket. The bucket is stable, so raising the percentage only
+     * ever adds clients, and it differs between releases, so the same clients are not always the first. Only checks
+     * made in-process apply rollouts, see UpdateManager::setRolloutId.
+     */
+    bool isRolledOut(const VelopackAsset &asset, std::string_view rolloutId);
+
+    /**
+     * Called with the progress of a download or an extraction, from 0 to 100.
+     */
+    using ProgressHandler = std::function<void(int16_t progress)>;
+
+    /**
+     * A file or directory stored in a BundleZip.
+     */
+    struct BundleEntry
+    {
+        /**
+         * The path of the entry within the package, with '/' separators. Directories end with '/'.
+         */
+        std::string_view name;
+        uint64_t compressedSize = 0;
+        uint64_t size = 0;
+        uint32_t crc32 = 0;
+        uint16_t method = 0;
+        uint16_t flags = 0;
+        uint64_t localHeaderOffset = 0;
+        /**
+         * The Unix permission bits of the entry, or 0 if the package was not created on a Unix system.
+         */
+        uint32_t unixMode = 0;
+
+        bool isDirectory() const { return name.ends_with('/'); }
+    };
+
+    /**
+     * A release package (.nupkg, which is a zip file) opened for reading. The file is memory mapped and its central
+     * directory is parsed once into an index, so finding an entry does no I/O and reading one only touches its data.
+     * Entries can be stored or deflated (zip64 is supported), and are checked against their CRC-32 as they are read.
+     */
+    class BundleZip
+    {
+    public:
+        /**
+         * Opens a package. Throws if the file can not be read, or is not a zip file.
+         */
+        static BundleZip open(const std::string &path);
+        ~BundleZip();
+        BundleZip(BundleZip &&) noexcept;
+        BundleZip &operator=(BundleZip &&) noexcept;
+        /**
+         * Returns every entry, in the order of the central directory. The names stay valid while the package is open.
+         */
+        const std::vector<BundleEntry> &entries() const;
+        /**
+         * Finds an entry by its exact name, or returns null if there is none.
+         */
+        const BundleEntry *find(std::string_view name) const;
+        /**
+         * Returns the first entry whose name matches the predicate, or null if there is none.
+         */
+        const BundleEntry *find(const std::function<bool(std::string_view name)> &predicate) const;
+        /**
+         * Returns the total compressed and uncompressed size of all entries.
+         */
+        std::pair<uint64_t, uint64_t> calculateSize() const;
+        /**
+         * Reads an entry into memory.
+         */
+        std::string read(const BundleEntry &entry) const;
+        /**
+         * Streams the contents of an entry to the sink in chunks, without holding the whole entry in memory.
+         */
+        void read(const BundleEntry &entry, const std::function<void(const char *data, size_t size)> &sink) const;
+        /**
+         * Extracts an entry to a file, creating its parent directories if needed.
+         */
+        void extract(const BundleEntry &entry, const std::string &path) const;
+        /**
+         * Extracts many entries into a directory at once. `pathFor` maps an entry to its path relative to the directory,
+         * or to an empty string to skip it; by default every entry is extracted under its own name. Directories are all
+         * created up front, and the files are written on `threads` worker threads (0 uses one per CPU), which share
+         * the work out between them so that a few large files do not hold up the rest. Throws if an entry would be
+         * written outside of the directory, or if any entry fails to extract.
+         */
+        void extractAll(const std::string &directory, const std::function<std::string(const BundleEntry &entry)> &pathFor = {},
+                        int threads = 0, const ProgressHandler &progress = {}) const;
+        /**
+         * Reads the package manifest (the .nuspec file). Throws if the package does not have one.
+         */
+        VelopackManifest readManifest() const;
+    private:
+        struct Impl;
+        explicit BundleZip(std::unique_ptr<Impl> impl);
+        std::unique_ptr<Impl> _impl;
+    };
+
+    /**
+     * Reconstructs a full package from a base package and a chain of delta packages. The base is extracted into a
+     * working directory once, and each delta is then applied to those files in place, so no intermediate full package
+     * is written. Patches are streamed from the delta package against a memory mapped copy of the old file, so memory
+     * use does not grow with file size. Every patched file is checked against the SHA1 in its .shasum file.
+     */
+    class DeltaApplier
+    {
+    public:
+        /**
+         * Extracts the base package into `workDirectory`, replacing anything already there. Files are extracted and
+         * patched on `threads` worker threads (0 uses one per CPU).
+         */
+        DeltaApplier(const std::string &basePackage, const std::string &workDirectory, int threads = 0);
+        /**
+         * Deletes the working directory.
+         */
+        ~DeltaApplier();
+        DeltaApplier(DeltaApplier &&) noexcept;
+        DeltaApplier &operator=(DeltaApplier &&) noexcept;
+        /**
+         * Applies the next delta package in the chain. Throws if a patch is corrupt, does not match its .shasum or
+         * needs a library which is not enabled (see VELOPACK_ZSTD and VELOPACK_BZIP2); the applier is then unusable.
+         */
+        void apply(const std::string &deltaPackage, const ProgressHandler &progress = {});
+        /**
+         * Writes the working files as a full package. The entries are stored rather than compressed, so the package
+         * is larger than the one in the feed, and its checksum will not match it.
+         */
+        void finish(const std::string &outputPackage) const;
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+    };
+
+    /**
+     * Applies a chain of delta packages, in order, to a base package and writes the full package which results.
+     * The working files are kept next to the output, in a directory which is removed again afterwards.
+     */
+    void applyDeltaPackages(const std::string &basePackage, const std::vector<std::string> &deltaPackages,
+                            const std::string &outputPackage, const ProgressHandler &progress = {});
+
+    /**
+     * An HTTP GET request sent by HttpSource.
+     */
+    struct HttpRequest
+    {
+        std::string url;
+        std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    /**
+     * The response to an HttpRequest. Header names are lower case.
+     */
+    struct HttpResponse
+    {
+        int statusCode = 0;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+        /**
+         * Returns the value of a header (the name is case insensitive), or an empty string if it is not present.
+         */
+        std::string header(std::string_view name) const;
+    };
+
+    /**
+     * Called with each chunk of a response body as it arrives. The response holds the status code and headers.
+     */
+    using HttpBodyHandler = std::function<void(const HttpResponse &response, const char *data, size_t size)>;
+
+    /**
+     * Sends HTTP requests for HttpSource. Provide your own implementation (eg. backed by libcurl or WinHTTP)
+     * to control TLS, proxies or authentication.
+     */
+    class HttpClient
+    {
+    public:
+        virtual ~HttpClient() = default;
+        /**
+         * Sends a GET request and follows redirects. If onBody is set, the body is passed to it in chunks as it
+         * arrives, instead of being collected in HttpResponse::body. Throws if the request could not be completed,
+         * HTTP error statuses are returned to the caller.
+         */
+        virtual HttpResponse get(const HttpRequest &request, const HttpBodyHandler &onBody = {}) = 0;
+        /**
+         * Returns the built-in client, which speaks plain HTTP/1.1. It does not support TLS, so https:// URLs
+         * need a custom client.
+         */
+        static std::shared_ptr<HttpClient> createDefault();
+    };
+
+    /**
+     * Checks that a package file matches the checksum of its asset: SHA256 if the feed provides one, otherwise SHA1.
+     * Returns false if it does not match, or if the asset has no checksum. Throws if the file can not be read.
+     * Downloads are already verified as they are written, this is for files which were put in place some other way.
+     */
+    bool verifyAsset(const std::string &path, const VelopackAsset &asset);
+
+    /**
+     * Caps the rate of downloads with a token bucket, so that updating does not crowd out an app's own traffic. One
+     * limiter can be shared by several sources, which then share the cap. Every setting can be changed at any time,
+     * also while downloads are in progress. Over HTTP, a download which is held back stops reading from its
+     * connections, so the sender slows down through TCP flow control; a long pause may make the server close the
+     * connection, in which case the download resumes where it stopped.
+     */
+    class BandwidthLimiter
+    {
+    public:
+        /**
+         * Creates a limiter with the given cap. Zero means there is no cap.
+         */
+        explicit BandwidthLimiter(uint64_t bytesPerSecond = 0);
+        ~BandwidthLimiter();
+        BandwidthLimiter(const BandwidthLimiter &) = delete;
+        BandwidthLimiter &operator=(const BandwidthLimiter &) = delete;
+        void setBytesPerSecond(uint64_t bytesPerSecond);
+        uint64_t bytesPerSecond() const;
+        /**
+         * Holds every download back until resume() is called.
+         */
+        void pause();
+        void resume();
+        bool isPaused() const;
+        /**
+         * Only lets downloads run while `isIdle` returns true (eg. when the app has no latency-sensitive work). It is
+         * asked at most once a second, from the downloading threads. An empty function turns this off.
+         */
+        void setIdleCondition(std::function<bool()> isIdle);
+        /**
+         * The rate achieved over the last two seconds, in bytes per second.
+         */
+        double throughput() const;
+        /**
+         * The number of bytes which have passed through the limiter.
+         */
+        uint64_t totalBytes() const;
+        /**
+         * Blocks until `bytes` more may be transferred. Sources call this as data arrives. A single call may exceed
+         * the capacity of the bucket, the wait for the next one is longer to make up for it. Throws
+         * ProcessCancelledException within a tenth of a second of `cancellation` being cancelled, also while paused.
+         */
+        void acquire(size_t bytes, const CancellationToken &cancellation = {});
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+    };
+
+    /**
+     * Abstraction for finding and downloading updates from a package source / repository. An implementation
+     * may copy a file from a local repository, download from a web address, or even use third party services
+     * and parse proprietary data to produce a package feed.
+     */
+    class UpdateSource
+    {
+    public:
+        virtual ~UpdateSource() = default;
+        /**
+         * Retrieves the list of available releases on a channel. These can subsequently be downloaded with
+         * downloadReleaseEntry. Once `cancellation` is cancelled, the request stops as soon as the data in flight has
+         * arrived and throws ProcessCancelledException.
+         */
+        virtual VelopackAssetFeed getReleaseFeed(const std::string &channel, const VelopackManifest &app,
+                                                 const CancellationToken &cancellation = {}) = 0;
+        /**
+         * Downloads the specified asset to the provided local file path. Once `cancellation` is cancelled, the download
+         * stops as soon as the data in flight has arrived and throws ProcessCancelledException.
+         */
+        virtual void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress = {},
+                                          const CancellationToken &cancellation = {}) = 0;
+    };
+
+    /**
+     * Retrieves updates from a static file host or other web server. Requests '{url}/releases.{channel}.json'
+     * to locate the available packages, with query parameters identifying the app and its current version.
+     *
+     * Feeds are revalidated with conditional requests (If-None-Match / If-Modified-Since) when the server provides
+     * an ETag or Last-Modified header. If the feed has not changed, the server answers 304 and the feed parsed
+     * earlier is returned again, so a steady-state poll costs one small request and no parsing.
+     *
+     * Large packages are downloaded over several connections at once, using HTTP Range requests, and verified
+     * against VelopackAsset::sha256 or sha1 as they are written. If a download is interrupted, the progress is kept in
+     * '{localFile}.state' and the next download to the same file resumes where it stopped.
+     */
+    class HttpSource : public UpdateSource
+    {
+    public:
+        /**
+         * Creates a source for the given base URL. If no client is given, the built-in HttpClient is used.
+         */
+        explicit HttpSource(std::string url, std::shared_ptr<HttpClient> client = nullptr);
+        /**
+         * Sets a directory where the last feed body and its validators are stored, so that conditional requests
+         * also work across restarts. By default feeds are only cached in memory.
+         */
+        void setCacheDirectory(std::string directory);
+        /**
+         * Sets how long reading the release feed may take in all, after which ProcessTimeoutException is thrown. It is
+         * checked as the body arrives, so a server which sends nothing at all is still only noticed once the socket
+         * times out (after 30 seconds with the built-in client). The default is 60 seconds.
+         */
+        void setFeedTimeout(std::chrono::milliseconds timeout);
+        /**
+         * Sets how many connections a single download may use at once. The default is 4.
+         */
+        void setMaxConnections(int connections);
+        /**
+         * Sets a limiter which downloads started afterwards are throttled by, or null for none.
+         */
+        void setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter);
+        VelopackAssetFeed getReleaseFeed(const std::string &channel, const VelopackManifest &app,
+                                         const CancellationToken &cancellation = {}) override;
+        void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress = {},
+                                  const CancellationToken &cancellation = {}) override;
+    protected:
+        /**
+         * Returns the URL of a file relative to the base URL of this source.
+         */
+        std::string getFileUrl(std::string_view fileName) const;
+        std::string _url;
+        std::shared_ptr<HttpClient> _client;
+    private:
+        struct CachedFeed
+        {
+            std::string etag;
+            std::string lastModified;
+            std::shared_ptr<const VelopackAssetFeed> feed; // null until a body stored on disk has been parsed
+        };
+        std::mutex _cacheMutex;
+        std::string _cacheDirectory;
+        std::unordered_map<std::string, CachedFeed> _cache;
+        std::atomic<std::chrono::milliseconds> _feedTimeout{ std::chrono::seconds(60) };
+        std::atomic<int> _maxConnections{ 4 };
+        std::mutex _limiterMutex;
+        std::shared_ptr<BandwidthLimiter> _limiter;
+    };
+
+    /**
+     * Retrieves available updates from a local or network-attached disk. The directory must contain
+     * one or more valid packages, as well as a 'releases.{channel}.json' index file. Packages are verified
+     * against VelopackAsset::sha256 or sha1 while they are copied.
+     */
+    class FileSource : public UpdateSource
+    {
+    public:
+        explicit FileSource(std::string path);
+        /**
+         * Sets a limiter which copies started afterwards are throttled by, or null for none.
+         */
+        void setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter);
+        VelopackAssetFeed getReleaseFeed(const std::string &channel, const VelopackManifest &app,
+                                         const CancellationToken &cancellation = {}) override;
+        void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress = {},
+                                  const CancellationToken &cancellation = {}) override;
+    private:
+        std::string _path;
+        std::mutex _limiterMutex;
+        std::shared_ptr<BandwidthLimiter> _limiter;
+    };
+
+    /**
+     * Wraps another source with a cache of packages which is shared by the Velopack apps of one account, so that a
+     * package used by several apps is downloaded and stored once. Packages are stored under their SHA1, and placed in
+     * each app's packages directory as a hard link, or else a copy-on-write clone (FICLONE on Linux, clonefile on
+     * macOS), or else a copy. Packages without a SHA1 are downloaded directly. Any number of processes may use the
+     * same cache at once: each package is fetched under a file lock (flock, or LockFileEx on Windows), so concurrent
+     * updaters which want the same package download it once, and a wait for the lock ends when the download is
+     * cancelled. A cached package is checked against its SHA1 every time it is used.
+     *
+     * The cache is not shared between accounts, as a package linked from it could be changed by whoever may write to
+     * it. On Linux and macOS the directory is created readable only by its owner, and one which is owned by another
+     * account, or writable by its group or others, is not used: packages are then downloaded directly.
+     */
+    class SharedCacheSource : public UpdateSource
+    {
+    public:
+        /**
+         * Creates a cache in `directory`, or in defaultDirectory() if it is empty, which downloads from `inner`.
+         */
+        SharedCacheSource(std::shared_ptr<UpdateSource> inner, std::string directory = {});
+        /**
+         * The default location of the cache for the current account, on the same volume as the packages directories
+         * where possible, as hard links can not cross volumes.
+         */
+        static std::string defaultDirectory();
+        const std::string &directory() const;
+        VelopackAssetFeed getReleaseFeed(const std::string &channel, const VelopackManifest &app,
+                                         const CancellationToken &cancellation = {}) override;
+        void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress = {},
+                                  const CancellationToken &cancellation = {}) override;
+        /**
+         * Removes the packages which have not been used for `unusedFor`, and which no app has a hard link to any more
+         * (a clone or copy does not depend on the cache), and interrupted downloads as old. Returns the bytes freed.
+         */
+        uint64_t prune(std::chrono::hours unusedFor = std::chrono::hours(24 * 30));
+    private:
+        std::shared_ptr<UpdateSource> _inner;
+        std::string _directory;
+    };
+
+    /**
+     * Carries out an update plan (see VelopackAssetFeed::planUpdate) which applies deltas, writing the full package of
+     * its target to `outputPackage`. Packages which are not cached are downloaded from `source` into `directory` on a
+     * background thread, while the calling thread applies each delta as soon as it has arrived, so the time taken
+     * approaches the longer of downloading and applying rather than their sum. At most two packages are downloaded
+     * ahead, downloaded deltas are deleted once applied, and a download waits for applied deltas to free disk space
+     * if there is not enough. Throws if a package fails to download or apply, or there is not enough disk space.
+     */
+    void executeUpdatePlan(const UpdatePlan &plan, UpdateSource &source, const std::string &directory, const std::string &outputPackage,
+                           const ProgressHandler &progress = {}, const CancellationToken &cancellation = {});
+
+    /**
+     * A package file found in the packages directory by PackageIndex.
+     */
+    struct LocalPackage
+    {
+        std::string fileName;
+        uint64_t size = 0;
+        std::chrono::system_clock::time_point modified;
+    };
+
+    /**
+     * How much PackageIndex::collectGarbage keeps in the packages directory.
+     */
+    struct PackageRetention
+    {
+        /**
+         * The most bytes of packages to keep, or 0 for no limit. The oldest files are removed first.
+         */
+        uint64_t maxBytes = 0;
+        /**
+         * Packages which have not been modified for longer than this are removed.
+         */
+        std::chrono::hours maxAge{ 24 * 30 };
+    };
+
+    /**
+     * Keeps track of the packages in a packages directory (see VelopackLocator::packagesDir). The directory is scanned
+     * once, listing it with getdents64 and reading the file attributes with statx on several threads on Linux, and
+     * is then kept up to date with update() as files are downloaded or removed. Packages are matched to assets by
+     * file name and size, and by SHA1 on request; hashes are cached until the file changes. Thread safe.
+     */
+    class PackageIndex
+    {
+    public:
+        /**
+         * Scans the directory. A directory which does not exist yet is empty.
+         */
+        explicit PackageIndex(std::string directory);
+        ~PackageIndex();
+        PackageIndex(PackageIndex &&) noexcept;
+        PackageIndex &operator=(PackageIndex &&) noexcept;
+        const std::string &directory() const;
+        /**
+         * Scans the whole directory again, keeping the cached hashes of files which have not changed.
+         */
+        void rescan();
+        /**
+         * Updates a single file after it was written, renamed or deleted.
+         */
+        void update(const std::string &fileName);
+        /**
+         * Returns every package (.nupkg) in the directory, in no particular order.
+         */
+        std::vector<LocalPackage> packages() const;
+        /**
+         * Returns the package of an asset, or nothing if it is not in the directory. Deltas must have the size given
+         * in the feed, full packages may have any size (a full package rebuilt from deltas differs from the one in the
+         * feed). With `verifyHash`, a package must also match the SHA1 of the asset, and the file is hashed the first
+         * time it is checked.
+         */
+        std::optional<LocalPackage> find(const VelopackAsset &asset, bool verifyHash = false) const;
+        /**
+         * Returns the SHA1 of a file in the directory in upper case, or an empty string if it is not there. The file
+         * is hashed if its hash is not cached yet, unless `compute` is false, in which case an empty string is
+         * returned instead.
+         */
+        std::string sha1(const std::string &fileName, bool compute = true) const;
+        /**
+         * Removes the packages which a future update can not use, and returns their file names. The full package
+         * of `installed` and of newer releases, and the deltas newer than `installed`, are kept as the delta planner
+         * (VelopackAssetFeed::planUpdate) may start a chain from them. Among those, files older than the maximum age
+         * are removed, and then the oldest ones until the directory is within the size limit; the full packages of
+         * `installed` and of the latest release are never removed. Packages not in the feed, older deltas and
+         * full packages, and interrupted downloads of those are always removed.
+         */
+        std::vector<std::string> collectGarbage(const VelopackAssetFeed &feed, const SemanticVersion &installed,
+                                                const PackageRetention &retention = {});
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> _impl;
+    };
+
+    /**
+     * How machines on a local network find each other to share packages, see PeerServer and PeerSource. Every machine
+     * on a site must use the same group and ports.
+     */
+    struct PeerSharingOptions
+    {
+        /**
+         * The IPv4 multicast group and UDP port which peers are discovered on.
+         */
+        std::string multicastGroup = "239.255.86.80";
+        uint16_t discoveryPort = 45380;
+        /**
+         * The IPv4 address of the network interface to share on, eg. "127.0.0.1" to try several processes on one
+         * machine. Empty means every interface, with discovery sent on the default one.
+         */
+        std::string interfaceAddress;
+        /**
+         * The TCP port PeerServer serves packages on. Zero picks a free port, which is announced in discovery replies.
+         */
+        uint16_t httpPort = 0;
+        /**
+         * How long PeerSource waits for the first peer to answer before it downloads from the origin.
+         */
+        std::chrono::milliseconds discoveryTimeout{ 250 };
+        /**
+         * The number of packages PeerServer sends at once. While it is that busy it does not answer discovery, so
+         * peers spread over the machines which have the package.
+         */
+        int maxUploads = 4;
+        /**
+         * The multicast time-to-live. 1 keeps discovery within the local subnet.
+         */
+        int multicastTtl = 1;
+    };
+
+    /**
+     * Serves the packages of a directory to other machines on the local network. It answers discovery requests from
+     * PeerSource for packages it has, and sends them over plain HTTP (with Range support). Only packages which match
+     * the SHA1 and size asked for are offered; peers check every download against the hash from their feed, so a peer
+     * can waste bandwidth but not change a package. Packages are hashed on a background thread, those in the
+     * directory when the server starts and any other the first time it is asked for, and discovery is only answered
+     * once a package's hash is known. Sharing stops when the server is destroyed.
+     */
+    class PeerServer
+    {
+    public:
+        PeerServer(std::shared_ptr<PackageIndex> packages, PeerSharingOptions options = {});
+        ~PeerServer();
+        PeerServer(const PeerServer &) = delete;
+        PeerServer &operator=(const PeerServer &) = delete;
+        /**
+         * The TCP port packages are served on.
+         */
+        uint16_t port() const;
+        /**
+         * The number of package bytes sent to peers.
+         */
+        uint64_t bytesServed() const;
+    private:
+        struct Impl;
+        std::shared_ptr<Impl> _impl;
+    };
+
+    /**
+     * Wraps another source, and downloads packages from machines on the local network which have them (see PeerServer)
+     * before falling back to it. Peers are found by multicasting the SHA1 of the package, and tried in the order they
+     * answer. A download from a peer is verified against the hash in the feed like any other, and one which fails is
+     * discarded. Packages without a SHA1 always come from the origin source.
+     */
+    class PeerSource : public UpdateSource
+    {
+    public:
+        PeerSource(std::shared_ptr<UpdateSource> origin, PeerSharingOptions options = {});
+        VelopackAssetFeed getReleaseFeed(const std::string &channel, const VelopackManifest &app,
+                                         const CancellationToken &cancellation = {}) override;
+        void downloadReleaseEntry(const VelopackAsset &asset, const std::string &localFile, const ProgressHandler &progress = {},
+                                  const CancellationToken &cancellation = {}) override;
+        /**
+         * Returns the base URLs of the peers which offer a package, in the order they answered. Waits up to
+         * PeerSharingOptions::discoveryTimeout for the first one.
+         */
+        std::vector<std::string> discover(const VelopackAsset &asset) const;
+    private:
+        std::shared_ptr<UpdateSource> _origin;
+        PeerSharingOptions _options;
+        std::shared_ptr<HttpClient> _client;
+    };
+
+    /**
+     * An update check which runs without blocking a thread, for applications built around an event loop. Register the
+     * descriptors of process() with your reactor and call poll() whenever one of them is ready (or process().nextTimeout()
+     * elapses) until it returns true. The outcome is then available from result().
+     */
+    class UpdateCheckOperation
+    {
+    public:
+        explicit UpdateCheckOperation(AsyncProcess process);
+        /**
+         * The underlying Velopack process, which provides the descriptors to wait on.
+         */
+        AsyncProcess &process();
+        /**
+         * Makes progress without blocking. Returns true once the check has completed.
+         */
+        bool poll();
+        /**
+         * Returns information about the latest available release, or null if there is no update. Throws if the check
+         * failed or has not completed yet.
+         */
+        std::shared_ptr<UpdateInfo> result() const;
+    private:
+        AsyncProcess _process;
+    };
+
+    /**
+     * This class is used to check for updates, download updates, and apply updates. It extends UpdateManagerSync
+     * with supervision of the Velopack child processes: every call can be given a CancellationToken, a default
+     * timeout can be applied to every process, and cancelAll() terminates every process still running on behalf of
+     * this manager. The manager must outlive the calls made on it, so stop them (with their tokens or cancelAll) and
+     * let them return before destroying it. A call which returns has terminated and reaped its process.
+     */
+    class UpdateManager : public UpdateManagerSync
+    {
+    public:
+        UpdateManager() = default;
+        UpdateManager(const UpdateManager &) = delete;
+        UpdateManager &operator=(const UpdateManager &) = delete;
+        /**
+         * Sets the maximum time any process launched by this manager may run before it is terminated.
+         * Zero (the default) means there is no limit.
+         */
+        void setProcessTimeout(std::chrono::milliseconds timeout);
+        /**
+         * Terminates every process which is currently running on behalf of this manager. The calls waiting
+         * on those processes will throw ProcessCancelledException. Later calls are not affected.
+         */
+        void cancelAll();
+        /**
+         * Get the currently installed version of the application. The version is cached for the lifetime
+         * of the process, so Vfusion is only started (subject to cancellation) the first time this is called.
+         * If the application is not installed, this function will throw an exception.
+         */
+        std::string getCurrentVersion(const CancellationToken &cancellation = {}) const;
+        /**
+         * Sets the installed app which in-process checks and downloads are for, instead of locating the app which
+         * contains this process (eg. for an unusual install layout, or for tests).
+         */
+        void setLocator(VelopackLocator locator);
+        /**
+         * Sets the source which updates are checked for in-process, instead of the one derived from setUrlOrPath.
+         */
+        void setUpdateSource(std::shared_ptr<UpdateSource> source);
+        /**
+         * Sets the HTTP client used for URLs passed to setUrlOrPath. Without one, http:// feeds are read with the
+         * built-in client and https:// feeds are checked by Vfusion.
+         */
+        void setHttpClient(std::shared_ptr<HttpClient> client);
+        /**
+         * Sets the limiter which downloads from the URL or path passed to setUrlOrPath are throttled by, or null for
+         * none. A source passed to setUpdateSource is not changed, give it the limiter directly.
+         */
+        void setBandwidthLimiter(std::shared_ptr<BandwidthLimiter> limiter);
+        /**
+         * Retrieves the list of available releases on the current channel from the update source.
+         */
+        VelopackAssetFeed getReleaseFeed(const CancellationToken &cancellation = {}) const;
+        /**
+         * This function will check for updates, and return information about the latest available release. The feed
+         * is read and compared in-process when possible (see getUpdateSource), and by Vfusion otherwise, which does not
+         * apply staged rollouts (see setRolloutId).
+         * Throws ProcessTimeoutException or ProcessCancelledException if the check was aborted.
+         */
+        std::shared_ptr<UpdateInfo> checkForUpdates(const CancellationToken &cancellation = {}) const;
+        /**
+         * Starts an update check and returns immediately. The check is driven by polling the returned operation,
+         * see UpdateCheckOperation. The check is subject to the same timeout and cancellation as checkForUpdates.
+         */
+        UpdateCheckOperation beginCheckForUpdates(const CancellationToken &cancellation = {}) const;
+        /**
+         * Downloads the specified updates to the local app packages directory. The package is downloaded in-process
+         * when possible (see getUpdateSource), reporting progress from 0 to 100, and by Vfusion otherwise. In-process,
+         * the full package is rebuilt from deltas instead when VelopackAssetFeed::planUpdate finds that is cheaper,
+         * for example because the package of the installed version is still in the packages directory. Afterwards,
+         * packages which a later update can not use are removed (see setPackageRetention).
+         * Throws ProcessTimeoutException or ProcessCancelledException if the download was aborted.
+         */
+        void downloadUpdates(const VelopackAsset *toDownload, const CancellationToken &cancellation = {}, const ProgressHandler &progress = {}) const;
+        /**
+         * Returns the index of the packages directory, which downloadUpdates keeps up to date. The directory is scanned
+         * the first time this is called. Throws if the app is not installed.
+         */
+        std::shared_ptr<PackageIndex> getPackageIndex() const;
+        /**
+         * Sets how much downloadUpdates keeps in the packages directory. After a download, the packages which can not
+         * be used by a later update are removed, see PackageIndex::collectGarbage.
+         */
+        void setPackageRetention(PackageRetention retention);
+        PackageRetention getPackageRetention() const;
+        /**
+         * Makes downloadUpdates share packages with other apps through a SharedCacheSource in `directory`
+         * (see SharedCacheSource::defaultDirectory). An empty string, the default, turns sharing off.
+         */
+        void setSharedPackageCache(std::string directory);
+        std::string getSharedPackageCache() const;
+        /**
+         * Shares packages with other machines on the local network: the packages directory is served with a
+         * PeerServer for as long as this manager exists, and downloadUpdates tries peers through a PeerSource before
+         * the update source. Throws if the app is not installed.
+         */
+        void enablePeerSharing(PeerSharingOptions options = {});
+        void disablePeerSharing();
+        /**
+         * Sets the identifier which decides when staged rollouts reach this client (see isRolledOut), eg. to
+         * roll releases out by user account. By default, a random identifier is created for the install and kept in
+         * the packages directory.
+         *
+         * Rollouts are only applied when the feed is read in-process (see getUpdateSource). A check which is delegated
+         * to Vfusion ignores VelopackAsset::rolloutPercentage and offers the latest release to every client. This is
+         * the case for an https:// URL unless setHttpClient was called, and for any app which is not installed.
+         */
+        void setRolloutId(std::string id);
+        /**
+         * Returns the identifier set with setRolloutId, or else the one of this install, creating it if needed.
+         * Throws if the app is not installed and no identifier was set.
+         */
+        std::string getRolloutId() const;
+        /**
+         * Sets a file which the updater started by the apply methods will append its output to. By default, the output
+         * is discarded. The updater is always fully detached, this process keeps no pipes or handles for it.
+         */
+        void setUpdaterOutputPath(std::string path);
+        /**
+         * This will exit your app immediately, apply updates, and then optionally relaunch the app using the specified
+         * restart arguments. If you need to save state or clean up, you should do that before calling this method.
+         */
+        void applyUpdatesAndExit(const VelopackAsset *toApply) const;
+        /**
+         * This will exit your app immediately, apply updates, and then relaunch the app using the specified
+         * restart arguments. If you need to save state or clean up, you should do that before calling this method.
+         */
+        void applyUpdatesAndRestart(const VelopackAsset *toApply, const std::vector<std::string> *restartArgs = nullptr) const;
+        /**
+         * This will launch the Velopack updater and tell it to wait for this program to exit gracefully.
+         * You should then clean up any state and exit your app. The updater will apply updates and then
+         * optionally restart your app. The updater will only wait for 60 seconds before giving up.
+         */
+        void waitExitThenApplyUpdates(const VelopackAsset *toApply, bool silent, bool restart, const std::vector<std::string> *restartArgs = nullptr) const;
+    protected:
+        /**
+         * Returns the options for a process launched on behalf of this manager, linking the caller's
+         * cancellation token with the lifetime of the manager.
+         */
+        ProcessOptions getProcessOptions(const CancellationToken &cancellation) const;
+        /**
+         * Starts the updater with the given command line, fully detached from this process.
+         */
+        void startUpdater(const std::vector<std::string> *command) const;
+        /**
+         * Returns the source used for in-process checks, or null if the check has to be delegated to Vfusion
+         * (eg. for an https:// URL without a custom HttpClient).
+         */
+        std::shared_ptr<UpdateSource> getUpdateSource() const;
+        /**
+         * Returns the channel updates are checked for: the explicit channel if one was set, otherwise
+         * the channel the app was packaged with, otherwise the default channel of this OS.
+         */
+        std::string getPracticalChannel(const VelopackManifest &app) const;
+        /**
+         * Returns the locator set with setLocator, or else the one of the app which contains this process, or null if
+         * it is not installed in a layout the locator recognises.
+         */
+        std::shared_ptr<const VelopackLocator> getLocator() const;
+    private:
+        std::shared_ptr<const VelopackLocator> findLocator() const; // with _mutex held
+        struct CheckResult
+        {
+            std::string validator;
+            std::string channel;
+            std::string version;
+            bool allowDowngrade = false;
+            std::string rolloutId; // staged rollouts give each client its own answer
+            std::shared_ptr<UpdateInfo> info;
+        };
+        mutable std::mutex _mutex;
+        std::shared_ptr<const VelopackLocator> _locator;
+        std::shared_ptr<UpdateSource> _updateSource;
+        std::shared_ptr<HttpClient> _httpClient;
+        std::shared_ptr<BandwidthLimiter> _bandwidthLimiter;
+        mutable std::shared_ptr<UpdateSource> _urlSource; // derived from setUrlOrPath, reused while the URL is unchanged
+        mutable std::string _urlSourceUrl;
+        mutable CheckResult _lastCheck;
+        mutable std::shared_ptr<PackageIndex> _packages;
+        PackageRetention _packageRetention;
+        std::string _sharedPackageCache;
+        mutable std::string _rolloutId;
+        std::optional<PeerSharingOptions> _peerSharing;
+        std::shared_ptr<PeerServer> _peerServer;
+        std::chrono::milliseconds _processTimeout{ 0 };
+        CancellationToken _lifetime;
+        std::string _updaterOutputPath;
+    };
+
+    /**
+     * When UpdateScheduler checks for updates, and what it does with them. Handlers run on the thread of the check,
+     * which downloads the update once onUpdateAvailable returns.
+     */
+    struct UpdateScheduleOptions
+    {
+        /**
+         * The time between successful checks.
+         */
+        std::chrono::milliseconds interval = std::chrono::hours(4);
+        /**
+         * Every delay is moved by a random amount of up to this fraction of itself, earlier or later, so that clients
+         * which started at the same time (eg. after an outage of the feed server) do not keep checking together.
+         */
+        double jitter = 0.25;
+        /**
+         * The first check runs at a random time within this long of start().
+         */
+        std::chrono::milliseconds firstCheckWithin = std::chrono::minutes(5);
+        /**
+         * After a failed check, the next one runs this much later, doubling with each further failure up to maxBackoff.
+         */
+        std::chrono::milliseconds retryDelay = std::chrono::minutes(1);
+        std::chrono::milliseconds maxBackoff = std::chrono::hours(24);
+        /**
+         * Downloads updates as soon as they are found.
+         */
+        bool autoDownload = true;
+        /**
+         * Asked before each check. Returning false (eg. while the user is busy, or the machine is on battery)
+         * postpones the check by retryDelay.
+         */
+        std::function<bool()> canCheck;
+        /**
+         * Asked before each automatic download. Returning false (eg. on a metered connection) postpones the download
+         * to the next check, the update is still reported to onUpdateAvailable.
+         */
+        std::function<bool()> canDownload;
+        /**
+         * Called once for each new version found.
+         */
+        std::function<void(std::shared_ptr<UpdateInfo> update)> onUpdateAvailable;
+        /**
+         * Called when an update has been downloaded, and can be applied with the UpdateManager.
+         */
+        std::function<void(std::shared_ptr<UpdateInfo> update)> onUpdateDownloaded;
+        /**
+         * Called when a check or download fails, before the next attempt is scheduled.
+         */
+        std::function<void(std::exception_ptr error)> onError;
+        ProgressHandler onDownloadProgress;
+    };
+
+    /**
+     * Checks for updates in the background on a fixed interval, with random jitter and exponential back-off after
+     * failures, and downloads them as they are found. Every scheduler in the process shares one timer thread, which
+     * only exists while a scheduler is started, and each check (with its download) runs on a thread of its own, so
+     * the checks of different schedulers do not wait for each other.
+     */
+    class UpdateScheduler
+    {
+    public:
+        explicit UpdateScheduler(std::shared_ptr<UpdateManager> manager, UpdateScheduleOptions options = {});
+        /**
+         * Stops the scheduler, see stop().
+         */
+        ~UpdateScheduler();
+        UpdateScheduler(const UpdateScheduler &) = delete;
+        UpdateScheduler &operator=(const UpdateScheduler &) = delete;
+        /**
+         * Starts checking. The first check runs within UpdateScheduleOptions::firstCheckWithin.
+         */
+        void start();
+        /**
+         * Stops checking, and cancels a check or download which is in progress. Waits for it to finish, unless this is
+         * called from a handler.
+         */
+        void stop();
+        bool isRunning() const;
+        /**
+         * Runs a check now, or has no effect if one is already running or the scheduler is stopped.
+         */
+        void checkNow();
+        /**
+         * The time of the next check. Undefined while the scheduler is stopped.
+         */
+        std::chrono::steady_clock::time_point nextCheck() const;
+        /**
+         * The number of checks which have failed since the last one which succeeded.
+         */
+        unsigned failureCount() const;
+    private:
+        struct Impl;
+        std::shared_ptr<Impl> _impl;
+    };
+}
+
+#endif // VELOPACK_EXT_H_INCLUDED